@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// AES-128 and the two TLS 1.3 AEADs built on it, AES-128-CCM and AES-128-GCM (RFC 8446 §5.2).
+// Only the cipher's encrypt direction is needed: CTR mode makes the keystream for both ways and
+// CCM's CBC-MAC is a CBC encryption. On the Teensy the DCP (the i.MX RT data co-processor)
+// runs the block cipher over whole buffers of counter or CBC blocks; elsewhere it is plain C.
+// CCM needs nothing but the DCP, GCM adds GHASH in software.
+#define AES_BLOCK_SIZE  16
+#define AES_KEY_SIZE    16
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE   16
+
+enum {
+    AEAD_AES_128_GCM,
+    AEAD_AES_128_CCM
+};
+
+typedef struct {
+    uint8_t rk[176];              // Software key schedule
+    uint8_t key[AES_KEY_SIZE];    // Raw key, the DCP takes it with every job
+} aes128_t;
+
+typedef struct {
+    aes128_t aes;
+    int mode;                     // AEAD_*
+    uint64_t h_hi[16], h_lo[16];  // GHASH multiples of H, GCM only
+} aead_t;
+
+void aes128_init(aes128_t& ctx, const uint8_t key[AES_KEY_SIZE]);
+
+// Encrypts blocks 16 byte blocks; in and out may be the same buffer
+void aes128_ecb(const aes128_t& ctx, const uint8_t* in, uint8_t* out, size_t blocks);
+
+// CBC encryption carrying the chaining value in iv from one call to the next
+void aes128_cbc(const aes128_t& ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* in, uint8_t* out, size_t blocks);
+
+void aead_init(aead_t& ctx, int mode, const uint8_t key[AES_KEY_SIZE]);
+
+// Encrypts len bytes of data in place and writes the tag
+void aead_seal(aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t* aad, size_t aad_len,
+               uint8_t* data, size_t len, uint8_t tag[AEAD_TAG_SIZE]);
+
+// Decrypts len bytes of data in place. False if the tag does not match, data is garbage then.
+bool aead_open(aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t* aad, size_t aad_len,
+               uint8_t* data, size_t len, const uint8_t tag[AEAD_TAG_SIZE]);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "s3bl.h"
+
+// Core clock policy: the phases in BOOT_CLOCK_FAST_PHASES run at BOOT_CLOCK_FAST_HZ, everything
+// else at F_CPU. Only VERIFY (CRC32 and SHA-256 over a received image) is bound by the core;
+// STORAGE waits on LittleFS reads and VALIDATE mostly on the boot delays, so raising the clock
+// there buys nothing but two PLL relocks. Every phase is timed either way.
+// BOOT_CLOCK_FAST_HZ is 0 (off) by default: 816 MHz is past the RT1062's 600 MHz rating and
+// runs at the overdrive voltage, so it's opt-in (env:teensy40_fastclock). Whether it pays off is
+// not measured on hardware yet; s3bl_upload.py clock reads verify_us for both builds.
+// jump_to_app always leaves the core at F_CPU (F_CPU_ACTUAL == F_CPU, the Arduino core's own PLL1
+// and voltage setting), and reports what happened in the handoff block below.
+// FlexSPI stays at the clock the boot ROM set up from the flash's configuration block. The code
+// runs from ITCM, so that is not the obstacle; but the FCB's read sequence (dummy cycles, sample
+// point) is set for that clock, a new one means disabling the controller, reprogramming the LUT
+// and relocking the DLL, and only the verify paths that read XIP flash would gain.
+#ifndef BOOT_CLOCK_FAST_HZ
+#define BOOT_CLOCK_FAST_HZ 0
+#endif
+#ifndef BOOT_CLOCK_FAST_PHASES
+#define BOOT_CLOCK_FAST_PHASES (1 << BOOT_PHASE_VERIFY)
+#endif
+
+// Handoff block just below the core's CrashReport area at the top of OCRAM2. The Teensy startup
+// code does not clear OCRAM, netboot images end well before it and the heap only grows into it
+// when nearly full, so the application can read it early in setup().
+#define BOOT_HANDOFF_ADDRESS 0x2027FF00
+#define BOOT_HANDOFF_MAGIC   0x53334844  // "S3HD"
+#define BOOT_HANDOFF_VERSION 2
+#define BOOT_CONFIRM_MAGIC   0x53334f4b  // "S3OK"
+#define BOOT_RECOVERY_MAGIC  0x53335243  // "S3RC"
+#define BOOT_SEEN_MAGIC      0x53335345  // "S3SE", the bootloader has acted on confirm
+
+enum {
+    BOOT_PHASE_STORAGE,    // LittleFS mount and metadata
+    BOOT_PHASE_VALIDATE,   // Slot checks up to the jump
+    BOOT_PHASE_VERIFY,     // Last image verification in recovery mode
+    BOOT_PHASES
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t arm_clock_hz;            // Core clock at the jump, always F_CPU
+    uint32_t fast_clock_hz;           // Clock the BOOT_CLOCK_FAST_PHASES ran at
+    uint32_t entry;                   // Vector table address that was jumped to
+    uint32_t boot_us;                 // micros() at the jump
+    uint32_t phase_us[BOOT_PHASES];   // 0 for phases that did not run
+    uint32_t trial;                   // 1 while the metadata records no good boot of entry or its modules
+    uint32_t crc;                     // crc32_update over all fields above
+    uint32_t confirm;                 // Set by the application, outside the CRC, see below
+} boot_handoff_t;
+
+// Starts timing a phase, raising the clock for a fast one. Phases may nest; the clock only drops
+// back to F_CPU when the last open fast phase ends. Ending a phase that is not open does nothing.
+void boot_phase_begin(int phase);
+void boot_phase_end(int phase);
+uint32_t boot_phase_us(int phase);
+
+// Ends any open phase, restores F_CPU and writes the handoff block for entry
+void boot_handoff_write(uint32_t entry);
+// Whether the next handoff block marks a trial boot, set from the metadata before every jump
+void boot_handoff_trial(bool trial);
+
+// Boot confirmation. The application calls boot_handoff_confirm once it works; on a trial boot it
+// then resets (SCB_AIRCR = 0x05FA0004), the bootloader records boot_success=1 for the image and,
+// if a rollout installed it, reports it on GET /status (BootCore::record_confirm, recovery.h),
+// and the application starts again with trial clear. An application that never confirms leaves
+// boot_success at 0.
+static inline bool boot_handoff_confirm() {
+    boot_handoff_t* h = (boot_handoff_t*)BOOT_HANDOFF_ADDRESS;
+    if (h->magic != BOOT_HANDOFF_MAGIC || h->version != BOOT_HANDOFF_VERSION || !h->trial) return false;
+    h->confirm = BOOT_CONFIRM_MAGIC;
+    arm_dcache_flush(h, sizeof(*h));
+    return true;
+}
+
+// Bootloader side: true if the last handoff block was for entry and the application confirmed
+// it. Marks the confirmation seen, so each one counts once.
+bool boot_handoff_confirmed(uint32_t entry);
+// Bootloader side: true if the last handoff block was a trial boot of entry that reset without a
+// confirmation or recovery request. Also counts once; call after boot_handoff_confirmed.
+bool boot_handoff_failed_trial(uint32_t entry);
+
+// Recovery on request. The application calls boot_handoff_request_recovery and resets; the
+// bootloader then runs recovery mode with the metadata as it is, so its image stays bootable and
+// the update paths stage next to it. Like the confirmation it needs the block of the last jump,
+// a power cycle boots the image as usual.
+static inline bool boot_handoff_request_recovery() {
+    boot_handoff_t* h = (boot_handoff_t*)BOOT_HANDOFF_ADDRESS;
+    if (h->magic != BOOT_HANDOFF_MAGIC || h->version != BOOT_HANDOFF_VERSION) return false;
+    h->confirm = BOOT_RECOVERY_MAGIC;
+    arm_dcache_flush(h, sizeof(*h));
+    return true;
+}
+
+// Bootloader side: true once per request, call before boot_handoff_confirmed
+bool boot_handoff_recovery_requested();
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "s3bl.h"
+#include "boot_clock.h"
+#include "hot_preload.h"
+#include "image_alloc.h"
+#include "component.h"
+
+// Boot flow shared by every build: bring up metadata storage, pick a slot, check it and jump,
+// or hand over to recovery. The behaviour that differs between deployments comes in as policies,
+// structs of static functions picked per PlatformIO environment (boot_policies.h). Every call is
+// resolved at compile time, and a policy that is not selected is never referenced, so its code
+// and libraries stay out of the image.
+//
+//   Storage   static bool begin();  static bool load(boot_metadata_t&);  static void save(const boot_metadata_t&);
+//   Verifier  static bool check(uint32_t slot_address);
+//   Logger    static print(value[, base]) / println(...), as Print; the boot flow's messages only
+//   Recovery  static void run(boot_metadata_t&);  only returns if the build has no way to receive an image
+//             static void report(const boot_metadata_t&);  serves the freshly recorded boot state for a while
+template <class Storage, class Verifier, class Logger, class Recovery>
+struct BootCore {
+    static void run() {
+        Logger::println("Checking metadata...");
+        delay(10);
+        boot_metadata_t m;
+        boot_phase_begin(BOOT_PHASE_STORAGE);
+        if (!Storage::begin()) {
+            Logger::println("Error starting metadata storage");
+            while (1);
+        }
+        load_or_init(m);
+        boot_phase_end(BOOT_PHASE_STORAGE);
+        if (boot_handoff_recovery_requested()) {
+            // Only returns without a transport, then the image boots as usual
+            Logger::println("Application asked for recovery mode.");
+            Recovery::run(m);
+        }
+        record_confirm(m);
+        Logger::println("Current metadata state:");
+        delay(10);
+        Logger::print("Active slot: 0x");
+        Logger::println(m.active_slot, HEX);
+        Logger::print("Valid A: 0x");
+        Logger::println(m.valid_a, HEX);
+        Logger::print("Valid B: 0x");
+        Logger::println(m.valid_b, HEX);
+        delay(1000);
+
+        // Boot decision logic, the phase ends at the jump or when recovery takes over
+        boot_phase_begin(BOOT_PHASE_VALIDATE);
+        uint32_t slot = select(m);
+        if (slot == 0) {
+            boot_phase_end(BOOT_PHASE_VALIDATE);
+            Logger::println("No valid application found. Entering recovery mode.");
+            Recovery::run(m);
+            return;
+        }
+        // Print vector table for diagnostics
+        Logger::print("Image at 0x"); Logger::print(slot, HEX); Logger::println(" vector table (first 32 bytes):");
+        for (int i = 0; i < 8; i++) {
+            uint32_t word = *((uint32_t*)(slot + i * 4));
+            Logger::print("0x"); Logger::print(word, HEX); Logger::print(" ");
+        }
+        Logger::println();
+        if (!Verifier::check(slot)) {
+            Logger::print("WARNING: Image at 0x"); Logger::print(slot, HEX);
+            Logger::println(" does not appear to contain a valid ARM Cortex-M7 binary. Aborting jump.");
+            boot_phase_end(BOOT_PHASE_VALIDATE);
+            return;
+        }
+        // Modules the base links against at fixed addresses (component.h)
+        bool modules_trial;
+        component_directory_write(m, slot, modules_trial);
+        boot_handoff_trial(!m.boot_success || modules_trial);
+        // Placed images may bring hot sections to copy into ITCM on the way
+        const hot_table_t* hot = hot_table_at(m, slot);
+        if (hot) {
+            Logger::print("Preloading "); Logger::print(hot->count); Logger::println(" hot sections into ITCM");
+            hot_jump(slot, hot);
+        }
+        jump_to_app(slot);
+    }
+
+    // An application confirms its trial boot through the handoff block and resets (boot_clock.h).
+    // The confirmation goes into the metadata, then out on GET /status once if a rollout asked
+    // for it: the rollout controller waits for it, and the application need not serve /status.
+    // A trial boot that reset without either demotes the modules it tried (component.h).
+    static void record_confirm(boot_metadata_t& m) {
+        uint32_t length;
+        uint32_t booted = alloc_booted(m, length);
+        if (!boot_handoff_confirmed(booted)) {
+            if (boot_handoff_failed_trial(booted) && component_trial_failed(m)) Storage::save(m);
+            return;
+        }
+        bool modules = component_confirm(m);
+        if (m.boot_success) {
+            if (modules) Storage::save(m);
+            return;
+        }
+        Logger::println("Application confirmed its boot");
+        m.boot_success = 1;
+        Storage::save(m);
+        Recovery::report(m);
+    }
+
+    static void load_or_init(boot_metadata_t& m) {
+        if (Storage::load(m) && m.active_slot != 0xFFFFFFFF) return;
+        Logger::println("Initializing metadata...");
+        delay(10);
+        memset(&m, 0, sizeof(m));
+        m.active_slot = 0;
+        m.valid_a = 0;
+        m.valid_b = 0;
+        m.boot_count = 0;
+        m.boot_success = 0;
+        Logger::println("Writing metadata...");
+        delay(10);
+        Storage::save(m);
+        Logger::println("Verifying metadata...");
+        delay(10);
+        boot_metadata_t verify_meta;
+        if (Storage::load(verify_meta) && verify_meta.active_slot == 0) {
+            Logger::println("Metadata write successful!");
+        } else {
+            Logger::println("Metadata write failed!");
+        }
+    }
+
+    // The active image if it is valid, otherwise whichever fixed slot is, otherwise any placed
+    // image (image_alloc.h) that is not a module. 0 when there is none.
+    static uint32_t select(const boot_metadata_t& m) {
+        if (m.active_slot == BOOT_SLOT_PLACED && m.active_image < PLACED_IMAGES && m.images[m.active_image].valid) {
+            Logger::print("Jumping to placed image "); Logger::println(m.active_image);
+            return m.images[m.active_image].base;
+        } else if (m.active_slot == 0 && m.valid_a) {
+            Logger::println("Jumping to application in slot A");
+            return SLOT_A_ADDRESS;
+        } else if (m.active_slot == 1 && m.valid_b) {
+            Logger::println("Jumping to application in slot B");
+            return SLOT_B_ADDRESS;
+        } else if (m.valid_a) {
+            Logger::println("Active slot invalid, but slot A is valid. Jumping to slot A.");
+            return SLOT_A_ADDRESS;
+        } else if (m.valid_b) {
+            Logger::println("Active slot invalid, but slot B is valid. Jumping to slot B.");
+            return SLOT_B_ADDRESS;
+        }
+        for (int i = 0; i < PLACED_IMAGES; i++) {
+            if (!m.images[i].valid || (m.images[i].valid & PLACED_MODULE)) continue;
+            Logger::print("Active image invalid, falling back to placed image "); Logger::println(i);
+            return m.images[i].base;
+        }
+        return 0;
+    }
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Bootloader log: everything printed through Log goes to USB Serial and into a RAM ring of
+// records, so it can still be shipped once the network is up (see syslog.h). A record ends at
+// '\n'; longer lines are split. The oldest records are overwritten when the ring is full.
+#define LOG_RECORDS       64
+#define LOG_RECORD_SIZE   120
+
+typedef struct {
+    uint32_t ms;            // millis() when the record was started
+    uint16_t len;
+    char text[LOG_RECORD_SIZE];
+} log_record_t;
+
+class BootLog : public Print {
+public:
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+
+    // Completed records are numbered from 0; first_seq() is the oldest one still held
+    uint32_t first_seq() const;
+    uint32_t next_seq() const { return head; }
+    // Copies record seq, false if it was already overwritten or is not complete yet
+    bool get(uint32_t seq, log_record_t& out) const;
+
+private:
+    void store(uint8_t c);
+    void commit();
+
+    log_record_t records[LOG_RECORDS];
+    uint32_t head = 0;      // Sequence number of the record being filled
+    bool started = false;
+};
+
+extern BootLog Log;
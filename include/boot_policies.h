@@ -0,0 +1,84 @@
+#pragma once
+
+#include "boot_core.h"
+
+// Feature selection, set per PlatformIO environment (platformio.ini). The default is the full
+// bootloader; the network modules need LittleFS for their leases, configs and manifests.
+#ifndef S3BL_STORAGE_LITTLEFS
+#define S3BL_STORAGE_LITTLEFS 1
+#endif
+#ifndef S3BL_RECOVERY_ETHERNET
+#define S3BL_RECOVERY_ETHERNET 1
+#endif
+#if S3BL_RECOVERY_ETHERNET && !S3BL_STORAGE_LITTLEFS
+#error "Ethernet recovery needs S3BL_STORAGE_LITTLEFS"
+#endif
+
+// Storage: metadata as /meta.bin in LittleFS_Program, committed with an atomic rename
+#if S3BL_STORAGE_LITTLEFS
+#include <LittleFS.h>
+#define PROG_FLASH_SIZE (1024 * 1024) // 1MB for metadata and future use
+extern LittleFS_Program myfs;
+
+struct LittleFsStorage {
+    static bool begin();
+    static bool load(boot_metadata_t& m);
+    static void save(const boot_metadata_t& m);
+};
+#endif
+
+// Storage: metadata in its own sector at METADATA_ADDRESS, no filesystem. A reset between the
+// erase and the program leaves the sector erased, which reads back as "no valid slot".
+struct RawFlashStorage {
+    static bool begin() { return true; }
+    static bool load(boot_metadata_t& m);
+    static void save(const boot_metadata_t& m);
+};
+
+// Verifier: stack pointer and reset handler both have to point into flash
+struct VectorTableVerifier {
+    static bool check(uint32_t slot) {
+        uint32_t sp = *((uint32_t*)slot);
+        uint32_t rv = *((uint32_t*)(slot + 4));
+        return (sp & 0x60000000) == 0x60000000 && (rv & 0x60000000) == 0x60000000;
+    }
+};
+
+// Logger: the Log ring and USB Serial. Only the boot flow prints through the policy; recovery and
+// the network modules write to Log themselves (boot_log.h).
+struct BootLogger {
+    template <typename T> static void print(const T& v) { Log.print(v); }
+    template <typename T> static void print(const T& v, int base) { Log.print(v, base); }
+    template <typename T> static void println(const T& v) { Log.println(v); }
+    template <typename T> static void println(const T& v, int base) { Log.println(v, base); }
+    static void println() { Log.println(); }
+};
+
+// Recovery: the Ethernet recovery server (recovery.h), or nothing; without a transport the board
+// stays in the bootloader until it is reflashed over USB
+#if S3BL_RECOVERY_ETHERNET
+#include "recovery.h"
+
+struct EthernetRecovery {
+    static void run(boot_metadata_t& m) { recovery_main(m); }
+    static void report(const boot_metadata_t& m) { recovery_report(m); }
+};
+#endif
+
+struct UsbOnlyRecovery {
+    static void run(boot_metadata_t&) { Log.println("No recovery transport in this build, reflash over USB."); }
+    static void report(const boot_metadata_t&) {}
+};
+
+#if S3BL_STORAGE_LITTLEFS
+typedef LittleFsStorage MetadataStorage;
+#else
+typedef RawFlashStorage MetadataStorage;
+#endif
+#if S3BL_RECOVERY_ETHERNET
+typedef EthernetRecovery RecoveryTransport;
+#else
+typedef UsbOnlyRecovery RecoveryTransport;
+#endif
+
+typedef BootCore<MetadataStorage, VectorTableVerifier, BootLogger, RecoveryTransport> Bootloader;
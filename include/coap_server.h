@@ -0,0 +1,25 @@
+#pragma once
+
+#include "s3bl.h"
+
+// CoAP (RFC 7252) recovery transport for sites that only pass UDP.
+//   PUT/POST coap://<ip>/fw?crc=<hex>  Block1 (RFC 7959) upload streamed into the inactive slot, crc required
+//   GET coap://<ip>/status             upload progress, observable (RFC 7641)
+#define COAP_PORT           5683
+// Largest block we take: 1024 bytes by default, the largest that fits one W5x00 UDP buffer comfortably.
+// Boards that give the socket less buffer lower it, clients asking for more are negotiated down.
+#ifndef COAP_MAX_SZX
+#define COAP_MAX_SZX        6
+#endif
+#if COAP_MAX_SZX > 6
+#error "COAP_MAX_SZX 7 is reserved (RFC 7959)"
+#endif
+#define COAP_MAX_OBSERVERS  2
+
+void coap_begin();
+
+// True while a Block1 transfer is in progress
+bool coap_upload_active();
+
+// Serves all pending datagrams. Returns true once an uploaded image has been committed.
+bool coap_poll(boot_metadata_t& meta_data);
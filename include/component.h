@@ -0,0 +1,84 @@
+#pragma once
+
+#include "image_alloc.h"
+#include "boot_clock.h"
+
+// Component images: a large base image (drivers, libraries, the application's main loop) plus
+// small modules that are updated on their own. Modules are placed images (image_alloc.h) sent to
+// POST /alloc with IMAGE_FLAG_MODULE, so an update only carries the module's own blocks, and
+// they never become the booted image themselves.
+//
+// The two sides link against fixed addresses instead of each other's symbols:
+//   - the base puts a component_exports_t at COMPONENT_EXPORTS_OFFSET into its image, an ABI
+//     number plus whatever function pointers it offers to modules
+//   - a module starts with a module_header_t instead of a vector table, naming its id, version,
+//     the base ABI it was built against and its init function
+// Before every jump to the base the bootloader writes a boot_modules_t at BOOT_MODULES_ADDRESS
+// listing, per module id, the highest version that passes its CRC32 and matches the base's ABI.
+// The base calls each listed init with its export table, early in setup().
+//
+// A newly installed version is on trial (PLACED_MODULE_TRIAL) and makes the boot that lists it a
+// trial boot (boot_clock.h), even under a confirmed base. The base's confirmation takes the listed
+// modules off trial. A trial that ends in a reset without one (boot_handoff_failed_trial) removes
+// the listed versions still on trial, and the next boot lists the version before them again. Older
+// versions stay installed as those fallbacks until their blocks or table entry are needed.
+#define COMPONENT_EXPORTS_OFFSET 0x400        // From the base image's start, after the vector table
+#define COMPONENT_EXPORTS_MAGIC  0x58453353   // "S3EX"
+#define MODULE_HEADER_MAGIC      0x444D3353   // "S3MD"
+#define PLACED_MODULE            8            // placed_image_t.valid: a module, never booted
+#define PLACED_MODULE_TRIAL      16           // placed_image_t.valid: no confirmed boot has listed it yet
+#define IMAGE_FLAG_MODULE        2            // image_header_t.flags: same
+
+// Next to the handoff block (boot_clock.h), same lifetime
+#define BOOT_MODULES_ADDRESS     (BOOT_HANDOFF_ADDRESS - 0x100)
+#define BOOT_MODULES_MAGIC       0x534D3353   // "S3MS"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t abi;            // Bumped by the base whenever functions[] changes incompatibly
+    uint32_t count;
+    uint32_t functions[];    // Thumb addresses, meaning up to the base
+} component_exports_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;             // One version of each id is started
+    uint32_t version;        // Highest valid version wins, see the trial rules above
+    uint32_t abi;            // component_exports_t.abi the module was built against
+    uint32_t init;           // void init(const component_exports_t*), Thumb address inside the module
+    uint32_t reserved[3];
+} module_header_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t version;
+    uint32_t base;           // module_header_t address
+    uint32_t length;
+    uint32_t init;
+} boot_module_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    boot_module_t modules[PLACED_IMAGES];
+    uint32_t crc;            // crc32_update over all fields above
+} boot_modules_t;
+
+// Export table of the base image at address, NULL if it has none
+const component_exports_t* component_exports(uint32_t address);
+
+// Module header for an image of length bytes linked at address: magic and init inside the image
+bool component_module_check(const module_header_t& m, uint32_t address, uint32_t length);
+
+// Picks the modules for the base image at address and writes the boot_modules_t. Logs, so it
+// runs before interrupts go off. Returns the number of modules listed; trial is set if one of
+// them is on trial.
+uint32_t component_directory_write(const boot_metadata_t& meta_data, uint32_t address, bool& trial);
+
+// The base confirmed the boot: the modules the last boot_modules_t listed are off trial.
+// Returns true if the metadata changed.
+bool component_confirm(boot_metadata_t& meta_data);
+
+// The last trial boot ended without a confirmation: removes the modules it listed that were still
+// on trial. Returns true if the metadata changed.
+bool component_trial_failed(boot_metadata_t& meta_data);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <LittleFS.h>
+
+// Last DHCP lease, persisted in LittleFS next to the boot metadata (/lease.bin).
+// On the next recovery entry we go straight to DHCPREQUEST in INIT-REBOOT state
+// (RFC 2131 4.3.2) and only fall back to a full discovery on NAK or timeout.
+#define DHCP_LEASE_MAGIC         0x53334C31 // "S3L1"
+#define DHCP_REBOOT_TIMEOUT_MS   1500
+#define DHCP_REBOOT_ATTEMPTS     2
+#define DHCP_FALLBACK_LEASE_SECS 3600       // Ethernet.begin() does not expose the real lease time
+
+typedef struct {
+    uint32_t magic;
+    uint32_t address;
+    uint32_t server;      // 0 when the lease came from Ethernet.begin()
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t obtained;    // rtc_get() seconds when the lease was acknowledged
+    uint32_t lease_time;  // seconds
+} dhcp_lease_t;
+
+bool load_dhcp_lease(FS& fs, dhcp_lease_t& lease);
+void save_dhcp_lease(FS& fs, const dhcp_lease_t& lease);
+
+// Brings up Ethernet with DHCP, reusing the cached lease when possible.
+// Returns false only if no address could be obtained at all.
+bool ethernet_begin_cached(FS& fs, uint8_t* mac);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+
+// W5x00 INTn pin. Socket interrupts (connect, disconnect, receive, timeout) pull it low and a
+// GPIO interrupt wakes the recovery loop out of WFI. Leave it at -1 to keep polling; only set it
+// on boards where INTn is actually wired to that pin.
+#ifndef ETH_INT_PIN
+#define ETH_INT_PIN -1
+#endif
+
+// Longest single sleep, whatever the caller asked for. A miswired or unwired INTn then costs a
+// second of latency per event instead of a recovery loop that never wakes.
+#define ETH_IRQ_MAX_WAIT_MS 1000
+
+// Enables socket interrupts on the W5x00, call after Ethernet is up
+void eth_irq_begin();
+
+// Sleeps in WFI until a socket event or until timeout_ms has passed (0 or anything above
+// ETH_IRQ_MAX_WAIT_MS waits ETH_IRQ_MAX_WAIT_MS at most).
+// Without an INTn pin this just waits 10 ms like the old polling loop.
+void eth_irq_wait(uint32_t timeout_ms);
+
+// Clears pending socket interrupts. Call before servicing the sockets, so an event that arrives
+// while we are servicing raises INTn again instead of being lost.
+void eth_irq_ack();
+
+// Before the core goes to an application without a reset: masks the socket interrupts, detaches
+// INTn and closes every socket, so nothing from the bootloader fires into the application
+void eth_irq_end();
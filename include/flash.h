@@ -40,4 +40,6 @@ typedef struct {
 #define IMXRT_FLEXSPI ((FLEX_RUNTIME_CFG_t *)0x402A8000)
 #define FLEXSPI_LUT_KEY     0x5AF05AF0
 #define FLEXSPI_LUT_UNLOCK  0x2
-#define SECTOR_SIZE         4096
\ No newline at end of file
+#define SECTOR_SIZE         4096
+#define FLASH_BASE          0x60000000
+#define FLASH_SIZE          (2 * 1024 * 1024) // Teensy 4.0 W25Q16JV
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "image_alloc.h"
+
+// Hot section preloading for placed images. A handful of ISR and control loop functions run
+// near RAM speed from ITCM instead of paying XIP cache misses, without the application copying
+// its whole image to RAM. The image header lists the sections (tools/hotsections.py writes the
+// linker fragment and the list); alloc_install checks them and programs them as a hot_table_t
+// after the image, and hot_jump copies them right before the jump.
+//
+// The application's linker script puts the hot sections above its own .text.itcm, outside the
+// range the Teensy startup code copies, and configures at least as many ITCM banks as the
+// bootloader runs with, so the banks holding the copies stay ITCM.
+
+// ITCM bytes the current FlexRAM configuration maps, 32KB per bank
+uint32_t hot_itcm_size();
+
+// Every section inside the image [base, base + length) and the ITCM size, word aligned
+bool hot_sections_check(const hot_section_t* sections, uint32_t count, uint32_t base, uint32_t length);
+
+// Hot table of the placed image starting at address, NULL if it has none or it fails its CRC
+const hot_table_t* hot_table_at(const boot_metadata_t& meta_data, uint32_t address);
+
+// jump_to_app with the table's sections copied into ITCM first. The bootloader's own code runs
+// from ITCM, so this runs from flash and calls nothing once the copy has started.
+void hot_jump(uint32_t address, const hot_table_t* table) __attribute__((noreturn));
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Ethernet.h>
+
+// HTTP helpers of the recovery server (recovery.cpp), for the modules it hands requests to.
+// Only builds with Ethernet recovery include this; the boot path stays clear of the network stack.
+
+// Reads one header line (CR/LF stripped); an empty line marks the end of the headers
+void http_read_line(Client& client, String& line, unsigned long timeout_ms = 1000);
+void http_respond(Client& client, const char* status, const char* body);
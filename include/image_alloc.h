@@ -0,0 +1,76 @@
+#pragma once
+
+#include "s3bl.h"
+
+class Client;
+
+// Block allocator over the application region: the 64KB erase blocks that lie wholly inside the
+// two fixed slots, in ALLOC_UNIT blocks. The slots are not block aligned, so the grid starts at
+// the first block boundary in slot A and placed images are erased with block erases; the 56KB
+// before it and the 8KB after it only ever hold fixed slot images. Images sent to POST /alloc
+// start with an image_header_t naming the address they are linked for (XIP code only runs where
+// it was linked) and are recorded in the metadata image table instead of taking a whole fixed
+// slot. The booted image is never overwritten; other valid images (fixed slots and placed ones)
+// are kept as fallbacks until a new image needs their blocks. GET /alloc[?size=<n>] shows the
+// block map and the first free range for a size, so the next build can be linked for it.
+#define APP_REGION_START   ((SLOT_A_ADDRESS + FLASH_BLOCK_SIZE - 1) & ~(FLASH_BLOCK_SIZE - 1))   // 0x60040000
+#define APP_REGION_END     ((SLOT_B_ADDRESS + SLOT_SIZE) & ~(FLASH_BLOCK_SIZE - 1))             // 0x601F0000
+#define ALLOC_UNIT         FLASH_BLOCK_SIZE
+#define ALLOC_UNITS        ((APP_REGION_END - APP_REGION_START) / ALLOC_UNIT)
+
+#define IMAGE_HEADER_MAGIC 0x48493353 // "S3IH"
+#define HOT_TABLE_MAGIC    0x54483353 // "S3HT"
+#define HOT_SECTIONS_MAX   8
+#define PLACED_HOT_TABLE   2          // placed_image_t.valid: a hot_table_t follows the image
+#define PLACED_FULL_RESET  4          // placed_image_t.valid: start it through a system reset
+#define IMAGE_FLAG_RESET   1          // image_header_t.flags: same, see recovery.h
+
+// Code the application wants in ITCM without copying it itself: its linker script gives these
+// sections an ITCM address and a load address inside the image (tools/hotsections.py), and
+// the bootloader copies them right before the jump (hot_preload.h)
+typedef struct {
+    uint32_t flash_addr;     // Load address, inside the image
+    uint32_t itcm_addr;      // Run address, 0x00000000 based
+    uint32_t length;         // Multiple of 4
+} hot_section_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t header_size;    // sizeof(image_header_t) + hot_count hot_section_t, the image follows
+    uint32_t load_address;   // ALLOC_UNIT aligned, inside APP_REGION_START..APP_REGION_END
+    uint32_t length;         // Image bytes after the header
+    uint32_t crc;            // CRC32 of the image bytes
+    uint16_t hot_count;      // hot_section_t entries right after this header
+    uint16_t flags;          // IMAGE_FLAG_*
+} image_header_t;
+
+// Programmed right after the image (4 byte aligned) when there are hot sections
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    hot_section_t sections[HOT_SECTIONS_MAX];
+    uint32_t crc;            // crc32_update over everything above
+} hot_table_t;
+
+bool alloc_overlaps(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len);
+
+// Flash bytes a placed image occupies, its hot table included
+uint32_t placed_footprint(const placed_image_t& img);
+
+// Start and length of the image the metadata boots, length 0 if there is none
+uint32_t alloc_booted(const boot_metadata_t& meta_data, uint32_t& length);
+
+// Bit per ALLOC_UNIT taken by the booted image, plus the fallbacks if asked for
+uint32_t alloc_used(const boot_metadata_t& meta_data, bool fallbacks);
+
+// Lowest address with length bytes of free units, fallbacks counting as used. 0 if none.
+uint32_t alloc_first_fit(const boot_metadata_t& meta_data, uint32_t length);
+
+// Invalidates every image, fixed or placed, overlapping [base, base + length)
+void alloc_forget(boot_metadata_t& meta_data, uint32_t base, uint32_t length);
+
+// GET /alloc
+void alloc_status(Client& client, const String& req_line, const boot_metadata_t& meta_data);
+
+// POST /alloc: header plus image. Returns true once the image is installed and made active.
+bool alloc_install(Client& client, boot_metadata_t& meta_data);
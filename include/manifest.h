@@ -0,0 +1,54 @@
+#pragma once
+
+#include <LittleFS.h>
+#include "s3bl.h"
+#include "http.h"
+#include "sha256.h"
+
+// Multi-image updates: a manifest lists every image of a release, they are all staged into the
+// inactive areas and committed together by the single metadata write that flips active_slot.
+//
+//   POST /manifest            body: one "<name> <target> <length> <sha256 hex>" line per image
+//   PUT /manifest/<name>      Content-Range: bytes <first>-<last>/<length>, appended at the resume point
+//   GET /manifest/status      per image resume point, for continuing an interrupted transfer
+//   DELETE /manifest          drops the staged release
+//
+// Targets:
+//   slot        the inactive application slot (at most one per manifest)
+//   data        a data partition kept as an A/B pair of LittleFS files, /<name>_a.bin and
+//               /<name>_b.bin. The application uses the one matching active_slot, so it switches
+//               together with the code (see data_partition_path).
+//
+// The manifest and its progress live in /manifest.bin and survive a reset. Posting the same
+// manifest again keeps the progress, so a large release resumes instead of starting over.
+#define MANIFEST_MAX_IMAGES     4
+#define MANIFEST_NAME_SIZE      16
+#define DATA_PARTITION_MAX_SIZE (256 * 1024)
+
+#define MANIFEST_TARGET_SLOT    1
+#define MANIFEST_TARGET_DATA    2
+
+typedef struct {
+    char name[MANIFEST_NAME_SIZE];
+    uint32_t target;
+    uint32_t length;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    uint32_t received;      // Resume point; for slots only whole sectors are counted
+} manifest_image_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t base_slot;     // active_slot the release was staged against
+    uint32_t staging_slot;  // 0 = A, 1 = B: inactive_slot_address when the release was posted
+    manifest_image_t images[MANIFEST_MAX_IMAGES];
+} manifest_t;
+
+// Path of a data partition for the given slot (0 = A, 1 = B)
+void data_partition_path(char* out, size_t size, const char* name, uint32_t slot);
+
+// Reloads a staged release after a reset; drops it if the metadata moved on since
+void manifest_begin(FS& fs, const boot_metadata_t& meta_data);
+
+// Serves the /manifest requests. Returns true once a release has been verified and committed.
+bool manifest_handle(Client& client, const String& req_line, FS& fs, boot_metadata_t& meta_data);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "s3bl.h"
+#include "net_config.h"
+
+// Minimal MQTT 3.1.1 client for update notifications.
+// Subscribes to s3bl/<mac>/update; an announcement payload of the form
+//   sha256=<64 hex> url=http://host[:port]/path [chunks=<64 hex>]
+// starts a pull-mode download of that image into the inactive slot, from site peers when one
+// has it (peer.h), from url otherwise.
+#define MQTT_TOPIC_PREFIX     "s3bl/"
+#define MQTT_TOPIC_SUFFIX     "/update"
+#define MQTT_MAX_PACKET       512
+#define MQTT_RETRY_MIN_MS     5000
+#define MQTT_RETRY_MAX_MS     60000
+
+void mqtt_begin(const net_config_t& cfg, const uint8_t* mac);
+bool mqtt_enabled();
+
+// Keeps the session alive and handles announcements. Returns true once an announced image was installed.
+bool mqtt_poll(boot_metadata_t& meta_data);
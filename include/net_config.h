@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+// Network service configuration, persisted in LittleFS (/netcfg.bin).
+// Fields are only ever appended: an older, shorter file still loads and the new fields keep their defaults.
+#define NET_CONFIG_MAGIC 0x53334E43 // "S3NC"
+
+// Build time defaults, override with -D in platformio.ini. A zero broker address disables MQTT.
+#ifndef MQTT_BROKER_DEFAULT
+#define MQTT_BROKER_DEFAULT "0.0.0.0"
+#endif
+#ifndef MQTT_PORT_DEFAULT
+#define MQTT_PORT_DEFAULT 1883
+#endif
+#ifndef MQTT_KEEPALIVE_DEFAULT
+#define MQTT_KEEPALIVE_DEFAULT 300 // Seconds, one PINGREQ per interval when otherwise idle
+#endif
+
+#ifndef SYSLOG_SERVER_DEFAULT
+#define SYSLOG_SERVER_DEFAULT "0.0.0.0"
+#endif
+#ifndef SYSLOG_PORT_DEFAULT
+#define SYSLOG_PORT_DEFAULT 514
+#endif
+#ifndef SYSLOG_RATE_DEFAULT
+#define SYSLOG_RATE_DEFAULT 2048 // Bytes/s of log traffic at most
+#endif
+
+#ifndef UPLOAD_RATE_DEFAULT
+#define UPLOAD_RATE_DEFAULT 0    // Bytes/s of update traffic at most, 0 = unlimited (rate_limit.h)
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t mqtt_broker;     // IPv4 address, 0 = MQTT disabled
+    uint16_t mqtt_port;
+    uint16_t mqtt_keepalive;  // Seconds
+    uint32_t syslog_server;   // IPv4 address, 0 = syslog disabled
+    uint16_t syslog_port;
+    uint16_t reserved;
+    uint32_t syslog_rate;     // Bytes/s
+    uint32_t upload_rate;     // Bytes/s, 0 = unlimited
+    uint8_t tls_psk[32];      // TLS 1.3 external PSK (tls_psk.h)
+    uint16_t tls_psk_length;  // Bytes of tls_psk in use, 0 = no TLS listener
+    uint16_t tls_only;        // 1 = plain HTTP, CoAP and MQTT announcements stay off, s3bl_provision.py's default
+    char tls_identity[32];    // PSK identity clients name, NUL terminated
+} net_config_t;
+
+void net_config_defaults(net_config_t& cfg);
+// Always leaves a usable config in cfg; returns false if only the defaults were used
+bool load_net_config(FS& fs, net_config_t& cfg);
+void save_net_config(FS& fs, const net_config_t& cfg);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "s3bl.h"
+#include "http.h"
+#include "sha256.h"
+
+// Site local image propagation. Sites have a slow uplink but a fast LAN, so an announced image
+// should cross the uplink once: a device in recovery serves the image it boots to its peers,
+// straight from XIP flash, and a device told to pull an image first asks the LAN for it.
+//
+// Peers find each other with text datagrams broadcast on PEER_PORT:
+//   S3BL-HAVE sha256=<hex> length=<n>   every PEER_ADVERT_MS, and in reply to a query
+//   S3BL-FETCHING sha256=<hex>          in reply to a query while pulling that image upstream
+//   S3BL-WHOHAS sha256=<hex>            query
+// and fetch over the recovery HTTP server:
+//   GET /peer/hashes?sha256=<hex>       SHA-256 of every PEER_CHUNK_SIZE chunk, back to back
+//   GET /peer/chunk?sha256=<hex>&n=<i>  one chunk
+// Chunks come from several peers in parallel and each is checked against the hash list before it
+// counts. The list is checked against the announcement's chunks=<hex> root (SHA-256 over the
+// list) when there is one; the SHA-256 of the whole image decides in the end either way, and
+// anything that fails falls back to the upstream URL.
+//
+// Only the bootloader speaks this protocol, so a peer is a device that is in recovery: one that is
+// there anyway and serves the image its metadata boots, or one that installed an announced image
+// and holds its seed window open (PEER_SEED_MS, cut short after PEER_SEED_IDLE_MS without a chunk
+// request) before rebooting into it. Devices running their application serve nothing, so the
+// uplink is only saved for devices that ask while an earlier one still seeds; one that asks after
+// every window closed goes upstream.
+#define PEER_PORT           5685
+#define PEER_CHUNK_SIZE     (32 * 1024)
+#define PEER_CHUNKS         ((SLOT_SIZE + PEER_CHUNK_SIZE - 1) / PEER_CHUNK_SIZE)
+#define PEER_MAX            4
+// Chunk fetches in parallel. The W5x00 has 8 sockets: CoAP, MQTT, syslog and PEER_PORT take
+// four, each recovery listener (port 80, TLS_PORT) one more. This is the count with one listener;
+// peer_begin drops one connection for each further listener.
+#define PEER_SOCKETS        8
+#define PEER_CONNECTIONS    (PEER_SOCKETS - 4 - 1)
+#define PEER_ADVERT_MS      10000
+#define PEER_STALE_MS       30000    // Peers not heard from for this long are dropped
+#define PEER_DISCOVER_MS    500      // Query window before going upstream, plus up to PEER_JITTER_MS
+#define PEER_JITTER_MS      2000     // Spreads devices announced at once, so one of them goes upstream first
+#define PEER_WAIT_MAX_MS    300000   // Longest wait for a peer that is fetching the image upstream
+#define PEER_SEED_MS        120000   // Recovery stays up this long after an announced install...
+#define PEER_SEED_IDLE_MS   20000    // ...or until no peer asked for a chunk for this long
+
+// Hashes the booted image, if its length is known, and opens the peer socket. listeners is the
+// number of TCP listeners recovery holds.
+void peer_begin(const boot_metadata_t& meta_data, int listeners);
+
+// True while there is something to advertise or a seed window is open
+bool peer_active();
+
+// Answers queries, records adverts and sends the periodic advert
+void peer_poll();
+
+// GET /peer/...
+void peer_serve(EthernetClient& client, const String& req_line);
+
+// Serves the image that was just installed and opens the seed window
+void peer_seed(const boot_metadata_t& meta_data);
+
+// True once the seed window has run out and the device can reboot into the new image
+bool peer_seed_done();
+
+// /status lines
+void peer_status(Print& out);
+
+// Installs the image with the given SHA-256 into the inactive slot from site peers, or from url
+// if no peer has it. chunks_root may be NULL. Returns true once the new slot is active.
+bool peer_update(const char* url, const uint8_t sha256[SHA256_DIGEST_SIZE], const uint8_t* chunks_root,
+                 boot_metadata_t& meta_data);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <LittleFS.h>
+#include "s3bl.h"
+#include "http.h"
+
+// Factory provisioning: POST /provision with one bundle programs the slots, the golden image,
+// the network config and the initial metadata in a single pass.
+//
+// Bundle layout (little endian):
+//   "S3PB"  uint32 version (1)  uint32 section count
+//   per section: uint32 type, uint32 length, uint8 sha256[32]
+//   section payloads, in table order
+// Slots are block erased up front and verified by hashing the flash readback. Config and
+// metadata are only applied after every section verified; a failed bundle leaves the slots it
+// touched marked invalid.
+#define PROVISION_VERSION       1
+#define PROVISION_MAX_SECTIONS  8
+
+#define PROVISION_SLOT_A        1
+#define PROVISION_SLOT_B        2
+#define PROVISION_GOLDEN        3   // Kept as /golden.bin in LittleFS
+#define PROVISION_NETCFG        4   // Raw net_config_t (may be an older, shorter version)
+#define PROVISION_METADATA      5   // Raw boot_metadata_t, otherwise derived from the slots written
+
+// Handles the request after its request line was read. Responds with a per-section timing
+// report and returns true when the board was provisioned with a bootable slot.
+bool handle_provision(EthernetClient& client, FS& fs, boot_metadata_t& meta_data);
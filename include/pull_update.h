@@ -0,0 +1,8 @@
+#pragma once
+
+#include "s3bl.h"
+#include "sha256.h"
+
+// Pull-mode update: downloads http://host[:port]/path into the inactive slot, checks the
+// SHA-256 of what landed in flash and commits it. Returns true once the new slot is active.
+bool pull_update(const char* url, const uint8_t expected_sha256[SHA256_DIGEST_SIZE], boot_metadata_t& meta_data);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "s3bl.h"
+#include "net_config.h"
+
+// Token bucket over update traffic on the plant network: image bytes read from upload, pull
+// and peer connections, and chunks served to peers, all against one cfg.upload_rate. A byte left
+// in the W5x00's socket buffer shrinks the TCP window it advertises, so deferring a read paces the
+// sender without anything being dropped or sent twice. At most RATE_LIMIT_BURST_MS worth of
+// bytes move at once. Factory provisioning and CoAP block transfers are not limited.
+#define RATE_LIMIT_BURST_MS  20
+#define RATE_LIMIT_MIN_BURST 1024   // One read's worth at low rates
+
+void rate_limit_begin(const net_config_t& cfg);
+
+// Bytes out of want that may move now, 0 while the bucket is empty. want when unlimited.
+size_t rate_limit_allow(size_t want);
+
+// Takes n bytes that did move out of the bucket
+void rate_limit_used(size_t n);
+
+// After rate_limit_allow gave 0: sleeps until a read's worth of bytes is back in the bucket, at
+// most RATE_LIMIT_BURST_MS, rather than asking again in a tight loop
+void rate_limit_defer();
+
+// /status lines: the limit, bytes counted, defer episodes and the time spent in them, cycles per call
+void rate_limit_status(Print& out);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "s3bl.h"
+#include "http.h"
+
+// Ethernet recovery mode: HTTP server on port 80 plus the CoAP, MQTT and syslog services.
+// Never returns: an installed update and a netboot both end in a jump.
+void recovery_main(boot_metadata_t& meta_data);
+
+// After a confirmed boot was recorded: answers GET /status (mode=confirmed, boot_success=1) on
+// port 80 until one report went out or S3BL_REPORT_WINDOW_MS passed, then tears the network down
+// again for the application. Only images a rollout installed wait: its PUT /image ranges carry
+// X-Boot-Report: 1, and the install leaves REPORT_FLAG_PATH for this one boot. 0 never waits.
+void recovery_report(const boot_metadata_t& meta_data);
+#define REPORT_FLAG_PATH "/report.bin"
+#ifndef S3BL_REPORT_WINDOW_MS
+#define S3BL_REPORT_WINDOW_MS 30000
+#endif
+
+// An installed image is started straight from recovery: the metadata is already committed, so
+// the network is torn down and the core jumps into the image without the ROM boot, Arduino init,
+// storage mount and boot delays a reset would cost. Placed images whose header sets
+// IMAGE_FLAG_RESET, or every image when this is 1, are started through a system reset instead.
+#ifndef S3BL_HANDOFF_RESET
+#define S3BL_HANDOFF_RESET 0
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include "flash.h"
+#include "boot_log.h"
+
+// Shared bootloader services (implemented in main.cpp) for the transport modules.
+
+#define METADATA_ADDRESS 0x60031000
+#define BOOT_SLOT_PLACED 2    // active_slot value: boot images[active_image] (image_alloc.h)
+#define PLACED_IMAGES    4
+
+typedef struct {
+   uint32_t base;         // XIP address of the vector table, the address the image is linked for
+   uint32_t length;
+   uint32_t crc;          // CRC32 of the installed image
+   uint32_t valid;        // Non-zero when bootable, PLACED_HOT_TABLE (image_alloc.h) is a flag bit
+} placed_image_t;
+
+typedef struct {
+   uint32_t active_slot;  // 0 = A, 1 = B, BOOT_SLOT_PLACED
+   uint32_t valid_a;
+   uint32_t valid_b;
+   uint32_t boot_count;
+   uint32_t boot_success;
+   // Image table of the block allocator. Metadata written before it existed is
+   // BOOT_METADATA_V1_SIZE bytes long and loads with an empty table.
+   uint32_t active_image;
+   placed_image_t images[PLACED_IMAGES];
+   // Image bytes in slot A and B, 0 when not known (provisioned without a length, or metadata
+   // written before this field, which is BOOT_METADATA_V2_SIZE bytes long)
+   uint32_t slot_length[2];
+} boot_metadata_t;
+
+#define BOOT_METADATA_V1_SIZE 20
+#define BOOT_METADATA_V2_SIZE offsetof(boot_metadata_t, slot_length)
+
+#define SLOT_A_ADDRESS 0x60032000
+#define SLOT_B_ADDRESS 0x60112000
+#define SLOT_SIZE      (SLOT_B_ADDRESS - SLOT_A_ADDRESS)
+#define SLOT_SECTORS   (SLOT_SIZE / SECTOR_SIZE)
+
+#define FLASH_BLOCK_SIZE (64 * 1024)
+
+void flash_erase_sector(uint32_t addr);
+void flash_erase_block(uint32_t addr);
+void flash_erase_range(uint32_t addr, uint32_t len);
+void flash_program(uint32_t addr, const void* data, size_t len);
+void flash_write(uint32_t addr, const void* data, size_t len);
+
+void save_metadata(const boot_metadata_t& meta_data);
+bool load_metadata(boot_metadata_t& meta_data);
+uint32_t inactive_slot_address(const boot_metadata_t& meta_data);
+void commit_inactive_slot(boot_metadata_t& meta_data, uint32_t length = 0);
+
+// Image bytes in slot 0 (A) or 1 (B), 0 when not known
+uint32_t slot_image_length(const boot_metadata_t& meta_data, int slot);
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len);
+
+// Restores the boot clock, writes the handoff block and jumps through the vector table at address
+void jump_to_app(uint32_t address);
+
+// Streams an image into flash in order: bytes are combined into whole sectors,
+// and each sector is erased right before it is programmed unless the region was erased up front.
+typedef struct {
+    uint32_t base;      // Sector aligned flash address of the first byte
+    uint32_t offset;    // Bytes accepted so far
+    uint32_t fill;      // Bytes waiting in buf
+    uint8_t* buf;       // SECTOR_SIZE staging buffer
+    bool erased;        // Set after slot_writer_begin when flash_erase_range already covered the region
+} slot_writer_t;
+
+void slot_writer_begin(slot_writer_t& w, uint32_t base, uint8_t* buf);
+void slot_writer_write(slot_writer_t& w, const uint8_t* data, size_t len);
+void slot_writer_finish(slot_writer_t& w);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;      // Bytes hashed so far
+    uint8_t block[64];
+    uint32_t fill;
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t& ctx);
+void sha256_update(sha256_ctx_t& ctx, const uint8_t* data, size_t len);
+void sha256_final(sha256_ctx_t& ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// HMAC-SHA-256 (RFC 2104), keys longer than the 64 byte block are hashed first
+void hmac_sha256(const uint8_t* key, size_t key_len, const uint8_t* data, size_t len, uint8_t mac[SHA256_DIGEST_SIZE]);
+
+// Parses 64 hex characters; returns false on anything else
+bool sha256_from_hex(const char* hex, uint8_t digest[SHA256_DIGEST_SIZE]);
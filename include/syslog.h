@@ -0,0 +1,20 @@
+#pragma once
+
+#include "s3bl.h"
+#include "net_config.h"
+
+// Ships the RAM log ring (boot_log.h) to a syslog collector over UDP, RFC 5424 framing
+// (RFC 5426 transport). Several records are batched into one message, one "<ms> text" line
+// each, so a datagram carries as much as fits in SYSLOG_MAX_PACKET. Traffic is held to
+// cfg.syslog_rate bytes/s and deferred entirely while an upload is running, unless the ring
+// is about to overwrite records that were not sent yet.
+#define SYSLOG_MAX_PACKET     1400  // Stays below the Ethernet MTU without IP fragmentation
+#define SYSLOG_FLUSH_MS       2000  // A partial batch waits this long for more records
+#define SYSLOG_LOCAL_PORT     5514
+#define SYSLOG_FACILITY       16    // local0
+
+void syslog_begin(const net_config_t& cfg);
+bool syslog_enabled();
+
+// Sends at most one batch. busy: an upload is in progress.
+void syslog_poll(bool busy);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "s3bl.h"
+#include "net_config.h"
+#include "aes.h"
+#include <Ethernet.h>
+
+// TLS 1.3 with an external pre-shared key (RFC 8446 §2.2) for the recovery server's install
+// routes, an alternative to plain HTTP on networks that must not carry images in the clear. No
+// certificates: the device and the upload tool hold the same key from the network config. Offered:
+//   - TLS_AES_128_CCM_SHA256, whose record protection runs entirely on the DCP (aes.h), preferred
+//   - TLS_AES_128_GCM_SHA256 for clients without CCM, GHASH in software
+//   - psk_dhe_ke with X25519 for forward secrecy, psk_ke when that's all the client offers
+// Records are decrypted in place in the receive buffer and the handlers read the plaintext from
+// there, so an image still moves from the socket to the flash writer through one buffer.
+// One connection at a time; no HelloRetryRequest, 0-RTT data or session tickets.
+//
+// Checked against openssl s_client -psk in test/test_tls.py. Host build throughput (hostsim.py
+// tls-bench, 512KB staged per PUT, median of 5, one 2.1GHz Xeon core, flash modelled as free):
+//   plain HTTP   14-15.5 MB/s
+//   CCM          8-9 MB/s,     30-37k cycles/KB to open
+//   GCM          9.5-10.5 MB/s, 20-22k cycles/KB to open
+// Both suites run the software AES there, so these bound the protocol's cost, not the DCP's; the
+// board figures come from s3bl_upload.py place with and without --tls-psk and are not taken yet.
+#define TLS_PORT              443
+#define TLS_RECORD_MAX        16384   // Plaintext bytes per record, RFC 8446 §5.1
+#define TLS_TX_RECORD         1024    // Plaintext bytes per record sent, responses are small
+#define TLS_HELLO_MAX         2048    // Largest ClientHello accepted
+#define TLS_HANDSHAKE_TIMEOUT 5000
+
+class TlsClient : public Client {
+public:
+    // Runs the server handshake over an accepted connection. On failure the connection is
+    // closed and false returned.
+    bool accept(EthernetClient& tcp, const net_config_t& cfg);
+
+    int connect(IPAddress ip, uint16_t port) { return 0; }
+    int connect(const char* host, uint16_t port) { return 0; }
+    size_t write(uint8_t b) { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size);
+    using Print::write;
+    int available();
+    int read();
+    int read(uint8_t* buf, size_t size);
+    int peek();
+    void flush();
+    // Sends close_notify first
+    void stop();
+    uint8_t connected();
+    operator bool() { return tcp; }
+
+private:
+    EthernetClient tcp;
+    aead_t rx_aead, tx_aead;
+    uint8_t rx_iv[AEAD_NONCE_SIZE], tx_iv[AEAD_NONCE_SIZE];
+    uint8_t rx_secret[32];   // Client application traffic secret, for KeyUpdate
+    uint8_t tx_secret[32];
+    uint64_t rx_seq, tx_seq;
+    int mode;                // AEAD_*
+    bool encrypting;         // Server handshake keys or later in use for sending
+    bool open;               // Application keys in place, no alert seen
+    size_t rx_fill;          // Bytes of the record being received
+    size_t rx_pos, rx_end;   // Decrypted application data not read yet
+    size_t tx_fill;          // Plaintext waiting to be sent
+
+    int poll_record();
+    bool wait_record(unsigned long deadline);
+    int open_record(size_t& len);
+    bool send_plain(uint8_t type, const uint8_t* data, size_t len);
+    bool send_record(uint8_t type, const uint8_t* data, size_t len);
+    void send_alert(uint8_t desc);
+    bool flush_tx();
+    void set_keys(aead_t& aead, uint8_t iv[AEAD_NONCE_SIZE], uint64_t& seq, const uint8_t secret[32]);
+    void key_update(const uint8_t* msg, size_t len);
+    bool fail(uint8_t alert, const char* why);
+};
+
+// True if cfg holds a PSK, so the TLS listener runs
+bool tls_enabled(const net_config_t& cfg);
+
+// /status lines: handshakes, the last one's duration, bytes and cycles per KB spent in the AEAD
+void tls_status(Print& out);
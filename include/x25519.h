@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// X25519 (RFC 7748) for the TLS psk_dhe_ke handshake, compact rather than fast: one shared
+// secret costs a few tens of milliseconds on the M7, once per connection.
+#define X25519_SIZE 32
+
+// out = scalar * point; point NULL means the base point
+void x25519(uint8_t out[X25519_SIZE], const uint8_t scalar[X25519_SIZE], const uint8_t* point);
@@ -0,0 +1,368 @@
+// AES-128 (FIPS 197) with CCM (NIST SP 800-38C) and GCM (NIST SP 800-38D) as TLS 1.3 uses
+// them: 12 byte nonce, 16 byte tag, 3 byte CCM length field.
+
+#include "aes.h"
+#include <string.h>
+#if defined(__IMXRT1062__)
+#include <Arduino.h>
+#endif
+
+#define AEAD_SCRATCH_BLOCKS 32   // Counter or CBC blocks per cipher job
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint8_t xtime(uint8_t x) {
+    return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+static void aes_block(const uint8_t* rk, const uint8_t* in, uint8_t* out) {
+    uint8_t s[16], t[16];
+    for (int i = 0; i < 16; i++) s[i] = in[i] ^ rk[i];
+    for (int round = 1; round <= 10; round++) {
+        // SubBytes and ShiftRows, the state is column major
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) t[4 * c + r] = sbox[s[4 * ((c + r) & 3) + r]];
+        }
+        if (round < 10) {
+            for (int c = 0; c < 4; c++) {
+                uint8_t* a = t + 4 * c;
+                uint8_t a0 = a[0], e = a[0] ^ a[1] ^ a[2] ^ a[3];
+                a[0] ^= e ^ xtime(a[0] ^ a[1]);
+                a[1] ^= e ^ xtime(a[1] ^ a[2]);
+                a[2] ^= e ^ xtime(a[2] ^ a[3]);
+                a[3] ^= e ^ xtime(a[3] ^ a0);
+            }
+        }
+        for (int i = 0; i < 16; i++) s[i] = t[i] ^ rk[16 * round + i];
+    }
+    memcpy(out, s, 16);
+}
+
+#if defined(__IMXRT1062__)
+// DCP channel 0, polled. Packets and payloads live in DTCM, which the DCP reaches without cache
+// maintenance; the AEADs below only ever hand it their DTCM scratch buffer.
+#define DCP_BASE             0x402FC000
+#define DCP_REG(offset)      (*(volatile uint32_t*)(DCP_BASE + (offset)))
+#define DCP_CTRL_CLR         DCP_REG(0x008)
+#define DCP_STAT_CLR         DCP_REG(0x018)
+#define DCP_CHANNELCTRL_SET  DCP_REG(0x024)
+#define DCP_CH0CMDPTR        DCP_REG(0x100)
+#define DCP_CH0SEMA          DCP_REG(0x110)
+#define DCP_CH0STAT          DCP_REG(0x120)
+#define DCP_CH0STAT_CLR      DCP_REG(0x128)
+#define DCP_CCGR0            (*(volatile uint32_t*)0x400FC068)
+#define DCP_CCGR0_ON         (3u << 10)
+#define DCP_CTRL_SFTRST      (1u << 31)
+#define DCP_CTRL_CLKGATE     (1u << 30)
+#define DCP_C0_DECR_SEMAPHORE (1u << 1)
+#define DCP_C0_ENABLE_CIPHER (1u << 5)
+#define DCP_C0_CIPHER_ENCRYPT (1u << 8)
+#define DCP_C0_CIPHER_INIT   (1u << 9)
+#define DCP_C0_PAYLOAD_KEY   (1u << 11)
+#define DCP_C1_AES128        0
+#define DCP_C1_ECB           (0u << 4)
+#define DCP_C1_CBC           (1u << 4)
+#define DCP_STATUS_COMPLETE  1u
+#define DCP_STATUS_ERRORS    0x7Eu
+
+typedef struct {
+    uint32_t next;
+    uint32_t control0;
+    uint32_t control1;
+    uint32_t src;
+    uint32_t dst;
+    uint32_t size;
+    uint32_t payload;
+    volatile uint32_t status;
+} dcp_packet_t;
+
+static dcp_packet_t dcp_packet __attribute__((aligned(16)));
+static uint8_t dcp_payload[32] __attribute__((aligned(16)));   // Key, then the CBC IV
+static bool dcp_started;
+static bool dcp_failed;
+
+// False if the DCP refused the job; the caller does it in software then
+static bool dcp_aes(const aes128_t& ctx, uint32_t mode, const uint8_t* iv, const uint8_t* in, uint8_t* out, size_t len) {
+    if (dcp_failed) return false;
+    if (!dcp_started) {
+        DCP_CCGR0 |= DCP_CCGR0_ON;
+        DCP_CTRL_CLR = DCP_CTRL_SFTRST | DCP_CTRL_CLKGATE;
+        DCP_CHANNELCTRL_SET = 1;
+        dcp_started = true;
+    }
+    memcpy(dcp_payload, ctx.key, AES_KEY_SIZE);
+    if (iv) memcpy(dcp_payload + AES_KEY_SIZE, iv, AES_BLOCK_SIZE);
+    arm_dcache_flush_delete((void*)in, len);
+    if (out != in) arm_dcache_flush_delete(out, len);
+    dcp_packet.next = 0;
+    dcp_packet.control0 = DCP_C0_DECR_SEMAPHORE | DCP_C0_ENABLE_CIPHER | DCP_C0_CIPHER_ENCRYPT |
+                          DCP_C0_CIPHER_INIT | DCP_C0_PAYLOAD_KEY;
+    dcp_packet.control1 = DCP_C1_AES128 | mode;
+    dcp_packet.src = (uint32_t)in;
+    dcp_packet.dst = (uint32_t)out;
+    dcp_packet.size = len;
+    dcp_packet.payload = (uint32_t)dcp_payload;
+    dcp_packet.status = 0;
+    DCP_CH0CMDPTR = (uint32_t)&dcp_packet;
+    DCP_CH0SEMA = 1;
+    while (!(dcp_packet.status & (DCP_STATUS_COMPLETE | DCP_STATUS_ERRORS)));
+    DCP_STAT_CLR = 1;
+    arm_dcache_delete(out, len);
+    if (dcp_packet.status & DCP_STATUS_ERRORS) {
+        DCP_CH0STAT_CLR = 0xFFFFFFFF;
+        dcp_failed = true;
+        return false;
+    }
+    return true;
+}
+#endif
+
+void aes128_init(aes128_t& ctx, const uint8_t key[AES_KEY_SIZE]) {
+    memcpy(ctx.key, key, AES_KEY_SIZE);
+    memcpy(ctx.rk, key, AES_KEY_SIZE);
+    uint8_t rcon = 1;
+    for (int i = 16; i < 176; i += 4) {
+        uint8_t t[4] = { ctx.rk[i - 4], ctx.rk[i - 3], ctx.rk[i - 2], ctx.rk[i - 1] };
+        if (i % 16 == 0) {
+            uint8_t t0 = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[t0];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++) ctx.rk[i + j] = ctx.rk[i - 16 + j] ^ t[j];
+    }
+}
+
+void aes128_ecb(const aes128_t& ctx, const uint8_t* in, uint8_t* out, size_t blocks) {
+#if defined(__IMXRT1062__)
+    if (dcp_aes(ctx, DCP_C1_ECB, NULL, in, out, blocks * AES_BLOCK_SIZE)) return;
+#endif
+    for (size_t i = 0; i < blocks; i++) aes_block(ctx.rk, in + i * AES_BLOCK_SIZE, out + i * AES_BLOCK_SIZE);
+}
+
+void aes128_cbc(const aes128_t& ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* in, uint8_t* out, size_t blocks) {
+    if (blocks == 0) return;
+#if defined(__IMXRT1062__)
+    if (dcp_aes(ctx, DCP_C1_CBC, iv, in, out, blocks * AES_BLOCK_SIZE)) {
+        memcpy(iv, out + (blocks - 1) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < blocks; i++) {
+        for (int j = 0; j < AES_BLOCK_SIZE; j++) iv[j] ^= in[i * AES_BLOCK_SIZE + j];
+        aes_block(ctx.rk, iv, iv);
+        memcpy(out + i * AES_BLOCK_SIZE, iv, AES_BLOCK_SIZE);
+    }
+}
+
+// Cipher jobs go through this buffer only
+static uint8_t aead_scratch[AEAD_SCRATCH_BLOCKS * AES_BLOCK_SIZE] __attribute__((aligned(32)));
+
+static size_t scratch_blocks(size_t len) {
+    size_t blocks = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+    return blocks < AEAD_SCRATCH_BLOCKS ? blocks : AEAD_SCRATCH_BLOCKS;
+}
+
+// XORs the CTR keystream into data. counter is a whole counter block; counter_bytes of it at
+// the end count up (4 for GCM, 3 for CCM) and it is left at the next unused value.
+static void ctr_xor(const aes128_t& aes, uint8_t counter[AES_BLOCK_SIZE], int counter_bytes, uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t blocks = scratch_blocks(len);
+        for (size_t b = 0; b < blocks; b++) {
+            memcpy(aead_scratch + b * AES_BLOCK_SIZE, counter, AES_BLOCK_SIZE);
+            for (int i = AES_BLOCK_SIZE - 1; i >= AES_BLOCK_SIZE - counter_bytes && ++counter[i] == 0; i--);
+        }
+        aes128_ecb(aes, aead_scratch, aead_scratch, blocks);
+        size_t n = len < blocks * AES_BLOCK_SIZE ? len : blocks * AES_BLOCK_SIZE;
+        for (size_t i = 0; i < n; i++) data[i] ^= aead_scratch[i];
+        data += n;
+        len -= n;
+    }
+}
+
+// CBC-MAC over data, zero padded to whole blocks, continuing from mac
+static void cbc_mac(const aes128_t& aes, uint8_t mac[AES_BLOCK_SIZE], const uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t blocks = scratch_blocks(len);
+        size_t n = len < blocks * AES_BLOCK_SIZE ? len : blocks * AES_BLOCK_SIZE;
+        memcpy(aead_scratch, data, n);
+        memset(aead_scratch + n, 0, blocks * AES_BLOCK_SIZE - n);
+        aes128_cbc(aes, mac, aead_scratch, aead_scratch, blocks);
+        data += n;
+        len -= n;
+    }
+}
+
+// GHASH with 4 bit tables (Shoup's method)
+static const uint64_t ghash_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static uint64_t load_be64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static void store_be64(uint8_t* p, uint64_t v) {
+    for (int i = 7; i >= 0; i--, v >>= 8) p[i] = (uint8_t)v;
+}
+
+static void ghash_init(aead_t& ctx) {
+    uint8_t h[AES_BLOCK_SIZE] = { 0 };
+    aes128_ecb(ctx.aes, h, h, 1);
+    uint64_t vh = load_be64(h), vl = load_be64(h + 8);
+    ctx.h_hi[0] = ctx.h_lo[0] = 0;
+    ctx.h_hi[8] = vh;
+    ctx.h_lo[8] = vl;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t t = (vl & 1) * 0xe1000000u;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ (t << 32);
+        ctx.h_hi[i] = vh;
+        ctx.h_lo[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            ctx.h_hi[i + j] = ctx.h_hi[i] ^ ctx.h_hi[j];
+            ctx.h_lo[i + j] = ctx.h_lo[i] ^ ctx.h_lo[j];
+        }
+    }
+}
+
+// y = (y ^ block) * H
+static void ghash_block(const aead_t& ctx, uint8_t y[AES_BLOCK_SIZE], const uint8_t* block) {
+    uint8_t x[AES_BLOCK_SIZE];
+    for (int i = 0; i < AES_BLOCK_SIZE; i++) x[i] = y[i] ^ block[i];
+    uint8_t lo = x[15] & 0xf;
+    uint64_t zh = ctx.h_hi[lo], zl = ctx.h_lo[lo];
+    for (int i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        uint8_t hi = x[i] >> 4;
+        if (i != 15) {
+            uint8_t rem = zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (ghash_last4[rem] << 48) ^ ctx.h_hi[lo];
+            zl ^= ctx.h_lo[lo];
+        }
+        uint8_t rem = zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (ghash_last4[rem] << 48) ^ ctx.h_hi[hi];
+        zl ^= ctx.h_lo[hi];
+    }
+    store_be64(y, zh);
+    store_be64(y + 8, zl);
+}
+
+static void ghash(const aead_t& ctx, uint8_t y[AES_BLOCK_SIZE], const uint8_t* data, size_t len) {
+    for (; len >= AES_BLOCK_SIZE; data += AES_BLOCK_SIZE, len -= AES_BLOCK_SIZE) ghash_block(ctx, y, data);
+    if (len) {
+        uint8_t last[AES_BLOCK_SIZE] = { 0 };
+        memcpy(last, data, len);
+        ghash_block(ctx, y, last);
+    }
+}
+
+void aead_init(aead_t& ctx, int mode, const uint8_t key[AES_KEY_SIZE]) {
+    aes128_init(ctx.aes, key);
+    ctx.mode = mode;
+    if (mode == AEAD_AES_128_GCM) ghash_init(ctx);
+}
+
+// Tag before its final encryption: CBC-MAC for CCM, GHASH for GCM. data is the plaintext for
+// CCM and the ciphertext for GCM.
+static void aead_mac(aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t* aad, size_t aad_len,
+                     const uint8_t* data, size_t len, uint8_t mac[AES_BLOCK_SIZE]) {
+    memset(mac, 0, AES_BLOCK_SIZE);
+    if (ctx.mode == AEAD_AES_128_CCM) {
+        // B0: Adata, M = 16, L = 3, then the formatted associated data (aad_len < 0xFF00)
+        uint8_t b0[AES_BLOCK_SIZE];
+        b0[0] = (aad_len ? 0x40 : 0) | (((AEAD_TAG_SIZE - 2) / 2) << 3) | (3 - 1);
+        memcpy(b0 + 1, nonce, AEAD_NONCE_SIZE);
+        b0[13] = (uint8_t)(len >> 16);
+        b0[14] = (uint8_t)(len >> 8);
+        b0[15] = (uint8_t)len;
+        cbc_mac(ctx.aes, mac, b0, AES_BLOCK_SIZE);
+        if (aad_len) {
+            uint8_t a[AES_BLOCK_SIZE] = { (uint8_t)(aad_len >> 8), (uint8_t)aad_len };
+            size_t first = aad_len < AES_BLOCK_SIZE - 2 ? aad_len : AES_BLOCK_SIZE - 2;
+            memcpy(a + 2, aad, first);
+            cbc_mac(ctx.aes, mac, a, AES_BLOCK_SIZE);
+            cbc_mac(ctx.aes, mac, aad + first, aad_len - first);
+        }
+        cbc_mac(ctx.aes, mac, data, len);
+    } else {
+        ghash(ctx, mac, aad, aad_len);
+        ghash(ctx, mac, data, len);
+        uint8_t lengths[AES_BLOCK_SIZE];
+        store_be64(lengths, (uint64_t)aad_len * 8);
+        store_be64(lengths + 8, (uint64_t)len * 8);
+        ghash_block(ctx, mac, lengths);
+    }
+}
+
+// First counter block, the one that encrypts the tag: A0 for CCM, J0 for GCM. The payload
+// starts at the next one.
+static int aead_counter0(const aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], uint8_t counter[AES_BLOCK_SIZE]) {
+    memset(counter, 0, AES_BLOCK_SIZE);
+    if (ctx.mode == AEAD_AES_128_CCM) {
+        counter[0] = 3 - 1;
+        memcpy(counter + 1, nonce, AEAD_NONCE_SIZE);
+        return 3;
+    }
+    memcpy(counter, nonce, AEAD_NONCE_SIZE);
+    counter[15] = 1;
+    return 4;
+}
+
+// The keystream block of counter0 encrypts the tag, the payload's start at the next one
+static void aead_crypt(aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], uint8_t* data, size_t len,
+                       uint8_t keystream0[AES_BLOCK_SIZE]) {
+    uint8_t counter[AES_BLOCK_SIZE];
+    int counter_bytes = aead_counter0(ctx, nonce, counter);
+    memset(keystream0, 0, AES_BLOCK_SIZE);
+    ctr_xor(ctx.aes, counter, counter_bytes, keystream0, AES_BLOCK_SIZE);
+    ctr_xor(ctx.aes, counter, counter_bytes, data, len);
+}
+
+void aead_seal(aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t* aad, size_t aad_len,
+               uint8_t* data, size_t len, uint8_t tag[AEAD_TAG_SIZE]) {
+    uint8_t keystream0[AES_BLOCK_SIZE];
+    // CCM authenticates the plaintext, GCM the ciphertext
+    if (ctx.mode == AEAD_AES_128_CCM) aead_mac(ctx, nonce, aad, aad_len, data, len, tag);
+    aead_crypt(ctx, nonce, data, len, keystream0);
+    if (ctx.mode == AEAD_AES_128_GCM) aead_mac(ctx, nonce, aad, aad_len, data, len, tag);
+    for (int i = 0; i < AEAD_TAG_SIZE; i++) tag[i] ^= keystream0[i];
+}
+
+bool aead_open(aead_t& ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t* aad, size_t aad_len,
+               uint8_t* data, size_t len, const uint8_t tag[AEAD_TAG_SIZE]) {
+    uint8_t keystream0[AES_BLOCK_SIZE], mac[AES_BLOCK_SIZE];
+    if (ctx.mode == AEAD_AES_128_GCM) aead_mac(ctx, nonce, aad, aad_len, data, len, mac);
+    aead_crypt(ctx, nonce, data, len, keystream0);
+    if (ctx.mode == AEAD_AES_128_CCM) aead_mac(ctx, nonce, aad, aad_len, data, len, mac);
+    // Constant time compare
+    uint8_t diff = 0;
+    for (int i = 0; i < AEAD_TAG_SIZE; i++) diff |= mac[i] ^ keystream0[i] ^ tag[i];
+    return diff == 0;
+}
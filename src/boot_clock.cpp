@@ -0,0 +1,96 @@
+#include "boot_clock.h"
+
+extern "C" uint32_t set_arm_clock(uint32_t frequency);
+
+static const char* phase_names[BOOT_PHASES] = { "storage", "validate", "verify" };
+static uint32_t phase_start[BOOT_PHASES];
+static uint32_t phase_us[BOOT_PHASES];
+static uint32_t phase_open;      // Bit per open phase
+static uint32_t phase_hz[BOOT_PHASES];
+static uint32_t handoff_trial;
+
+void boot_phase_begin(int phase) {
+    if (phase_open & (1 << phase)) return;
+    if ((BOOT_CLOCK_FAST_PHASES & (1 << phase)) && BOOT_CLOCK_FAST_HZ && F_CPU_ACTUAL != BOOT_CLOCK_FAST_HZ) {
+        set_arm_clock(BOOT_CLOCK_FAST_HZ);
+    }
+    phase_open |= 1 << phase;
+    phase_hz[phase] = F_CPU_ACTUAL;
+    // micros() follows the clock change, set_arm_clock rescales the cycle counter conversion
+    phase_start[phase] = micros();
+}
+
+static bool phase_stop(int phase) {
+    if (!(phase_open & (1 << phase))) return false;
+    phase_us[phase] = micros() - phase_start[phase];
+    phase_open &= ~(1 << phase);
+    if (!(phase_open & BOOT_CLOCK_FAST_PHASES) && F_CPU_ACTUAL != F_CPU) {
+        set_arm_clock(F_CPU);
+    }
+    return true;
+}
+
+void boot_phase_end(int phase) {
+    if (!phase_stop(phase)) return;
+    Log.print("Boot phase "); Log.print(phase_names[phase]); Log.print(": "); Log.print(phase_us[phase]);
+    Log.print(" us at "); Log.print(phase_hz[phase] / 1000000); Log.println(" MHz");
+}
+
+uint32_t boot_phase_us(int phase) {
+    return phase_us[phase];
+}
+
+void boot_handoff_write(uint32_t entry) {
+    // No logging here, interrupts may already be off
+    for (int i = 0; i < BOOT_PHASES; i++) phase_stop(i);
+    boot_handoff_t* h = (boot_handoff_t*)BOOT_HANDOFF_ADDRESS;
+    h->magic = BOOT_HANDOFF_MAGIC;
+    h->version = BOOT_HANDOFF_VERSION;
+    h->arm_clock_hz = F_CPU_ACTUAL;
+    h->fast_clock_hz = BOOT_CLOCK_FAST_HZ ? BOOT_CLOCK_FAST_HZ : F_CPU;
+    h->entry = entry;
+    h->boot_us = micros();
+    memcpy(h->phase_us, phase_us, sizeof(phase_us));
+    h->trial = handoff_trial;
+    h->crc = crc32_update(0, (const uint8_t*)h, offsetof(boot_handoff_t, crc));
+    h->confirm = 0;
+    // OCRAM is cached write-back; the application may read it with the cache off
+    arm_dcache_flush(h, sizeof(*h));
+}
+
+void boot_handoff_trial(bool trial) {
+    handoff_trial = trial;
+}
+
+// OCRAM2 is not cleared at reset, so the block the last jump wrote is still there; after a power
+// cycle the magic and CRC won't match
+static bool handoff_valid(const boot_handoff_t* h) {
+    return h->magic == BOOT_HANDOFF_MAGIC && h->version == BOOT_HANDOFF_VERSION &&
+           h->crc == crc32_update(0, (const uint8_t*)h, offsetof(boot_handoff_t, crc));
+}
+
+bool boot_handoff_confirmed(uint32_t entry) {
+    boot_handoff_t* h = (boot_handoff_t*)BOOT_HANDOFF_ADDRESS;
+    bool confirmed = handoff_valid(h) && h->entry == entry && h->trial && h->confirm == BOOT_CONFIRM_MAGIC;
+    if (h->confirm && h->confirm != BOOT_SEEN_MAGIC) {
+        h->confirm = BOOT_SEEN_MAGIC;
+        arm_dcache_flush(h, sizeof(*h));
+    }
+    return confirmed;
+}
+
+bool boot_handoff_failed_trial(uint32_t entry) {
+    boot_handoff_t* h = (boot_handoff_t*)BOOT_HANDOFF_ADDRESS;
+    if (!handoff_valid(h) || h->entry != entry || !h->trial || h->confirm) return false;
+    h->confirm = BOOT_SEEN_MAGIC;
+    arm_dcache_flush(h, sizeof(*h));
+    return true;
+}
+
+bool boot_handoff_recovery_requested() {
+    boot_handoff_t* h = (boot_handoff_t*)BOOT_HANDOFF_ADDRESS;
+    if (!handoff_valid(h) || h->confirm != BOOT_RECOVERY_MAGIC) return false;
+    h->confirm = BOOT_SEEN_MAGIC;
+    arm_dcache_flush(h, sizeof(*h));
+    return true;
+}
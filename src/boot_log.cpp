@@ -0,0 +1,47 @@
+#include "boot_log.h"
+
+BootLog Log;
+
+void BootLog::commit() {
+    head++;
+    started = false;
+}
+
+void BootLog::store(uint8_t c) {
+    if (c == '\r') return;
+    log_record_t& r = records[head % LOG_RECORDS];
+    if (!started) {
+        r.ms = millis();
+        r.len = 0;
+        started = true;
+    }
+    if (c == '\n') {
+        commit();
+    } else {
+        r.text[r.len++] = c;
+        if (r.len == LOG_RECORD_SIZE) commit();
+    }
+}
+
+size_t BootLog::write(uint8_t c) {
+    Serial.write(c);
+    store(c);
+    return 1;
+}
+
+size_t BootLog::write(const uint8_t* buffer, size_t size) {
+    Serial.write(buffer, size);
+    for (size_t i = 0; i < size; i++) store(buffer[i]);
+    return size;
+}
+
+// The slot being filled is not readable, so one record less than the ring size is kept
+uint32_t BootLog::first_seq() const {
+    return head >= LOG_RECORDS - 1 ? head - (LOG_RECORDS - 1) : 0;
+}
+
+bool BootLog::get(uint32_t seq, log_record_t& out) const {
+    if (seq < first_seq() || seq >= head) return false;
+    out = records[seq % LOG_RECORDS];
+    return true;
+}
@@ -0,0 +1,58 @@
+#include "boot_policies.h"
+
+#if S3BL_STORAGE_LITTLEFS
+LittleFS_Program myfs;
+
+bool LittleFsStorage::begin() {
+    if (myfs.begin(PROG_FLASH_SIZE)) return true;
+    Log.println("Error starting PROGRAM FLASH DISK");
+    return false;
+}
+
+// Written to a temporary file and renamed over meta.bin, so a reset leaves either the old or the
+// new metadata and every commit is a single atomic transaction. FILE_WRITE appends, which is why
+// the temporary file is removed first.
+void LittleFsStorage::save(const boot_metadata_t& meta_data) {
+    myfs.remove("/meta.tmp");
+    File f = myfs.open("/meta.tmp", FILE_WRITE);
+    if (f) {
+        size_t written = f.write((const uint8_t*)&meta_data, sizeof(meta_data));
+        f.close();
+        if (written == sizeof(meta_data) && myfs.rename("/meta.tmp", "/meta.bin")) {
+            Log.println("Metadata written to LittleFS_Program.");
+        } else {
+            Log.println("Failed to commit meta.bin!");
+        }
+    } else {
+        Log.println("Failed to open meta.tmp for writing!");
+    }
+}
+
+bool LittleFsStorage::load(boot_metadata_t& meta_data) {
+    File f = myfs.open("/meta.bin", FILE_READ);
+    if (f && (f.size() == sizeof(meta_data) || f.size() == BOOT_METADATA_V2_SIZE || f.size() == BOOT_METADATA_V1_SIZE)) {
+        // Older metadata lacks the image table or the slot lengths, the fields it lacks stay zero
+        memset(&meta_data, 0, sizeof(meta_data));
+        f.read((uint8_t*)&meta_data, f.size());
+        f.close();
+        Log.println("Metadata loaded from LittleFS_Program.");
+        return true;
+    }
+    Log.println("No valid metadata found in LittleFS_Program.");
+    return false;
+}
+#endif
+
+// An erased sector reads back as active_slot 0xFFFFFFFF, which BootCore treats as uninitialised
+bool RawFlashStorage::load(boot_metadata_t& meta_data) {
+    arm_dcache_delete((void*)METADATA_ADDRESS, sizeof(meta_data));
+    memcpy(&meta_data, (const void*)METADATA_ADDRESS, sizeof(meta_data));
+    return meta_data.active_slot != 0xFFFFFFFF;
+}
+
+void RawFlashStorage::save(const boot_metadata_t& meta_data) {
+    flash_erase_sector(METADATA_ADDRESS);
+    flash_program(METADATA_ADDRESS, &meta_data, sizeof(meta_data));
+    arm_dcache_delete((void*)METADATA_ADDRESS, sizeof(meta_data));
+    Log.println("Metadata written to its flash sector.");
+}
@@ -0,0 +1,418 @@
+// CoAP block-wise firmware transfer (RFC 7252, RFC 7959 Block1, RFC 7641 Observe).
+// Blocks have to arrive in order; each one is acknowledged with 2.31 Continue and goes straight
+// into the slot writer, so nothing but one sector is ever buffered. A client sending bigger blocks
+// than COAP_MAX_SZX, on block 0 or later, gets 4.13 with our size and continues at the same offset.
+// Block 0 has to carry ?crc=<hex>: nothing unverified is committed.
+
+#include "coap_server.h"
+#include <Ethernet.h>
+#include "boot_clock.h"
+
+#define COAP_VERSION        1
+#define COAP_CON            0
+#define COAP_NON            1
+#define COAP_ACK            2
+#define COAP_RST            3
+
+#define COAP_CODE(c, d)     (((c) << 5) | (d))
+#define COAP_EMPTY          COAP_CODE(0, 0)
+#define COAP_GET            COAP_CODE(0, 1)
+#define COAP_POST           COAP_CODE(0, 2)
+#define COAP_PUT            COAP_CODE(0, 3)
+#define COAP_CHANGED        COAP_CODE(2, 4)
+#define COAP_CONTENT        COAP_CODE(2, 5)
+#define COAP_CONTINUE       COAP_CODE(2, 31)
+#define COAP_BAD_REQUEST    COAP_CODE(4, 0)
+#define COAP_NOT_FOUND      COAP_CODE(4, 4)
+#define COAP_NOT_ALLOWED    COAP_CODE(4, 5)
+#define COAP_INCOMPLETE     COAP_CODE(4, 8)
+#define COAP_PRECONDITION   COAP_CODE(4, 12)
+#define COAP_TOO_LARGE      COAP_CODE(4, 13)
+
+#define COAP_OPT_OBSERVE    6
+#define COAP_OPT_URI_PATH   11
+#define COAP_OPT_FORMAT     12
+#define COAP_OPT_URI_QUERY  15
+#define COAP_OPT_BLOCK2     23
+#define COAP_OPT_BLOCK1     27
+#define COAP_OPT_SIZE1      60
+
+#define COAP_FORMAT_TEXT    0
+#define COAP_BUF_SIZE       ((16 << COAP_MAX_SZX) + 64)
+#define COAP_NOTIFY_EVERY   (32 * 1024) // Progress notification interval in bytes
+
+typedef struct {
+    uint8_t type;
+    uint8_t code;
+    uint16_t mid;
+    uint8_t tkl;
+    uint8_t token[8];
+    char path[24];
+    char query[32];
+    bool has_block1;
+    uint32_t block1;
+    bool has_observe;
+    uint32_t observe;
+    bool has_size1;
+    uint32_t size1;
+    const uint8_t* payload;
+    size_t payload_len;
+} coap_msg_t;
+
+typedef struct {
+    IPAddress ip;
+    uint16_t port;
+    uint8_t tkl;
+    uint8_t token[8];
+    bool active;
+} coap_observer_t;
+
+static EthernetUDP coap_udp;
+static uint8_t coap_rx[COAP_BUF_SIZE];
+static uint8_t coap_tx[128];        // Responses, kept until the next one for retransmitted requests
+static uint8_t coap_notify_tx[128]; // Observe notifications
+static uint16_t coap_next_mid;
+static uint32_t coap_observe_seq;
+static coap_observer_t coap_observers[COAP_MAX_OBSERVERS];
+
+// Last response, re-sent as is when a confirmable request is retransmitted
+static IPAddress coap_last_ip;
+static uint16_t coap_last_port;
+static uint16_t coap_last_mid;
+static size_t coap_last_len;
+
+static struct {
+    slot_writer_t writer;
+    uint32_t total;         // From Size1, 0 if the client did not send it
+    uint32_t crc;
+    bool active;
+    bool complete;
+    bool failed;
+    uint32_t notified;      // writer.offset at the last progress notification
+} coap_upload;
+DMAMEM static uint8_t coap_sector_buf[SECTOR_SIZE] __attribute__((aligned(32)));
+
+static uint32_t coap_uint(const uint8_t* p, size_t len) {
+    uint32_t v = 0;
+    for (size_t i = 0; i < len && i < 4; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static bool coap_parse(const uint8_t* pkt, size_t len, coap_msg_t& m) {
+    memset(&m, 0, sizeof(m));
+    if (len < 4 || (pkt[0] >> 6) != COAP_VERSION) return false;
+    m.type = (pkt[0] >> 4) & 3;
+    m.tkl = pkt[0] & 0x0F;
+    m.code = pkt[1];
+    m.mid = (pkt[2] << 8) | pkt[3];
+    if (m.tkl > 8 || 4u + m.tkl > len) return false;
+    memcpy(m.token, pkt + 4, m.tkl);
+    size_t p = 4 + m.tkl;
+    uint16_t opt = 0;
+    while (p < len) {
+        if (pkt[p] == 0xFF) {
+            m.payload = pkt + p + 1;
+            m.payload_len = len - p - 1;
+            return m.payload_len > 0; // A payload marker without payload is a format error
+        }
+        uint32_t delta = pkt[p] >> 4, olen = pkt[p] & 0x0F;
+        p++;
+        if (delta == 15 || olen == 15) return false;
+        if (delta == 13) { if (p >= len) return false; delta = 13 + pkt[p++]; }
+        else if (delta == 14) { if (p + 1 >= len) return false; delta = 269 + ((pkt[p] << 8) | pkt[p + 1]); p += 2; }
+        if (olen == 13) { if (p >= len) return false; olen = 13 + pkt[p++]; }
+        else if (olen == 14) { if (p + 1 >= len) return false; olen = 269 + ((pkt[p] << 8) | pkt[p + 1]); p += 2; }
+        if (p + olen > len) return false;
+        opt += delta;
+        const uint8_t* val = pkt + p;
+        switch (opt) {
+            case COAP_OPT_URI_PATH: {
+                size_t used = strlen(m.path);
+                if (used && used + 1 < sizeof(m.path)) m.path[used++] = '/';
+                size_t n = min((size_t)olen, sizeof(m.path) - 1 - used);
+                memcpy(m.path + used, val, n);
+                m.path[used + n] = 0;
+                break;
+            }
+            case COAP_OPT_URI_QUERY: {
+                size_t used = strlen(m.query);
+                if (used && used + 1 < sizeof(m.query)) m.query[used++] = '&';
+                size_t n = min((size_t)olen, sizeof(m.query) - 1 - used);
+                memcpy(m.query + used, val, n);
+                m.query[used + n] = 0;
+                break;
+            }
+            case COAP_OPT_BLOCK1: m.has_block1 = true; m.block1 = coap_uint(val, olen); break;
+            case COAP_OPT_OBSERVE: m.has_observe = true; m.observe = coap_uint(val, olen); break;
+            case COAP_OPT_SIZE1: m.has_size1 = true; m.size1 = coap_uint(val, olen); break;
+            default: break;
+        }
+        p += olen;
+    }
+    return true;
+}
+
+static size_t coap_put_header(uint8_t* out, uint8_t type, uint8_t code, uint16_t mid, const uint8_t* token, uint8_t tkl) {
+    out[0] = (COAP_VERSION << 6) | (type << 4) | tkl;
+    out[1] = code;
+    out[2] = mid >> 8;
+    out[3] = mid;
+    if (tkl) memcpy(out + 4, token, tkl);
+    return 4 + tkl;
+}
+
+// Options have to be appended in ascending order; last tracks the previous option number
+static size_t coap_put_uint_option(uint8_t* out, uint16_t& last, uint16_t num, uint32_t value) {
+    uint8_t val[4];
+    size_t len = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (len || (value >> shift) & 0xFF) val[len++] = value >> shift;
+    }
+    size_t p = 0;
+    uint16_t delta = num - last;
+    last = num;
+    if (delta < 13) {
+        out[p++] = (delta << 4) | len;
+    } else {
+        out[p++] = (13 << 4) | len;
+        out[p++] = delta - 13;
+    }
+    memcpy(out + p, val, len);
+    return p + len;
+}
+
+static void coap_send(IPAddress ip, uint16_t port, const uint8_t* data, size_t len) {
+    coap_udp.beginPacket(ip, port);
+    coap_udp.write(data, len);
+    coap_udp.endPacket();
+}
+
+static size_t coap_status_payload(char* out, size_t size) {
+    const char* state = coap_upload.complete ? "complete" : coap_upload.failed ? "failed" : coap_upload.active ? "receiving" : "idle";
+    return snprintf(out, size, "state=%s received=%lu total=%lu", state,
+                    (unsigned long)coap_upload.writer.offset, (unsigned long)coap_upload.total);
+}
+
+static void coap_notify_observers() {
+    for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+        coap_observer_t& o = coap_observers[i];
+        if (!o.active) continue;
+        uint16_t last = 0;
+        size_t n = coap_put_header(coap_notify_tx, COAP_NON, COAP_CONTENT, coap_next_mid++, o.token, o.tkl);
+        n += coap_put_uint_option(coap_notify_tx + n, last, COAP_OPT_OBSERVE, ++coap_observe_seq & 0xFFFFFF);
+        n += coap_put_uint_option(coap_notify_tx + n, last, COAP_OPT_FORMAT, COAP_FORMAT_TEXT);
+        coap_notify_tx[n++] = 0xFF;
+        n += coap_status_payload((char*)coap_notify_tx + n, sizeof(coap_notify_tx) - n);
+        coap_send(o.ip, o.port, coap_notify_tx, n);
+    }
+    coap_upload.notified = coap_upload.writer.offset;
+}
+
+// Sends a response matching the request type (piggybacked ACK for CON) and remembers it for retransmissions
+static void coap_reply(const coap_msg_t& req, uint8_t code, bool block1, uint32_t block1_value,
+                       bool size1, uint32_t size1_value, bool observe, const char* payload) {
+    uint16_t last = 0;
+    bool con = req.type == COAP_CON;
+    size_t n = coap_put_header(coap_tx, con ? COAP_ACK : COAP_NON, code, con ? req.mid : coap_next_mid++, req.token, req.tkl);
+    if (observe) n += coap_put_uint_option(coap_tx + n, last, COAP_OPT_OBSERVE, coap_observe_seq & 0xFFFFFF);
+    if (payload) n += coap_put_uint_option(coap_tx + n, last, COAP_OPT_FORMAT, COAP_FORMAT_TEXT);
+    if (block1) n += coap_put_uint_option(coap_tx + n, last, COAP_OPT_BLOCK1, block1_value);
+    if (size1) n += coap_put_uint_option(coap_tx + n, last, COAP_OPT_SIZE1, size1_value);
+    if (payload && *payload) {
+        coap_tx[n++] = 0xFF;
+        size_t len = min(strlen(payload), sizeof(coap_tx) - n);
+        memcpy(coap_tx + n, payload, len);
+        n += len;
+    }
+    coap_send(coap_udp.remoteIP(), coap_udp.remotePort(), coap_tx, n);
+    if (con) {
+        coap_last_ip = coap_udp.remoteIP();
+        coap_last_port = coap_udp.remotePort();
+        coap_last_mid = req.mid;
+        coap_last_len = n;
+    }
+}
+
+static void coap_handle_status(const coap_msg_t& req) {
+    if (req.code != COAP_GET) {
+        coap_reply(req, COAP_NOT_ALLOWED, false, 0, false, 0, false, NULL);
+        return;
+    }
+    bool observing = false;
+    if (req.has_observe) {
+        IPAddress ip = coap_udp.remoteIP();
+        uint16_t port = coap_udp.remotePort();
+        int free_slot = -1;
+        for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+            coap_observer_t& o = coap_observers[i];
+            if (o.active && o.ip == ip && o.port == port && o.tkl == req.tkl && !memcmp(o.token, req.token, req.tkl)) {
+                o.active = false; // Re-registration or deregistration, both replace the old entry
+            }
+            if (!o.active && free_slot < 0) free_slot = i;
+        }
+        if (req.observe == 0 && free_slot >= 0) {
+            coap_observer_t& o = coap_observers[free_slot];
+            o.ip = ip;
+            o.port = port;
+            o.tkl = req.tkl;
+            memcpy(o.token, req.token, req.tkl);
+            o.active = true;
+            observing = true;
+        }
+    }
+    char payload[64];
+    coap_status_payload(payload, sizeof(payload));
+    coap_reply(req, COAP_CONTENT, false, 0, false, 0, observing, payload);
+}
+
+static bool coap_finish_upload(boot_metadata_t& meta_data) {
+    slot_writer_finish(coap_upload.writer);
+    coap_upload.active = false;
+    uint32_t len = coap_upload.writer.offset;
+    arm_dcache_delete((void*)coap_upload.writer.base, len);
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    bool crc_ok = crc32_update(0, (const uint8_t*)coap_upload.writer.base, len) == coap_upload.crc;
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    if (!crc_ok) {
+        Log.println("ERROR: CoAP upload CRC32 mismatch. Upload discarded.");
+        coap_upload.failed = true;
+        return false;
+    }
+    commit_inactive_slot(meta_data, len);
+    coap_upload.total = len;
+    coap_upload.complete = true;
+    Log.print("CoAP upload complete: "); Log.print(len); Log.println(" bytes. Metadata updated.");
+    return true;
+}
+
+static bool coap_handle_firmware(const coap_msg_t& req, boot_metadata_t& meta_data) {
+    if (req.code != COAP_PUT && req.code != COAP_POST) {
+        coap_reply(req, COAP_NOT_ALLOWED, false, 0, false, 0, false, NULL);
+        return false;
+    }
+    // A request without Block1 is a single block 0 with no more to follow
+    uint32_t block1 = req.has_block1 ? req.block1 : (COAP_MAX_SZX & 7);
+    uint32_t num = block1 >> 4;
+    bool more = block1 & 0x08;
+    uint32_t szx = block1 & 0x07;
+    if (szx > COAP_MAX_SZX) {
+        // Tell the client the block size we take, it carries on from the same offset with that
+        coap_reply(req, COAP_TOO_LARGE, true, COAP_MAX_SZX, false, 0, false, NULL);
+        return false;
+    }
+    uint32_t block_size = 16u << szx;
+    uint32_t offset = num * block_size;
+    if (!req.payload_len || (more && req.payload_len != block_size)) {
+        coap_reply(req, COAP_BAD_REQUEST, false, 0, false, 0, false, "Non-final blocks must be full size");
+        return false;
+    }
+    if (num == 0) {
+        if ((req.has_size1 && req.size1 > SLOT_SIZE) || req.payload_len > SLOT_SIZE) {
+            coap_reply(req, COAP_TOO_LARGE, false, 0, true, SLOT_SIZE, false, NULL);
+            return false;
+        }
+        const char* crc = strstr(req.query, "crc=");
+        char* crc_end = NULL;
+        uint32_t crc_value = crc ? strtoul(crc + 4, &crc_end, 16) : 0;
+        if (!crc || crc_end == crc + 4 || (*crc_end && *crc_end != '&')) {
+            coap_reply(req, COAP_BAD_REQUEST, false, 0, false, 0, false, "crc=<hex> query required");
+            return false;
+        }
+        if (coap_upload.active && coap_upload.writer.offset > 0) {
+            Log.println("CoAP upload restarted from block 0.");
+        }
+        memset(&coap_upload, 0, sizeof(coap_upload));
+        slot_writer_begin(coap_upload.writer, inactive_slot_address(meta_data), coap_sector_buf);
+        coap_upload.total = req.has_size1 ? req.size1 : 0;
+        coap_upload.crc = crc_value;
+        coap_upload.active = true;
+        Log.print("CoAP upload started, block size: "); Log.println(block_size);
+    } else if (!coap_upload.active || offset > coap_upload.writer.offset) {
+        coap_reply(req, COAP_INCOMPLETE, false, 0, false, 0, false, NULL);
+        return false;
+    }
+    if (offset + req.payload_len > SLOT_SIZE) {
+        coap_reply(req, COAP_TOO_LARGE, false, 0, true, SLOT_SIZE, false, NULL);
+        coap_upload.active = false;
+        coap_upload.failed = true;
+        return false;
+    }
+    // Blocks before the write position are duplicates (e.g. a lost ACK), acknowledge without writing
+    if (offset == coap_upload.writer.offset) {
+        slot_writer_write(coap_upload.writer, req.payload, req.payload_len);
+    }
+    uint32_t reply_block1 = (num << 4) | (more ? 0x08 : 0) | szx;
+    if (more) {
+        coap_reply(req, COAP_CONTINUE, true, reply_block1, false, 0, false, NULL);
+        if (coap_upload.writer.offset - coap_upload.notified >= COAP_NOTIFY_EVERY) coap_notify_observers();
+        return false;
+    }
+    bool ok = coap_finish_upload(meta_data);
+    if (ok) {
+        coap_reply(req, COAP_CHANGED, true, reply_block1, false, 0, false, "Image written. Starting it...");
+    } else {
+        coap_reply(req, COAP_PRECONDITION, true, reply_block1, false, 0, false, "CRC32 mismatch");
+    }
+    coap_notify_observers();
+    return ok;
+}
+
+void coap_begin() {
+    coap_udp.begin(COAP_PORT);
+    coap_next_mid = micros();
+    Log.print("Recovery CoAP server started on port "); Log.println(COAP_PORT);
+}
+
+static bool coap_handle_packet(int size, boot_metadata_t& meta_data) {
+    int len = coap_udp.read(coap_rx, sizeof(coap_rx));
+    coap_msg_t req;
+    if (len < 4 || !coap_parse(coap_rx, len, req)) {
+        // Format errors on confirmable messages are answered with a reset
+        if (len >= 4 && (coap_rx[0] >> 6) == COAP_VERSION && ((coap_rx[0] >> 4) & 3) == COAP_CON) {
+            uint16_t mid = (coap_rx[2] << 8) | coap_rx[3];
+            size_t n = coap_put_header(coap_tx, COAP_RST, COAP_EMPTY, mid, NULL, 0);
+            coap_send(coap_udp.remoteIP(), coap_udp.remotePort(), coap_tx, n);
+        }
+        return false;
+    }
+    if (req.type == COAP_CON && req.mid == coap_last_mid && coap_last_len &&
+        coap_udp.remoteIP() == coap_last_ip && coap_udp.remotePort() == coap_last_port) {
+        coap_send(coap_last_ip, coap_last_port, coap_tx, coap_last_len);
+        return false;
+    }
+    if (req.type == COAP_RST) {
+        // A reset to a notification cancels the observation
+        for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+            if (coap_observers[i].ip == coap_udp.remoteIP() && coap_observers[i].port == coap_udp.remotePort()) {
+                coap_observers[i].active = false;
+            }
+        }
+        return false;
+    }
+    if (req.type == COAP_ACK || req.code == COAP_EMPTY) return false;
+    if (size > (int)sizeof(coap_rx)) {
+        coap_reply(req, COAP_TOO_LARGE, true, COAP_MAX_SZX, false, 0, false, NULL);
+        return false;
+    }
+    if (!strcmp(req.path, "fw")) return coap_handle_firmware(req, meta_data);
+    if (!strcmp(req.path, "status")) {
+        coap_handle_status(req);
+        return false;
+    }
+    coap_reply(req, COAP_NOT_FOUND, false, 0, false, 0, false, NULL);
+    return false;
+}
+
+bool coap_upload_active() {
+    return coap_upload.active;
+}
+
+bool coap_poll(boot_metadata_t& meta_data) {
+    // Drain everything queued: the socket interrupt only fires again for new datagrams
+    bool installed = false;
+    int size;
+    while ((size = coap_udp.parsePacket()) > 0) {
+        installed |= coap_handle_packet(size, meta_data);
+    }
+    return installed;
+}
@@ -0,0 +1,104 @@
+#include "component.h"
+
+const component_exports_t* component_exports(uint32_t address) {
+    const component_exports_t* exports = (const component_exports_t*)(address + COMPONENT_EXPORTS_OFFSET);
+    return exports->magic == COMPONENT_EXPORTS_MAGIC ? exports : NULL;
+}
+
+bool component_module_check(const module_header_t& m, uint32_t address, uint32_t length) {
+    if (length < sizeof(m) || m.magic != MODULE_HEADER_MAGIC) return false;
+    // Thumb bit set, inside the module
+    return (m.init & 1) && m.init >= address && m.init - address < length;
+}
+
+uint32_t component_directory_write(const boot_metadata_t& meta_data, uint32_t address, bool& trial) {
+    boot_modules_t dir;
+    bool on_trial[PLACED_IMAGES] = {};
+    memset(&dir, 0, sizeof(dir));
+    dir.magic = BOOT_MODULES_MAGIC;
+    const component_exports_t* exports = component_exports(address);
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        const placed_image_t& img = meta_data.images[i];
+        if (!(img.valid & PLACED_MODULE)) continue;
+        const module_header_t* m = (const module_header_t*)img.base;
+        if (!component_module_check(*m, img.base, img.length)) {
+            Log.print("WARNING: Image "); Log.print(i); Log.println(" is not a module, skipping it.");
+            continue;
+        }
+        if (!exports || m->abi != exports->abi) {
+            Log.print("Module "); Log.print(m->id); Log.print(" version "); Log.print(m->version);
+            Log.print(" wants base ABI "); Log.print(m->abi); Log.println(", skipping it.");
+            continue;
+        }
+        uint32_t k = 0;
+        while (k < dir.count && dir.modules[k].id != m->id) k++;
+        if (k < dir.count && dir.modules[k].version >= m->version) continue;
+        if (crc32_update(0, (const uint8_t*)img.base, img.length) != img.crc) {
+            Log.print("WARNING: Module "); Log.print(m->id); Log.print(" version "); Log.print(m->version);
+            Log.println(" fails its CRC32, skipping it.");
+            continue;
+        }
+        dir.modules[k] = { m->id, m->version, img.base, img.length, m->init };
+        on_trial[k] = img.valid & PLACED_MODULE_TRIAL;
+        if (k == dir.count) dir.count++;
+    }
+    trial = false;
+    for (uint32_t k = 0; k < dir.count; k++) {
+        Log.print("Module "); Log.print(dir.modules[k].id); Log.print(" version "); Log.print(dir.modules[k].version);
+        Log.print(" at 0x"); Log.print(dir.modules[k].base, HEX); Log.println(on_trial[k] ? ", on trial" : "");
+        trial |= on_trial[k];
+    }
+    dir.crc = crc32_update(0, (const uint8_t*)&dir, offsetof(boot_modules_t, crc));
+    boot_modules_t* out = (boot_modules_t*)BOOT_MODULES_ADDRESS;
+    memcpy(out, &dir, sizeof(dir));
+    // OCRAM is cached write-back, as for the handoff block
+    arm_dcache_flush(out, sizeof(*out));
+    return dir.count;
+}
+
+// The boot_modules_t the last jump left in OCRAM2, NULL after a power cycle
+static const boot_modules_t* last_directory() {
+    const boot_modules_t* dir = (const boot_modules_t*)BOOT_MODULES_ADDRESS;
+    if (dir->magic != BOOT_MODULES_MAGIC || dir->count > PLACED_IMAGES ||
+        dir->crc != crc32_update(0, (const uint8_t*)dir, offsetof(boot_modules_t, crc))) return NULL;
+    return dir;
+}
+
+// Table entry of a listed module on trial, -1 if there is none (anymore)
+static int listed_on_trial(const boot_metadata_t& meta_data, const boot_module_t& listed) {
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        const placed_image_t& img = meta_data.images[i];
+        if (!(img.valid & PLACED_MODULE_TRIAL) || img.base != listed.base || img.length != listed.length) continue;
+        const module_header_t* m = (const module_header_t*)img.base;
+        if (m->id == listed.id && m->version == listed.version) return i;
+    }
+    return -1;
+}
+
+bool component_confirm(boot_metadata_t& meta_data) {
+    const boot_modules_t* dir = last_directory();
+    bool changed = false;
+    for (uint32_t k = 0; dir && k < dir->count; k++) {
+        int i = listed_on_trial(meta_data, dir->modules[k]);
+        if (i < 0) continue;
+        meta_data.images[i].valid &= ~PLACED_MODULE_TRIAL;
+        Log.print("Module "); Log.print(dir->modules[k].id); Log.print(" version "); Log.print(dir->modules[k].version);
+        Log.println(" confirmed");
+        changed = true;
+    }
+    return changed;
+}
+
+bool component_trial_failed(boot_metadata_t& meta_data) {
+    const boot_modules_t* dir = last_directory();
+    bool changed = false;
+    for (uint32_t k = 0; dir && k < dir->count; k++) {
+        int i = listed_on_trial(meta_data, dir->modules[k]);
+        if (i < 0) continue;
+        meta_data.images[i].valid = 0;
+        Log.print("Module "); Log.print(dir->modules[k].id); Log.print(" version "); Log.print(dir->modules[k].version);
+        Log.println(" failed its trial boot, falling back to the version before it");
+        changed = true;
+    }
+    return changed;
+}
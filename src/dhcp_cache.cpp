@@ -0,0 +1,189 @@
+// DHCP lease caching with INIT-REBOOT fast reacquire.
+// A full DISCOVER/OFFER/REQUEST/ACK exchange through Ethernet.begin(mac) can take seconds on busy
+// plant networks. If we still hold an unexpired lease we broadcast a single DHCPREQUEST for it and
+// configure the W5x00 straight from the ACK.
+
+#include "dhcp_cache.h"
+#include "boot_log.h"
+
+#define DHCP_SERVER_PORT   67
+#define DHCP_CLIENT_PORT   68
+#define DHCP_MAGIC_COOKIE  0x63825363
+#define DHCP_HEADER_SIZE   240 // Fixed BOOTP header including the magic cookie
+
+#define DHCP_OPT_SUBNET     1
+#define DHCP_OPT_ROUTER     3
+#define DHCP_OPT_DNS        6
+#define DHCP_OPT_REQ_IP     50
+#define DHCP_OPT_LEASE_TIME 51
+#define DHCP_OPT_MSG_TYPE   53
+#define DHCP_OPT_SERVER_ID  54
+#define DHCP_OPT_PARAM_REQ  55
+#define DHCP_OPT_CLIENT_ID  61
+#define DHCP_OPT_END        255
+
+#define DHCP_REQUEST 3
+#define DHCP_ACK     5
+#define DHCP_NAK     6
+
+bool load_dhcp_lease(FS& fs, dhcp_lease_t& lease) {
+    File f = fs.open("/lease.bin", FILE_READ);
+    if (f && f.size() == sizeof(lease)) {
+        f.read((uint8_t*)&lease, sizeof(lease));
+        f.close();
+        return lease.magic == DHCP_LEASE_MAGIC;
+    }
+    return false;
+}
+
+void save_dhcp_lease(FS& fs, const dhcp_lease_t& lease) {
+    fs.remove("/lease.bin");
+    File f = fs.open("/lease.bin", FILE_WRITE);
+    if (f) {
+        f.write((const uint8_t*)&lease, sizeof(lease));
+        f.close();
+    } else {
+        Log.println("Failed to open lease.bin for writing!");
+    }
+}
+
+static void put_ip(uint8_t* p, uint32_t ip) {
+    memcpy(p, &ip, 4); // IPAddress keeps its octets in network order
+}
+
+static uint32_t get_ip(const uint8_t* p) {
+    uint32_t ip;
+    memcpy(&ip, p, 4);
+    return ip;
+}
+
+static uint32_t get_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Sends a DHCPREQUEST in INIT-REBOOT state: ciaddr zero, requested IP option, no server identifier.
+static void send_init_reboot_request(EthernetUDP& udp, const uint8_t* mac, uint32_t xid, uint32_t requested) {
+    uint8_t pkt[DHCP_HEADER_SIZE + 32];
+    memset(pkt, 0, sizeof(pkt));
+    pkt[0] = 1;    // BOOTREQUEST
+    pkt[1] = 1;    // Ethernet
+    pkt[2] = 6;    // MAC length
+    pkt[4] = xid >> 24; pkt[5] = xid >> 16; pkt[6] = xid >> 8; pkt[7] = xid;
+    pkt[10] = 0x80; // Broadcast flag, we cannot receive unicast without an address yet
+    memcpy(pkt + 28, mac, 6);
+    pkt[236] = 0x63; pkt[237] = 0x82; pkt[238] = 0x53; pkt[239] = 0x63;
+
+    uint8_t* opt = pkt + DHCP_HEADER_SIZE;
+    *opt++ = DHCP_OPT_MSG_TYPE; *opt++ = 1; *opt++ = DHCP_REQUEST;
+    *opt++ = DHCP_OPT_CLIENT_ID; *opt++ = 7; *opt++ = 1; memcpy(opt, mac, 6); opt += 6;
+    *opt++ = DHCP_OPT_REQ_IP; *opt++ = 4; put_ip(opt, requested); opt += 4;
+    *opt++ = DHCP_OPT_PARAM_REQ; *opt++ = 5;
+    *opt++ = DHCP_OPT_SUBNET; *opt++ = DHCP_OPT_ROUTER; *opt++ = DHCP_OPT_DNS;
+    *opt++ = DHCP_OPT_LEASE_TIME; *opt++ = DHCP_OPT_SERVER_ID;
+    *opt++ = DHCP_OPT_END;
+
+    udp.beginPacket(IPAddress(255, 255, 255, 255), DHCP_SERVER_PORT);
+    udp.write(pkt, opt - pkt);
+    udp.endPacket();
+}
+
+// Returns DHCP_ACK or DHCP_NAK for a reply matching our transaction, 0 for anything else.
+static int parse_reply(const uint8_t* pkt, int len, const uint8_t* mac, uint32_t xid, dhcp_lease_t& lease) {
+    if (len < DHCP_HEADER_SIZE || pkt[0] != 2) return 0;
+    if (get_be32(pkt + 4) != xid || memcmp(pkt + 28, mac, 6) != 0) return 0;
+    if (get_be32(pkt + 236) != DHCP_MAGIC_COOKIE) return 0;
+    int type = 0;
+    lease.address = get_ip(pkt + 16); // yiaddr
+    const uint8_t* opt = pkt + DHCP_HEADER_SIZE;
+    const uint8_t* end = pkt + len;
+    while (opt < end && *opt != DHCP_OPT_END) {
+        if (*opt == 0) { opt++; continue; } // Pad
+        if (opt + 2 > end || opt + 2 + opt[1] > end) break;
+        uint8_t code = opt[0], olen = opt[1];
+        const uint8_t* val = opt + 2;
+        if (code == DHCP_OPT_MSG_TYPE && olen >= 1) type = val[0];
+        else if (code == DHCP_OPT_SUBNET && olen >= 4) lease.subnet = get_ip(val);
+        else if (code == DHCP_OPT_ROUTER && olen >= 4) lease.gateway = get_ip(val);
+        else if (code == DHCP_OPT_DNS && olen >= 4) lease.dns = get_ip(val);
+        else if (code == DHCP_OPT_LEASE_TIME && olen >= 4) lease.lease_time = get_be32(val);
+        else if (code == DHCP_OPT_SERVER_ID && olen >= 4) lease.server = get_ip(val);
+        opt += 2 + olen;
+    }
+    return (type == DHCP_ACK || type == DHCP_NAK) ? type : 0;
+}
+
+static bool try_init_reboot(uint8_t* mac, dhcp_lease_t& lease) {
+    // Bring the chip up with a zero address, exactly as the library's own DHCP client does
+    Ethernet.begin(mac, IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+    EthernetUDP udp;
+    if (!udp.begin(DHCP_CLIENT_PORT)) return false;
+    uint32_t xid = micros() ^ get_ip(mac + 2);
+    uint8_t pkt[548];
+    bool acked = false;
+    for (int attempt = 0; attempt < DHCP_REBOOT_ATTEMPTS && !acked; attempt++) {
+        send_init_reboot_request(udp, mac, xid, lease.address);
+        unsigned long deadline = millis() + DHCP_REBOOT_TIMEOUT_MS;
+        while (millis() < deadline) {
+            int size = udp.parsePacket();
+            if (size <= 0) continue;
+            int len = udp.read(pkt, sizeof(pkt));
+            dhcp_lease_t reply = lease;
+            int type = parse_reply(pkt, len, mac, xid, reply);
+            if (type == DHCP_NAK) {
+                Log.println("DHCP: cached lease NAKed, falling back to discovery.");
+                udp.stop();
+                return false;
+            }
+            if (type == DHCP_ACK && reply.address == lease.address) {
+                lease = reply;
+                acked = true;
+                break;
+            }
+        }
+    }
+    udp.stop();
+    if (!acked) {
+        Log.println("DHCP: no answer to INIT-REBOOT request, falling back to discovery.");
+        return false;
+    }
+    Ethernet.setLocalIP(IPAddress(lease.address));
+    Ethernet.setSubnetMask(IPAddress(lease.subnet));
+    Ethernet.setGatewayIP(IPAddress(lease.gateway));
+    Ethernet.setDnsServerIP(IPAddress(lease.dns));
+    return true;
+}
+
+bool ethernet_begin_cached(FS& fs, uint8_t* mac) {
+    unsigned long start = millis();
+    dhcp_lease_t lease;
+    if (load_dhcp_lease(fs, lease)) {
+        uint32_t now = rtc_get();
+        // A clock that went back (RTC reset, battery swap) can't tell the lease's age: expired
+        bool expired = now < lease.obtained || now - lease.obtained >= lease.lease_time;
+        if (!expired && try_init_reboot(mac, lease)) {
+            lease.obtained = rtc_get();
+            save_dhcp_lease(fs, lease);
+            Log.print("DHCP: reacquired cached lease (INIT-REBOOT) in ");
+            Log.print(millis() - start);
+            Log.println(" ms");
+            return true;
+        }
+    }
+    if (Ethernet.begin(mac) == 0) {
+        Log.println("DHCP: discovery failed.");
+        return false;
+    }
+    lease.magic = DHCP_LEASE_MAGIC;
+    lease.address = (uint32_t)Ethernet.localIP();
+    lease.server = 0;
+    lease.gateway = (uint32_t)Ethernet.gatewayIP();
+    lease.subnet = (uint32_t)Ethernet.subnetMask();
+    lease.dns = (uint32_t)Ethernet.dnsServerIP();
+    lease.obtained = rtc_get();
+    lease.lease_time = DHCP_FALLBACK_LEASE_SECS;
+    save_dhcp_lease(fs, lease);
+    Log.print("DHCP: full discovery took ");
+    Log.print(millis() - start);
+    Log.println(" ms");
+    return true;
+}
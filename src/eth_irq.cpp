@@ -0,0 +1,121 @@
+// Interrupt driven socket events for the recovery server.
+// Polling server.available() every 10 ms costs up to 10 ms per event and keeps the SPI bus busy
+// while idle. With INTn wired up, the loop only touches the W5x00 after it told us something happened.
+
+#include "eth_irq.h"
+#include "boot_log.h"
+#include <Ethernet.h>
+#include <SPI.h>
+#include <utility/w5100.h>
+
+// Sn_IR bits we want INTn for. SEND_OK is left out on purpose: the library polls and clears it itself.
+#define SNIR_EVENTS  0x0F // CON | DISCON | RECV | TIMEOUT
+#define SN_IR        0x0002
+#define SN_IMR       0x002C // W5200/W5500 only, the W5100 always reports every socket event
+
+// Common register addresses as the Ethernet library maps them for each chip
+#define W5100_IR     0x0015 // Low nibble: socket 0-3 interrupt
+#define W5100_IMR    0x0016
+#define W5200_IR2    0x0034 // Socket interrupt flags
+#define W5200_IMR    0x0016 // Socket interrupt mask
+#define W5500_SIR    0x0017
+#define W5500_SIMR   0x0018
+
+static volatile bool eth_event = false;
+static bool eth_irq_enabled = false;
+static uint8_t eth_sockets = 0;
+static uint16_t eth_mask_reg = 0;
+
+static void eth_isr() {
+    eth_event = true;
+}
+
+// Socket register block base, using the same address convention as W5100Class::read()/write()
+static uint16_t socket_base(uint8_t s) {
+    switch (Ethernet.hardwareStatus()) {
+        case EthernetW5100: return 0x0400 + s * 0x100;
+        case EthernetW5200: return 0x4000 + s * 0x100;
+        default:            return 0x1000 + s * 0x100;
+    }
+}
+
+static uint16_t socket_ir_reg() {
+    switch (Ethernet.hardwareStatus()) {
+        case EthernetW5100: return W5100_IR;
+        case EthernetW5200: return W5200_IR2;
+        default:            return W5500_SIR;
+    }
+}
+
+void eth_irq_begin() {
+    if (ETH_INT_PIN < 0) return;
+    uint8_t mask;
+    uint16_t mask_reg;
+    switch (Ethernet.hardwareStatus()) {
+        case EthernetW5100: eth_sockets = 4; mask_reg = W5100_IMR;  break;
+        case EthernetW5200: eth_sockets = 8; mask_reg = W5200_IMR;  break;
+        case EthernetW5500: eth_sockets = 8; mask_reg = W5500_SIMR; break;
+        default:
+            Log.println("Ethernet: unknown chip, socket interrupts disabled.");
+            return;
+    }
+    eth_mask_reg = mask_reg;
+    mask = (eth_sockets == 8) ? 0xFF : 0x0F;
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    for (uint8_t s = 0; s < eth_sockets; s++) {
+        if (Ethernet.hardwareStatus() != EthernetW5100) {
+            W5100.write(socket_base(s) + SN_IMR, SNIR_EVENTS);
+        }
+        W5100.write(socket_base(s) + SN_IR, SNIR_EVENTS);
+    }
+    W5100.write(mask_reg, mask);
+    SPI.endTransaction();
+    pinMode(ETH_INT_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(ETH_INT_PIN), eth_isr, FALLING);
+    eth_irq_enabled = true;
+    Log.print("Ethernet socket interrupts enabled on pin ");
+    Log.println(ETH_INT_PIN);
+}
+
+void eth_irq_wait(uint32_t timeout_ms) {
+    if (!eth_irq_enabled) {
+        delay(10);
+        return;
+    }
+    if (!timeout_ms || timeout_ms > ETH_IRQ_MAX_WAIT_MS) timeout_ms = ETH_IRQ_MAX_WAIT_MS;
+    uint32_t start = millis();
+    // INTn is level low while anything is pending, which also covers an edge we missed
+    while (!eth_event && digitalRead(ETH_INT_PIN) == HIGH) {
+        if (millis() - start >= timeout_ms) break;
+        asm volatile ("wfi");
+    }
+    eth_event = false;
+}
+
+void eth_irq_ack() {
+    if (!eth_irq_enabled) return;
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    uint8_t pending = W5100.read(socket_ir_reg());
+    for (uint8_t s = 0; s < eth_sockets; s++) {
+        if (pending & (1 << s)) {
+            W5100.write(socket_base(s) + SN_IR, SNIR_EVENTS);
+        }
+    }
+    SPI.endTransaction();
+}
+
+void eth_irq_end() {
+    if (eth_irq_enabled) {
+        detachInterrupt(digitalPinToInterrupt(ETH_INT_PIN));
+        SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+        W5100.write(eth_mask_reg, 0);
+        SPI.endTransaction();
+        eth_irq_enabled = false;
+    }
+    uint8_t sockets = Ethernet.hardwareStatus() == EthernetW5100 ? 4 : 8;
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    for (uint8_t s = 0; s < sockets; s++) {
+        W5100.execCmdSn(s, Sock_CLOSE);
+    }
+    SPI.endTransaction();
+}
@@ -0,0 +1,66 @@
+#include "hot_preload.h"
+#include "boot_clock.h"
+
+#define FLEXRAM_BANKS     16
+#define FLEXRAM_BANK_SIZE 0x8000
+#define FLEXRAM_BANK_ITCM 3
+
+uint32_t hot_itcm_size() {
+    uint32_t config = IOMUXC_GPR_GPR17;
+    uint32_t banks = 0;
+    for (int i = 0; i < FLEXRAM_BANKS; i++) {
+        if (((config >> (i * 2)) & 3) == FLEXRAM_BANK_ITCM) banks++;
+    }
+    return banks * FLEXRAM_BANK_SIZE;
+}
+
+bool hot_sections_check(const hot_section_t* sections, uint32_t count, uint32_t base, uint32_t length) {
+    if (count > HOT_SECTIONS_MAX) return false;
+    uint32_t itcm_size = hot_itcm_size();
+    for (uint32_t i = 0; i < count; i++) {
+        const hot_section_t& s = sections[i];
+        if (s.length == 0 || (s.length | s.flash_addr | s.itcm_addr) & 3) return false;
+        if (s.flash_addr < base || s.flash_addr - base > length || s.length > length - (s.flash_addr - base)) return false;
+        if (s.itcm_addr >= itcm_size || s.length > itcm_size - s.itcm_addr) return false;
+    }
+    return true;
+}
+
+const hot_table_t* hot_table_at(const boot_metadata_t& meta_data, uint32_t address) {
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        const placed_image_t& img = meta_data.images[i];
+        if (!(img.valid & PLACED_HOT_TABLE) || img.base != address) continue;
+        const hot_table_t* table = (const hot_table_t*)(img.base + ((img.length + 3) & ~3u));
+        arm_dcache_delete((void*)table, sizeof(*table));
+        if (table->magic != HOT_TABLE_MAGIC ||
+            crc32_update(0, (const uint8_t*)table, offsetof(hot_table_t, crc)) != table->crc ||
+            !hot_sections_check(table->sections, table->count, img.base, img.length)) {
+            Log.println("WARNING: Hot section table does not check out, booting without it.");
+            return NULL;
+        }
+        return table;
+    }
+    return NULL;
+}
+
+#if defined(__IMXRT1062__)
+FLASHMEM void hot_jump(uint32_t address, const hot_table_t* table) {
+    boot_handoff_write(address);
+    __disable_irq();
+
+    // Word copies through volatile pointers so the compiler can't turn this into a memcpy call,
+    // which would live in ITCM
+    for (uint32_t i = 0; i < table->count; i++) {
+        const volatile uint32_t* src = (const volatile uint32_t*)table->sections[i].flash_addr;
+        volatile uint32_t* dst = (volatile uint32_t*)table->sections[i].itcm_addr;
+        for (uint32_t n = table->sections[i].length / 4; n > 0; n--) *dst++ = *src++;
+    }
+    asm volatile ("DSB");
+    asm volatile ("ISB");
+
+    SCB_VTOR = address;
+    uint32_t* vectorTable = (uint32_t*)address;
+    asm volatile ("MSR msp, %0\n\tBX %1" : : "r" (vectorTable[0]), "r" (vectorTable[1]));
+    while (1);
+}
+#endif
@@ -0,0 +1,322 @@
+#include "image_alloc.h"
+#include "boot_policies.h"
+#include "hot_preload.h"
+#include "component.h"
+#if S3BL_RECOVERY_ETHERNET
+#include "http.h"
+#include "rate_limit.h"
+#endif
+
+#define ALLOC_IDLE_TIMEOUT 10000
+
+bool alloc_overlaps(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len) {
+    return a_len && b_len && a < b + b_len && b < a + a_len;
+}
+
+uint32_t placed_footprint(const placed_image_t& img) {
+    if (!(img.valid & PLACED_HOT_TABLE)) return img.length;
+    return ((img.length + 3) & ~3u) + sizeof(hot_table_t);
+}
+
+// Same order as BootCore::select
+uint32_t alloc_booted(const boot_metadata_t& meta_data, uint32_t& length) {
+    if (meta_data.active_slot == BOOT_SLOT_PLACED && meta_data.active_image < PLACED_IMAGES &&
+        meta_data.images[meta_data.active_image].valid) {
+        length = placed_footprint(meta_data.images[meta_data.active_image]);
+        return meta_data.images[meta_data.active_image].base;
+    }
+    // Fixed slot images are not recorded with a length, so they keep the whole slot
+    length = SLOT_SIZE;
+    if (meta_data.active_slot == 0 && meta_data.valid_a) return SLOT_A_ADDRESS;
+    if (meta_data.active_slot == 1 && meta_data.valid_b) return SLOT_B_ADDRESS;
+    if (meta_data.valid_a) return SLOT_A_ADDRESS;
+    if (meta_data.valid_b) return SLOT_B_ADDRESS;
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        if (!meta_data.images[i].valid || (meta_data.images[i].valid & PLACED_MODULE)) continue;
+        length = placed_footprint(meta_data.images[i]);
+        return meta_data.images[i].base;
+    }
+    length = 0;
+    return 0;
+}
+
+static uint32_t units_of(uint32_t base, uint32_t length) {
+    uint32_t mask = 0;
+    for (uint32_t u = 0; u < ALLOC_UNITS; u++) {
+        if (alloc_overlaps(base, length, APP_REGION_START + u * ALLOC_UNIT, ALLOC_UNIT)) mask |= 1u << u;
+    }
+    return mask;
+}
+
+uint32_t alloc_used(const boot_metadata_t& meta_data, bool fallbacks) {
+    uint32_t length;
+    uint32_t base = alloc_booted(meta_data, length);
+    uint32_t mask = units_of(base, length);
+    if (!fallbacks) return mask;
+    if (meta_data.valid_a) mask |= units_of(SLOT_A_ADDRESS, SLOT_SIZE);
+    if (meta_data.valid_b) mask |= units_of(SLOT_B_ADDRESS, SLOT_SIZE);
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        if (meta_data.images[i].valid) mask |= units_of(meta_data.images[i].base, placed_footprint(meta_data.images[i]));
+    }
+    return mask;
+}
+
+uint32_t alloc_first_fit(const boot_metadata_t& meta_data, uint32_t length) {
+    uint32_t used = alloc_used(meta_data, true);
+    uint32_t need = (length + ALLOC_UNIT - 1) / ALLOC_UNIT;
+    uint32_t run = 0;
+    for (uint32_t u = 0; u < ALLOC_UNITS && need; u++) {
+        run = (used & (1u << u)) ? 0 : run + 1;
+        if (run == need) return APP_REGION_START + (u + 1 - need) * ALLOC_UNIT;
+    }
+    return 0;
+}
+
+void alloc_forget(boot_metadata_t& meta_data, uint32_t base, uint32_t length) {
+    if (alloc_overlaps(base, length, SLOT_A_ADDRESS, SLOT_SIZE)) meta_data.valid_a = 0;
+    if (alloc_overlaps(base, length, SLOT_B_ADDRESS, SLOT_SIZE)) meta_data.valid_b = 0;
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        placed_image_t& img = meta_data.images[i];
+        if (img.valid && alloc_overlaps(base, length, img.base, placed_footprint(img))) img.valid = 0;
+    }
+}
+
+#if S3BL_RECOVERY_ETHERNET
+DMAMEM static uint8_t alloc_sector_buf[SECTOR_SIZE] __attribute__((aligned(32)));
+static uint8_t alloc_chunk[1024];
+
+void alloc_status(Client& client, const String& req_line, const boot_metadata_t& meta_data) {
+    String line;
+    do {
+        http_read_line(client, line);
+    } while (line.length() > 0);
+    uint32_t booted_len;
+    uint32_t booted = alloc_booted(meta_data, booted_len);
+    uint32_t booted_units = units_of(booted, booted_len);
+    uint32_t used = alloc_used(meta_data, true);
+    // One character per unit: # booted image, f fallback, . free
+    char map[ALLOC_UNITS + 1];
+    for (uint32_t u = 0; u < ALLOC_UNITS; u++) {
+        map[u] = (booted_units & (1u << u)) ? '#' : (used & (1u << u)) ? 'f' : '.';
+    }
+    map[ALLOC_UNITS] = 0;
+
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: text/plain");
+    client.println("Connection: close");
+    client.println();
+    client.print("region=0x"); client.print(APP_REGION_START, HEX); client.print("-0x"); client.println(APP_REGION_END, HEX);
+    client.print("unit="); client.println(ALLOC_UNIT);
+    client.print("map="); client.println(map);
+    client.print("booted=0x"); client.print(booted, HEX); client.print(" length="); client.println(booted_len);
+    client.print("slot_a=0x"); client.print(SLOT_A_ADDRESS, HEX); client.print(" valid="); client.println(meta_data.valid_a ? 1 : 0);
+    client.print("slot_b=0x"); client.print(SLOT_B_ADDRESS, HEX); client.print(" valid="); client.println(meta_data.valid_b ? 1 : 0);
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        const placed_image_t& img = meta_data.images[i];
+        if (!img.valid) continue;
+        client.print("image="); client.print(i);
+        client.print(" base=0x"); client.print(img.base, HEX);
+        client.print(" length="); client.print(img.length);
+        client.print(" crc32="); client.print(img.crc, HEX);
+        client.print(" hot="); client.print(img.valid & PLACED_HOT_TABLE ? 1 : 0);
+        if (img.valid & PLACED_MODULE) {
+            const module_header_t* m = (const module_header_t*)img.base;
+            client.print(" module="); client.print(m->id);
+            client.print(" version="); client.print(m->version);
+            client.print(" abi="); client.print(m->abi);
+            client.print(" trial="); client.print(img.valid & PLACED_MODULE_TRIAL ? 1 : 0);
+        }
+        client.print(" active="); client.println(meta_data.active_slot == BOOT_SLOT_PLACED && meta_data.active_image == (uint32_t)i ? 1 : 0);
+    }
+    int q = req_line.indexOf("size=");
+    if (q >= 0) {
+        uint32_t fit = alloc_first_fit(meta_data, strtoul(req_line.c_str() + q + 5, NULL, 0));
+        client.print("fit=");
+        if (fit) {
+            client.print("0x"); client.println(fit, HEX);
+        } else {
+            client.println("none");
+        }
+    }
+    client.stop();
+}
+
+static bool read_exact(Client& client, uint8_t* buf, size_t len) {
+    unsigned long last_rx = millis();
+    while (len > 0) {
+        int n = client.available();
+        if (n <= 0) {
+            if (!client.connected() || millis() - last_rx > ALLOC_IDLE_TIMEOUT) return false;
+            continue;
+        }
+        size_t want = rate_limit_allow(min((size_t)n, len));
+        if (want == 0) {
+            rate_limit_defer();
+            continue;
+        }
+        int got = client.read(buf, want);
+        if (got <= 0) continue;
+        rate_limit_used(got);
+        buf += got;
+        len -= got;
+        last_rx = millis();
+    }
+    return true;
+}
+
+// Table entry for a new image: a free one, else one the new image overwrites anyway, else for a
+// module the oldest version of the same module, else the first that is neither booted nor a
+// module, else the first that is not booted
+static int alloc_entry(const boot_metadata_t& meta_data, uint32_t base, uint32_t length, const module_header_t* module) {
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        if (!meta_data.images[i].valid) return i;
+    }
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        if (alloc_overlaps(base, length, meta_data.images[i].base, placed_footprint(meta_data.images[i]))) return i;
+    }
+    int oldest = -1;
+    for (int i = 0; module && i < PLACED_IMAGES; i++) {
+        if (!(meta_data.images[i].valid & PLACED_MODULE)) continue;
+        const module_header_t* m = (const module_header_t*)meta_data.images[i].base;
+        if (m->id != module->id) continue;
+        if (oldest < 0 || m->version < ((const module_header_t*)meta_data.images[oldest].base)->version) oldest = i;
+    }
+    if (oldest >= 0) return oldest;
+    bool booted[PLACED_IMAGES];
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        booted[i] = meta_data.active_slot == BOOT_SLOT_PLACED && meta_data.active_image == (uint32_t)i;
+        if (!booted[i] && !(meta_data.images[i].valid & PLACED_MODULE)) return i;
+    }
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        if (!booted[i]) return i;
+    }
+    return 0;
+}
+
+bool alloc_install(Client& client, boot_metadata_t& meta_data) {
+    size_t content_length = 0;
+    String line;
+    do {
+        http_read_line(client, line);
+        if (line.startsWith("Content-Length:")) content_length = line.substring(15).toInt();
+    } while (line.length() > 0);
+
+    image_header_t hdr;
+    if (!read_exact(client, (uint8_t*)&hdr, sizeof(hdr)) || hdr.magic != IMAGE_HEADER_MAGIC ||
+        hdr.hot_count > HOT_SECTIONS_MAX || hdr.header_size != sizeof(hdr) + hdr.hot_count * sizeof(hot_section_t)) {
+        http_respond(client, "400 Bad Request", "ERROR: Body has to start with an image header.");
+        return false;
+    }
+    hot_table_t hot;
+    memset(&hot, 0, sizeof(hot));
+    hot.magic = HOT_TABLE_MAGIC;
+    hot.count = hdr.hot_count;
+    if (!read_exact(client, (uint8_t*)hot.sections, hdr.hot_count * sizeof(hot_section_t))) {
+        http_respond(client, "400 Bad Request", "ERROR: Body has to start with an image header.");
+        return false;
+    }
+    hot.crc = crc32_update(0, (const uint8_t*)&hot, offsetof(hot_table_t, crc));
+    if (content_length != 0 && content_length != hdr.header_size + hdr.length) {
+        http_respond(client, "400 Bad Request", "ERROR: Content-Length does not match the image header.");
+        return false;
+    }
+    // The hot table, if any, is programmed right after the image and counts towards its blocks
+    placed_image_t placed = { hdr.load_address, hdr.length, hdr.crc, 1u };
+    if (hdr.hot_count) placed.valid |= PLACED_HOT_TABLE;
+    if (hdr.flags & IMAGE_FLAG_RESET) placed.valid |= PLACED_FULL_RESET;
+    bool module = hdr.flags & IMAGE_FLAG_MODULE;
+    if (module) placed.valid |= PLACED_MODULE | PLACED_MODULE_TRIAL;
+    uint32_t footprint = placed_footprint(placed);
+    if (hdr.length == 0 || hdr.load_address < APP_REGION_START || hdr.load_address >= APP_REGION_END ||
+        footprint > APP_REGION_END - hdr.load_address || (hdr.load_address - APP_REGION_START) % ALLOC_UNIT) {
+        http_respond(client, "400 Bad Request", "ERROR: Load address has to be a 64KB unit inside the application region.");
+        return false;
+    }
+    if (!hot_sections_check(hot.sections, hot.count, hdr.load_address, hdr.length)) {
+        http_respond(client, "400 Bad Request", "ERROR: Hot sections have to be word aligned, inside the image and inside ITCM.");
+        return false;
+    }
+    // Modules are checked before anything is erased, and only started through the base
+    module_header_t mod;
+    if (module && (hdr.hot_count || !read_exact(client, (uint8_t*)&mod, sizeof(mod)) ||
+                   !component_module_check(mod, hdr.load_address, hdr.length))) {
+        http_respond(client, "400 Bad Request", "ERROR: Modules have to start with a module header and have no hot sections.");
+        return false;
+    }
+    uint32_t booted_len;
+    uint32_t booted = alloc_booted(meta_data, booted_len);
+    if (alloc_overlaps(hdr.load_address, footprint, booted, booted_len)) {
+        http_respond(client, "409 Conflict", "ERROR: Image overlaps the booted image, link it for a free range (GET /alloc?size=).");
+        return false;
+    }
+
+    // Fallbacks in the way stop being bootable before their blocks are erased
+    int idx = alloc_entry(meta_data, hdr.load_address, footprint, module ? &mod : NULL);
+    boot_metadata_t new_meta = meta_data;
+    alloc_forget(new_meta, hdr.load_address, footprint);
+    new_meta.images[idx].valid = 0;
+    save_metadata(new_meta);
+    meta_data = new_meta;
+    Log.print("Alloc: installing "); Log.print(hdr.length); Log.print(" bytes at 0x");
+    Log.print(hdr.load_address, HEX); Log.print(" as image "); Log.print(idx);
+    Log.print(", hot sections "); Log.println(hdr.hot_count);
+    if (module) {
+        Log.print("Alloc: module "); Log.print(mod.id); Log.print(" version "); Log.print(mod.version);
+        Log.print(" for base ABI "); Log.println(mod.abi);
+    }
+
+    unsigned long start = millis();
+    flash_erase_range(hdr.load_address, footprint);
+    unsigned long erase_ms = millis() - start;
+    slot_writer_t writer;
+    slot_writer_begin(writer, hdr.load_address, alloc_sector_buf);
+    writer.erased = true;
+    if (module) slot_writer_write(writer, (const uint8_t*)&mod, sizeof(mod));
+    while (writer.offset < hdr.length) {
+        size_t n = min(sizeof(alloc_chunk), (size_t)(hdr.length - writer.offset));
+        if (!read_exact(client, alloc_chunk, n)) break;
+        slot_writer_write(writer, alloc_chunk, n);
+    }
+    bool complete = writer.offset == hdr.length;
+    if (complete && hdr.hot_count) {
+        // Padding up to the table stays erased
+        static const uint8_t pad[3] = { 0xFF, 0xFF, 0xFF };
+        slot_writer_write(writer, pad, footprint - sizeof(hot) - hdr.length);
+        slot_writer_write(writer, (const uint8_t*)&hot, sizeof(hot));
+    }
+    slot_writer_finish(writer);
+    if (!complete) {
+        Log.println("Alloc: transfer incomplete.");
+        http_respond(client, "408 Request Timeout", "ERROR: Image transfer incomplete.");
+        return false;
+    }
+    arm_dcache_delete((void*)hdr.load_address, footprint);
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    uint32_t crc = crc32_update(0, (const uint8_t*)hdr.load_address, hdr.length);
+    bool hot_ok = hdr.hot_count == 0 || memcmp((const void*)(hdr.load_address + footprint - sizeof(hot)), &hot, sizeof(hot)) == 0;
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    if (crc != hdr.crc || !hot_ok) {
+        Log.print("ERROR: Placed image CRC32 mismatch: 0x"); Log.println(crc, HEX);
+        http_respond(client, "422 Unprocessable Entity", "ERROR: CRC32 mismatch after programming.");
+        return false;
+    }
+
+    new_meta.images[idx] = placed;
+    if (!module) {
+        new_meta.active_slot = BOOT_SLOT_PLACED;
+        new_meta.active_image = idx;
+        new_meta.boot_count = 0;
+        new_meta.boot_success = 0;
+    }
+    save_metadata(new_meta);
+    meta_data = new_meta;
+    Log.print("Alloc: image "); Log.print(idx); Log.print(" installed, erase "); Log.print(erase_ms);
+    Log.print(" ms, total "); Log.print(millis() - start); Log.println(" ms");
+    if (module) {
+        http_respond(client, "200 OK", "Module installed. Starting the base image...");
+    } else {
+        http_respond(client, "200 OK", "Image installed and made active. Starting it...");
+    }
+    return true;
+}
+#endif
@@ -9,29 +9,24 @@
 #include <Arduino.h>
 #include "imxrt.h"  // Teensy 4.0 specific header
 #include <arm_math.h>
-#include <Ethernet.h>
 #include "flash.h"  // Add this include
-#include <LittleFS.h>
-#define PROG_FLASH_SIZE (1024 * 1024) // 1MB for metadata and future use
-LittleFS_Program myfs;
+#include "s3bl.h"
+#include "boot_clock.h"
+#include "boot_policies.h"
+#include "image_alloc.h"
 
 
-#define METADATA_ADDRESS 0x60031000
-typedef struct {
-   uint32_t active_slot;  // 0 = A, 1 = B
-   uint32_t valid_a;
-   uint32_t valid_b;
-   uint32_t boot_count;
-   uint32_t boot_success;
-} boot_metadata_t;
-
-#define SLOT_A_ADDRESS 0x60032000
-#define SLOT_B_ADDRESS 0x60112000
 #define NVIC_VTOR (*(volatile uint32_t *)0xE000ED08)
 
 typedef void (*app_entry_t)(void);
 boot_metadata_t* meta = (boot_metadata_t*)METADATA_ADDRESS;
+
+// The jump and the FlexSPI flash_* backend are the board's; the host build (test/host) brings its own
+#if defined(__IMXRT1062__)
 void jump_to_app(uint32_t address) {
+   // Back to F_CPU and tell the application how the boot went
+   boot_handoff_write(address);
+
    // Disable interrupts before jumping
    __disable_irq();
    
@@ -79,15 +74,48 @@ void flash_erase_sector(uint32_t addr) {
     __enable_irq();
 }
 
-void flash_write(uint32_t addr, const void* data, size_t len) {
-    Serial.println("Starting flash write...");
-    uint32_t aligned_addr = addr & ~(SECTOR_SIZE - 1);
+// 64KB block erase, one command instead of sixteen sector erases
+void flash_erase_block(uint32_t addr) {
+    __disable_irq();
     
-    // First erase the sector(s)
-    Serial.println("Erasing sector...");
-    flash_erase_sector(aligned_addr);
+    IMXRT_FLEXSPI->IPCR0 = addr;
     
-    Serial.println("Starting write process...");
+    IMXRT_FLEXSPI->LUTKEY = FLEXSPI_LUT_KEY;
+    IMXRT_FLEXSPI->LUTCR = FLEXSPI_LUT_UNLOCK;
+    
+    IMXRT_FLEXSPI->LUT[0] = 0x06000000; // Write enable
+    IMXRT_FLEXSPI->LUT[1] = 0xD8000000; // Block erase
+    
+    IMXRT_FLEXSPI->IPCMD = 1;
+    while(IMXRT_FLEXSPI->INTR & 1) ;
+    IMXRT_FLEXSPI->INTR = 1;
+    
+    IMXRT_FLEXSPI->IPCMD = 2;
+    while(IMXRT_FLEXSPI->INTR & 1) ;
+    IMXRT_FLEXSPI->INTR = 1;
+    
+    __enable_irq();
+}
+#endif
+
+// Erases [addr, addr + len) rounded out to sectors, using block erases wherever a whole block fits
+void flash_erase_range(uint32_t addr, uint32_t len) {
+    uint32_t end = (addr + len + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    addr &= ~(SECTOR_SIZE - 1);
+    while (addr < end) {
+        if ((addr & (FLASH_BLOCK_SIZE - 1)) == 0 && end - addr >= FLASH_BLOCK_SIZE) {
+            flash_erase_block(addr);
+            addr += FLASH_BLOCK_SIZE;
+        } else {
+            flash_erase_sector(addr);
+            addr += SECTOR_SIZE;
+        }
+    }
+}
+
+#if defined(__IMXRT1062__)
+// Programs already erased flash, no erase and no verification
+void flash_program(uint32_t addr, const void* data, size_t len) {
     __disable_irq();
     
     // Write unlock sequence
@@ -125,361 +153,142 @@ void flash_write(uint32_t addr, const void* data, size_t len) {
     }
     
     __enable_irq();
-    Serial.println("Write complete, verifying...");
+}
+#endif
+
+void flash_write(uint32_t addr, const void* data, size_t len) {
+    Log.println("Starting flash write...");
+    uint32_t aligned_addr = addr & ~(SECTOR_SIZE - 1);
+    
+    // First erase the sector(s)
+    Log.println("Erasing sector...");
+    flash_erase_sector(aligned_addr);
+    
+    Log.println("Starting write process...");
+    flash_program(addr, data, len);
+    Log.println("Write complete, verifying...");
     
     // Add a delay before verification
     delay(10);
     
     // Verify the write
+    const uint32_t* src = (const uint32_t*)data;
+    size_t words = (len + 3) / 4;
     const uint32_t* written = (const uint32_t*)addr;
     bool verify_failed = false;
     for(size_t i = 0; i < words; i++) {
         if(written[i] != src[i]) {
-            Serial.print("Flash write verification failed at word ");
-            Serial.print(i);
-            Serial.print(" Expected: 0x");
-            Serial.print(src[i], HEX);
-            Serial.print(" Got: 0x");
-            Serial.println(written[i], HEX);
+            Log.print("Flash write verification failed at word ");
+            Log.print(i);
+            Log.print(" Expected: 0x");
+            Log.print(src[i], HEX);
+            Log.print(" Got: 0x");
+            Log.println(written[i], HEX);
             verify_failed = true;
             break;
         }
     }
     
     if (!verify_failed) {
-        Serial.println("Flash write verification successful!");
+        Log.println("Flash write verification successful!");
     }
 }
 
+void slot_writer_begin(slot_writer_t& w, uint32_t base, uint8_t* buf) {
+    w.base = base;
+    w.offset = 0;
+    w.fill = 0;
+    w.buf = buf;
+    w.erased = false;
+}
+
+static void slot_writer_flush(slot_writer_t& w) {
+    uint32_t addr = w.base + w.offset - w.fill;
+    if (!w.erased) flash_erase_sector(addr);
+    flash_program(addr, w.buf, w.fill);
+    w.fill = 0;
+}
+
+void slot_writer_write(slot_writer_t& w, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t n = min(len, (size_t)(SECTOR_SIZE - w.fill));
+        memcpy(w.buf + w.fill, data, n);
+        w.fill += n;
+        w.offset += n;
+        data += n;
+        len -= n;
+        if (w.fill == SECTOR_SIZE) slot_writer_flush(w);
+    }
+}
+
+void slot_writer_finish(slot_writer_t& w) {
+    if (w.fill > 0) slot_writer_flush(w);
+}
+
 void save_metadata(const boot_metadata_t& meta_data) {
-    File f = myfs.open("/meta.bin", FILE_WRITE);
-    if (f) {
-        f.write((const uint8_t*)&meta_data, sizeof(meta_data));
-        f.close();
-        Serial.println("Metadata written to LittleFS_Program.");
+    MetadataStorage::save(meta_data);
+}
+
+bool load_metadata(boot_metadata_t& meta_data) {
+    return MetadataStorage::load(meta_data);
+}
+
+uint32_t inactive_slot_address(const boot_metadata_t& meta_data) {
+    if (meta_data.active_slot == BOOT_SLOT_PLACED) {
+        // Whichever fixed slot leaves the booted placed image alone, B if both do
+        uint32_t length;
+        uint32_t booted = alloc_booted(meta_data, length);
+        return alloc_overlaps(booted, length, SLOT_B_ADDRESS, SLOT_SIZE) ? SLOT_A_ADDRESS : SLOT_B_ADDRESS;
+    }
+    return (meta_data.active_slot == 0) ? SLOT_B_ADDRESS : SLOT_A_ADDRESS;
+}
+
+// Marks the freshly written inactive slot valid and active, and invalidates the other one
+// along with any placed image the slot was written over
+void commit_inactive_slot(boot_metadata_t& meta_data, uint32_t length) {
+    uint32_t slot = inactive_slot_address(meta_data);
+    alloc_forget(meta_data, slot, SLOT_SIZE);
+    meta_data.slot_length[slot == SLOT_B_ADDRESS ? 1 : 0] = length;
+    meta_data.boot_success = 0;    // Until the new image confirms, boot_clock.h
+    if (slot == SLOT_B_ADDRESS) {
+        meta_data.valid_b = 1;
+        meta_data.active_slot = 1;
+        meta_data.valid_a = 0;
     } else {
-        Serial.println("Failed to open meta.bin for writing!");
+        meta_data.valid_a = 1;
+        meta_data.active_slot = 0;
+        meta_data.valid_b = 0;
     }
+    save_metadata(meta_data);
 }
 
-bool load_metadata(boot_metadata_t& meta_data) {
-    File f = myfs.open("/meta.bin", FILE_READ);
-    if (f && f.size() == sizeof(meta_data)) {
-        f.read((uint8_t*)&meta_data, sizeof(meta_data));
-        f.close();
-        Serial.println("Metadata loaded from LittleFS_Program.");
-        return true;
+// Raw flash metadata written before slot_length existed reads back 0xFF there
+uint32_t slot_image_length(const boot_metadata_t& meta_data, int slot) {
+    uint32_t length = meta_data.slot_length[slot];
+    return length <= SLOT_SIZE ? length : 0;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
     }
-    Serial.println("No valid metadata found in LittleFS_Program.");
-    return false;
+    return ~crc;
 }
 
 void setup() {
     Serial.begin(115200);
     delay(100);
-    Serial.println("S3BL Bootloader Starting...");
-    delay(10);
-    Serial.println("Checking metadata...");
-    delay(10);
-    if (!myfs.begin(PROG_FLASH_SIZE)) {
-        Serial.println("Error starting PROGRAM FLASH DISK");
-        while (1);
-    }
-    boot_metadata_t init_meta;
-    if (!load_metadata(init_meta) || init_meta.active_slot == 0xFFFFFFFF) {
-        Serial.println("Initializing metadata...");
-        delay(10);
-        init_meta.active_slot = 0;
-        init_meta.valid_a = 0;
-        init_meta.valid_b = 0;
-        init_meta.boot_count = 0;
-        init_meta.boot_success = 0;
-        Serial.println("Writing metadata...");
-        delay(10);
-        save_metadata(init_meta);
-        Serial.println("Verifying metadata...");
-        delay(10);
-        boot_metadata_t verify_meta;
-        if (load_metadata(verify_meta) && verify_meta.active_slot == 0) {
-            Serial.println("Metadata write successful!");
-        } else {
-            Serial.println("Metadata write failed!");
-        }
-    }
-    Serial.println("Current metadata state:");
+    Log.println("S3BL Bootloader Starting...");
     delay(10);
-    Serial.print("Active slot: 0x");
-    Serial.println(init_meta.active_slot, HEX);
-    Serial.print("Valid A: 0x");
-    Serial.println(init_meta.valid_a, HEX);
-    Serial.print("Valid B: 0x");
-    Serial.println(init_meta.valid_b, HEX);
-    delay(1000);
-
-    // Boot decision logic
-    if (init_meta.active_slot == 0 && init_meta.valid_a) {
-        Serial.println("Jumping to application in slot A");
-        // Print vector table for diagnostics
-        Serial.println("Slot A vector table (first 32 bytes):");
-        for (int i = 0; i < 8; i++) {
-            uint32_t word = *((uint32_t*)(SLOT_A_ADDRESS + i * 4));
-            Serial.print("0x"); Serial.print(word, HEX); Serial.print(" ");
-        }
-        Serial.println();
-        // Check vector table validity
-        uint32_t sp = *((uint32_t*)SLOT_A_ADDRESS);
-        uint32_t rv = *((uint32_t*)(SLOT_A_ADDRESS + 4));
-        if ((sp & 0x60000000) != 0x60000000 || (rv & 0x60000000) != 0x60000000) {
-            Serial.println("WARNING: Slot A does not appear to contain a valid ARM Cortex-M7 binary. Aborting jump.");
-        } else {
-            jump_to_app(SLOT_A_ADDRESS);
-        }
-    } else if (init_meta.active_slot == 1 && init_meta.valid_b) {
-        Serial.println("Jumping to application in slot B");
-        Serial.println("Slot B vector table (first 32 bytes):");
-        for (int i = 0; i < 8; i++) {
-            uint32_t word = *((uint32_t*)(SLOT_B_ADDRESS + i * 4));
-            Serial.print("0x"); Serial.print(word, HEX); Serial.print(" ");
-        }
-        Serial.println();
-        uint32_t sp = *((uint32_t*)SLOT_B_ADDRESS);
-        uint32_t rv = *((uint32_t*)(SLOT_B_ADDRESS + 4));
-        if ((sp & 0x60000000) != 0x60000000 || (rv & 0x60000000) != 0x60000000) {
-            Serial.println("WARNING: Slot B does not appear to contain a valid ARM Cortex-M7 binary. Aborting jump.");
-        } else {
-            jump_to_app(SLOT_B_ADDRESS);
-        }
-    } else if (init_meta.valid_a) {
-        Serial.println("Active slot invalid, but slot A is valid. Jumping to slot A.");
-        Serial.println("Slot A vector table (first 32 bytes):");
-        for (int i = 0; i < 8; i++) {
-            uint32_t word = *((uint32_t*)(SLOT_A_ADDRESS + i * 4));
-            Serial.print("0x"); Serial.print(word, HEX); Serial.print(" ");
-        }
-        Serial.println();
-        uint32_t sp = *((uint32_t*)SLOT_A_ADDRESS);
-        uint32_t rv = *((uint32_t*)(SLOT_A_ADDRESS + 4));
-        if ((sp & 0x60000000) != 0x60000000 || (rv & 0x60000000) != 0x60000000) {
-            Serial.println("WARNING: Slot A does not appear to contain a valid ARM Cortex-M7 binary. Aborting jump.");
-        } else {
-            jump_to_app(SLOT_A_ADDRESS);
-        }
-    } else if (init_meta.valid_b) {
-        Serial.println("Active slot invalid, but slot B is valid. Jumping to slot B.");
-        Serial.println("Slot B vector table (first 32 bytes):");
-        for (int i = 0; i < 8; i++) {
-            uint32_t word = *((uint32_t*)(SLOT_B_ADDRESS + i * 4));
-            Serial.print("0x"); Serial.print(word, HEX); Serial.print(" ");
-        }
-        Serial.println();
-        uint32_t sp = *((uint32_t*)SLOT_B_ADDRESS);
-        uint32_t rv = *((uint32_t*)(SLOT_B_ADDRESS + 4));
-        if ((sp & 0x60000000) != 0x60000000 || (rv & 0x60000000) != 0x60000000) {
-            Serial.println("WARNING: Slot B does not appear to contain a valid ARM Cortex-M7 binary. Aborting jump.");
-        } else {
-            jump_to_app(SLOT_B_ADDRESS);
-        }
-    } else {
-        Serial.println("No valid application found. Entering recovery mode.");
-        // Initialize Ethernet for recovery
-        byte mac[6] = { 0x04, 0xE9, 0xE5, 0x00, 0x00, 0x01 };
-        IPAddress ip(192, 168, 1, 222);
-        IPAddress gateway(192, 168, 1, 1);
-        IPAddress subnet(255, 255, 255, 0);
-        Ethernet.begin(mac);
-        Serial.print("Ethernet started. IP address: ");
-        Serial.println(Ethernet.localIP());
-        EthernetServer server(80);
-        server.begin();
-        Serial.println("Recovery HTTP server started on port 80");
-        while (true) {
-            EthernetClient client = server.available();
-            if (client) {
-                Serial.println("Client connected in recovery mode");
-                String request = "";
-                unsigned long start_time = millis();
-                // Read the first line (request line)
-                while (client.connected() && client.available() == 0 && millis() - start_time < 1000) {
-                    delay(1);
-                }
-                // Read the request line
-                String req_line = "";
-                while (client.connected() && client.available()) {
-                    char c = client.read();
-                    if (c == '\n') break;
-                    if (c != '\r') req_line += c;
-                }
-                Serial.print("HTTP request line: ");
-                Serial.println(req_line);
-                // Only buffer and process upload for POST /upload
-                if (req_line.startsWith("POST /upload")) {
-                    // Read headers until blank line
-                    String headers = "";
-                    int content_length = 0;
-                    while (client.connected()) {
-                        String line = "";
-                        while (client.available()) {
-                            char c = client.read();
-                            if (c == '\n') break;
-                            if (c != '\r') line += c;
-                        }
-                        if (line.length() == 0) break; // End of headers
-                        headers += line + "\n";
-                        if (line.startsWith("Content-Length:")) {
-                            content_length = line.substring(15).toInt();
-                        }
-                    }
-                    Serial.print("Content-Length: "); Serial.println(content_length);
-                    // Now read the body (uploaded file)
-                    size_t upload_bytes = 0;
-                    bool upload_too_large = false;
-                    const size_t MAX_UPLOAD_SIZE = 1024 * 1024; // 1MB
-                    unsigned long timeout = millis() + 10000;
-                    String code = "";
-                    while (client.connected() && upload_bytes < content_length && millis() < timeout) {
-                        while (client.available() && upload_bytes < content_length) {
-                            char c = client.read();
-                            code += c;
-                            upload_bytes++;
-                            if (upload_bytes % 1024 == 0) {
-                                Serial.print("Upload progress: ");
-                                Serial.print(upload_bytes);
-                                Serial.println(" bytes received");
-                            }
-                            if (upload_bytes > MAX_UPLOAD_SIZE) {
-                                Serial.println("ERROR: Uploaded file exceeds 1MB. Aborting upload.");
-                                upload_too_large = true;
-                                break;
-                            }
-                            timeout = millis() + 10000;
-                        }
-                        if (upload_too_large) break;
-                    }
-                    if (upload_too_large) {
-                        client.println("HTTP/1.1 413 Payload Too Large");
-                        client.println("Content-Type: text/plain");
-                        client.println("Connection: close");
-                        client.println();
-                        client.println("ERROR: Uploaded file exceeds 1MB. Aborting upload.");
-                        client.stop();
-                        continue;
-                    }
-                    if (upload_bytes == 0) {
-                        Serial.println("No data received from client.");
-                    }
-                    if (millis() >= timeout) {
-                        Serial.println("ERROR: Upload timed out (no data for 10s). Aborting.");
-                        client.println("HTTP/1.1 408 Request Timeout");
-                        client.println("Content-Type: text/plain");
-                        client.println("Connection: close");
-                        client.println();
-                        client.println("ERROR: Upload timed out (no data for 10s). Aborting.");
-                        client.stop();
-                        continue;
-                    }
-                    Serial.println("--- Received uploaded code ---");
-                    Serial.println(code);
-                    Serial.println("-----------------------------");
-                    // Write to non-primary partition (slot B if active is A, else slot A)
-                    uint32_t target_addr = (init_meta.active_slot == 0) ? SLOT_B_ADDRESS : SLOT_A_ADDRESS;
-                    // Parse multipart/form-data to extract the binary payload
-                    int bin_start = -1, bin_end = -1;
-                    // Find the start of the binary (after the first double CRLF after Content-Type)
-                    int content_type_idx = code.indexOf("Content-Type:");
-                    if (content_type_idx >= 0) {
-                        int bin_hdr_end = code.indexOf("\r\n\r\n", content_type_idx);
-                        if (bin_hdr_end >= 0) {
-                            bin_start = bin_hdr_end + 4;
-                            // Find the boundary at the end
-                            String boundary = code.substring(0, code.indexOf("\r\n"));
-                            bin_end = code.indexOf(boundary, bin_start) - 4; // -4 to remove trailing CRLF
-                        }
-                    }
-                    if (bin_start >= 0 && bin_end > bin_start) {
-                        Serial.print("Extracted binary payload: start=");
-                        Serial.print(bin_start);
-                        Serial.print(", end=");
-                        Serial.println(bin_end);
-                        int bin_len = bin_end - bin_start;
-                        // Write only the binary payload to flash
-                        flash_erase_sector(target_addr);
-                        flash_write(target_addr, code.c_str() + bin_start, bin_len);
-                        Serial.print("Wrote "); Serial.print(bin_len); Serial.println(" bytes of firmware to flash partition.");
-                    } else {
-                        Serial.println("ERROR: Could not parse firmware binary from multipart upload. Aborting.");
-                        client.println("HTTP/1.1 400 Bad Request");
-                        client.println("Content-Type: text/plain");
-                        client.println("Connection: close");
-                        client.println();
-                        client.println("ERROR: Could not parse firmware binary from upload. Make sure you are uploading a .bin file.");
-                        client.stop();
-                        continue;
-                    }
-                    Serial.println("Code written to flash partition.");
-                    // Update metadata: set new slot as valid and active, invalidate the other
-                    if (init_meta.active_slot == 0) {
-                        init_meta.valid_b = 1;
-                        init_meta.active_slot = 1;
-                        init_meta.valid_a = 0;
-                    } else {
-                        init_meta.valid_a = 1;
-                        init_meta.active_slot = 0;
-                        init_meta.valid_b = 0;
-                    }
-                    save_metadata(init_meta);
-                    Serial.println("Metadata updated. Rebooting to new application...");
-                    client.println("HTTP/1.1 200 OK");
-                    client.println("Content-Type: text/plain");
-                    client.println("Connection: close");
-                    client.println();
-                    client.println("Upload received. Code written to partition. Rebooting...");
-                    client.stop();
-                    delay(100);
-                    SCB_AIRCR = 0x05FA0004;
-                    while (1);
-                } else if (req_line.startsWith("GET / ") || req_line.startsWith("GET /HTTP")) {
-                    // Serve upload form for GET /
-                    client.println("HTTP/1.1 200 OK");
-                    client.println("Content-Type: text/html");
-                    client.println("Connection: close");
-                    client.println();
-                    client.println("<html><head><title>S3BL Recovery</title></head><body>");
-                    client.println("<h2>S3BL Recovery Mode</h2>");
-                    client.println("<h2>Upload Compiled Firmware (.bin)</h2>");
-                    client.println("<p style='color:red'><b>NOTE:</b> Only compiled binary files (.bin) generated for Teensy 4.0 are supported. Do NOT upload C++ source code. The file must start with a valid ARM Cortex-M7 vector table.</p>");
-                    client.println("<form method='POST' action='/upload' enctype='multipart/form-data'>");
-                    client.println("<input type='file' name='firmware' accept='.bin'><br><br>");
-                    client.println("<input type='submit' value='Upload Firmware'>");
-                    client.println("</form>");
-                    client.println("<hr>");
-                    client.println("<h3>Advanced: Upload Raw Code (NOT SUPPORTED)</h3>");
-                    client.println("<p style='color:orange'>Uploading C++ code as text will NOT work. Only compiled .bin files are supported.</p>");
-                    client.println("<form method='POST' action='/upload' enctype='text/plain'>");
-                    client.println("<textarea name='code' rows='16' cols='60'></textarea><br>");
-                    client.println("<input type='submit' value='Upload Code (Not Supported)'>");
-                    client.println("</form>");
-                    client.println("</body></html>");
-                    client.stop();
-                    continue;
-                } else {
-                    // Fallback: print request
-                    Serial.println("--- Received HTTP data ---");
-                    Serial.println(req_line);
-                    Serial.println("--------------------------");
-                    client.println("HTTP/1.1 200 OK");
-                    client.println("Content-Type: text/plain");
-                    client.println("Connection: close");
-                    client.println();
-                    client.println("S3BL Recovery Mode: Data received. Check serial for content.");
-                    client.stop();
-                }
-            }
-            delay(10);
-        }
-    }
+    // Storage, verifier, logger and recovery transport are picked per environment in boot_policies.h
+    Bootloader::run();
 }
 void loop() {
     // Just print a heartbeat message every few seconds
-    Serial.println("Bootloader running...");
+    Log.println("Bootloader running...");
     delay(5000);
 }
\ No newline at end of file
@@ -0,0 +1,402 @@
+#include "manifest.h"
+#include "boot_clock.h"
+#include "rate_limit.h"
+
+#define MANIFEST_MAGIC        0x53334D46 // "S3MF"
+#define MANIFEST_IDLE_TIMEOUT 10000
+#define MANIFEST_BODY_MAX     1024
+
+static manifest_t manifest;
+static bool manifest_active = false;
+
+DMAMEM static uint8_t manifest_sector_buf[SECTOR_SIZE] __attribute__((aligned(32)));
+static uint8_t manifest_chunk[1024];
+
+void data_partition_path(char* out, size_t size, const char* name, uint32_t slot) {
+    snprintf(out, size, "/%s_%c.bin", name, slot == 0 ? 'a' : 'b');
+}
+
+// The slot commit_inactive_slot will mark, also for a placed image that is booted (image_alloc.h),
+// and the data partitions that go with it
+static uint32_t inactive_slot(const boot_metadata_t& meta_data) {
+    return inactive_slot_address(meta_data) == SLOT_A_ADDRESS ? 0 : 1;
+}
+
+static uint32_t staging_slot() {
+    return manifest.staging_slot;
+}
+
+static uint32_t staging_slot_address() {
+    return staging_slot() == 0 ? SLOT_A_ADDRESS : SLOT_B_ADDRESS;
+}
+
+// A commit through another path, or another placed image booted, moves the inactive slot
+static bool manifest_current(const boot_metadata_t& meta_data) {
+    return manifest.base_slot == meta_data.active_slot && manifest.staging_slot == inactive_slot(meta_data);
+}
+
+// Same tmp + rename pattern as the metadata, a reset never leaves a torn manifest behind
+static void save_manifest(FS& fs) {
+    fs.remove("/manifest.tmp");
+    File f = fs.open("/manifest.tmp", FILE_WRITE);
+    if (!f) {
+        Log.println("Failed to open manifest.tmp for writing!");
+        return;
+    }
+    f.write((const uint8_t*)&manifest, sizeof(manifest));
+    f.close();
+    fs.rename("/manifest.tmp", "/manifest.bin");
+}
+
+static void drop_manifest(FS& fs) {
+    manifest_active = false;
+    fs.remove("/manifest.bin");
+}
+
+// Data partitions resume from what the filesystem actually holds
+static uint32_t data_partition_size(FS& fs, const manifest_image_t& img) {
+    char path[MANIFEST_NAME_SIZE + 8];
+    data_partition_path(path, sizeof(path), img.name, staging_slot());
+    File f = fs.open(path, FILE_READ);
+    if (!f) return 0;
+    uint32_t size = f.size();
+    f.close();
+    return size;
+}
+
+void manifest_begin(FS& fs, const boot_metadata_t& meta_data) {
+    File f = fs.open("/manifest.bin", FILE_READ);
+    if (!f) return;
+    bool ok = f.size() == sizeof(manifest) && f.read((uint8_t*)&manifest, sizeof(manifest)) == sizeof(manifest);
+    f.close();
+    if (!ok || manifest.magic != MANIFEST_MAGIC || manifest.count > MANIFEST_MAX_IMAGES) {
+        drop_manifest(fs);
+        return;
+    }
+    if (!manifest_current(meta_data)) {
+        // Committed (or replaced by another upload path) before the manifest was removed
+        Log.println("Manifest: staged release is stale, dropped.");
+        drop_manifest(fs);
+        return;
+    }
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        manifest_image_t& img = manifest.images[i];
+        if (img.target == MANIFEST_TARGET_DATA) img.received = min(data_partition_size(fs, img), img.length);
+    }
+    manifest_active = true;
+    Log.print("Manifest: resuming staged release with "); Log.print(manifest.count); Log.println(" image(s).");
+}
+
+static void manifest_status(Client& client) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: text/plain");
+    client.println("Connection: close");
+    client.println();
+    client.print("state="); client.println(manifest_active ? "staging" : "empty");
+    if (manifest_active) {
+        client.print("base_slot="); client.println(manifest.base_slot);
+        client.print("staging_slot="); client.println(staging_slot() == 0 ? "a" : "b");
+        for (uint32_t i = 0; i < manifest.count; i++) {
+            const manifest_image_t& img = manifest.images[i];
+            client.print("image="); client.print(img.name);
+            client.print(" target="); client.print(img.target == MANIFEST_TARGET_SLOT ? "slot" : "data");
+            client.print(" length="); client.print(img.length);
+            client.print(" received="); client.println(img.received);
+        }
+    }
+    client.stop();
+}
+
+static size_t read_headers(Client& client, unsigned long* first, unsigned long* last, unsigned long* total, bool* have_range) {
+    size_t content_length = 0;
+    String line;
+    do {
+        http_read_line(client, line);
+        if (line.startsWith("Content-Length:")) {
+            content_length = line.substring(15).toInt();
+        } else if (have_range && line.startsWith("Content-Range:")) {
+            *have_range = sscanf(line.c_str() + 14, " bytes %lu-%lu/%lu", first, last, total) == 3;
+        }
+    } while (line.length() > 0);
+    return content_length;
+}
+
+static bool valid_name(const char* name) {
+    if (!*name) return false;
+    for (const char* p = name; *p; p++) {
+        if (!isalnum(*p) && *p != '_' && *p != '-') return false;
+    }
+    return true;
+}
+
+// Parses the manifest body into m; returns an error message or NULL
+static const char* parse_manifest(char* body, manifest_t& m) {
+    memset(&m, 0, sizeof(m));
+    m.magic = MANIFEST_MAGIC;
+    int slots = 0;
+    for (char* line = strtok(body, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        if (*line == 0 || *line == '#') continue;
+        if (m.count == MANIFEST_MAX_IMAGES) return "ERROR: Too many images in manifest.";
+        manifest_image_t& img = m.images[m.count];
+        char name[MANIFEST_NAME_SIZE], target[8], hex[65];
+        unsigned long length;
+        if (sscanf(line, "%15s %7s %lu %64s", name, target, &length, hex) != 4 || !valid_name(name)) {
+            return "ERROR: Manifest lines are '<name> <slot|data> <length> <sha256>'.";
+        }
+        for (uint32_t i = 0; i < m.count; i++) {
+            if (strcmp(m.images[i].name, name) == 0) return "ERROR: Duplicate image name in manifest.";
+        }
+        strcpy(img.name, name);
+        img.length = length;
+        if (strcmp(target, "slot") == 0) {
+            img.target = MANIFEST_TARGET_SLOT;
+            slots++;
+            if (length == 0 || length > SLOT_SIZE) return "ERROR: Slot image does not fit in a slot.";
+        } else if (strcmp(target, "data") == 0) {
+            img.target = MANIFEST_TARGET_DATA;
+            if (length == 0 || length > DATA_PARTITION_MAX_SIZE) return "ERROR: Data image exceeds the partition size.";
+        } else {
+            return "ERROR: Unknown image target.";
+        }
+        if (!sha256_from_hex(hex, img.sha256)) return "ERROR: Bad SHA-256 in manifest.";
+        m.count++;
+    }
+    // Committing flips active_slot, which only makes sense with a new application in the other slot
+    if (slots != 1) return "ERROR: A manifest needs exactly one slot image.";
+    return NULL;
+}
+
+static bool same_release(const manifest_t& a, const manifest_t& b) {
+    if (a.count != b.count) return false;
+    for (uint32_t i = 0; i < a.count; i++) {
+        const manifest_image_t& x = a.images[i];
+        const manifest_image_t& y = b.images[i];
+        if (strcmp(x.name, y.name) != 0 || x.target != y.target || x.length != y.length ||
+            memcmp(x.sha256, y.sha256, SHA256_DIGEST_SIZE) != 0) return false;
+    }
+    return true;
+}
+
+static void handle_post(Client& client, FS& fs, const boot_metadata_t& meta_data) {
+    size_t content_length = read_headers(client, NULL, NULL, NULL, NULL);
+    static char body[MANIFEST_BODY_MAX + 1];
+    if (content_length == 0 || content_length > MANIFEST_BODY_MAX) {
+        http_respond(client, "400 Bad Request", "ERROR: Manifest body missing or too large.");
+        return;
+    }
+    size_t len = 0;
+    unsigned long last_rx = millis();
+    while (len < content_length && client.connected() && millis() - last_rx < MANIFEST_IDLE_TIMEOUT) {
+        int got = client.read((uint8_t*)body + len, content_length - len);
+        if (got > 0) {
+            len += got;
+            last_rx = millis();
+        }
+    }
+    body[len] = 0;
+    static manifest_t parsed;
+    const char* error = len == content_length ? parse_manifest(body, parsed) : "ERROR: Manifest body incomplete.";
+    if (error) {
+        http_respond(client, "400 Bad Request", error);
+        return;
+    }
+    parsed.base_slot = meta_data.active_slot;
+    parsed.staging_slot = inactive_slot(meta_data);
+    if (manifest_active && same_release(manifest, parsed)) {
+        Log.println("Manifest: same release posted again, keeping progress.");
+    } else {
+        manifest = parsed;
+        manifest_active = true;
+        // Stale partial data partitions from an older release must not be appended to
+        for (uint32_t i = 0; i < manifest.count; i++) {
+            if (manifest.images[i].target != MANIFEST_TARGET_DATA) continue;
+            char path[MANIFEST_NAME_SIZE + 8];
+            data_partition_path(path, sizeof(path), manifest.images[i].name, staging_slot());
+            fs.remove(path);
+        }
+        save_manifest(fs);
+        Log.print("Manifest: staging "); Log.print(manifest.count); Log.println(" image(s).");
+    }
+    manifest_status(client);
+}
+
+static bool verify_image(FS& fs, const manifest_image_t& img) {
+    sha256_ctx_t sha;
+    sha256_init(sha);
+    if (img.target == MANIFEST_TARGET_SLOT) {
+        // Hash what actually landed in flash, which also catches programming errors
+        arm_dcache_delete((void*)staging_slot_address(), img.length);
+        sha256_update(sha, (const uint8_t*)staging_slot_address(), img.length);
+    } else {
+        char path[MANIFEST_NAME_SIZE + 8];
+        data_partition_path(path, sizeof(path), img.name, staging_slot());
+        File f = fs.open(path, FILE_READ);
+        if (!f || f.size() != img.length) return false;
+        int got;
+        while ((got = f.read(manifest_chunk, sizeof(manifest_chunk))) > 0) {
+            sha256_update(sha, manifest_chunk, got);
+        }
+        f.close();
+    }
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(sha, digest);
+    return memcmp(digest, img.sha256, SHA256_DIGEST_SIZE) == 0;
+}
+
+// Verifies every image and commits them all with one metadata write
+static bool commit_release(Client& client, FS& fs, boot_metadata_t& meta_data) {
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        manifest_image_t& img = manifest.images[i];
+        boot_phase_begin(BOOT_PHASE_VERIFY);
+        bool ok = verify_image(fs, img);
+        boot_phase_end(BOOT_PHASE_VERIFY);
+        if (ok) continue;
+        Log.print("Manifest: SHA-256 mismatch on "); Log.println(img.name);
+        img.received = 0;
+        if (img.target == MANIFEST_TARGET_DATA) {
+            char path[MANIFEST_NAME_SIZE + 8];
+            data_partition_path(path, sizeof(path), img.name, staging_slot());
+            fs.remove(path);
+        }
+        save_manifest(fs);
+        http_respond(client, "422 Unprocessable Entity", "ERROR: Image hash mismatch, that image has to be sent again.");
+        return false;
+    }
+    uint32_t slot_length = 0;
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        if (manifest.images[i].target == MANIFEST_TARGET_SLOT) slot_length = manifest.images[i].length;
+    }
+    commit_inactive_slot(meta_data, slot_length);
+    drop_manifest(fs);
+    Log.println("Manifest: release verified and committed.");
+    http_respond(client, "200 OK", "Release verified and committed.");
+    return true;
+}
+
+static bool handle_put(Client& client, const String& req_line, FS& fs, boot_metadata_t& meta_data) {
+    unsigned long first = 0, last = 0, total = 0;
+    bool have_range = false;
+    size_t content_length = read_headers(client, &first, &last, &total, &have_range);
+    int name_start = strlen("PUT /manifest/");
+    String name = req_line.substring(name_start, req_line.indexOf(' ', name_start));
+    manifest_image_t* img = NULL;
+    for (uint32_t i = 0; manifest_active && i < manifest.count; i++) {
+        if (name == manifest.images[i].name) img = &manifest.images[i];
+    }
+    if (!img) {
+        http_respond(client, "404 Not Found", "ERROR: No such image in the staged manifest.");
+        return false;
+    }
+    if (!have_range || total != img->length || last < first || last >= total || content_length != last - first + 1) {
+        http_respond(client, "400 Bad Request", "ERROR: PUT needs Content-Range and Content-Length matching the manifest.");
+        return false;
+    }
+    if (first != img->received) {
+        char msg[48];
+        snprintf(msg, sizeof(msg), "ERROR: Resume at %lu.", (unsigned long)img->received);
+        http_respond(client, "416 Range Not Satisfiable", msg);
+        return false;
+    }
+
+    uint32_t done = 0;
+    unsigned long last_rx = millis();
+    if (img->target == MANIFEST_TARGET_SLOT) {
+        slot_writer_t writer;
+        slot_writer_begin(writer, staging_slot_address() + first, manifest_sector_buf);
+        uint32_t next_save = (first / FLASH_BLOCK_SIZE + 1) * FLASH_BLOCK_SIZE;
+        while (done < content_length) {
+            int n = client.available();
+            if (n <= 0) {
+                if (!client.connected() || millis() - last_rx > MANIFEST_IDLE_TIMEOUT) break;
+                continue;
+            }
+            size_t want = rate_limit_allow(min((size_t)n, min(sizeof(manifest_chunk), (size_t)(content_length - done))));
+            if (want == 0) {
+                rate_limit_defer();
+                continue;
+            }
+            int got = client.read(manifest_chunk, want);
+            if (got <= 0) continue;
+            rate_limit_used(got);
+            slot_writer_write(writer, manifest_chunk, got);
+            done += got;
+            last_rx = millis();
+            // Persist the resume point now and then; sectors past it are simply written again
+            uint32_t flushed = first + writer.offset - writer.fill;
+            if (flushed >= next_save) {
+                img->received = flushed;
+                save_manifest(fs);
+                next_save += FLASH_BLOCK_SIZE;
+            }
+        }
+        slot_writer_finish(writer);
+        // A trailing partial sector is erased and rewritten by the next range
+        uint32_t end = first + done;
+        img->received = (end == img->length) ? end : end & ~(SECTOR_SIZE - 1);
+    } else {
+        char path[MANIFEST_NAME_SIZE + 8];
+        data_partition_path(path, sizeof(path), img->name, staging_slot());
+        File f = fs.open(path, FILE_WRITE);
+        if (!f || f.size() != first) {
+            if (f) f.close();
+            img->received = data_partition_size(fs, *img);
+            http_respond(client, "409 Conflict", "ERROR: Data partition out of step with the manifest, query the status.");
+            return false;
+        }
+        while (done < content_length) {
+            int n = client.available();
+            if (n <= 0) {
+                if (!client.connected() || millis() - last_rx > MANIFEST_IDLE_TIMEOUT) break;
+                continue;
+            }
+            size_t want = rate_limit_allow(min((size_t)n, min(sizeof(manifest_chunk), (size_t)(content_length - done))));
+            if (want == 0) {
+                rate_limit_defer();
+                continue;
+            }
+            int got = client.read(manifest_chunk, want);
+            if (got <= 0) continue;
+            rate_limit_used(got);
+            if (f.write(manifest_chunk, got) != (size_t)got) break;
+            done += got;
+            last_rx = millis();
+        }
+        f.close();
+        img->received = data_partition_size(fs, *img);
+    }
+    save_manifest(fs);
+    if (done != content_length) {
+        Log.print("Manifest: transfer of "); Log.print(img->name); Log.println(" interrupted.");
+        client.stop();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        if (manifest.images[i].received != manifest.images[i].length) {
+            http_respond(client, "202 Accepted", "Range stored.");
+            return false;
+        }
+    }
+    return commit_release(client, fs, meta_data);
+}
+
+bool manifest_handle(Client& client, const String& req_line, FS& fs, boot_metadata_t& meta_data) {
+    if (manifest_active && !manifest_current(meta_data)) {
+        // Another upload path committed in the meantime, the staged areas are no longer inactive
+        Log.println("Manifest: active slot changed, staged release dropped.");
+        drop_manifest(fs);
+    }
+    if (req_line.startsWith("POST /manifest")) {
+        handle_post(client, fs, meta_data);
+    } else if (req_line.startsWith("PUT /manifest/")) {
+        return handle_put(client, req_line, fs, meta_data);
+    } else if (req_line.startsWith("DELETE /manifest")) {
+        read_headers(client, NULL, NULL, NULL, NULL);
+        drop_manifest(fs);
+        http_respond(client, "200 OK", "Staged release dropped.");
+    } else {
+        read_headers(client, NULL, NULL, NULL, NULL);
+        manifest_status(client);
+    }
+    return false;
+}
@@ -0,0 +1,204 @@
+// MQTT-triggered update notifications.
+// Keep-alive costs one 2 byte PINGREQ per keep-alive interval, and only when nothing else was sent.
+
+#include "mqtt_client.h"
+#include <Ethernet.h>
+#include "peer.h"
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82 // Reserved flag bits must be 0010
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+
+static EthernetClient mqtt;
+static net_config_t mqtt_cfg;
+static char mqtt_client_id[24];
+static char mqtt_topic[48];
+static uint8_t mqtt_buf[MQTT_MAX_PACKET];
+static bool mqtt_session = false;        // CONNACK received
+static unsigned long mqtt_last_tx;
+static unsigned long mqtt_ping_sent;     // 0 when no PINGRESP is outstanding
+static unsigned long mqtt_next_attempt;
+static uint32_t mqtt_backoff = MQTT_RETRY_MIN_MS;
+static uint16_t mqtt_packet_id = 1;
+
+static size_t put_string(uint8_t* p, const char* s) {
+    size_t len = strlen(s);
+    p[0] = len >> 8;
+    p[1] = len;
+    memcpy(p + 2, s, len);
+    return len + 2;
+}
+
+// Fixed header with the variable length "remaining length" encoding
+static void mqtt_send(uint8_t type, const uint8_t* body, size_t len) {
+    uint8_t hdr[5];
+    size_t n = 0;
+    hdr[n++] = type;
+    size_t rem = len;
+    do {
+        uint8_t b = rem & 0x7F;
+        rem >>= 7;
+        hdr[n++] = rem ? (b | 0x80) : b;
+    } while (rem);
+    mqtt.write(hdr, n);
+    if (len) mqtt.write(body, len);
+    mqtt_last_tx = millis();
+}
+
+static bool mqtt_read_byte(uint8_t& b, unsigned long deadline) {
+    while (!mqtt.available()) {
+        if (!mqtt.connected() || millis() > deadline) return false;
+    }
+    b = mqtt.read();
+    return true;
+}
+
+// Reads one complete packet. Packets too big for mqtt_buf are consumed and reported with len = 0.
+static bool mqtt_read_packet(uint8_t& type, size_t& len) {
+    unsigned long deadline = millis() + 2000;
+    uint8_t b;
+    if (!mqtt_read_byte(type, deadline)) return false;
+    size_t rem = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (!mqtt_read_byte(b, deadline)) return false;
+        rem |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+    }
+    len = 0;
+    for (size_t i = 0; i < rem; i++) {
+        if (!mqtt_read_byte(b, deadline)) return false;
+        if (rem <= sizeof(mqtt_buf)) mqtt_buf[len++] = b;
+    }
+    return true;
+}
+
+static void mqtt_disconnect(const char* why) {
+    Log.print("MQTT: "); Log.println(why);
+    mqtt.stop();
+    mqtt_session = false;
+    mqtt_next_attempt = millis() + mqtt_backoff;
+    mqtt_backoff = min(mqtt_backoff * 2, (uint32_t)MQTT_RETRY_MAX_MS);
+}
+
+static void mqtt_connect() {
+    IPAddress broker(mqtt_cfg.mqtt_broker);
+    if (!mqtt.connect(broker, mqtt_cfg.mqtt_port)) {
+        mqtt_disconnect("broker unreachable");
+        return;
+    }
+    uint8_t body[64];
+    size_t n = put_string(body, "MQTT");
+    body[n++] = 4;     // Protocol level 3.1.1
+    body[n++] = 0x02;  // Clean session
+    body[n++] = mqtt_cfg.mqtt_keepalive >> 8;
+    body[n++] = mqtt_cfg.mqtt_keepalive;
+    n += put_string(body + n, mqtt_client_id);
+    mqtt_send(MQTT_CONNECT, body, n);
+
+    uint8_t type;
+    size_t len;
+    if (!mqtt_read_packet(type, len) || (type & 0xF0) != MQTT_CONNACK || len < 2 || mqtt_buf[1] != 0) {
+        mqtt_disconnect("connection refused");
+        return;
+    }
+    // QoS 1, so a retained announcement published while we were offline is delivered reliably
+    n = 0;
+    body[n++] = mqtt_packet_id >> 8;
+    body[n++] = mqtt_packet_id++;
+    n += put_string(body + n, mqtt_topic);
+    body[n++] = 1;
+    mqtt_send(MQTT_SUBSCRIBE, body, n);
+    mqtt_session = true;
+    mqtt_ping_sent = 0;
+    mqtt_backoff = MQTT_RETRY_MIN_MS;
+    Log.print("MQTT: subscribed to "); Log.println(mqtt_topic);
+}
+
+// Returns true if the announcement was valid and the image got installed
+static bool mqtt_handle_publish(uint8_t flags, size_t len, boot_metadata_t& meta_data) {
+    if (len < 2) return false;
+    size_t topic_len = (mqtt_buf[0] << 8) | mqtt_buf[1];
+    size_t p = 2 + topic_len;
+    uint8_t qos = (flags >> 1) & 3;
+    if (qos) {
+        if (p + 2 > len) return false;
+        uint8_t ack[2] = { mqtt_buf[p], mqtt_buf[p + 1] };
+        mqtt_send(MQTT_PUBACK, ack, 2);
+        p += 2;
+    }
+    if (p > len) return false;
+    char payload[256];
+    size_t plen = min(len - p, sizeof(payload) - 1);
+    memcpy(payload, mqtt_buf + p, plen);
+    payload[plen] = 0;
+    Log.print("MQTT: announcement: "); Log.println(payload);
+
+    uint8_t sha[SHA256_DIGEST_SIZE];
+    uint8_t root[SHA256_DIGEST_SIZE];
+    char url[160] = "";
+    bool have_sha = false, have_root = false;
+    for (char* tok = strtok(payload, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        if (!strncmp(tok, "sha256=", 7)) have_sha = strlen(tok + 7) == 64 && sha256_from_hex(tok + 7, sha);
+        else if (!strncmp(tok, "chunks=", 7)) have_root = strlen(tok + 7) == 64 && sha256_from_hex(tok + 7, root);
+        else if (!strncmp(tok, "url=", 4)) strncpy(url, tok + 4, sizeof(url) - 1);
+    }
+    if (!have_sha || !url[0]) {
+        Log.println("MQTT: announcement needs sha256=<hex> and url=<http url>, ignored.");
+        return false;
+    }
+    return peer_update(url, sha, have_root ? root : NULL, meta_data);
+}
+
+void mqtt_begin(const net_config_t& cfg, const uint8_t* mac) {
+    mqtt_cfg = cfg;
+    snprintf(mqtt_client_id, sizeof(mqtt_client_id), "s3bl-%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    snprintf(mqtt_topic, sizeof(mqtt_topic), MQTT_TOPIC_PREFIX "%02x%02x%02x%02x%02x%02x" MQTT_TOPIC_SUFFIX,
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    mqtt_next_attempt = millis();
+    if (mqtt_enabled()) {
+        Log.print("MQTT: broker "); Log.print(IPAddress(cfg.mqtt_broker)); Log.print(":"); Log.println(cfg.mqtt_port);
+    }
+}
+
+bool mqtt_enabled() {
+    return mqtt_cfg.mqtt_broker != 0;
+}
+
+bool mqtt_poll(boot_metadata_t& meta_data) {
+    if (!mqtt_enabled()) return false;
+    if (!mqtt_session) {
+        if ((long)(millis() - mqtt_next_attempt) >= 0) mqtt_connect();
+        return false;
+    }
+    if (!mqtt.connected()) {
+        mqtt_disconnect("connection lost");
+        return false;
+    }
+    bool installed = false;
+    while (mqtt.available()) {
+        uint8_t type;
+        size_t len;
+        if (!mqtt_read_packet(type, len)) {
+            mqtt_disconnect("malformed packet");
+            return false;
+        }
+        mqtt_ping_sent = 0; // Any packet proves the broker is alive
+        if ((type & 0xF0) == MQTT_PUBLISH) {
+            installed |= mqtt_handle_publish(type & 0x0F, len, meta_data);
+        }
+    }
+    if (!mqtt_cfg.mqtt_keepalive) return installed;
+    if (mqtt_ping_sent && millis() - mqtt_ping_sent > mqtt_cfg.mqtt_keepalive * 500UL) {
+        mqtt_disconnect("no PINGRESP from broker");
+    } else if (!mqtt_ping_sent && millis() - mqtt_last_tx >= mqtt_cfg.mqtt_keepalive * 750UL) {
+        mqtt_send(MQTT_PINGREQ, NULL, 0);
+        mqtt_ping_sent = millis() | 1;
+    }
+    return installed;
+}
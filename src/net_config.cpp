@@ -0,0 +1,40 @@
+#include "net_config.h"
+#include "boot_log.h"
+#include <Ethernet.h>
+
+void net_config_defaults(net_config_t& cfg) {
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.magic = NET_CONFIG_MAGIC;
+    IPAddress broker;
+    if (broker.fromString(MQTT_BROKER_DEFAULT)) cfg.mqtt_broker = (uint32_t)broker;
+    cfg.mqtt_port = MQTT_PORT_DEFAULT;
+    cfg.mqtt_keepalive = MQTT_KEEPALIVE_DEFAULT;
+    IPAddress syslog;
+    if (syslog.fromString(SYSLOG_SERVER_DEFAULT)) cfg.syslog_server = (uint32_t)syslog;
+    cfg.syslog_port = SYSLOG_PORT_DEFAULT;
+    cfg.syslog_rate = SYSLOG_RATE_DEFAULT;
+    cfg.upload_rate = UPLOAD_RATE_DEFAULT;
+}
+
+bool load_net_config(FS& fs, net_config_t& cfg) {
+    net_config_defaults(cfg);
+    File f = fs.open("/netcfg.bin", FILE_READ);
+    if (!f) return false;
+    net_config_t stored;
+    size_t len = min((size_t)f.size(), sizeof(stored));
+    bool ok = len >= sizeof(stored.magic) && f.read((uint8_t*)&stored, len) == len && stored.magic == NET_CONFIG_MAGIC;
+    f.close();
+    if (ok) memcpy(&cfg, &stored, len);
+    return ok;
+}
+
+void save_net_config(FS& fs, const net_config_t& cfg) {
+    fs.remove("/netcfg.bin");
+    File f = fs.open("/netcfg.bin", FILE_WRITE);
+    if (f) {
+        f.write((const uint8_t*)&cfg, sizeof(cfg));
+        f.close();
+    } else {
+        Log.println("Failed to open netcfg.bin for writing!");
+    }
+}
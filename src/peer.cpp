@@ -0,0 +1,544 @@
+#include "peer.h"
+#include <Ethernet.h>
+#include "boot_clock.h"
+#include "image_alloc.h"
+#include "pull_update.h"
+#include "rate_limit.h"
+
+#define PEER_IDLE_TIMEOUT 5000
+#define PEER_MAX_STRIKES  2      // Failed or bad chunks before a peer is left out of the current fetch
+
+#define PEER_CHUNK_PENDING 0
+#define PEER_CHUNK_BUSY    1
+#define PEER_CHUNK_DONE    2
+
+// The image this device serves: the one it boots
+typedef struct {
+    uint32_t base;
+    uint32_t length;
+    uint32_t chunks;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    uint8_t hashes[PEER_CHUNKS][SHA256_DIGEST_SIZE];
+    bool valid;
+} peer_image_t;
+
+typedef struct {
+    IPAddress ip;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    uint32_t length;
+    bool fetching;            // Pulling the image upstream, nothing to serve yet
+    uint8_t strikes;
+    unsigned long last_seen;  // 0 = free entry
+} peer_t;
+
+typedef struct {
+    EthernetClient client;
+    slot_writer_t writer;
+    int peer;
+    uint32_t chunk;
+    uint32_t length;
+    unsigned long last_rx;
+    bool active;
+} peer_conn_t;
+
+static EthernetUDP peer_udp;
+static bool peer_started;
+static peer_image_t peer_image;
+static peer_t peers[PEER_MAX];
+static const uint8_t* peer_fetching_sha;  // Set while pull_update runs for that image
+static unsigned long peer_last_advert;
+static bool peer_seeding;
+static unsigned long peer_seed_start;
+static unsigned long peer_last_served;
+static uint32_t peer_chunks_served;
+static char peer_packet[160];
+
+DMAMEM static uint8_t peer_sector_buf[PEER_CONNECTIONS][SECTOR_SIZE] __attribute__((aligned(32)));
+static uint8_t peer_rx[1024];
+static uint8_t peer_hashes[PEER_CHUNKS][SHA256_DIGEST_SIZE];  // List of the image being fetched
+static uint8_t peer_chunk_state[PEER_CHUNKS];
+static uint8_t peer_chunk_tries[PEER_CHUNKS];
+static peer_conn_t peer_conns[PEER_CONNECTIONS];
+static int peer_connections = PEER_CONNECTIONS;   // The ones the socket budget leaves, peer_begin
+
+static void sha_to_hex(const uint8_t sha[SHA256_DIGEST_SIZE], char hex[2 * SHA256_DIGEST_SIZE + 1]) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[2 * i] = digits[sha[i] >> 4];
+        hex[2 * i + 1] = digits[sha[i] & 15];
+    }
+    hex[2 * SHA256_DIGEST_SIZE] = 0;
+}
+
+static IPAddress peer_broadcast() {
+    IPAddress ip = Ethernet.localIP();
+    IPAddress mask = Ethernet.subnetMask();
+    return IPAddress(ip[0] | (uint8_t)~mask[0], ip[1] | (uint8_t)~mask[1], ip[2] | (uint8_t)~mask[2], ip[3] | (uint8_t)~mask[3]);
+}
+
+// length 0 leaves the field out
+static void peer_send(IPAddress ip, const char* kind, const uint8_t sha[SHA256_DIGEST_SIZE], uint32_t length) {
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    sha_to_hex(sha, hex);
+    int n = snprintf(peer_packet, sizeof(peer_packet), "S3BL-%s sha256=%s", kind, hex);
+    if (length) n += snprintf(peer_packet + n, sizeof(peer_packet) - n, " length=%lu", (unsigned long)length);
+    peer_udp.beginPacket(ip, PEER_PORT);
+    peer_udp.write((const uint8_t*)peer_packet, n);
+    peer_udp.endPacket();
+}
+
+// Image bytes of the booted image, 0 when the metadata does not know them
+static uint32_t booted_image_length(const boot_metadata_t& m, uint32_t base) {
+    bool placed = m.active_slot == BOOT_SLOT_PLACED && m.active_image < PLACED_IMAGES && m.images[m.active_image].valid;
+    if (!placed && base == SLOT_A_ADDRESS && m.valid_a) return slot_image_length(m, 0);
+    if (!placed && base == SLOT_B_ADDRESS && m.valid_b) return slot_image_length(m, 1);
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        if (m.images[i].valid && m.images[i].base == base) return m.images[i].length;
+    }
+    return 0;
+}
+
+// Hashes every chunk and the whole image once, so serving never hashes anything
+static void peer_load_image(const boot_metadata_t& meta_data) {
+    peer_image.valid = false;
+    uint32_t footprint;
+    uint32_t base = alloc_booted(meta_data, footprint);
+    uint32_t length = base ? booted_image_length(meta_data, base) : 0;
+    if (length == 0 || length > PEER_CHUNKS * PEER_CHUNK_SIZE) return;
+    arm_dcache_delete((void*)base, length);
+    sha256_ctx_t whole, chunk;
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    sha256_init(whole);
+    uint32_t chunks = 0;
+    for (uint32_t offset = 0; offset < length; offset += PEER_CHUNK_SIZE, chunks++) {
+        const uint8_t* p = (const uint8_t*)(base + offset);
+        size_t n = min((uint32_t)PEER_CHUNK_SIZE, length - offset);
+        sha256_init(chunk);
+        sha256_update(chunk, p, n);
+        sha256_final(chunk, peer_image.hashes[chunks]);
+        sha256_update(whole, p, n);
+    }
+    sha256_final(whole, peer_image.sha256);
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    peer_image.base = base;
+    peer_image.length = length;
+    peer_image.chunks = chunks;
+    peer_image.valid = true;
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    sha_to_hex(peer_image.sha256, hex);
+    Log.print("Peer: serving "); Log.print(length); Log.print(" bytes at 0x"); Log.print(base, HEX);
+    Log.print(", sha256="); Log.println(hex);
+}
+
+void peer_begin(const boot_metadata_t& meta_data, int listeners) {
+    peer_connections = max(1, PEER_CONNECTIONS - max(0, listeners - 1));
+    peer_started = peer_udp.begin(PEER_PORT);
+    if (!peer_started) {
+        Log.println("Peer: no socket left, site propagation disabled.");
+        return;
+    }
+    peer_load_image(meta_data);
+    peer_last_advert = millis() - PEER_ADVERT_MS;
+}
+
+bool peer_active() {
+    return peer_started && (peer_image.valid || peer_seeding);
+}
+
+static void peer_record(IPAddress ip, const uint8_t sha[SHA256_DIGEST_SIZE], uint32_t length, bool fetching) {
+    int slot = -1;
+    for (int i = 0; i < PEER_MAX; i++) {
+        if (peers[i].last_seen && peers[i].ip == ip) {
+            slot = i;
+            break;
+        }
+        // Otherwise the free or least recently heard entry
+        if (slot < 0 || !peers[i].last_seen || (peers[slot].last_seen && peers[i].last_seen < peers[slot].last_seen)) slot = i;
+    }
+    peer_t& p = peers[slot];
+    if (!p.last_seen || p.ip != ip || memcmp(p.sha256, sha, SHA256_DIGEST_SIZE)) p.strikes = 0;
+    p.ip = ip;
+    memcpy(p.sha256, sha, SHA256_DIGEST_SIZE);
+    p.length = length;
+    p.fetching = fetching;
+    p.last_seen = millis() | 1;
+}
+
+static void peer_handle_packet() {
+    int len = peer_udp.read((uint8_t*)peer_packet, sizeof(peer_packet) - 1);
+    if (len <= 0) return;
+    peer_packet[len] = 0;
+    IPAddress from = peer_udp.remoteIP();
+    if (from == Ethernet.localIP()) return;  // Our own broadcast
+    const char* s = strstr(peer_packet, "sha256=");
+    uint8_t sha[SHA256_DIGEST_SIZE];
+    if (!s || strlen(s + 7) < 2 * SHA256_DIGEST_SIZE || !sha256_from_hex(s + 7, sha)) return;
+    if (!strncmp(peer_packet, "S3BL-WHOHAS ", 12)) {
+        if (peer_image.valid && !memcmp(sha, peer_image.sha256, SHA256_DIGEST_SIZE)) {
+            peer_send(from, "HAVE", sha, peer_image.length);
+        } else if (peer_fetching_sha && !memcmp(sha, peer_fetching_sha, SHA256_DIGEST_SIZE)) {
+            peer_send(from, "FETCHING", sha, 0);
+        }
+        return;
+    }
+    bool have = !strncmp(peer_packet, "S3BL-HAVE ", 10);
+    if (!have && strncmp(peer_packet, "S3BL-FETCHING ", 14)) return;
+    const char* l = strstr(peer_packet, "length=");
+    uint32_t length = l ? strtoul(l + 7, NULL, 10) : 0;
+    if (have && (length == 0 || length > PEER_CHUNKS * PEER_CHUNK_SIZE)) return;
+    peer_record(from, sha, length, !have);
+}
+
+void peer_poll() {
+    if (!peer_started) return;
+    // Drain everything queued: the socket interrupt only fires again for new datagrams
+    while (peer_udp.parsePacket() > 0) {
+        peer_handle_packet();
+    }
+    if (peer_image.valid && millis() - peer_last_advert >= PEER_ADVERT_MS) {
+        peer_last_advert = millis();
+        peer_send(peer_broadcast(), "HAVE", peer_image.sha256, peer_image.length);
+    }
+}
+
+void peer_serve(EthernetClient& client, const String& req_line) {
+    String line;
+    do {
+        http_read_line(client, line);
+    } while (line.length() > 0);
+    uint8_t sha[SHA256_DIGEST_SIZE];
+    int q = req_line.indexOf("sha256=");
+    if (!peer_image.valid || q < 0 || !sha256_from_hex(req_line.c_str() + q + 7, sha) ||
+        memcmp(sha, peer_image.sha256, SHA256_DIGEST_SIZE)) {
+        http_respond(client, "404 Not Found", "ERROR: This device does not serve that image.");
+        return;
+    }
+    const uint8_t* src;
+    uint32_t length;
+    if (req_line.startsWith("GET /peer/hashes")) {
+        src = peer_image.hashes[0];
+        length = peer_image.chunks * SHA256_DIGEST_SIZE;
+    } else {
+        q = req_line.indexOf("&n=");
+        uint32_t n = q >= 0 ? strtoul(req_line.c_str() + q + 3, NULL, 10) : peer_image.chunks;
+        if (n >= peer_image.chunks) {
+            http_respond(client, "416 Range Not Satisfiable", "ERROR: No such chunk.");
+            return;
+        }
+        src = (const uint8_t*)(peer_image.base + n * PEER_CHUNK_SIZE);
+        length = min((uint32_t)PEER_CHUNK_SIZE, peer_image.length - n * PEER_CHUNK_SIZE);
+        peer_chunks_served++;
+        peer_last_served = millis();
+    }
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/octet-stream");
+    client.print("Content-Length: "); client.println(length);
+    client.println("Connection: close");
+    client.println();
+    // Straight from XIP flash, nothing is staged in RAM
+    while (length > 0 && client.connected()) {
+        size_t n = rate_limit_allow(min(length, (uint32_t)1024));
+        if (n == 0) {
+            rate_limit_defer();
+            continue;
+        }
+        n = client.write(src, n);
+        if (n == 0) continue;
+        rate_limit_used(n);
+        src += n;
+        length -= n;
+    }
+    client.stop();
+}
+
+void peer_seed(const boot_metadata_t& meta_data) {
+    peer_load_image(meta_data);
+    peer_seeding = true;
+    peer_seed_start = millis();
+    peer_last_served = millis();
+    peer_last_advert = millis() - PEER_ADVERT_MS;
+    if (peer_image.valid) Log.println("Peer: seeding the new image to the site before rebooting.");
+}
+
+bool peer_seed_done() {
+    if (!peer_seeding) return false;
+    if (peer_started && peer_image.valid && millis() - peer_seed_start < PEER_SEED_MS &&
+        millis() - peer_last_served < PEER_SEED_IDLE_MS) return false;
+    peer_seeding = false;
+    Log.print("Peer: seed window closed, "); Log.print(peer_chunks_served); Log.println(" chunks served.");
+    return true;
+}
+
+void peer_status(Print& out) {
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    if (peer_image.valid) sha_to_hex(peer_image.sha256, hex);
+    out.print("peer_sha256="); out.println(peer_image.valid ? hex : "none");
+    out.print("peer_seeding="); out.println(peer_seeding ? 1 : 0);
+    out.print("peer_chunks_served="); out.println(peer_chunks_served);
+    out.print("peer_connections="); out.println(peer_connections);
+}
+
+static bool peer_fresh(const peer_t& p) {
+    return p.last_seen && millis() - p.last_seen < PEER_STALE_MS;
+}
+
+static int peer_count(const uint8_t sha[SHA256_DIGEST_SIZE], bool fetching) {
+    int n = 0;
+    for (int i = 0; i < PEER_MAX; i++) {
+        if (peer_fresh(peers[i]) && peers[i].fetching == fetching && !memcmp(peers[i].sha256, sha, SHA256_DIGEST_SIZE)) n++;
+    }
+    return n;
+}
+
+static bool peer_usable(int i, const uint8_t sha[SHA256_DIGEST_SIZE], uint32_t length) {
+    const peer_t& p = peers[i];
+    return peer_fresh(p) && !p.fetching && p.length == length && p.strikes < PEER_MAX_STRIKES &&
+           !memcmp(p.sha256, sha, SHA256_DIGEST_SIZE);
+}
+
+static bool read_exact(EthernetClient& client, uint8_t* buf, size_t len) {
+    unsigned long last_rx = millis();
+    while (len > 0) {
+        int n = client.available();
+        if (n <= 0) {
+            if (!client.connected() || millis() - last_rx > PEER_IDLE_TIMEOUT) return false;
+            continue;
+        }
+        int got = client.read(buf, min((size_t)n, len));
+        if (got <= 0) continue;
+        buf += got;
+        len -= got;
+        last_rx = millis();
+    }
+    return true;
+}
+
+// Sends GET /peer/<what> and reads the response headers. Returns the Content-Length of a 200
+// response, -1 otherwise (the connection is closed then).
+static long peer_request(EthernetClient& client, int p, const char* what, const uint8_t sha[SHA256_DIGEST_SIZE], long chunk) {
+    if (!client.connect(peers[p].ip, 80)) return -1;
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    sha_to_hex(sha, hex);
+    client.print("GET /peer/"); client.print(what); client.print("?sha256="); client.print(hex);
+    if (chunk >= 0) {
+        client.print("&n="); client.print(chunk);
+    }
+    client.println(" HTTP/1.0");
+    client.println("Connection: close");
+    client.println();
+    String line;
+    http_read_line(client, line, PEER_IDLE_TIMEOUT);
+    long content_length = -1;
+    if (line.startsWith("HTTP/1.") && line.substring(9, 12) == "200") {
+        do {
+            http_read_line(client, line);
+            if (line.startsWith("Content-Length:")) content_length = line.substring(15).toInt();
+        } while (line.length() > 0);
+    }
+    if (content_length < 0) client.stop();
+    return content_length;
+}
+
+static bool peer_get_hashes(int p, const uint8_t sha[SHA256_DIGEST_SIZE], uint32_t chunks, const uint8_t* root) {
+    EthernetClient client;
+    long n = peer_request(client, p, "hashes", sha, -1);
+    bool ok = n == (long)(chunks * SHA256_DIGEST_SIZE) && read_exact(client, peer_hashes[0], n);
+    client.stop();
+    if (ok && root) {
+        sha256_ctx_t ctx;
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_init(ctx);
+        sha256_update(ctx, peer_hashes[0], n);
+        sha256_final(ctx, digest);
+        ok = memcmp(digest, root, SHA256_DIGEST_SIZE) == 0;
+    }
+    if (!ok) {
+        Log.print("Peer: no usable chunk hash list from "); Log.println(peers[p].ip);
+    }
+    return ok;
+}
+
+static bool peer_conn_start(int c, int p, uint32_t chunk, uint32_t target, uint32_t length, const uint8_t sha[SHA256_DIGEST_SIZE]) {
+    peer_conn_t& conn = peer_conns[c];
+    uint32_t offset = chunk * PEER_CHUNK_SIZE;
+    uint32_t n = min((uint32_t)PEER_CHUNK_SIZE, length - offset);
+    if (peer_request(conn.client, p, "chunk", sha, chunk) != (long)n) {
+        conn.client.stop();
+        return false;
+    }
+    // A retried chunk may have been partly programmed by the attempt that failed
+    if (peer_chunk_tries[chunk]) flash_erase_range(target + offset, n);
+    slot_writer_begin(conn.writer, target + offset, peer_sector_buf[c]);
+    conn.writer.erased = true;
+    conn.peer = p;
+    conn.chunk = chunk;
+    conn.length = n;
+    conn.last_rx = millis();
+    conn.active = true;
+    peer_chunk_state[chunk] = PEER_CHUNK_BUSY;
+    return true;
+}
+
+// Moves received bytes into flash. Returns 1 once the chunk is in, -1 on a dropped or idle
+// connection, 0 otherwise.
+static int peer_conn_poll(peer_conn_t& conn) {
+    int avail = conn.client.available();
+    if (avail <= 0) {
+        if (!conn.client.connected() || millis() - conn.last_rx > PEER_IDLE_TIMEOUT) return -1;
+        return 0;
+    }
+    size_t want = rate_limit_allow(min((size_t)avail, min(sizeof(peer_rx), (size_t)(conn.length - conn.writer.offset))));
+    if (want == 0) {
+        rate_limit_defer();
+        return 0;
+    }
+    int got = conn.client.read(peer_rx, want);
+    if (got <= 0) return 0;
+    rate_limit_used(got);
+    slot_writer_write(conn.writer, peer_rx, got);
+    conn.last_rx = millis();
+    return conn.writer.offset == conn.length ? 1 : 0;
+}
+
+// Closes the connection and checks the chunk against the hash list
+static bool peer_conn_finish(peer_conn_t& conn, bool complete) {
+    conn.client.stop();
+    conn.active = false;
+    slot_writer_finish(conn.writer);
+    if (!complete) return false;
+    arm_dcache_delete((void*)conn.writer.base, conn.length);
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_init(ctx);
+    sha256_update(ctx, (const uint8_t*)conn.writer.base, conn.length);
+    sha256_final(ctx, digest);
+    return memcmp(digest, peer_hashes[conn.chunk], SHA256_DIGEST_SIZE) == 0;
+}
+
+// Chunks from every peer that has the image, peer_connections at a time, into the inactive slot
+static bool peer_fetch(const uint8_t sha[SHA256_DIGEST_SIZE], const uint8_t* root, boot_metadata_t& meta_data) {
+    uint32_t length = 0;
+    for (int i = 0; i < PEER_MAX; i++) {
+        if (peer_fresh(peers[i]) && !peers[i].fetching && !memcmp(peers[i].sha256, sha, SHA256_DIGEST_SIZE)) {
+            length = peers[i].length;
+            peers[i].strikes = 0;
+        }
+    }
+    uint32_t chunks = (length + PEER_CHUNK_SIZE - 1) / PEER_CHUNK_SIZE;
+    if (length == 0 || length > SLOT_SIZE) return false;
+    bool have_list = false;
+    for (int i = 0; i < PEER_MAX && !have_list; i++) {
+        if (!peer_usable(i, sha, length)) continue;
+        have_list = peer_get_hashes(i, sha, chunks, root);
+        if (!have_list) peers[i].strikes = PEER_MAX_STRIKES;
+    }
+    if (!have_list) return false;
+
+    uint32_t target = inactive_slot_address(meta_data);
+    Log.print("Peer: fetching "); Log.print(length); Log.print(" bytes in "); Log.print(chunks);
+    Log.print(" chunks from "); Log.print(peer_count(sha, false)); Log.println(" peer(s)");
+    unsigned long start = millis();
+    flash_erase_range(target, length);
+    memset(peer_chunk_state, PEER_CHUNK_PENDING, sizeof(peer_chunk_state));
+    memset(peer_chunk_tries, 0, sizeof(peer_chunk_tries));
+    uint32_t done = 0;
+    uint32_t next_chunk = 0;
+    int next_peer = 0;
+    while (done < chunks) {
+        bool busy = false;
+        for (int c = 0; c < peer_connections; c++) {
+            peer_conn_t& conn = peer_conns[c];
+            if (!conn.active) {
+                // Next pending chunk, round robin over the peers still in good standing
+                uint32_t chunk = chunks;
+                for (uint32_t k = 0; k < chunks && chunk == chunks; k++) {
+                    uint32_t i = (next_chunk + k) % chunks;
+                    if (peer_chunk_state[i] == PEER_CHUNK_PENDING) chunk = i;
+                }
+                if (chunk == chunks) continue;
+                int p = -1;
+                for (int k = 0; k < PEER_MAX && p < 0; k++) {
+                    if (peer_usable((next_peer + k) % PEER_MAX, sha, length)) p = (next_peer + k) % PEER_MAX;
+                }
+                if (p < 0) continue;
+                next_peer = p + 1;
+                busy = true;
+                if (!peer_conn_start(c, p, chunk, target, length, sha)) {
+                    peers[p].strikes++;
+                    continue;
+                }
+                next_chunk = chunk + 1;
+            }
+            busy = true;
+            int r = peer_conn_poll(conn);
+            if (r == 0) continue;
+            if (peer_conn_finish(conn, r > 0)) {
+                peer_chunk_state[conn.chunk] = PEER_CHUNK_DONE;
+                done++;
+            } else {
+                Log.print("Peer: chunk "); Log.print(conn.chunk); Log.print(" from ");
+                Log.print(peers[conn.peer].ip); Log.println(" failed, retrying elsewhere.");
+                peer_chunk_state[conn.chunk] = PEER_CHUNK_PENDING;
+                peer_chunk_tries[conn.chunk]++;
+                peers[conn.peer].strikes++;
+            }
+        }
+        if (!busy) break;  // Chunks left but no peer to ask
+        peer_poll();
+    }
+    for (int c = 0; c < PEER_CONNECTIONS; c++) {
+        if (peer_conns[c].active) peer_conn_finish(peer_conns[c], false);
+    }
+    if (done < chunks) {
+        Log.print("Peer: "); Log.print(chunks - done); Log.println(" chunks could not be fetched from peers.");
+        return false;
+    }
+
+    arm_dcache_delete((void*)target, length);
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    sha256_init(ctx);
+    sha256_update(ctx, (const uint8_t*)target, length);
+    sha256_final(ctx, digest);
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    if (memcmp(digest, sha, SHA256_DIGEST_SIZE) != 0) {
+        Log.println("Peer: SHA-256 mismatch on the assembled image, discarded.");
+        return false;
+    }
+    commit_inactive_slot(meta_data, length);
+    Log.print("Peer: installed "); Log.print(length); Log.print(" bytes from peers in ");
+    Log.print(millis() - start); Log.println(" ms.");
+    return true;
+}
+
+bool peer_update(const char* url, const uint8_t sha256[SHA256_DIGEST_SIZE], const uint8_t* chunks_root,
+                 boot_metadata_t& meta_data) {
+    if (peer_started) {
+        // Devices announced at the same time spread their windows, so the first one to give up
+        // goes upstream and answers the others' queries with FETCHING
+        unsigned long start = millis();
+        unsigned long window = PEER_DISCOVER_MS + ((uint32_t)Ethernet.localIP() * 2654435761u + micros()) % PEER_JITTER_MS;
+        unsigned long last_query = 0;
+        bool queried = false, waiting = false;
+        while (!peer_count(sha256, false)) {
+            if (!queried || millis() - last_query >= PEER_DISCOVER_MS) {
+                peer_send(peer_broadcast(), "WHOHAS", sha256, 0);
+                last_query = millis();
+                queried = true;
+            }
+            peer_poll();
+            delay(5);
+            if (millis() - start < window) continue;
+            if (!peer_count(sha256, true) || millis() - start >= PEER_WAIT_MAX_MS) break;
+            if (!waiting) Log.println("Peer: another device is fetching the image upstream, waiting for it.");
+            waiting = true;
+        }
+        if (peer_count(sha256, false) && peer_fetch(sha256, chunks_root, meta_data)) return true;
+    }
+    Log.println("Peer: no peer has the image, pulling it upstream.");
+    peer_fetching_sha = sha256;
+    bool ok = pull_update(url, sha256, meta_data);
+    peer_fetching_sha = NULL;
+    return ok;
+}
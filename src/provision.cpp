@@ -0,0 +1,255 @@
+#include "provision.h"
+#include "net_config.h"
+#include "sha256.h"
+#include "boot_clock.h"
+#include "image_alloc.h"
+
+#define PROVISION_IDLE_TIMEOUT 10000
+#define PROVISION_HEADER_SIZE  12
+#define PROVISION_REPORT_SIZE  1024
+
+typedef struct {
+    uint32_t type;
+    uint32_t length;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+} provision_section_t;
+
+typedef struct {
+    uint32_t erase_ms;
+    uint32_t write_ms;    // Receiving and programming, they overlap
+    uint32_t verify_ms;
+    bool ok;
+} provision_timing_t;
+
+DMAMEM static uint8_t provision_sector_buf[SECTOR_SIZE] __attribute__((aligned(32)));
+static uint8_t provision_chunk[1024];
+
+static const char* section_name(uint32_t type) {
+    switch (type) {
+        case PROVISION_SLOT_A:   return "slot_a";
+        case PROVISION_SLOT_B:   return "slot_b";
+        case PROVISION_GOLDEN:   return "golden";
+        case PROVISION_NETCFG:   return "netcfg";
+        case PROVISION_METADATA: return "metadata";
+        default:                 return "unknown";
+    }
+}
+
+static bool read_exact(EthernetClient& client, uint8_t* buf, size_t len) {
+    unsigned long last_rx = millis();
+    while (len > 0) {
+        int n = client.available();
+        if (n <= 0) {
+            if (!client.connected() || millis() - last_rx > PROVISION_IDLE_TIMEOUT) return false;
+            continue;
+        }
+        int got = client.read(buf, min((size_t)n, len));
+        if (got <= 0) continue;
+        buf += got;
+        len -= got;
+        last_rx = millis();
+    }
+    return true;
+}
+
+static bool digest_matches(sha256_ctx_t& sha, const uint8_t expected[SHA256_DIGEST_SIZE]) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(sha, digest);
+    return memcmp(digest, expected, SHA256_DIGEST_SIZE) == 0;
+}
+
+static bool provision_slot(EthernetClient& client, const provision_section_t& sec, uint32_t base, provision_timing_t& t) {
+    unsigned long start = millis();
+    flash_erase_range(base, sec.length);
+    t.erase_ms = millis() - start;
+
+    start = millis();
+    slot_writer_t writer;
+    slot_writer_begin(writer, base, provision_sector_buf);
+    writer.erased = true;
+    while (writer.offset < sec.length) {
+        size_t n = min(sizeof(provision_chunk), (size_t)(sec.length - writer.offset));
+        if (!read_exact(client, provision_chunk, n)) break;
+        slot_writer_write(writer, provision_chunk, n);
+    }
+    slot_writer_finish(writer);
+    t.write_ms = millis() - start;
+    if (writer.offset != sec.length) return false;
+
+    // Hash what actually landed in flash, which also catches programming errors
+    start = millis();
+    arm_dcache_delete((void*)base, sec.length);
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    sha256_ctx_t sha;
+    sha256_init(sha);
+    sha256_update(sha, (const uint8_t*)base, sec.length);
+    bool ok = digest_matches(sha, sec.sha256);
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    t.verify_ms = millis() - start;
+    return ok;
+}
+
+static bool provision_golden(EthernetClient& client, FS& fs, const provision_section_t& sec, provision_timing_t& t) {
+    unsigned long start = millis();
+    fs.remove("/golden.tmp");
+    File f = fs.open("/golden.tmp", FILE_WRITE);
+    if (!f) return false;
+    uint32_t done = 0;
+    while (done < sec.length) {
+        size_t n = min(sizeof(provision_chunk), (size_t)(sec.length - done));
+        if (!read_exact(client, provision_chunk, n) || f.write(provision_chunk, n) != n) break;
+        done += n;
+    }
+    f.close();
+    t.write_ms = millis() - start;
+    if (done != sec.length) return false;
+
+    // Read back through the filesystem before the old golden image is replaced
+    start = millis();
+    sha256_ctx_t sha;
+    sha256_init(sha);
+    f = fs.open("/golden.tmp", FILE_READ);
+    if (!f) return false;
+    int got;
+    while ((got = f.read(provision_chunk, sizeof(provision_chunk))) > 0) {
+        sha256_update(sha, provision_chunk, got);
+    }
+    f.close();
+    bool ok = digest_matches(sha, sec.sha256);
+    t.verify_ms = millis() - start;
+    if (!ok) return false;
+    fs.remove("/golden.bin");
+    return fs.rename("/golden.tmp", "/golden.bin");
+}
+
+// Small sections are kept in RAM and applied once the whole bundle verified
+static bool provision_small(EthernetClient& client, const provision_section_t& sec, void* dest, provision_timing_t& t) {
+    unsigned long start = millis();
+    if (!read_exact(client, (uint8_t*)dest, sec.length)) return false;
+    t.write_ms = millis() - start;
+    sha256_ctx_t sha;
+    sha256_init(sha);
+    sha256_update(sha, (const uint8_t*)dest, sec.length);
+    return digest_matches(sha, sec.sha256);
+}
+
+bool handle_provision(EthernetClient& client, FS& fs, boot_metadata_t& meta_data) {
+    unsigned long started = millis();
+    size_t content_length = 0;
+    String line;
+    do {
+        http_read_line(client, line);
+        if (line.startsWith("Content-Length:")) content_length = line.substring(15).toInt();
+    } while (line.length() > 0);
+
+    uint8_t header[PROVISION_HEADER_SIZE];
+    provision_section_t sections[PROVISION_MAX_SECTIONS];
+    uint32_t count = 0;
+    if (!read_exact(client, header, sizeof(header)) || memcmp(header, "S3PB", 4) != 0) {
+        http_respond(client, "400 Bad Request", "ERROR: Not a provisioning bundle.");
+        return false;
+    }
+    uint32_t version;
+    memcpy(&version, header + 4, 4);
+    memcpy(&count, header + 8, 4);
+    if (version != PROVISION_VERSION || count == 0 || count > PROVISION_MAX_SECTIONS ||
+        !read_exact(client, (uint8_t*)sections, count * sizeof(provision_section_t))) {
+        http_respond(client, "400 Bad Request", "ERROR: Unsupported bundle version or section table.");
+        return false;
+    }
+
+    // Validate the whole table before anything is erased
+    size_t expected = sizeof(header) + count * sizeof(provision_section_t);
+    bool slot_a = false, slot_b = false, have_meta = false, have_netcfg = false;
+    for (uint32_t i = 0; i < count; i++) {
+        const provision_section_t& sec = sections[i];
+        bool size_ok;
+        switch (sec.type) {
+            case PROVISION_SLOT_A:   size_ok = !slot_a && sec.length > 0 && sec.length <= SLOT_SIZE; slot_a = true; break;
+            case PROVISION_SLOT_B:   size_ok = !slot_b && sec.length > 0 && sec.length <= SLOT_SIZE; slot_b = true; break;
+            case PROVISION_GOLDEN:   size_ok = sec.length > 0 && sec.length <= SLOT_SIZE; break;
+            case PROVISION_NETCFG:   size_ok = !have_netcfg && sec.length >= 4 && sec.length <= sizeof(net_config_t); have_netcfg = true; break;
+            case PROVISION_METADATA: size_ok = !have_meta && (sec.length == sizeof(boot_metadata_t) || sec.length == BOOT_METADATA_V2_SIZE || sec.length == BOOT_METADATA_V1_SIZE); have_meta = true; break;
+            default:                 size_ok = false; break;
+        }
+        if (!size_ok) {
+            http_respond(client, "400 Bad Request", "ERROR: Invalid section in bundle table.");
+            return false;
+        }
+        expected += sec.length;
+    }
+    if (content_length != 0 && content_length != expected) {
+        http_respond(client, "400 Bad Request", "ERROR: Content-Length does not match the bundle table.");
+        return false;
+    }
+
+    // Slots about to be rewritten stop being bootable until the bundle is through
+    boot_metadata_t new_meta = meta_data;
+    if (slot_a) alloc_forget(new_meta, SLOT_A_ADDRESS, SLOT_SIZE);
+    if (slot_b) alloc_forget(new_meta, SLOT_B_ADDRESS, SLOT_SIZE);
+    if (slot_a || slot_b) save_metadata(new_meta);
+
+    Log.print("Provisioning: "); Log.print(count); Log.print(" section(s), ");
+    Log.print(expected); Log.println(" bytes");
+    provision_timing_t timing[PROVISION_MAX_SECTIONS];
+    memset(timing, 0, sizeof(timing));
+    net_config_t cfg;
+    net_config_defaults(cfg);
+    boot_metadata_t bundle_meta;
+    memset(&bundle_meta, 0, sizeof(bundle_meta));   // A 20 byte section leaves the image table empty
+    bool ok = true;
+    uint32_t i = 0;
+    for (; i < count && ok; i++) {
+        const provision_section_t& sec = sections[i];
+        switch (sec.type) {
+            case PROVISION_SLOT_A:   ok = provision_slot(client, sec, SLOT_A_ADDRESS, timing[i]); break;
+            case PROVISION_SLOT_B:   ok = provision_slot(client, sec, SLOT_B_ADDRESS, timing[i]); break;
+            case PROVISION_GOLDEN:   ok = provision_golden(client, fs, sec, timing[i]); break;
+            case PROVISION_NETCFG:   ok = provision_small(client, sec, &cfg, timing[i]) && cfg.magic == NET_CONFIG_MAGIC; break;
+            case PROVISION_METADATA: ok = provision_small(client, sec, &bundle_meta, timing[i]); break;
+        }
+        timing[i].ok = ok;
+        Log.print("  "); Log.print(section_name(sec.type));
+        Log.print(ok ? " ok, " : " FAILED, "); Log.print(sec.length); Log.print(" bytes, erase ");
+        Log.print(timing[i].erase_ms); Log.print(" ms, write "); Log.print(timing[i].write_ms);
+        Log.print(" ms, verify "); Log.print(timing[i].verify_ms); Log.println(" ms");
+    }
+
+    if (ok) {
+        if (have_netcfg) save_net_config(fs, cfg);
+        if (have_meta) {
+            new_meta = bundle_meta;
+        } else if (slot_a || slot_b) {
+            new_meta.valid_a = slot_a ? 1 : new_meta.valid_a;
+            new_meta.valid_b = slot_b ? 1 : new_meta.valid_b;
+            new_meta.active_slot = slot_a ? 0 : 1;
+            for (uint32_t k = 0; k < count; k++) {
+                if (sections[k].type == PROVISION_SLOT_A) new_meta.slot_length[0] = sections[k].length;
+                if (sections[k].type == PROVISION_SLOT_B) new_meta.slot_length[1] = sections[k].length;
+            }
+            new_meta.boot_count = 0;
+            new_meta.boot_success = 0;
+        }
+        save_metadata(new_meta);
+    }
+    meta_data = new_meta;
+    uint32_t total_ms = millis() - started;
+
+    // Per section timing report, one key=value line each, for tuning line throughput
+    static char report[PROVISION_REPORT_SIZE];
+    size_t len = snprintf(report, sizeof(report), "result=%s\ntotal_ms=%lu\nbytes=%u\n",
+                          ok ? "ok" : "failed", (unsigned long)total_ms, (unsigned)expected);
+    for (uint32_t k = 0; k < i && len < sizeof(report); k++) {
+        len += snprintf(report + len, sizeof(report) - len,
+                        "section=%s bytes=%lu erase_ms=%lu write_ms=%lu verify_ms=%lu ok=%d\n",
+                        section_name(sections[k].type), (unsigned long)sections[k].length,
+                        (unsigned long)timing[k].erase_ms, (unsigned long)timing[k].write_ms,
+                        (unsigned long)timing[k].verify_ms, timing[k].ok ? 1 : 0);
+    }
+    Log.print("Provisioning "); Log.print(ok ? "complete" : "failed"); Log.print(" in ");
+    Log.print(total_ms); Log.println(" ms");
+    http_respond(client, ok ? "200 OK" : "422 Unprocessable Entity", report);
+    uint32_t booted_len;
+    alloc_booted(new_meta, booted_len);
+    return ok && booted_len != 0;
+}
@@ -0,0 +1,114 @@
+#include "pull_update.h"
+#include "http.h"
+#include "boot_clock.h"
+#include "peer.h"
+#include "rate_limit.h"
+
+#define PULL_IDLE_TIMEOUT 10000
+
+DMAMEM static uint8_t pull_sector_buf[SECTOR_SIZE] __attribute__((aligned(32)));
+
+// Splits http://host[:port]/path, the path pointer stays inside url
+static bool parse_http_url(const char* url, char* host, size_t host_size, uint16_t& port, const char*& path) {
+    if (strncmp(url, "http://", 7) != 0) return false;
+    const char* start = url + 7;
+    const char* end = start + strcspn(start, ":/");
+    size_t len = end - start;
+    if (len == 0 || len >= host_size) return false;
+    memcpy(host, start, len);
+    host[len] = 0;
+    port = 80;
+    if (*end == ':') {
+        port = strtoul(end + 1, (char**)&end, 10);
+    }
+    path = (*end == '/') ? end : "/";
+    return port != 0;
+}
+
+bool pull_update(const char* url, const uint8_t expected_sha256[SHA256_DIGEST_SIZE], boot_metadata_t& meta_data) {
+    char host[64];
+    uint16_t port;
+    const char* path;
+    if (!parse_http_url(url, host, sizeof(host), port, path)) {
+        Log.print("Pull update: unsupported URL "); Log.println(url);
+        return false;
+    }
+    Log.print("Pull update: fetching "); Log.println(url);
+    EthernetClient client;
+    if (!client.connect(host, port)) {
+        Log.println("Pull update: connection failed.");
+        return false;
+    }
+    client.print("GET "); client.print(path); client.println(" HTTP/1.0");
+    client.print("Host: "); client.println(host);
+    client.println("Connection: close");
+    client.println();
+
+    String line;
+    http_read_line(client, line, PULL_IDLE_TIMEOUT);
+    if (!line.startsWith("HTTP/1.") || line.substring(9, 12) != "200") {
+        Log.print("Pull update: server answered "); Log.println(line);
+        client.stop();
+        return false;
+    }
+    long content_length = -1; // -1 = read until the server closes
+    do {
+        http_read_line(client, line);
+        if (line.startsWith("Content-Length:")) content_length = line.substring(15).toInt();
+    } while (line.length() > 0);
+    if (content_length > (long)SLOT_SIZE) {
+        Log.println("Pull update: image does not fit in a slot.");
+        client.stop();
+        return false;
+    }
+
+    slot_writer_t writer;
+    slot_writer_begin(writer, inactive_slot_address(meta_data), pull_sector_buf);
+    uint8_t chunk[1024];
+    unsigned long last_rx = millis();
+    while (content_length < 0 || (long)writer.offset < content_length) {
+        int n = client.available();
+        if (n <= 0) {
+            if (!client.connected() || millis() - last_rx > PULL_IDLE_TIMEOUT) break;
+            // Site peers asking for this image are told to wait for it
+            peer_poll();
+            continue;
+        }
+        size_t want = min((size_t)n, sizeof(chunk));
+        if (content_length >= 0) want = min(want, (size_t)(content_length - writer.offset));
+        if (writer.offset + want > SLOT_SIZE) break;
+        want = rate_limit_allow(want);
+        if (want == 0) {
+            rate_limit_defer();
+            continue;
+        }
+        int got = client.read(chunk, want);
+        if (got <= 0) continue;
+        rate_limit_used(got);
+        slot_writer_write(writer, chunk, got);
+        last_rx = millis();
+    }
+    client.stop();
+    slot_writer_finish(writer);
+    if (writer.offset == 0 || (content_length >= 0 && (long)writer.offset != content_length)) {
+        Log.println("Pull update: download incomplete.");
+        return false;
+    }
+
+    // Hash what actually landed in flash, which also catches programming errors
+    arm_dcache_delete((void*)writer.base, writer.offset);
+    sha256_ctx_t sha;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    sha256_init(sha);
+    sha256_update(sha, (const uint8_t*)writer.base, writer.offset);
+    sha256_final(sha, digest);
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    if (memcmp(digest, expected_sha256, SHA256_DIGEST_SIZE) != 0) {
+        Log.println("Pull update: SHA-256 mismatch, image discarded.");
+        return false;
+    }
+    commit_inactive_slot(meta_data, writer.offset);
+    Log.print("Pull update: installed "); Log.print(writer.offset); Log.println(" bytes.");
+    return true;
+}
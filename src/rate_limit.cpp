@@ -0,0 +1,72 @@
+#include "rate_limit.h"
+
+static uint32_t rate_limit_rate;        // Bytes/s, 0 = unlimited
+static uint32_t rate_limit_burst;
+static uint32_t rate_limit_tokens;
+static uint32_t rate_limit_last_refill; // micros()
+static uint32_t rate_limit_bytes;       // Counted since rate_limit_begin
+static uint32_t rate_limit_waits;       // Times a transfer found the bucket empty, not the calls that did
+static uint32_t rate_limit_wait_us;     // Slept in rate_limit_defer
+static bool rate_limit_empty;           // The last allow gave nothing
+static uint32_t rate_limit_calls;
+static uint64_t rate_limit_cycles;      // Spent inside allow and used
+
+void rate_limit_begin(const net_config_t& cfg) {
+    rate_limit_rate = cfg.upload_rate;
+    rate_limit_burst = max((uint32_t)RATE_LIMIT_MIN_BURST, (uint32_t)((uint64_t)cfg.upload_rate * RATE_LIMIT_BURST_MS / 1000));
+    rate_limit_tokens = rate_limit_burst;
+    rate_limit_last_refill = micros();
+    if (rate_limit_rate) {
+        Log.print("Update traffic limited to "); Log.print(rate_limit_rate); Log.println(" bytes/s");
+    }
+}
+
+size_t rate_limit_allow(size_t want) {
+    if (!rate_limit_rate) return want;
+    uint32_t start = ARM_DWT_CYCCNT;
+    uint32_t now = micros();
+    uint32_t add = (uint64_t)(now - rate_limit_last_refill) * rate_limit_rate / 1000000;
+    if (add) {
+        rate_limit_tokens += min(add, rate_limit_burst);
+        if (rate_limit_tokens >= rate_limit_burst) {
+            rate_limit_tokens = rate_limit_burst;
+            rate_limit_last_refill = now;
+        } else {
+            // Keep the fraction of a byte, frequent calls would otherwise lose most of the rate
+            rate_limit_last_refill += (uint64_t)add * 1000000 / rate_limit_rate;
+        }
+    }
+    size_t n = min(want, (size_t)rate_limit_tokens);
+    if (n == 0 && !rate_limit_empty) rate_limit_waits++;
+    rate_limit_empty = (n == 0);
+    rate_limit_calls++;
+    rate_limit_cycles += ARM_DWT_CYCCNT - start;
+    return n;
+}
+
+void rate_limit_used(size_t n) {
+    rate_limit_bytes += n;
+    if (!rate_limit_rate) return;
+    rate_limit_tokens -= min((uint32_t)n, rate_limit_tokens);
+}
+
+void rate_limit_defer() {
+    if (!rate_limit_rate) return;
+    uint32_t need = min((uint32_t)RATE_LIMIT_MIN_BURST, rate_limit_burst);
+    if (rate_limit_tokens >= need) return;
+    // Tokens accrue from rate_limit_last_refill on, allow adds them on the next call
+    uint32_t due = (uint64_t)(need - rate_limit_tokens) * 1000000 / rate_limit_rate;
+    uint32_t since = micros() - rate_limit_last_refill;
+    if (since >= due) return;
+    uint32_t us = min(due - since, (uint32_t)RATE_LIMIT_BURST_MS * 1000);
+    delayMicroseconds(us);
+    rate_limit_wait_us += us;
+}
+
+void rate_limit_status(Print& out) {
+    out.print("upload_rate="); out.println(rate_limit_rate);
+    out.print("rate_limit_bytes="); out.println(rate_limit_bytes);
+    out.print("rate_limit_waits="); out.println(rate_limit_waits);
+    out.print("rate_limit_wait_ms="); out.println(rate_limit_wait_us / 1000);
+    out.print("rate_limit_cycles_per_call="); out.println(rate_limit_calls ? (uint32_t)(rate_limit_cycles / rate_limit_calls) : 0);
+}
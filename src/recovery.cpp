@@ -0,0 +1,832 @@
+// Recovery mode: the HTTP server and every network update path, entered when no slot can boot.
+
+#include "recovery.h"
+#include "boot_policies.h"
+#include "dhcp_cache.h"
+#include "eth_irq.h"
+#include "coap_server.h"
+#include "mqtt_client.h"
+#include "provision.h"
+#include "manifest.h"
+#include "syslog.h"
+#include "image_alloc.h"
+#include "peer.h"
+#include "hot_preload.h"
+#include "component.h"
+#include "rate_limit.h"
+#include "tls_psk.h"
+#include <SPI.h>
+
+// Waits up to timeout_ms for the rest of the line to arrive
+void http_read_line(Client& client, String& line, unsigned long timeout_ms) {
+    line = "";
+    unsigned long line_timeout = millis() + timeout_ms;
+    while (client.connected() && millis() < line_timeout) {
+        if (!client.available()) continue;
+        char c = client.read();
+        if (c == '\n') break;
+        if (c != '\r') line += c;
+    }
+}
+
+void http_respond(Client& client, const char* status, const char* body) {
+    client.print("HTTP/1.1 ");
+    client.println(status);
+    client.println("Content-Type: text/plain");
+    client.println("Connection: close");
+    client.println();
+    client.println(body);
+    client.stop();
+}
+
+// Network boot: run an image straight from RAM without touching either slot.
+// Netboot images are linked to run from the start of OCRAM2 (NETBOOT_ADDRESS) with their
+// vector table first, just like a slot image. Anything the image wants in ITCM/DTCM is copied
+// there by its own startup code. The DMAMEM buffers and the USB buffers live at the start of
+// OCRAM2, so the image is received into a heap block taken for this request only and moved to
+// NETBOOT_ADDRESS right before the jump.
+// The Teensy startup code marks OCRAM (and DTCM) execute-never in the MPU. netboot_jump turns the
+// MPU off, which leaves the default memory map with OCRAM executable; an image built on the
+// Teensy core runs configure_cache() again and has to leave its own region executable.
+#define NETBOOT_ADDRESS   0x20200000
+#define NETBOOT_MAX_SIZE  (384 * 1024)
+#define OCRAM2_END        0x20280000
+#define DTCM_START        0x20000000
+#define DTCM_END          0x20080000
+
+
+bool netboot_image_valid(const uint8_t* image, size_t len) {
+    if (len < 8) return false;
+    const uint32_t* vectorTable = (const uint32_t*)image;
+    uint32_t sp = vectorTable[0];
+    uint32_t rv = vectorTable[1];
+    // Stack has to live in DTCM or OCRAM, and the reset handler inside the received image (Thumb bit set)
+    bool sp_ok = (sp > DTCM_START && sp <= DTCM_END) || (sp > NETBOOT_ADDRESS && sp <= OCRAM2_END);
+    bool rv_ok = (rv & 1) && (rv & ~1u) >= NETBOOT_ADDRESS && (rv & ~1u) < NETBOOT_ADDRESS + len;
+    return sp_ok && rv_ok;
+}
+
+void netboot_jump(const uint8_t* image, size_t len) {
+    __disable_irq();
+    // Nothing but this code and the stack (DTCM) is needed from here on, so OCRAM2 can be
+    // overwritten, the heap block holding the image included
+    memmove((void*)NETBOOT_ADDRESS, image, len);
+    arm_dcache_flush_delete((void*)NETBOOT_ADDRESS, len);
+#if defined(__IMXRT1062__)
+    asm volatile ("DSB");
+    SCB_MPU_CTRL = 0;
+    asm volatile ("DSB");
+    asm volatile ("ISB");
+    SCB_CACHE_ICIALLU = 0;
+    asm volatile ("DSB");
+    asm volatile ("ISB");
+#endif
+    jump_to_app(NETBOOT_ADDRESS);
+}
+
+// Handles POST /netboot with the raw image as body (Content-Length and X-Image-CRC32 headers required).
+// On success this never returns.
+void handle_netboot(EthernetClient& client) {
+    size_t content_length = 0;
+    uint32_t expected_crc = 0;
+    bool have_crc = false;
+    bool report = false;
+    while (client.connected()) {
+        String line;
+        http_read_line(client, line);
+        if (line.length() == 0) break; // End of headers
+        if (line.startsWith("Content-Length:")) {
+            content_length = line.substring(15).toInt();
+        } else if (line.startsWith("X-Image-CRC32:")) {
+            String value = line.substring(14);
+            value.trim();
+            expected_crc = strtoul(value.c_str(), NULL, 16);
+            have_crc = true;
+        }
+    }
+    Log.print("Netboot image size: "); Log.println(content_length);
+    if (content_length == 0 || content_length > NETBOOT_MAX_SIZE || !have_crc) {
+        Log.println("ERROR: Netboot needs a raw image body, Content-Length and X-Image-CRC32.");
+        http_respond(client, "400 Bad Request", "ERROR: POST the raw RAM image with Content-Length (max 384KB) and X-Image-CRC32 headers.");
+        return;
+    }
+    uint8_t* netboot_image = (uint8_t*)malloc(content_length);
+    if (!netboot_image) {
+        Log.println("ERROR: Not enough free RAM for the netboot image.");
+        http_respond(client, "507 Insufficient Storage", "ERROR: Not enough free RAM for the netboot image.");
+        return;
+    }
+    size_t received = 0;
+    unsigned long timeout = millis() + 10000;
+    while (client.connected() && received < content_length && millis() < timeout) {
+        int n = client.available();
+        if (n <= 0) continue;
+        if ((size_t)n > content_length - received) n = content_length - received;
+        n = rate_limit_allow(n);
+        if (n == 0) {
+            rate_limit_defer();
+            continue;
+        }
+        n = client.read(netboot_image + received, n);
+        if (n <= 0) continue;
+        received += n;
+        rate_limit_used(n);
+        timeout = millis() + 10000;
+    }
+    if (received != content_length) {
+        Log.println("ERROR: Netboot transfer incomplete. Aborting.");
+        free(netboot_image);
+        http_respond(client, "408 Request Timeout", "ERROR: Netboot transfer incomplete.");
+        return;
+    }
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    uint32_t crc = crc32_update(0, netboot_image, received);
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    if (crc != expected_crc || !netboot_image_valid(netboot_image, received)) {
+        Log.print("ERROR: Netboot image rejected. CRC32: 0x");
+        Log.println(crc, HEX);
+        free(netboot_image);
+        http_respond(client, "422 Unprocessable Entity", "ERROR: CRC mismatch or image is not linked to run from OCRAM (0x20200000).");
+        return;
+    }
+    Log.println("Netboot image verified. Jumping to RAM image (slots untouched)...");
+    http_respond(client, "200 OK", "Netboot image verified. Jumping to RAM image...");
+    delay(10);
+    netboot_jump(netboot_image, received);
+}
+
+// Parallel range uploads: several connections each PUT a distinct, sector aligned byte range of the
+// same image (Content-Range: bytes first-last/total) and the ranges are merged into the inactive slot.
+// Every session combines its bytes into a full sector before erasing and programming it, and a bitmap
+// of received sectors tells us when the image is complete, so the ranges may arrive in any order.
+// A single W5x00 socket is bounded by its window over the RTT, so more sockets means more throughput.
+#define MAX_UPLOAD_SESSIONS  4   // Leaves the remaining W5x00 sockets for the listener and GET requests
+#define RANGE_IDLE_TIMEOUT   10000
+
+typedef struct {
+    EthernetClient client;
+    uint32_t offset;          // Next image offset expected on this connection
+    uint32_t end;             // One past the last byte of the range
+    uint32_t fill;            // Bytes combined into the sector buffer so far
+    unsigned long last_rx;
+    bool active;
+} range_session_t;
+
+typedef struct {
+    uint32_t target;          // Flash address of the slot being written
+    uint32_t total;
+    uint32_t crc;
+    uint32_t sectors_done;
+    uint8_t received[(SLOT_SECTORS + 7) / 8];
+    bool active;
+    bool complete;
+    bool report;              // A range asked for the boot report, see recovery_report
+} range_upload_t;
+
+static range_session_t range_sessions[MAX_UPLOAD_SESSIONS];
+DMAMEM static uint8_t range_sector_buf[MAX_UPLOAD_SESSIONS][SECTOR_SIZE] __attribute__((aligned(32)));
+static range_upload_t range_upload;
+
+static uint32_t range_total_sectors() {
+    return (range_upload.total + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+static bool range_sector_received(uint32_t sector) {
+    return range_upload.received[sector / 8] & (1 << (sector % 8));
+}
+
+bool range_sessions_busy() {
+    for (int i = 0; i < MAX_UPLOAD_SESSIONS; i++) {
+        if (range_sessions[i].active) return true;
+    }
+    return false;
+}
+
+// Erases and programs one combined sector, unless an earlier (retried) range already wrote it
+static void range_flush_sector(int idx) {
+    range_session_t& s = range_sessions[idx];
+    uint32_t sector = (s.offset - s.fill) / SECTOR_SIZE;
+    if (!range_sector_received(sector)) {
+        uint32_t addr = range_upload.target + sector * SECTOR_SIZE;
+        flash_erase_sector(addr);
+        flash_program(addr, range_sector_buf[idx], s.fill);
+        range_upload.received[sector / 8] |= 1 << (sector % 8);
+        range_upload.sectors_done++;
+    }
+    s.fill = 0;
+}
+
+// Verifies the merged image from flash and commits it. Returns false on CRC mismatch.
+static bool range_finish_upload(boot_metadata_t& meta_data) {
+    arm_dcache_delete((void*)range_upload.target, range_upload.total);
+    boot_phase_begin(BOOT_PHASE_VERIFY);
+    uint32_t crc = crc32_update(0, (const uint8_t*)range_upload.target, range_upload.total);
+    boot_phase_end(BOOT_PHASE_VERIFY);
+    range_upload.active = false;
+    if (crc != range_upload.crc) {
+        Log.print("ERROR: Merged image CRC32 mismatch: 0x");
+        Log.println(crc, HEX);
+        return false;
+    }
+    commit_inactive_slot(meta_data, range_upload.total);
+    range_upload.complete = true;
+    Log.println("Range upload complete and verified. Metadata updated.");
+    return true;
+}
+
+// Handles the headers of PUT /image and turns the connection into a range session
+void range_session_begin(EthernetClient& client, boot_metadata_t& meta_data) {
+    unsigned long first = 0, last = 0, total = 0, content_length = 0;
+    bool have_range = false;
+    uint32_t crc = 0;
+    bool have_crc = false;
+    bool report = false;
+    while (client.connected()) {
+        String line;
+        http_read_line(client, line);
+        if (line.length() == 0) break; // End of headers
+        if (line.startsWith("Content-Length:")) {
+            content_length = line.substring(15).toInt();
+        } else if (line.startsWith("Content-Range:")) {
+            have_range = sscanf(line.c_str() + 14, " bytes %lu-%lu/%lu", &first, &last, &total) == 3;
+        } else if (line.startsWith("X-Image-CRC32:")) {
+            String value = line.substring(14);
+            value.trim();
+            crc = strtoul(value.c_str(), NULL, 16);
+            have_crc = true;
+        } else if (line.startsWith("X-Boot-Report:")) {
+            report = line.substring(14).toInt() == 1;
+        }
+    }
+    if (!have_range || !have_crc || last < first || last >= total || content_length != last - first + 1) {
+        http_respond(client, "400 Bad Request", "ERROR: PUT /image needs Content-Range, Content-Length and X-Image-CRC32.");
+        return;
+    }
+    if (total > SLOT_SIZE) {
+        http_respond(client, "413 Payload Too Large", "ERROR: Image does not fit in a slot.");
+        return;
+    }
+    if (first % SECTOR_SIZE != 0 || ((last + 1) % SECTOR_SIZE != 0 && last + 1 != total)) {
+        http_respond(client, "416 Range Not Satisfiable", "ERROR: Ranges must start and end on 4KB sector boundaries.");
+        return;
+    }
+    if (!range_upload.active || range_upload.total != total || range_upload.crc != crc) {
+        if (range_sessions_busy()) {
+            http_respond(client, "409 Conflict", "ERROR: Another image upload is in progress.");
+            return;
+        }
+        memset(&range_upload, 0, sizeof(range_upload));
+        range_upload.target = inactive_slot_address(meta_data);
+        range_upload.total = total;
+        range_upload.crc = crc;
+        range_upload.active = true;
+        Log.print("Range upload started, image size: "); Log.println(total);
+    }
+    range_upload.report |= report;
+    for (int i = 0; i < MAX_UPLOAD_SESSIONS; i++) {
+        range_session_t& s = range_sessions[i];
+        if (s.active) continue;
+        s.client = client;
+        s.offset = first;
+        s.end = last + 1;
+        s.fill = 0;
+        s.last_rx = millis();
+        s.active = true;
+        return;
+    }
+    http_respond(client, "503 Service Unavailable", "ERROR: Too many concurrent upload connections.");
+}
+
+// True if any session still has unread data in its W5x00 socket buffer
+bool range_sessions_pending() {
+    for (int i = 0; i < MAX_UPLOAD_SESSIONS; i++) {
+        if (range_sessions[i].active && range_sessions[i].client.available() > 0) return true;
+    }
+    return false;
+}
+
+// Moves whatever each session has pending from the W5x00 into its sector buffer.
+// Returns true once an uploaded image has been verified and committed.
+bool range_sessions_poll(boot_metadata_t& meta_data) {
+    for (int i = 0; i < MAX_UPLOAD_SESSIONS; i++) {
+        range_session_t& s = range_sessions[i];
+        if (!s.active) continue;
+        int n = s.client.available();
+        if (n <= 0) {
+            if (!s.client.connected() || millis() - s.last_rx > RANGE_IDLE_TIMEOUT) {
+                // Whole sectors already written stay marked, the client re-sends the rest
+                Log.println("Range upload connection dropped.");
+                s.client.stop();
+                s.active = false;
+            }
+            continue;
+        }
+        uint32_t want = rate_limit_allow(min((uint32_t)n, min(SECTOR_SIZE - s.fill, s.end - s.offset)));
+        if (want == 0) {
+            rate_limit_defer();
+            continue;
+        }
+        int got = s.client.read(range_sector_buf[i] + s.fill, want);
+        if (got <= 0) continue;
+        rate_limit_used(got);
+        s.fill += got;
+        s.offset += got;
+        s.last_rx = millis();
+        if (s.fill == SECTOR_SIZE || s.offset == s.end) {
+            range_flush_sector(i);
+        }
+        if (s.offset == s.end) {
+            s.active = false;
+            if (range_upload.sectors_done < range_total_sectors()) {
+                http_respond(s.client, "202 Accepted", "Range stored.");
+            } else if (range_finish_upload(meta_data)) {
+                http_respond(s.client, "200 OK", "Upload complete. Image verified and committed.");
+            } else {
+                http_respond(s.client, "422 Unprocessable Entity", "ERROR: Merged image CRC32 mismatch. Upload discarded.");
+            }
+        }
+    }
+    return range_upload.complete;
+}
+
+// GET /upload/status: lets the host client pick a connection count and re-send missing ranges
+void range_upload_status(EthernetClient& client) {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: text/plain");
+    client.println("Connection: close");
+    client.println();
+    client.print("max_sessions="); client.println(MAX_UPLOAD_SESSIONS);
+    client.print("sector_size="); client.println(SECTOR_SIZE);
+    client.print("slot_size="); client.println(SLOT_SIZE);
+    client.print("active="); client.println(range_upload.active ? 1 : 0);
+    client.print("total="); client.println(range_upload.total);
+    client.print("crc32="); client.println(range_upload.crc, HEX);
+    client.print("missing=");
+    bool first = true;
+    for (uint32_t sector = 0; range_upload.active && sector < range_total_sectors(); sector++) {
+        if (range_sector_received(sector)) continue;
+        if (!first) client.print(",");
+        client.print(sector);
+        first = false;
+    }
+    client.println();
+    client.stop();
+}
+
+// GET /status: boot state for the host rollout controller. mode=recovery never counts as a good
+// boot of a freshly installed image; mode=confirmed comes from recovery_report.
+void boot_status(Client& client, const boot_metadata_t& meta, const char* mode = "recovery") {
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: text/plain");
+    client.println("Connection: close");
+    client.println();
+    client.print("mode="); client.println(mode);
+    client.print("active_slot="); client.println(meta.active_slot);
+    client.print("valid_a="); client.println(meta.valid_a ? 1 : 0);
+    client.print("valid_b="); client.println(meta.valid_b ? 1 : 0);
+    client.print("boot_count="); client.println(meta.boot_count);
+    client.print("boot_success="); client.println(meta.boot_success ? 1 : 0);
+    client.print("uptime_ms="); client.println(millis());
+    client.print("upload_active="); client.println(range_upload.active ? 1 : 0);
+    client.print("active_image="); client.println(meta.active_image);
+    client.print("arm_clock_hz="); client.println(F_CPU_ACTUAL);
+    client.print("fast_clock_hz="); client.println(BOOT_CLOCK_FAST_HZ ? BOOT_CLOCK_FAST_HZ : F_CPU);
+    client.print("storage_us="); client.println(boot_phase_us(BOOT_PHASE_STORAGE));
+    client.print("verify_us="); client.println(boot_phase_us(BOOT_PHASE_VERIFY));
+    peer_status(client);
+    rate_limit_status(client);
+    tls_status(client);
+    client.stop();
+}
+
+// GET /flash[?offset=<n>&length=<n>]: raw XIP read of the external flash, the whole 2MB by
+// default, so a field unit's state can be captured and inspected offline (tools/flashimg.py).
+// Refused once a PSK is configured: the dump includes LittleFS, and with it /netcfg.bin and the key.
+void flash_dump(EthernetClient& client, const String& req_line, const net_config_t& net_cfg) {
+    String line;
+    do {
+        http_read_line(client, line);
+    } while (line.length() > 0);
+    if (tls_enabled(net_cfg)) {
+        http_respond(client, "403 Forbidden", "ERROR: Flash dumps are disabled on devices with a TLS key.");
+        return;
+    }
+    uint32_t offset = 0, length = FLASH_SIZE;
+    int q = req_line.indexOf("offset=");
+    if (q >= 0) offset = strtoul(req_line.c_str() + q + 7, NULL, 0);
+    q = req_line.indexOf("length=");
+    if (q >= 0) length = strtoul(req_line.c_str() + q + 7, NULL, 0);
+    if (offset > FLASH_SIZE || length > FLASH_SIZE - offset) {
+        http_respond(client, "416 Range Not Satisfiable", "ERROR: Range outside the 2MB flash.");
+        return;
+    }
+    client.println("HTTP/1.1 200 OK");
+    client.println("Content-Type: application/octet-stream");
+    client.print("Content-Length: "); client.println(length);
+    client.println("Connection: close");
+    client.println();
+    const uint8_t* src = (const uint8_t*)(FLASH_BASE + offset);
+    while (length > 0 && client.connected()) {
+        size_t n = client.write(src, min(length, (uint32_t)1024));
+        if (n == 0) continue;
+        src += n;
+        length -= n;
+    }
+    client.stop();
+}
+
+// Starts whatever the committed metadata boots now, see recovery.h
+static void install_handoff(const boot_metadata_t& meta_data) {
+    // Arms the boot report for a rollout's upload, and drops one a stalled rollout left behind
+    myfs.remove(REPORT_FLAG_PATH);
+    if (range_upload.complete && range_upload.report) {
+        File f = myfs.open(REPORT_FLAG_PATH, FILE_WRITE);
+        f.close();
+    }
+    uint32_t length;
+    uint32_t entry = alloc_booted(meta_data, length);
+    bool reset = S3BL_HANDOFF_RESET || entry == 0 || !VectorTableVerifier::check(entry);
+    for (int i = 0; i < PLACED_IMAGES; i++) {
+        const placed_image_t& img = meta_data.images[i];
+        if (img.valid && img.base == entry && (img.valid & PLACED_FULL_RESET)) reset = true;
+    }
+    if (reset) {
+        Log.println("Rebooting to new application...");
+        delay(100);
+        SCB_AIRCR = 0x05FA0004;
+        while (1);
+    }
+    Log.print("Starting new application at 0x"); Log.print(entry, HEX); Log.print(" after ");
+    Log.print(millis()); Log.println(" ms in the bootloader");
+    bool modules_trial;
+    component_directory_write(meta_data, entry, modules_trial);
+    boot_handoff_trial(!meta_data.boot_success || modules_trial);
+    // Closed sockets and a detached INTn, so the application finds a quiet W5x00
+    eth_irq_end();
+    SPI.end();
+    const hot_table_t* hot = hot_table_at(meta_data, entry);
+    if (hot) hot_jump(entry, hot);
+    jump_to_app(entry);
+}
+
+// The routes the upload tool drives over TLS: placed images, releases and /status. Returns true
+// once something was installed.
+static bool tls_serve(EthernetClient& tcp, const net_config_t& net_cfg, boot_metadata_t& meta_data) {
+    static TlsClient client;
+    if (!client.accept(tcp, net_cfg)) return false;
+    String req_line;
+    http_read_line(client, req_line);
+    Log.print("HTTPS request line: ");
+    Log.println(req_line);
+    if (req_line.startsWith("POST /manifest") || req_line.startsWith("PUT /manifest/") ||
+        req_line.startsWith("GET /manifest") || req_line.startsWith("DELETE /manifest")) {
+        return manifest_handle(client, req_line, myfs, meta_data);
+    } else if (req_line.startsWith("GET /alloc")) {
+        alloc_status(client, req_line, meta_data);
+    } else if (req_line.startsWith("POST /alloc")) {
+        return alloc_install(client, meta_data);
+    } else if (req_line.startsWith("GET /status")) {
+        boot_status(client, meta_data);
+    } else {
+        http_respond(client, "404 Not Found", "ERROR: Only /manifest, /alloc and /status are served over TLS.");
+    }
+    return false;
+}
+
+void recovery_report(const boot_metadata_t& meta_data) {
+    if (!S3BL_REPORT_WINDOW_MS || !myfs.exists(REPORT_FLAG_PATH)) return;
+    myfs.remove(REPORT_FLAG_PATH);
+    byte mac[6] = { 0x04, 0xE9, 0xE5, 0x00, 0x00, 0x01 };
+    if (!ethernet_begin_cached(myfs, mac)) {
+        Log.println("ERROR: Could not obtain an IP address, boot not reported.");
+        return;
+    }
+    // Plain HTTP even with tls_only: /status is read only and carries no secrets
+    EthernetServer server(80);
+    server.begin();
+    eth_irq_begin();
+    Log.print("Reporting the confirmed boot on GET /status for up to "); Log.print(S3BL_REPORT_WINDOW_MS);
+    Log.println(" ms");
+    unsigned long start = millis();
+    bool reported = false;
+    while (!reported && millis() - start < S3BL_REPORT_WINDOW_MS) {
+        EthernetClient client = server.accept();
+        if (client) {
+            String req_line;
+            http_read_line(client, req_line);
+            if (req_line.startsWith("GET /status")) {
+                boot_status(client, meta_data, "confirmed");
+                reported = true;
+            } else {
+                http_respond(client, "503 Service Unavailable", "Starting the application, only GET /status is served.");
+            }
+        }
+        unsigned long elapsed = millis() - start;
+        if (!reported && elapsed < S3BL_REPORT_WINDOW_MS) eth_irq_wait(S3BL_REPORT_WINDOW_MS - elapsed);
+        eth_irq_ack();
+    }
+    eth_irq_end();
+    SPI.end();
+}
+
+void recovery_main(boot_metadata_t& init_meta) {
+    // Initialize Ethernet for recovery
+    byte mac[6] = { 0x04, 0xE9, 0xE5, 0x00, 0x00, 0x01 };
+    IPAddress ip(192, 168, 1, 222);
+    IPAddress gateway(192, 168, 1, 1);
+    IPAddress subnet(255, 255, 255, 0);
+    if (!ethernet_begin_cached(myfs, mac)) {
+        Log.println("ERROR: Could not obtain an IP address.");
+    }
+    Log.print("Ethernet started. IP address: ");
+    Log.println(Ethernet.localIP());
+    net_config_t net_cfg;
+    load_net_config(myfs, net_cfg);
+    // Every listener holds a W5x00 socket, so the TLS one only exists with a PSK configured
+    bool tls = tls_enabled(net_cfg);
+    bool plain = !tls || !net_cfg.tls_only;
+    EthernetServer server(80);
+    EthernetServer tls_server(TLS_PORT);
+    if (plain) {
+        server.begin();
+        Log.println("Recovery HTTP server started on port 80");
+    }
+    if (tls) {
+        tls_server.begin();
+        Log.print("Recovery TLS server started on port "); Log.println(TLS_PORT);
+    }
+    // CoAP uploads and MQTT announcements carry no authentication, so a TLS-only device takes
+    // images over the PSK listener alone
+    net_config_t announce_cfg = net_cfg;
+    if (plain) {
+        coap_begin();
+    } else {
+        announce_cfg.mqtt_broker = 0;
+        Log.println("TLS only: CoAP and MQTT update paths are off.");
+    }
+    mqtt_begin(announce_cfg, mac);
+    syslog_begin(net_cfg);
+    rate_limit_begin(net_cfg);
+    peer_begin(init_meta, (plain ? 1 : 0) + (tls ? 1 : 0));
+    manifest_begin(myfs, init_meta);
+    eth_irq_begin();
+    while (true) {
+        // accept() only hands out new connections, so sockets owned by range sessions are left alone.
+        // It also relistens whenever the port has no listener, so a closed port 80 is never polled.
+        EthernetClient client = plain ? server.accept() : EthernetClient();
+        if (client) {
+            Log.println("Client connected in recovery mode");
+            String request = "";
+            unsigned long start_time = millis();
+            // Read the first line (request line)
+            while (client.connected() && client.available() == 0 && millis() - start_time < 1000) {
+                delay(1);
+            }
+            // Read the request line
+            String req_line = "";
+            while (client.connected() && client.available()) {
+                char c = client.read();
+                if (c == '\n') break;
+                if (c != '\r') req_line += c;
+            }
+            Log.print("HTTP request line: ");
+            Log.println(req_line);
+            // Only buffer and process upload for POST /upload
+            if (req_line.startsWith("POST /upload")) {
+                // Read headers until blank line
+                String headers = "";
+                int content_length = 0;
+                while (client.connected()) {
+                    String line = "";
+                    while (client.available()) {
+                        char c = client.read();
+                        if (c == '\n') break;
+                        if (c != '\r') line += c;
+                    }
+                    if (line.length() == 0) break; // End of headers
+                    headers += line + "\n";
+                    if (line.startsWith("Content-Length:")) {
+                        content_length = line.substring(15).toInt();
+                    }
+                }
+                Log.print("Content-Length: "); Log.println(content_length);
+                // Now read the body (uploaded file)
+                size_t upload_bytes = 0;
+                bool upload_too_large = false;
+                const size_t MAX_UPLOAD_SIZE = SLOT_SIZE + 4096; // A full slot plus the multipart framing
+                unsigned long timeout = millis() + 10000;
+                String code = "";
+                while (client.connected() && upload_bytes < content_length && millis() < timeout) {
+                    size_t quota = rate_limit_allow(content_length - upload_bytes);
+                    if (quota == 0) {
+                        rate_limit_defer();
+                        continue;
+                    }
+                    size_t taken = 0;
+                    while (client.available() && upload_bytes < content_length && taken < quota) {
+                        char c = client.read();
+                        code += c;
+                        upload_bytes++;
+                        taken++;
+                        if (upload_bytes % 1024 == 0) {
+                            Log.print("Upload progress: ");
+                            Log.print(upload_bytes);
+                            Log.println(" bytes received");
+                        }
+                        if (upload_bytes > MAX_UPLOAD_SIZE) {
+                            Log.println("ERROR: Uploaded file exceeds the slot size. Aborting upload.");
+                            upload_too_large = true;
+                            break;
+                        }
+                        timeout = millis() + 10000;
+                    }
+                    rate_limit_used(taken);
+                    if (upload_too_large) break;
+                }
+                if (upload_too_large) {
+                    client.println("HTTP/1.1 413 Payload Too Large");
+                    client.println("Content-Type: text/plain");
+                    client.println("Connection: close");
+                    client.println();
+                    client.println("ERROR: Uploaded file exceeds the slot size, use POST /alloc for larger images.");
+                    client.stop();
+                    continue;
+                }
+                if (upload_bytes == 0) {
+                    Log.println("No data received from client.");
+                }
+                if (millis() >= timeout) {
+                    Log.println("ERROR: Upload timed out (no data for 10s). Aborting.");
+                    client.println("HTTP/1.1 408 Request Timeout");
+                    client.println("Content-Type: text/plain");
+                    client.println("Connection: close");
+                    client.println();
+                    client.println("ERROR: Upload timed out (no data for 10s). Aborting.");
+                    client.stop();
+                    continue;
+                }
+                // Only a summary: the body is the whole binary and would flood the log ring and syslog
+                Serial.print("Received upload: ");
+                Serial.print(code.length());
+                Serial.print(" bytes, crc32=");
+                Serial.println(crc32_update(0, (const uint8_t*)code.c_str(), code.length()), HEX);
+                // Write to non-primary partition (slot B if active is A, else slot A)
+                uint32_t target_addr = inactive_slot_address(init_meta);
+                // Parse multipart/form-data to extract the binary payload
+                int bin_start = -1, bin_end = -1, bin_len = 0;
+                // Find the start of the binary (after the first double CRLF after Content-Type)
+                int content_type_idx = code.indexOf("Content-Type:");
+                if (content_type_idx >= 0) {
+                    int bin_hdr_end = code.indexOf("\r\n\r\n", content_type_idx);
+                    if (bin_hdr_end >= 0) {
+                        bin_start = bin_hdr_end + 4;
+                        // Find the boundary at the end
+                        String boundary = code.substring(0, code.indexOf("\r\n"));
+                        bin_end = code.indexOf(boundary, bin_start) - 4; // -4 to remove trailing CRLF
+                    }
+                }
+                if (bin_start >= 0 && bin_end > bin_start) {
+                    Log.print("Extracted binary payload: start=");
+                    Log.print(bin_start);
+                    Log.print(", end=");
+                    Log.println(bin_end);
+                    bin_len = bin_end - bin_start;
+                    // Write only the binary payload to flash
+                    flash_erase_sector(target_addr);
+                    flash_write(target_addr, code.c_str() + bin_start, bin_len);
+                    Log.print("Wrote "); Log.print(bin_len); Log.println(" bytes of firmware to flash partition.");
+                } else {
+                    Log.println("ERROR: Could not parse firmware binary from multipart upload. Aborting.");
+                    client.println("HTTP/1.1 400 Bad Request");
+                    client.println("Content-Type: text/plain");
+                    client.println("Connection: close");
+                    client.println();
+                    client.println("ERROR: Could not parse firmware binary from upload. Make sure you are uploading a .bin file.");
+                    client.stop();
+                    continue;
+                }
+                Log.println("Code written to flash partition.");
+                // Update metadata: set new slot as valid and active, invalidate the other
+                commit_inactive_slot(init_meta, bin_len);
+                Log.println("Metadata updated.");
+                client.println("HTTP/1.1 200 OK");
+                client.println("Content-Type: text/plain");
+                client.println("Connection: close");
+                client.println();
+                client.println("Upload received. Code written to partition. Starting it...");
+                client.stop();
+                install_handoff(init_meta);
+            } else if (req_line.startsWith("PUT /image")) {
+                range_session_begin(client, init_meta);
+                continue;
+            } else if (req_line.startsWith("GET /upload/status")) {
+                range_upload_status(client);
+                continue;
+            } else if (req_line.startsWith("POST /provision")) {
+                if (handle_provision(client, myfs, init_meta)) {
+                    Log.println("Starting the provisioned application...");
+                    install_handoff(init_meta);
+                }
+                continue;
+            } else if (req_line.startsWith("POST /manifest") || req_line.startsWith("PUT /manifest/") ||
+                       req_line.startsWith("GET /manifest") || req_line.startsWith("DELETE /manifest")) {
+                if (manifest_handle(client, req_line, myfs, init_meta)) {
+                    Log.println("Starting new release...");
+                    install_handoff(init_meta);
+                }
+                continue;
+            } else if (req_line.startsWith("GET /alloc")) {
+                alloc_status(client, req_line, init_meta);
+                continue;
+            } else if (req_line.startsWith("POST /alloc")) {
+                if (alloc_install(client, init_meta)) {
+                    Log.println("Starting the placed image...");
+                    install_handoff(init_meta);
+                }
+                continue;
+            } else if (req_line.startsWith("GET /flash")) {
+                flash_dump(client, req_line, net_cfg);
+                continue;
+            } else if (req_line.startsWith("GET /peer/")) {
+                peer_serve(client, req_line);
+                continue;
+            } else if (req_line.startsWith("GET /status")) {
+                boot_status(client, init_meta);
+                continue;
+            } else if (req_line.startsWith("POST /netboot")) {
+                handle_netboot(client);
+                continue;
+            } else if (req_line.startsWith("GET / ") || req_line.startsWith("GET /HTTP")) {
+                // Serve upload form for GET /
+                client.println("HTTP/1.1 200 OK");
+                client.println("Content-Type: text/html");
+                client.println("Connection: close");
+                client.println();
+                client.println("<html><head><title>S3BL Recovery</title></head><body>");
+                client.println("<h2>S3BL Recovery Mode</h2>");
+                client.println("<h2>Upload Compiled Firmware (.bin)</h2>");
+                client.println("<p style='color:red'><b>NOTE:</b> Only compiled binary files (.bin) generated for Teensy 4.0 are supported. Do NOT upload C++ source code. The file must start with a valid ARM Cortex-M7 vector table.</p>");
+                client.println("<form method='POST' action='/upload' enctype='multipart/form-data'>");
+                client.println("<input type='file' name='firmware' accept='.bin'><br><br>");
+                client.println("<input type='submit' value='Upload Firmware'>");
+                client.println("</form>");
+                client.println("<hr>");
+                client.println("<h3>Network Boot (RAM image, slots untouched)</h3>");
+                client.println("<p>POST a raw image linked for OCRAM (0x20200000) to /netboot with an X-Image-CRC32 header, e.g.<br>");
+                client.println("<code>curl --data-binary @app_ram.bin -H \"X-Image-CRC32: $(crc32 app_ram.bin)\" http://&lt;ip&gt;/netboot</code></p>");
+                client.println("<hr>");
+                client.println("<h3>Placed Images</h3>");
+                client.println("<p>GET /alloc?size=&lt;bytes&gt; shows the block map and a free address to link for; POST the image with its header to /alloc (<code>tools/s3bl_upload.py place</code>).</p>");
+                client.println("<hr>");
+                client.println("<h3>Factory Provisioning</h3>");
+                client.println("<p>POST a bundle built with <code>tools/s3bl_provision.py build</code> to /provision to program slots, golden image, network config and metadata in one pass.</p>");
+                client.println("<hr>");
+                client.println("<h3>Advanced: Upload Raw Code (NOT SUPPORTED)</h3>");
+                client.println("<p style='color:orange'>Uploading C++ code as text will NOT work. Only compiled .bin files are supported.</p>");
+                client.println("<form method='POST' action='/upload' enctype='text/plain'>");
+                client.println("<textarea name='code' rows='16' cols='60'></textarea><br>");
+                client.println("<input type='submit' value='Upload Code (Not Supported)'>");
+                client.println("</form>");
+                client.println("</body></html>");
+                client.stop();
+                continue;
+            } else {
+                // Fallback: print request
+                Log.println("--- Received HTTP data ---");
+                Log.println(req_line);
+                Log.println("--------------------------");
+                client.println("HTTP/1.1 200 OK");
+                client.println("Content-Type: text/plain");
+                client.println("Connection: close");
+                client.println();
+                client.println("S3BL Recovery Mode: Data received. Check serial for content.");
+                client.stop();
+            }
+        }
+        if (tls) {
+            EthernetClient tcp = tls_server.accept();
+            if (tcp && tls_serve(tcp, net_cfg, init_meta)) {
+                Log.println("Starting the installed image...");
+                install_handoff(init_meta);
+            }
+        }
+        bool installed = range_sessions_poll(init_meta) && !range_sessions_busy();
+        if (plain) installed |= coap_poll(init_meta);
+        if (mqtt_poll(init_meta)) {
+            // Announced images go to the whole site, so stay up as a peer for a while first
+            peer_seed(init_meta);
+        }
+        peer_poll();
+        installed |= peer_seed_done();
+        syslog_poll(range_sessions_busy() || coap_upload_active());
+        if (installed) install_handoff(init_meta);
+        if (range_sessions_busy()) {
+            // Session idle timeouts still need a tick, and data left in a socket raises no new interrupt
+            if (!range_sessions_pending()) eth_irq_wait(100);
+        } else {
+            // MQTT keep-alive, reconnects and syslog batches run on time, not on socket events
+            eth_irq_wait((mqtt_enabled() || syslog_enabled() || peer_active()) ? 1000 : 0);
+        }
+        eth_irq_ack();
+    }
+}
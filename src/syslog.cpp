@@ -0,0 +1,122 @@
+#include "syslog.h"
+#include <Ethernet.h>
+#include <time.h>
+
+#define SYSLOG_SEV_ERR      3
+#define SYSLOG_SEV_WARNING  4
+#define SYSLOG_SEV_INFO     6
+#define SYSLOG_VALID_RTC    1577836800 // 2020-01-01, anything earlier means the RTC was never set
+
+static EthernetUDP syslog_udp;
+static net_config_t syslog_cfg;
+static bool syslog_started = false;
+static uint32_t syslog_sent_seq;       // Next log record to ship
+static uint32_t syslog_lost;           // Records overwritten before they could be sent
+static uint32_t syslog_msg_seq;        // meta sequenceId, 1 based
+static uint32_t syslog_tokens;         // Token bucket in bytes
+static unsigned long syslog_last_refill;
+static char syslog_body[SYSLOG_MAX_PACKET];
+static char syslog_packet[SYSLOG_MAX_PACKET];
+
+void syslog_begin(const net_config_t& cfg) {
+    syslog_cfg = cfg;
+    if (!syslog_enabled()) return;
+    syslog_started = syslog_udp.begin(SYSLOG_LOCAL_PORT);
+    syslog_sent_seq = Log.first_seq();   // Whatever the boot logged before the network came up
+    syslog_tokens = SYSLOG_MAX_PACKET;
+    syslog_last_refill = millis();
+    Log.print("Syslog: shipping to "); Log.print(IPAddress(cfg.syslog_server)); Log.print(":");
+    Log.print(cfg.syslog_port); Log.print(" at up to "); Log.print(cfg.syslog_rate); Log.println(" bytes/s");
+}
+
+bool syslog_enabled() {
+    return syslog_cfg.syslog_server != 0 && syslog_cfg.syslog_port != 0 && syslog_cfg.syslog_rate != 0;
+}
+
+static void syslog_refill() {
+    unsigned long now = millis();
+    uint32_t add = (uint64_t)(now - syslog_last_refill) * syslog_cfg.syslog_rate / 1000;
+    if (add == 0) return;
+    syslog_last_refill = now;
+    syslog_tokens = min((uint32_t)SYSLOG_MAX_PACKET, syslog_tokens + add);
+}
+
+// RFC 5424 timestamp of a record, or the NILVALUE if the RTC was never set
+static void syslog_timestamp(char* out, size_t size, uint32_t record_ms) {
+    time_t now = rtc_get();
+    if (now < SYSLOG_VALID_RTC) {
+        snprintf(out, size, "-");
+        return;
+    }
+    time_t t = now - (millis() - record_ms) / 1000;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+void syslog_poll(bool busy) {
+    if (!syslog_started) return;
+    uint32_t head = Log.next_seq();
+    uint32_t first = Log.first_seq();
+    if (syslog_sent_seq < first) {
+        syslog_lost += first - syslog_sent_seq;
+        syslog_sent_seq = first;
+    }
+    if (syslog_sent_seq == head) return;
+    // Uploads have priority; only step in when records are about to be overwritten
+    bool urgent = head - syslog_sent_seq >= LOG_RECORDS * 3 / 4;
+    if (busy && !urgent) return;
+
+    log_record_t r;
+    if (!Log.get(syslog_sent_seq, r)) return;
+    uint32_t oldest_ms = r.ms;
+    char header[128];
+    char timestamp[24];
+    syslog_timestamp(timestamp, sizeof(timestamp), oldest_ms);
+    IPAddress ip = Ethernet.localIP();
+    // PRI is rewritten once the batch severity is known, local0 keeps it at three digits either way
+    size_t header_len = snprintf(header, sizeof(header), "<%d>1 %s %u.%u.%u.%u s3bl - boot [meta sequenceId=\"%lu\" sysUpTime=\"%lu\"] ",
+                                 SYSLOG_FACILITY * 8 + SYSLOG_SEV_INFO, timestamp, ip[0], ip[1], ip[2], ip[3],
+                                 (unsigned long)syslog_msg_seq + 1, (unsigned long)(millis() / 10));
+
+    size_t body_len = 0;
+    int severity = SYSLOG_SEV_INFO;
+    if (syslog_lost) {
+        body_len = snprintf(syslog_body, sizeof(syslog_body), "%lu log records lost\n", (unsigned long)syslog_lost);
+        severity = SYSLOG_SEV_WARNING;
+    }
+    uint32_t seq = syslog_sent_seq;
+    bool full = false;
+    while (seq < head && Log.get(seq, r)) {
+        char prefix[16];
+        size_t prefix_len = snprintf(prefix, sizeof(prefix), "%lu ", (unsigned long)r.ms);
+        if (header_len + body_len + prefix_len + r.len + 1 > sizeof(syslog_packet)) {
+            full = true;
+            break;
+        }
+        memcpy(syslog_body + body_len, prefix, prefix_len);
+        memcpy(syslog_body + body_len + prefix_len, r.text, r.len);
+        body_len += prefix_len + r.len;
+        syslog_body[body_len++] = '\n';
+        if (memmem(r.text, r.len, "ERROR", 5)) severity = SYSLOG_SEV_ERR;
+        else if (severity > SYSLOG_SEV_WARNING && memmem(r.text, r.len, "WARNING", 7)) severity = SYSLOG_SEV_WARNING;
+        seq++;
+    }
+    // Keep collecting until the datagram is full or the oldest record has waited long enough
+    if (!full && !urgent && millis() - oldest_ms < SYSLOG_FLUSH_MS) return;
+
+    syslog_refill();
+    size_t len = header_len + body_len;
+    if (syslog_tokens < len) return;
+
+    header_len = snprintf(syslog_packet, sizeof(syslog_packet), "<%d>%s",
+                          SYSLOG_FACILITY * 8 + severity, strchr(header, '>') + 1);
+    memcpy(syslog_packet + header_len, syslog_body, body_len);
+    syslog_udp.beginPacket(IPAddress(syslog_cfg.syslog_server), syslog_cfg.syslog_port);
+    syslog_udp.write((const uint8_t*)syslog_packet, len);
+    if (!syslog_udp.endPacket()) return;
+    syslog_tokens -= len;
+    syslog_msg_seq++;
+    syslog_sent_seq = seq;
+    syslog_lost = 0;
+}
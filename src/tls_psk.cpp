@@ -0,0 +1,677 @@
+// TLS 1.3 server side, external PSK only (RFC 8446). The ClientHello is parsed for the few
+// extensions that matter here and everything else is ignored, as the RFC allows a server to.
+
+#include "tls_psk.h"
+#include "sha256.h"
+#include "x25519.h"
+
+#define TLS_RECORD_HEADER      5
+#define TLS_CHANGE_CIPHER_SPEC 20
+#define TLS_ALERT              21
+#define TLS_HANDSHAKE          22
+#define TLS_APPLICATION_DATA   23
+
+#define TLS_CLIENT_HELLO       1
+#define TLS_SERVER_HELLO       2
+#define TLS_ENCRYPTED_EXTENSIONS 8
+#define TLS_FINISHED           20
+#define TLS_KEY_UPDATE         24
+
+#define TLS_AES_128_GCM_SHA256 0x1301
+#define TLS_AES_128_CCM_SHA256 0x1304
+#define TLS_GROUP_X25519       0x001d
+
+#define EXT_PRE_SHARED_KEY     41
+#define EXT_EARLY_DATA         42
+#define EXT_SUPPORTED_VERSIONS 43
+#define EXT_PSK_MODES          45
+#define EXT_KEY_SHARE          51
+
+#define ALERT_CLOSE_NOTIFY         0
+#define ALERT_UNEXPECTED_MESSAGE   10
+#define ALERT_BAD_RECORD_MAC       20
+#define ALERT_HANDSHAKE_FAILURE    40
+#define ALERT_ILLEGAL_PARAMETER    47
+#define ALERT_DECODE_ERROR         50
+#define ALERT_DECRYPT_ERROR        51
+#define ALERT_PROTOCOL_VERSION     70
+#define ALERT_UNKNOWN_PSK_IDENTITY 115
+
+// Ciphertext may be 256 bytes longer than the plaintext limit (§5.2). Received records are
+// decrypted where they land, so this is also the buffer handlers read from.
+DMAMEM static uint8_t tls_rx[TLS_RECORD_HEADER + TLS_RECORD_MAX + 256] __attribute__((aligned(32)));
+static uint8_t tls_tx[TLS_RECORD_HEADER + TLS_TX_RECORD + 1 + AEAD_TAG_SIZE];
+static uint8_t tls_hello[TLS_HELLO_MAX];
+
+static uint32_t tls_handshakes;
+static uint32_t tls_failures;
+static uint32_t tls_handshake_ms;     // Last successful handshake
+static uint32_t tls_bytes_in;         // Application data
+static uint32_t tls_bytes_out;
+static uint64_t tls_open_cycles;      // Spent in aead_open
+static uint64_t tls_seal_cycles;      // Spent in aead_seal
+
+#if defined(__IMXRT1062__)
+// TRNG (i.MX RT1060 reference manual chapter 52), kept running between handshakes
+#define TRNG_BASE            0x400CC000
+#define TRNG_CTL             (*(volatile uint32_t*)TRNG_BASE)
+#define TRNG_ENTROPY(n)      (*(volatile uint32_t*)(TRNG_BASE + 0x40 + 4 * (n)))
+#define TRNG_CTL_PRGM        (1u << 16)
+#define TRNG_CTL_ERR         (1u << 12)
+#define TRNG_CTL_ENT_VAL     (1u << 10)
+#define TRNG_CTL_RST_DEF     (1u << 6)
+#define TRNG_CTL_VON_NEUMANN 2u
+#define TRNG_CCGR6           (*(volatile uint32_t*)0x400FC080)
+#define TRNG_CCGR6_ON        (3u << 12)
+
+static bool trng_started;
+
+static void trng_start() {
+    TRNG_CCGR6 |= TRNG_CCGR6_ON;
+    TRNG_CTL = TRNG_CTL_PRGM | TRNG_CTL_RST_DEF;
+    TRNG_CTL = TRNG_CTL_VON_NEUMANN;
+    (void)TRNG_ENTROPY(15);   // Reading the last word starts a new run
+    trng_started = true;
+}
+
+static void tls_random(uint8_t* out, size_t len) {
+    if (!trng_started) trng_start();
+    while (len) {
+        while (!(TRNG_CTL & (TRNG_CTL_ENT_VAL | TRNG_CTL_ERR))) ;
+        if (TRNG_CTL & TRNG_CTL_ERR) {
+            Log.println("WARNING: TRNG error, restarting it.");
+            trng_start();
+            continue;
+        }
+        uint32_t entropy[16];
+        for (int i = 0; i < 16; i++) entropy[i] = TRNG_ENTROPY(i);
+        size_t n = min(len, sizeof(entropy));
+        memcpy(out, entropy, n);
+        out += n;
+        len -= n;
+    }
+}
+#else
+#include <stdio.h>
+
+static void tls_random(uint8_t* out, size_t len) {
+    FILE* f = fopen("/dev/urandom", "rb");
+    if (!f || fread(out, 1, len, f) != len) abort();
+    fclose(f);
+}
+#endif
+
+static uint32_t get_be24(const uint8_t* p) {
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static bool equal_ct(const uint8_t* a, const uint8_t* b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+// Bounds checked reader over a handshake message; a short read clears ok and yields zeros
+typedef struct {
+    const uint8_t* p;
+    size_t left;
+    bool ok;
+} tls_reader_t;
+
+static uint32_t get(tls_reader_t& r, size_t bytes) {
+    if (r.left < bytes) {
+        r.ok = false;
+        r.left = 0;
+        return 0;
+    }
+    uint32_t v = 0;
+    for (size_t i = 0; i < bytes; i++) v = (v << 8) | r.p[i];
+    r.p += bytes;
+    r.left -= bytes;
+    return v;
+}
+
+static tls_reader_t sub(tls_reader_t& r, size_t len) {
+    tls_reader_t s = { r.p, 0, false };
+    if (r.left < len) {
+        r.ok = false;
+        r.left = 0;
+        return s;
+    }
+    s.left = len;
+    s.ok = true;
+    r.p += len;
+    r.left -= len;
+    return s;
+}
+
+// What the server needs out of a ClientHello
+typedef struct {
+    const uint8_t* session_id;   // Echoed in the ServerHello
+    size_t session_id_len;
+    int mode;                    // AEAD_*, -1 if neither suite was offered
+    bool tls13;
+    bool psk_ke, psk_dhe_ke;
+    bool early_data;
+    const uint8_t* share;        // Client's X25519 key, NULL if none
+    int psk_index;               // Offered identity matching ours, -1 if none
+    const uint8_t* binder;
+    size_t binders_offset;       // Bytes of the message the binder covers
+} tls_hello_t;
+
+// Returns the alert to send, 0 if the hello is usable
+static uint8_t parse_hello(const uint8_t* msg, size_t len, const net_config_t& cfg, tls_hello_t& h) {
+    memset(&h, 0, sizeof(h));
+    h.mode = -1;
+    h.psk_index = -1;
+    tls_reader_t r = { msg + 4, len - 4, true };
+    get(r, 2);                                   // legacy_version
+    sub(r, 32);                                  // random
+    h.session_id_len = get(r, 1);
+    h.session_id = r.p;
+    sub(r, h.session_id_len);
+    tls_reader_t suites = sub(r, get(r, 2));
+    while (suites.left >= 2) {
+        uint32_t suite = get(suites, 2);
+        if (suite == TLS_AES_128_CCM_SHA256) h.mode = AEAD_AES_128_CCM;
+        else if (suite == TLS_AES_128_GCM_SHA256 && h.mode < 0) h.mode = AEAD_AES_128_GCM;
+    }
+    sub(r, get(r, 1));                           // legacy_compression_methods
+    tls_reader_t exts = sub(r, get(r, 2));
+    if (!r.ok || h.session_id_len > 32) return ALERT_DECODE_ERROR;
+    size_t identity_len = strnlen(cfg.tls_identity, sizeof(cfg.tls_identity));
+    while (exts.left) {
+        uint32_t type = get(exts, 2);
+        tls_reader_t ext = sub(exts, get(exts, 2));
+        if (!exts.ok) return ALERT_DECODE_ERROR;
+        if (type == EXT_SUPPORTED_VERSIONS) {
+            tls_reader_t versions = sub(ext, get(ext, 1));
+            while (versions.left >= 2) h.tls13 |= get(versions, 2) == 0x0304;
+        } else if (type == EXT_PSK_MODES) {
+            tls_reader_t modes = sub(ext, get(ext, 1));
+            while (modes.left) {
+                uint32_t m = get(modes, 1);
+                h.psk_ke |= m == 0;
+                h.psk_dhe_ke |= m == 1;
+            }
+        } else if (type == EXT_KEY_SHARE) {
+            tls_reader_t shares = sub(ext, get(ext, 2));
+            while (shares.left) {
+                uint32_t group = get(shares, 2);
+                uint32_t key_len = get(shares, 2);
+                const uint8_t* key = shares.p;
+                sub(shares, key_len);
+                if (shares.ok && group == TLS_GROUP_X25519 && key_len == X25519_SIZE) h.share = key;
+            }
+        } else if (type == EXT_EARLY_DATA) {
+            h.early_data = true;
+        } else if (type == EXT_PRE_SHARED_KEY) {
+            // Always the last extension, the binders cover everything before them
+            if (exts.left) return ALERT_ILLEGAL_PARAMETER;
+            tls_reader_t ids = sub(ext, get(ext, 2));
+            for (int i = 0; ids.left; i++) {
+                size_t id_len = get(ids, 2);
+                const uint8_t* id = ids.p;
+                sub(ids, id_len);
+                get(ids, 4);                     // obfuscated_ticket_age, meaningless for external keys
+                if (ids.ok && h.psk_index < 0 && id_len == identity_len && !memcmp(id, cfg.tls_identity, id_len)) {
+                    h.psk_index = i;
+                }
+            }
+            h.binders_offset = ext.p - msg;
+            tls_reader_t binders = sub(ext, get(ext, 2));
+            for (int i = 0; binders.left; i++) {
+                size_t binder_len = get(binders, 1);
+                if (i == h.psk_index && binder_len == SHA256_DIGEST_SIZE) h.binder = binders.p;
+                sub(binders, binder_len);
+            }
+            if (!ids.ok || !binders.ok || ext.left) return ALERT_DECODE_ERROR;
+        }
+    }
+    if (!h.tls13) return ALERT_PROTOCOL_VERSION;
+    if (h.mode < 0 || !(h.psk_ke || h.psk_dhe_ke)) return ALERT_HANDSHAKE_FAILURE;
+    if (h.psk_index < 0) return ALERT_UNKNOWN_PSK_IDENTITY;
+    if (!h.binder) return ALERT_DECRYPT_ERROR;
+    if (!h.psk_ke && !h.share) return ALERT_HANDSHAKE_FAILURE;   // Would need a HelloRetryRequest
+    return 0;
+}
+
+// HKDF (RFC 5869) as the TLS 1.3 key schedule uses it, SHA-256 only
+static void hkdf_extract(const uint8_t salt[SHA256_DIGEST_SIZE], const uint8_t* ikm, size_t ikm_len, uint8_t prk[SHA256_DIGEST_SIZE]) {
+    hmac_sha256(salt, SHA256_DIGEST_SIZE, ikm, ikm_len, prk);
+}
+
+// HKDF-Expand-Label, §7.1; len at most one hash output
+static void expand_label(const uint8_t secret[SHA256_DIGEST_SIZE], const char* label, const uint8_t* context, size_t context_len,
+                         uint8_t* out, size_t len) {
+    uint8_t info[64];
+    size_t label_len = strlen(label);
+    size_t n = 0;
+    info[n++] = len >> 8;
+    info[n++] = len;
+    info[n++] = 6 + label_len;
+    memcpy(info + n, "tls13 ", 6);
+    n += 6;
+    memcpy(info + n, label, label_len);
+    n += label_len;
+    info[n++] = context_len;
+    if (context_len) memcpy(info + n, context, context_len);
+    n += context_len;
+    info[n++] = 1;
+    uint8_t t[SHA256_DIGEST_SIZE];
+    hmac_sha256(secret, SHA256_DIGEST_SIZE, info, n, t);
+    memcpy(out, t, len);
+}
+
+static void derive_secret(const uint8_t secret[SHA256_DIGEST_SIZE], const char* label, const uint8_t hash[SHA256_DIGEST_SIZE],
+                          uint8_t out[SHA256_DIGEST_SIZE]) {
+    expand_label(secret, label, hash, SHA256_DIGEST_SIZE, out, SHA256_DIGEST_SIZE);
+}
+
+static void transcript_hash(const sha256_ctx_t& transcript, uint8_t hash[SHA256_DIGEST_SIZE]) {
+    sha256_ctx_t copy = transcript;
+    sha256_final(copy, hash);
+}
+
+static void finished_mac(const uint8_t secret[SHA256_DIGEST_SIZE], const uint8_t hash[SHA256_DIGEST_SIZE], uint8_t mac[SHA256_DIGEST_SIZE]) {
+    uint8_t key[SHA256_DIGEST_SIZE];
+    expand_label(secret, "finished", NULL, 0, key, SHA256_DIGEST_SIZE);
+    hmac_sha256(key, SHA256_DIGEST_SIZE, hash, SHA256_DIGEST_SIZE, mac);
+}
+
+// Per record nonce, §5.3
+static void record_nonce(const uint8_t iv[AEAD_NONCE_SIZE], uint64_t seq, uint8_t nonce[AEAD_NONCE_SIZE]) {
+    memcpy(nonce, iv, AEAD_NONCE_SIZE);
+    for (int i = 0; i < 8; i++) nonce[AEAD_NONCE_SIZE - 1 - i] ^= seq >> (8 * i);
+}
+
+void TlsClient::set_keys(aead_t& aead, uint8_t iv[AEAD_NONCE_SIZE], uint64_t& seq, const uint8_t secret[SHA256_DIGEST_SIZE]) {
+    uint8_t key[AES_KEY_SIZE];
+    expand_label(secret, "key", NULL, 0, key, AES_KEY_SIZE);
+    expand_label(secret, "iv", NULL, 0, iv, AEAD_NONCE_SIZE);
+    aead_init(aead, mode, key);
+    seq = 0;
+}
+
+// 1 once a whole record is in tls_rx, 0 while waiting for more, -1 on a bad header or a closed connection
+int TlsClient::poll_record() {
+    size_t need = TLS_RECORD_HEADER;
+    if (rx_fill >= TLS_RECORD_HEADER) need += (tls_rx[3] << 8) | tls_rx[4];
+    while (rx_fill < need) {
+        int n = tcp.available();
+        if (n <= 0) return tcp.connected() ? 0 : -1;
+        int got = tcp.read(tls_rx + rx_fill, min((size_t)n, need - rx_fill));
+        if (got <= 0) return 0;
+        rx_fill += got;
+        if (rx_fill == TLS_RECORD_HEADER) {
+            size_t len = (tls_rx[3] << 8) | tls_rx[4];
+            if (tls_rx[1] != 3 || len > TLS_RECORD_MAX + 256) return -1;
+            need += len;
+        }
+    }
+    return 1;
+}
+
+bool TlsClient::wait_record(unsigned long deadline) {
+    while (true) {
+        int r = poll_record();
+        if (r) return r > 0;
+        if ((long)(millis() - deadline) >= 0) return false;
+        delay(1);
+    }
+}
+
+// Decrypts the record in tls_rx in place. Returns its real content type with len set to the
+// plaintext length, or -1 if it does not decrypt.
+int TlsClient::open_record(size_t& len) {
+    size_t n = rx_fill - TLS_RECORD_HEADER;
+    if (tls_rx[0] != TLS_APPLICATION_DATA || n < AEAD_TAG_SIZE + 1) return -1;
+    n -= AEAD_TAG_SIZE;
+    uint8_t nonce[AEAD_NONCE_SIZE];
+    record_nonce(rx_iv, rx_seq, nonce);
+    uint8_t* data = tls_rx + TLS_RECORD_HEADER;
+    uint32_t start = ARM_DWT_CYCCNT;
+    bool ok = aead_open(rx_aead, nonce, tls_rx, TLS_RECORD_HEADER, data, n, data + n);
+    tls_open_cycles += ARM_DWT_CYCCNT - start;
+    if (!ok) return -1;
+    rx_seq++;
+    // Zero padding follows the content type
+    while (n && data[n - 1] == 0) n--;
+    if (!n) return -1;
+    len = n - 1;
+    return data[len];
+}
+
+static bool tcp_write(EthernetClient& tcp, const uint8_t* buf, size_t len) {
+    while (len) {
+        size_t n = tcp.write(buf, len);
+        if (!n) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool TlsClient::send_plain(uint8_t type, const uint8_t* data, size_t len) {
+    tls_tx[0] = type;
+    tls_tx[1] = 3;
+    tls_tx[2] = 3;
+    tls_tx[3] = len >> 8;
+    tls_tx[4] = len;
+    memcpy(tls_tx + TLS_RECORD_HEADER, data, len);
+    return tcp_write(tcp, tls_tx, TLS_RECORD_HEADER + len);
+}
+
+// Protects and sends len bytes; data may already sit at tls_tx + TLS_RECORD_HEADER
+bool TlsClient::send_record(uint8_t type, const uint8_t* data, size_t len) {
+    uint8_t* p = tls_tx + TLS_RECORD_HEADER;
+    if (data != p) memmove(p, data, len);
+    p[len] = type;
+    size_t n = len + 1 + AEAD_TAG_SIZE;
+    tls_tx[0] = TLS_APPLICATION_DATA;
+    tls_tx[1] = 3;
+    tls_tx[2] = 3;
+    tls_tx[3] = n >> 8;
+    tls_tx[4] = n;
+    uint8_t nonce[AEAD_NONCE_SIZE];
+    record_nonce(tx_iv, tx_seq++, nonce);
+    uint32_t start = ARM_DWT_CYCCNT;
+    aead_seal(tx_aead, nonce, tls_tx, TLS_RECORD_HEADER, p, len + 1, p + len + 1);
+    tls_seal_cycles += ARM_DWT_CYCCNT - start;
+    return tcp_write(tcp, tls_tx, TLS_RECORD_HEADER + n);
+}
+
+void TlsClient::send_alert(uint8_t desc) {
+    const uint8_t alert[2] = { (uint8_t)(desc == ALERT_CLOSE_NOTIFY ? 1 : 2), desc };
+    tx_fill = 0;
+    if (encrypting) send_record(TLS_ALERT, alert, sizeof(alert));
+    else send_plain(TLS_ALERT, alert, sizeof(alert));
+}
+
+bool TlsClient::flush_tx() {
+    if (!tx_fill) return true;
+    tls_bytes_out += tx_fill;
+    size_t len = tx_fill;
+    tx_fill = 0;
+    return send_record(TLS_APPLICATION_DATA, tls_tx + TLS_RECORD_HEADER, len);
+}
+
+bool TlsClient::fail(uint8_t alert, const char* why) {
+    if (alert) send_alert(alert);
+    Log.print("TLS handshake failed: ");
+    Log.println(why);
+    tls_failures++;
+    encrypting = false;
+    open = false;
+    tcp.stop();
+    return false;
+}
+
+bool TlsClient::accept(EthernetClient& client, const net_config_t& cfg) {
+    tcp = client;
+    encrypting = false;
+    open = false;
+    rx_fill = rx_pos = rx_end = tx_fill = 0;
+    unsigned long start = millis();
+    unsigned long deadline = start + TLS_HANDSHAKE_TIMEOUT;
+
+    // ClientHello, which may span records
+    size_t hello_len = 0, need = 4;
+    while (hello_len < need) {
+        if (!wait_record(deadline)) return fail(0, "no ClientHello");
+        size_t len = rx_fill - TLS_RECORD_HEADER;
+        if (tls_rx[0] != TLS_HANDSHAKE || hello_len + len > sizeof(tls_hello)) return fail(ALERT_UNEXPECTED_MESSAGE, "not a ClientHello");
+        memcpy(tls_hello + hello_len, tls_rx + TLS_RECORD_HEADER, len);
+        hello_len += len;
+        rx_fill = 0;
+        if (hello_len >= 4) need = 4 + get_be24(tls_hello + 1);
+    }
+    if (tls_hello[0] != TLS_CLIENT_HELLO || hello_len != need) return fail(ALERT_UNEXPECTED_MESSAGE, "not a ClientHello");
+    tls_hello_t hello;
+    uint8_t alert = parse_hello(tls_hello, hello_len, cfg, hello);
+    if (alert) return fail(alert, "ClientHello not acceptable");
+    mode = hello.mode;
+
+    uint8_t zeros[SHA256_DIGEST_SIZE] = { 0 };
+    uint8_t empty_hash[SHA256_DIGEST_SIZE];
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint8_t early[SHA256_DIGEST_SIZE], handshake[SHA256_DIGEST_SIZE], secret[SHA256_DIGEST_SIZE];
+    uint8_t client_hs[SHA256_DIGEST_SIZE], server_hs[SHA256_DIGEST_SIZE];
+    sha256_ctx_t transcript;
+    sha256_init(transcript);
+    transcript_hash(transcript, empty_hash);
+
+    // The binder proves the client holds the key, over the hello up to the binders (§4.2.11.2)
+    hkdf_extract(zeros, cfg.tls_psk, cfg.tls_psk_length, early);
+    derive_secret(early, "ext binder", empty_hash, secret);
+    sha256_update(transcript, tls_hello, hello.binders_offset);
+    transcript_hash(transcript, hash);
+    uint8_t binder[SHA256_DIGEST_SIZE];
+    finished_mac(secret, hash, binder);
+    if (!equal_ct(binder, hello.binder, sizeof(binder))) return fail(ALERT_DECRYPT_ERROR, "wrong PSK");
+    sha256_update(transcript, tls_hello + hello.binders_offset, hello_len - hello.binders_offset);
+
+    // ServerHello
+    bool dhe = hello.psk_dhe_ke && hello.share;
+    uint8_t shared[X25519_SIZE] = { 0 };
+    uint8_t sh[128];
+    size_t n = 0;
+    sh[n++] = TLS_SERVER_HELLO;
+    n += 3;
+    sh[n++] = 3;
+    sh[n++] = 3;
+    tls_random(sh + n, 32);
+    n += 32;
+    sh[n++] = hello.session_id_len;
+    memcpy(sh + n, hello.session_id, hello.session_id_len);
+    n += hello.session_id_len;
+    uint16_t suite = mode == AEAD_AES_128_CCM ? TLS_AES_128_CCM_SHA256 : TLS_AES_128_GCM_SHA256;
+    sh[n++] = suite >> 8;
+    sh[n++] = suite;
+    sh[n++] = 0;
+    const uint8_t versions[] = { 0, EXT_SUPPORTED_VERSIONS, 0, 2, 3, 4 };
+    const uint8_t psk[] = { 0, EXT_PRE_SHARED_KEY, 0, 2, 0, (uint8_t)hello.psk_index };
+    size_t ext_len = sizeof(versions) + sizeof(psk) + (dhe ? 8 + X25519_SIZE : 0);
+    sh[n++] = ext_len >> 8;
+    sh[n++] = ext_len;
+    memcpy(sh + n, versions, sizeof(versions));
+    n += sizeof(versions);
+    if (dhe) {
+        uint8_t priv[X25519_SIZE];
+        const uint8_t share[] = { 0, EXT_KEY_SHARE, 0, 4 + X25519_SIZE, 0, TLS_GROUP_X25519, 0, X25519_SIZE };
+        memcpy(sh + n, share, sizeof(share));
+        n += sizeof(share);
+        tls_random(priv, sizeof(priv));
+        x25519(sh + n, priv, NULL);
+        n += X25519_SIZE;
+        x25519(shared, priv, hello.share);
+        memset(priv, 0, sizeof(priv));
+        if (equal_ct(shared, zeros, sizeof(shared))) return fail(ALERT_ILLEGAL_PARAMETER, "bad key share");
+    }
+    memcpy(sh + n, psk, sizeof(psk));
+    n += sizeof(psk);
+    sh[1] = 0;
+    sh[2] = (n - 4) >> 8;
+    sh[3] = n - 4;
+    sha256_update(transcript, sh, n);
+    if (!send_plain(TLS_HANDSHAKE, sh, n)) return fail(0, "connection lost");
+    // Middlebox compatibility mode (§D.4): the client sent a session id, so it expects one
+    const uint8_t ccs = 1;
+    if (hello.session_id_len && !send_plain(TLS_CHANGE_CIPHER_SPEC, &ccs, 1)) return fail(0, "connection lost");
+
+    // Handshake secrets
+    derive_secret(early, "derived", empty_hash, secret);
+    hkdf_extract(secret, shared, sizeof(shared), handshake);
+    memset(shared, 0, sizeof(shared));
+    transcript_hash(transcript, hash);
+    derive_secret(handshake, "c hs traffic", hash, client_hs);
+    derive_secret(handshake, "s hs traffic", hash, server_hs);
+    set_keys(tx_aead, tx_iv, tx_seq, server_hs);
+    set_keys(rx_aead, rx_iv, rx_seq, client_hs);
+    encrypting = true;
+
+    // EncryptedExtensions (empty) and Finished in one record
+    uint8_t flight[6 + 4 + SHA256_DIGEST_SIZE] = { TLS_ENCRYPTED_EXTENSIONS, 0, 0, 2, 0, 0, TLS_FINISHED, 0, 0, SHA256_DIGEST_SIZE };
+    sha256_update(transcript, flight, 6);
+    transcript_hash(transcript, hash);
+    finished_mac(server_hs, hash, flight + 10);
+    sha256_update(transcript, flight + 6, 4 + SHA256_DIGEST_SIZE);
+    if (!send_record(TLS_HANDSHAKE, flight, sizeof(flight))) return fail(0, "connection lost");
+
+    // Application secrets cover the transcript up to the server Finished
+    transcript_hash(transcript, hash);
+    uint8_t master[SHA256_DIGEST_SIZE], expected[SHA256_DIGEST_SIZE];
+    derive_secret(handshake, "derived", empty_hash, secret);
+    hkdf_extract(secret, zeros, sizeof(zeros), master);
+    derive_secret(master, "c ap traffic", hash, rx_secret);
+    derive_secret(master, "s ap traffic", hash, tx_secret);
+    finished_mac(client_hs, hash, expected);
+    set_keys(tx_aead, tx_iv, tx_seq, tx_secret);
+
+    // Client Finished
+    while (true) {
+        if (!wait_record(deadline)) return fail(0, "no Finished");
+        if (tls_rx[0] == TLS_CHANGE_CIPHER_SPEC) {
+            rx_fill = 0;
+            continue;
+        }
+        size_t len;
+        int type = open_record(len);
+        rx_fill = 0;
+        // 0-RTT data is never accepted, so it arrives under keys we don't have and is skipped
+        if (type < 0 && hello.early_data) continue;
+        if (type < 0) return fail(ALERT_BAD_RECORD_MAC, "record does not decrypt");
+        const uint8_t* msg = tls_rx + TLS_RECORD_HEADER;
+        if (type != TLS_HANDSHAKE || len != 4 + SHA256_DIGEST_SIZE || msg[0] != TLS_FINISHED) return fail(ALERT_UNEXPECTED_MESSAGE, "no Finished");
+        if (!equal_ct(msg + 4, expected, SHA256_DIGEST_SIZE)) return fail(ALERT_DECRYPT_ERROR, "bad Finished");
+        break;
+    }
+    set_keys(rx_aead, rx_iv, rx_seq, rx_secret);
+    open = true;
+    tls_handshakes++;
+    tls_handshake_ms = millis() - start;
+    Log.print("TLS session: ");
+    Log.print(mode == AEAD_AES_128_CCM ? "AES-128-CCM" : "AES-128-GCM");
+    Log.print(dhe ? ", X25519" : ", PSK only");
+    Log.print(", handshake "); Log.print(tls_handshake_ms); Log.println(" ms");
+    return true;
+}
+
+// KeyUpdate, the only post-handshake message a client sends a PSK-only server (§4.6.3)
+void TlsClient::key_update(const uint8_t* msg, size_t len) {
+    while (len >= 4) {
+        size_t body = get_be24(msg + 1);
+        if (body > len - 4) return;
+        if (msg[0] == TLS_KEY_UPDATE && body == 1) {
+            expand_label(rx_secret, "traffic upd", NULL, 0, rx_secret, SHA256_DIGEST_SIZE);
+            set_keys(rx_aead, rx_iv, rx_seq, rx_secret);
+            if (msg[4] == 1) {
+                const uint8_t reply[5] = { TLS_KEY_UPDATE, 0, 0, 1, 0 };
+                flush_tx();
+                send_record(TLS_HANDSHAKE, reply, sizeof(reply));
+                expand_label(tx_secret, "traffic upd", NULL, 0, tx_secret, SHA256_DIGEST_SIZE);
+                set_keys(tx_aead, tx_iv, tx_seq, tx_secret);
+            }
+        }
+        msg += 4 + body;
+        len -= 4 + body;
+    }
+}
+
+int TlsClient::available() {
+    if (rx_pos < rx_end) return rx_end - rx_pos;
+    while (open) {
+        int r = poll_record();
+        if (r == 0) return 0;
+        if (r < 0) {
+            open = false;
+            return 0;
+        }
+        size_t len;
+        int type = open_record(len);
+        rx_fill = 0;
+        if (type == TLS_APPLICATION_DATA) {
+            if (!len) continue;
+            rx_pos = TLS_RECORD_HEADER;
+            rx_end = TLS_RECORD_HEADER + len;
+            tls_bytes_in += len;
+            return len;
+        } else if (type == TLS_HANDSHAKE) {
+            key_update(tls_rx + TLS_RECORD_HEADER, len);
+        } else if (type == TLS_ALERT) {
+            // close_notify or an error, either way the client is done
+            open = false;
+        } else {
+            send_alert(type < 0 ? ALERT_BAD_RECORD_MAC : ALERT_UNEXPECTED_MESSAGE);
+            open = false;
+        }
+    }
+    return 0;
+}
+
+int TlsClient::read() {
+    if (available() <= 0) return -1;
+    return tls_rx[rx_pos++];
+}
+
+int TlsClient::read(uint8_t* buf, size_t size) {
+    int n = available();
+    if (n <= 0) return -1;
+    size = min(size, (size_t)n);
+    memcpy(buf, tls_rx + rx_pos, size);
+    rx_pos += size;
+    return size;
+}
+
+int TlsClient::peek() {
+    if (available() <= 0) return -1;
+    return tls_rx[rx_pos];
+}
+
+size_t TlsClient::write(const uint8_t* buf, size_t size) {
+    if (!open) return 0;
+    size_t done = 0;
+    while (done < size) {
+        size_t n = min(size - done, (size_t)TLS_TX_RECORD - tx_fill);
+        memcpy(tls_tx + TLS_RECORD_HEADER + tx_fill, buf + done, n);
+        tx_fill += n;
+        done += n;
+        if (tx_fill == TLS_TX_RECORD && !flush_tx()) return done;
+    }
+    return size;
+}
+
+void TlsClient::flush() {
+    if (open) flush_tx();
+    tcp.flush();
+}
+
+void TlsClient::stop() {
+    if (open) {
+        flush_tx();
+        send_alert(ALERT_CLOSE_NOTIFY);
+        open = false;
+    }
+    encrypting = false;
+    rx_pos = rx_end = 0;
+    tcp.stop();
+}
+
+uint8_t TlsClient::connected() {
+    return rx_pos < rx_end || (open && tcp.connected());
+}
+
+bool tls_enabled(const net_config_t& cfg) {
+    return cfg.tls_psk_length > 0 && cfg.tls_psk_length <= sizeof(cfg.tls_psk);
+}
+
+void tls_status(Print& out) {
+    out.print("tls_handshakes="); out.println(tls_handshakes);
+    out.print("tls_failures="); out.println(tls_failures);
+    out.print("tls_handshake_ms="); out.println(tls_handshake_ms);
+    out.print("tls_bytes_in="); out.println(tls_bytes_in);
+    out.print("tls_bytes_out="); out.println(tls_bytes_out);
+    // Cost of record protection, against zero for the same upload over plain HTTP
+    out.print("tls_open_cycles_per_kb="); out.println(tls_bytes_in ? (uint32_t)(tls_open_cycles * 1024 / tls_bytes_in) : 0);
+    out.print("tls_seal_cycles_per_kb="); out.println(tls_bytes_out ? (uint32_t)(tls_seal_cycles * 1024 / tls_bytes_out) : 0);
+}
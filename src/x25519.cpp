@@ -0,0 +1,132 @@
+// X25519 after TweetNaCl's crypto_scalarmult: field elements as 16 limbs of 16 bits held in
+// int64_t, a constant time Montgomery ladder.
+
+#include "x25519.h"
+#include <string.h>
+
+typedef int64_t gf[16];
+
+static const gf gf_121665 = { 0xDB41, 1 };
+
+static void carry(gf o) {
+    for (int i = 0; i < 16; i++) {
+        o[i] += (int64_t)1 << 16;
+        int64_t c = o[i] >> 16;
+        o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+        o[i] -= c * 65536;
+    }
+}
+
+// Swaps p and q when b is 1, without a branch
+static void swap(gf p, gf q, int b) {
+    int64_t c = ~((int64_t)b - 1);
+    for (int i = 0; i < 16; i++) {
+        int64_t t = c & (p[i] ^ q[i]);
+        p[i] ^= t;
+        q[i] ^= t;
+    }
+}
+
+static void pack(uint8_t* o, const gf n) {
+    gf m, t;
+    memcpy(t, n, sizeof(gf));
+    carry(t);
+    carry(t);
+    carry(t);
+    for (int j = 0; j < 2; j++) {
+        m[0] = t[0] - 0xffed;
+        for (int i = 1; i < 15; i++) {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        int b = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        swap(t, m, 1 - b);
+    }
+    for (int i = 0; i < 16; i++) {
+        o[2 * i] = t[i] & 0xff;
+        o[2 * i + 1] = t[i] >> 8;
+    }
+}
+
+static void unpack(gf o, const uint8_t* n) {
+    for (int i = 0; i < 16; i++) o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+    o[15] &= 0x7fff;
+}
+
+static void add(gf o, const gf a, const gf b) {
+    for (int i = 0; i < 16; i++) o[i] = a[i] + b[i];
+}
+
+static void sub(gf o, const gf a, const gf b) {
+    for (int i = 0; i < 16; i++) o[i] = a[i] - b[i];
+}
+
+static void mul(gf o, const gf a, const gf b) {
+    int64_t t[31] = { 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < 16; j++) t[i + j] += a[i] * b[j];
+    }
+    for (int i = 0; i < 15; i++) t[i] += 38 * t[i + 16];
+    memcpy(o, t, sizeof(gf));
+    carry(o);
+    carry(o);
+}
+
+static void square(gf o, const gf a) {
+    mul(o, a, a);
+}
+
+static void invert(gf o, const gf in) {
+    gf c;
+    memcpy(c, in, sizeof(gf));
+    for (int a = 253; a >= 0; a--) {
+        square(c, c);
+        if (a != 2 && a != 4) mul(c, c, in);
+    }
+    memcpy(o, c, sizeof(gf));
+}
+
+void x25519(uint8_t out[X25519_SIZE], const uint8_t scalar[X25519_SIZE], const uint8_t* point) {
+    static const uint8_t base[X25519_SIZE] = { 9 };
+    uint8_t z[X25519_SIZE];
+    gf x, a, b, c, d, e, f;
+    memcpy(z, scalar, X25519_SIZE);
+    z[31] = (z[31] & 127) | 64;
+    z[0] &= 248;
+    unpack(x, point ? point : base);
+    for (int i = 0; i < 16; i++) {
+        b[i] = x[i];
+        a[i] = c[i] = d[i] = 0;
+    }
+    a[0] = d[0] = 1;
+    for (int i = 254; i >= 0; i--) {
+        int r = (z[i >> 3] >> (i & 7)) & 1;
+        swap(a, b, r);
+        swap(c, d, r);
+        add(e, a, c);
+        sub(a, a, c);
+        add(c, b, d);
+        sub(b, b, d);
+        square(d, e);
+        square(f, a);
+        mul(a, c, a);
+        mul(c, b, e);
+        add(e, a, c);
+        sub(a, a, c);
+        square(b, a);
+        sub(c, d, f);
+        mul(a, c, gf_121665);
+        add(a, a, d);
+        mul(c, c, a);
+        mul(a, d, f);
+        mul(d, b, x);
+        square(b, e);
+        swap(a, b, r);
+        swap(c, d, r);
+    }
+    invert(c, c);
+    mul(a, a, c);
+    pack(out, a);
+}
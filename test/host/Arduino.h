@@ -0,0 +1,264 @@
+#pragma once
+
+// Host build: the parts of the Teensy 4 Arduino core the bootloader uses, backed by the host
+// clock (host.h). Behaviour follows the Teensyduino core where the firmware depends on it.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HEX 16
+#define DEC 10
+#define OCT 8
+#define BIN 2
+
+// No separate RAM regions on the host; the fixed addresses the firmware uses are mapped by flash.cpp
+#define DMAMEM
+#define FASTRUN
+#define FLASHMEM
+#define PROGMEM
+
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+#define LOW          0
+#define HIGH         1
+#define CHANGE       4
+#define FALLING      2
+#define RISING       3
+
+#ifndef F_CPU
+#define F_CPU 600000000
+#endif
+extern volatile uint32_t F_CPU_ACTUAL;
+extern volatile uint32_t F_BUS_ACTUAL;
+extern "C" uint32_t set_arm_clock(uint32_t frequency);
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+uint8_t digitalRead(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+uint32_t rtc_get();
+void rtc_set(uint32_t t);
+
+#define __disable_irq() do {} while (0)
+#define __enable_irq()  do {} while (0)
+
+// The host has no data cache in front of the mapped flash
+inline void arm_dcache_flush(void*, uint32_t) {}
+inline void arm_dcache_delete(void*, uint32_t) {}
+inline void arm_dcache_flush_delete(void*, uint32_t) {}
+
+#ifdef min
+#undef min
+#endif
+#ifdef max
+#undef max
+#endif
+template <class T> inline T min(T a, T b) { return a < b ? a : b; }
+template <class T> inline T max(T a, T b) { return a > b ? a : b; }
+template <class T> inline T constrain(T x, T lo, T hi) { return x < lo ? lo : (x > hi ? hi : x); }
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+
+class Print;
+
+class Printable {
+public:
+    virtual size_t printTo(Print& p) const = 0;
+    virtual ~Printable() {}
+};
+
+class String {
+public:
+    String(const char* s = "");
+    String(const String& s);
+    explicit String(char c);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    ~String();
+
+    String& operator=(const String& s);
+    String& operator=(const char* s);
+    String& operator+=(const String& s) { concat(s.buf, s.len); return *this; }
+    String& operator+=(const char* s) { concat(s, strlen(s)); return *this; }
+    String& operator+=(char c) { concat(&c, 1); return *this; }
+    friend String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+    friend String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+    friend String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+    friend String operator+(const String& a, char b) { String r(a); r += b; return r; }
+
+    bool operator==(const String& s) const { return len == s.len && memcmp(buf, s.buf, len) == 0; }
+    bool operator==(const char* s) const { return strcmp(buf, s) == 0; }
+    bool operator!=(const String& s) const { return !(*this == s); }
+    bool operator!=(const char* s) const { return !(*this == s); }
+    bool equals(const String& s) const { return *this == s; }
+    bool equalsIgnoreCase(const String& s) const;
+
+    unsigned int length() const { return len; }
+    const char* c_str() const { return buf; }
+    char operator[](unsigned int i) const { return i < len ? buf[i] : 0; }
+    char charAt(unsigned int i) const { return (*this)[i]; }
+    bool reserve(unsigned int size);
+    bool concat(const char* s, unsigned int n);
+
+    bool startsWith(const String& prefix) const;
+    bool startsWith(const char* prefix) const;
+    bool endsWith(const String& suffix) const;
+    bool endsWith(const char* suffix) const;
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const String& s, unsigned int from = 0) const { return indexOf(s.buf, from); }
+    int indexOf(const char* s, unsigned int from = 0) const;
+    int lastIndexOf(char c) const;
+    String substring(unsigned int from) const { return substring(from, len); }
+    String substring(unsigned int from, unsigned int to) const;
+
+    long toInt() const { return atol(buf); }
+    void trim();
+    void toLowerCase();
+    void toUpperCase();
+
+private:
+    char* buf;
+    unsigned int len;
+    unsigned int cap;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* s) { return s ? write((const uint8_t*)s, strlen(s)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const char* s) { return write(s); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const __FlashStringHelper* s) { return write((const char*)s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long long n, int base = DEC);
+    size_t print(unsigned long long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+    size_t print(const Printable& p) { return p.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(const T& v, int base) { size_t n = print(v, base); return n + println(); }
+
+    int printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t readBytes(char* buffer, size_t length);
+    void setTimeout(unsigned long ms) { timeout = ms; }
+
+protected:
+    unsigned long timeout = 1000;
+};
+
+// Serial goes to the host's stdout
+class usb_serial_class : public Stream {
+public:
+    void begin(long) {}
+    void end() {}
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override;
+    operator bool() { return true; }
+};
+extern usb_serial_class Serial;
+
+class IPAddress : public Printable {
+public:
+    IPAddress() { addr.dword = 0; }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { addr.bytes[0] = a; addr.bytes[1] = b; addr.bytes[2] = c; addr.bytes[3] = d; }
+    IPAddress(uint32_t dword) { addr.dword = dword; }
+    IPAddress(const uint8_t* bytes) { memcpy(addr.bytes, bytes, 4); }
+
+    operator uint32_t() const { return addr.dword; }
+    bool operator==(const IPAddress& o) const { return addr.dword == o.addr.dword; }
+    bool operator!=(const IPAddress& o) const { return addr.dword != o.addr.dword; }
+    bool operator==(const uint8_t* bytes) const { return memcmp(addr.bytes, bytes, 4) == 0; }
+    uint8_t operator[](int i) const { return addr.bytes[i]; }
+    uint8_t& operator[](int i) { return addr.bytes[i]; }
+    IPAddress& operator=(uint32_t dword) { addr.dword = dword; return *this; }
+    bool fromString(const char* s);
+    size_t printTo(Print& p) const override;
+
+private:
+    union {
+        uint8_t bytes[4];
+        uint32_t dword;   // Network byte order in memory, as in the Arduino core
+    } addr;
+};
+
+class Client : public Stream {
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t* buf, size_t size) = 0;
+    using Print::write;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(uint8_t* buf, size_t size) = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+};
+
+class Server : public Print {
+public:
+    virtual void begin() = 0;
+};
+
+class UDP : public Stream {
+public:
+    virtual uint8_t begin(uint16_t port) = 0;
+    virtual void stop() = 0;
+    virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+    virtual int endPacket() = 0;
+    virtual int parsePacket() = 0;
+    virtual int read(unsigned char* buffer, size_t len) = 0;
+    virtual IPAddress remoteIP() = 0;
+    virtual uint16_t remotePort() = 0;
+    using Stream::read;
+};
+
+#include "imxrt.h"
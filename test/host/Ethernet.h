@@ -0,0 +1,130 @@
+#pragma once
+
+// Host build: the Arduino Ethernet library API over the simulated W5x00 socket table in net.cpp.
+// As on the chip there are MAX_SOCK_NUM sockets shared by every listener, client and UDP socket,
+// and each holds a 2KB receive buffer; the table is fed either by real localhost sockets or by
+// a scripted network on the virtual clock (host.h).
+
+#include <Arduino.h>
+
+#define MAX_SOCK_NUM 8
+
+// Socket status, the W5x00 Sn_SR values
+#define SnSR_CLOSED      0x00
+#define SnSR_INIT        0x13
+#define SnSR_LISTEN      0x14
+#define SnSR_ESTABLISHED 0x17
+#define SnSR_FIN_WAIT    0x18
+#define SnSR_CLOSE_WAIT  0x1C
+#define SnSR_UDP         0x22
+
+enum EthernetHardwareStatus { EthernetNoHardware, EthernetW5100, EthernetW5200, EthernetW5500 };
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+
+class EthernetClass {
+public:
+    // DHCP: the host network hands out the --bridge or --ip address
+    int begin(uint8_t* mac, unsigned long timeout = 60000, unsigned long responseTimeout = 4000);
+    void begin(uint8_t* mac, IPAddress ip);
+    void begin(uint8_t* mac, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet);
+    int maintain() { return 0; }
+    EthernetLinkStatus linkStatus() { return LinkON; }
+    EthernetHardwareStatus hardwareStatus() { return EthernetW5500; }
+
+    IPAddress localIP();
+    IPAddress subnetMask();
+    IPAddress gatewayIP();
+    IPAddress dnsServerIP();
+    void setLocalIP(const IPAddress ip);
+    void setSubnetMask(const IPAddress mask);
+    void setGatewayIP(const IPAddress ip);
+    void setDnsServerIP(const IPAddress ip);
+    void MACAddress(uint8_t* mac);
+    void setRetransmissionTimeout(uint16_t) {}
+    void setRetransmissionCount(uint8_t) {}
+};
+extern EthernetClass Ethernet;
+
+class EthernetClient : public Client {
+public:
+    EthernetClient() : sockindex(MAX_SOCK_NUM) {}
+    EthernetClient(uint8_t s) : sockindex(s) {}
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    using Print::write;
+    int availableForWrite() override { return 2048; }
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return sockindex < MAX_SOCK_NUM; }
+    bool operator==(const EthernetClient& o) const { return sockindex == o.sockindex; }
+    bool operator!=(const EthernetClient& o) const { return sockindex != o.sockindex; }
+    uint8_t status();
+    uint8_t getSocketNumber() const { return sockindex; }
+    IPAddress remoteIP();
+    uint16_t remotePort();
+    uint16_t localPort();
+    void setConnectionTimeout(uint16_t ms) { connect_timeout = ms; }
+
+private:
+    uint8_t sockindex;
+    uint16_t connect_timeout = 1000;
+};
+
+class EthernetServer : public Server {
+public:
+    EthernetServer(uint16_t port) : port(port) {}
+    void begin() override;
+    // A connection that has not been handed out yet; the server listens on a new socket for the next one
+    EthernetClient accept();
+    // Any connection on this port with data waiting
+    EthernetClient available();
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    using Print::write;
+    operator bool();
+
+private:
+    uint16_t port;
+};
+
+class EthernetUDP : public UDP {
+public:
+    uint8_t begin(uint16_t port) override;
+    void stop() override;
+    int beginPacket(IPAddress ip, uint16_t port) override;
+    int beginPacket(const char* host, uint16_t port);
+    int endPacket() override;
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    using Print::write;
+    int parsePacket() override;
+    int available() override { return rx_len - rx_pos; }
+    int read() override;
+    int read(unsigned char* buffer, size_t len) override;
+    int read(char* buffer, size_t len) { return read((unsigned char*)buffer, len); }
+    int peek() override { return rx_pos < rx_len ? rx_buf[rx_pos] : -1; }
+    void flush() override {}
+    IPAddress remoteIP() override { return IPAddress(rx_ip); }
+    uint16_t remotePort() override { return rx_port; }
+    uint16_t localPort() { return port; }
+
+private:
+    uint8_t sockindex = MAX_SOCK_NUM;
+    uint16_t port = 0;
+    uint8_t tx_buf[1472];
+    size_t tx_len = 0;
+    uint32_t tx_ip = 0;
+    uint16_t tx_port = 0;
+    uint8_t rx_buf[1472];
+    int rx_len = 0, rx_pos = 0;
+    uint32_t rx_ip = 0;
+    uint16_t rx_port = 0;
+};
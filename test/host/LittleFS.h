@@ -0,0 +1,74 @@
+#pragma once
+
+// Host build: LittleFS_Program inside the flash image, in the region the Teensy 4.0 library gives
+// it: begin(size) puts the filesystem right below the 64KB EEPROM emulation and restore area at
+// the top of flash, so with PROG_FLASH_SIZE that is 0x600F0000-0x601F0000. A /flash dump and a
+// host image hold the same state in one file. Only the calls the bootloader makes.
+//
+// The files are kept in memory and the whole set is rewritten into the region, in the host's own
+// format (fs.cpp, tools/flashimg.py reads it), whenever a written file is closed or flushed and on
+// every rename or remove. Like LittleFS, writes that are never synced are lost at a reset. The
+// rewrite bypasses the flash cost model: the virtual clock does not charge for filesystem I/O.
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ        0
+#define FILE_WRITE       1   // Starts at the end, like the Teensy LittleFS
+#define FILE_WRITE_BEGIN 2
+
+#define LFS_PROGRAM_FLASH_END 0x601F0000
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct HostFile;
+
+class File : public Stream {
+public:
+    File() {}
+    // Copies share the open file, which closes with the last of them, as on the Teensy
+    File(std::shared_ptr<HostFile> f) : f(f) {}
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    size_t write(const void* buf, size_t size) { return write((const uint8_t*)buf, size); }
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(void* buf, size_t size);
+    int peek() override;
+    void flush() override;
+    bool seek(uint64_t pos, int mode = SeekSet);
+    uint64_t position();
+    uint64_t size();
+    void close();
+    operator bool() { return f != nullptr; }
+
+private:
+    std::shared_ptr<HostFile> f;
+};
+
+class FS {
+public:
+    virtual ~FS() {}
+    File open(const char* path, uint8_t mode = FILE_READ);
+    bool exists(const char* path);
+    bool mkdir(const char* path);
+    bool rename(const char* from, const char* to);
+    bool remove(const char* path);
+    bool rmdir(const char* path);
+    uint64_t usedSize();
+    uint64_t totalSize() { return size; }
+
+protected:
+    uint64_t size = 0;
+};
+
+class LittleFS : public FS {
+public:
+    bool quickFormat();
+};
+
+class LittleFS_Program : public LittleFS {
+public:
+    bool begin(uint32_t size);
+};
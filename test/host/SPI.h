@@ -0,0 +1,12 @@
+#pragma once
+
+// Host build: the W5x00 is simulated above the SPI bus (Ethernet.h), so the bus does nothing
+
+#include <Arduino.h>
+
+class SPIClass {
+public:
+    void begin() {}
+    void end() {}
+};
+extern SPIClass SPI;
@@ -0,0 +1,328 @@
+// Host build: Arduino core stand-ins (String, Print, Serial, IPAddress), the clock and the few
+// registers the portable code reads.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <stdarg.h>
+#include <time.h>
+#include "host.h"
+
+usb_serial_class Serial;
+SPIClass SPI;
+
+volatile uint32_t F_CPU_ACTUAL = F_CPU;
+volatile uint32_t F_BUS_ACTUAL = F_CPU / 4;
+volatile uint32_t IOMUXC_GPR_GPR17 = 0xAAAAAAFF;
+volatile uint32_t SCB_VTOR;
+volatile uint32_t SCB_CACHE_ICIALLU;
+host_aircr_t SCB_AIRCR;
+
+// ---- Clock ----
+
+#define HOST_MILLIS_NS 50   // Virtual cost of reading the clock, so a loop on millis() alone ends
+
+static bool virtual_clock = false;
+static uint64_t virtual_ns = 0;
+static struct timespec wall_start;
+static uint32_t rtc_offset;
+
+void host_use_virtual_clock() {
+    virtual_clock = true;
+}
+
+bool host_virtual() {
+    return virtual_clock;
+}
+
+uint64_t host_now_ns() {
+    if (virtual_clock) return virtual_ns;
+    if (wall_start.tv_sec == 0) clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - wall_start.tv_sec) * 1000000000ull + now.tv_nsec - wall_start.tv_nsec;
+}
+
+void host_spend_ns(uint64_t ns) {
+    if (virtual_clock) {
+        virtual_ns += ns;
+        return;
+    }
+    struct timespec t = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+    nanosleep(&t, NULL);
+}
+
+unsigned long millis() {
+    if (virtual_clock) virtual_ns += HOST_MILLIS_NS;
+    return (unsigned long)(uint32_t)(host_now_ns() / 1000000);
+}
+
+unsigned long micros() {
+    if (virtual_clock) virtual_ns += HOST_MILLIS_NS;
+    return (unsigned long)(uint32_t)(host_now_ns() / 1000);
+}
+
+void delay(uint32_t ms) {
+    host_spend_ns((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    host_spend_ns((uint64_t)us * 1000);
+}
+
+void yield() {}
+
+uint32_t host_cycle_count() {
+    return (uint32_t)(host_now_ns() * (F_CPU_ACTUAL / 1000000) / 1000);
+}
+
+extern "C" uint32_t set_arm_clock(uint32_t frequency) {
+    F_CPU_ACTUAL = frequency;
+    return frequency;
+}
+
+// The virtual clock starts at a fixed date, so leases and log stamps are reproducible too
+uint32_t rtc_get() {
+    if (virtual_clock) return 1760000000u + rtc_offset + (uint32_t)(virtual_ns / 1000000000ull);
+    return (uint32_t)time(NULL) + rtc_offset;
+}
+
+void rtc_set(uint32_t t) {
+    rtc_offset += t - rtc_get();
+}
+
+host_aircr_t& host_aircr_t::operator=(uint32_t value) {
+    if (value == 0x05FA0004) {
+        host_event("reset");
+        host_exit(HOST_EXIT_RESET);
+    }
+    return *this;
+}
+
+// No GPIO: INTn is never wired on the host, eth_irq_wait is the socket layer's own wait
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+uint8_t digitalRead(uint8_t) { return HIGH; }
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+void detachInterrupt(uint8_t) {}
+
+// ---- String ----
+
+String::String(const char* s) : buf(NULL), len(0), cap(0) {
+    concat(s ? s : "", s ? strlen(s) : 0);
+}
+
+String::String(const String& s) : buf(NULL), len(0), cap(0) {
+    concat(s.buf, s.len);
+}
+
+String::String(char c) : buf(NULL), len(0), cap(0) {
+    concat(&c, 1);
+}
+
+static void format_unsigned(char* out, unsigned long value, unsigned char base) {
+    char tmp[72];
+    int n = 0;
+    do {
+        int d = value % base;
+        tmp[n++] = d < 10 ? '0' + d : 'A' + d - 10;
+        value /= base;
+    } while (value);
+    while (n) *out++ = tmp[--n];
+    *out = 0;
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+
+String::String(long value, unsigned char base) : buf(NULL), len(0), cap(0) {
+    char tmp[72];
+    if (base == 10 && value < 0) {
+        tmp[0] = '-';
+        format_unsigned(tmp + 1, -(unsigned long)value, 10);
+    } else {
+        format_unsigned(tmp, (unsigned long)value, base);
+    }
+    concat(tmp, strlen(tmp));
+}
+
+String::String(unsigned long value, unsigned char base) : buf(NULL), len(0), cap(0) {
+    char tmp[72];
+    format_unsigned(tmp, value, base);
+    concat(tmp, strlen(tmp));
+}
+
+String::~String() {
+    free(buf);
+}
+
+String& String::operator=(const String& s) {
+    if (this == &s) return *this;
+    len = 0;
+    concat(s.buf, s.len);
+    return *this;
+}
+
+String& String::operator=(const char* s) {
+    String copy(s);
+    return *this = copy;
+}
+
+bool String::reserve(unsigned int size) {
+    if (buf && size < cap) return true;
+    unsigned int n = cap ? cap : 16;
+    while (n <= size) n *= 2;
+    char* p = (char*)realloc(buf, n);
+    if (!p) return false;
+    if (!buf) p[0] = 0;
+    buf = p;
+    cap = n;
+    return true;
+}
+
+bool String::concat(const char* s, unsigned int n) {
+    if (!reserve(len + n)) return false;
+    memmove(buf + len, s, n);
+    len += n;
+    buf[len] = 0;
+    return true;
+}
+
+bool String::equalsIgnoreCase(const String& s) const {
+    return len == s.len && strcasecmp(buf, s.buf) == 0;
+}
+
+bool String::startsWith(const String& prefix) const {
+    return prefix.len <= len && memcmp(buf, prefix.buf, prefix.len) == 0;
+}
+
+bool String::startsWith(const char* prefix) const {
+    return strncmp(buf, prefix, strlen(prefix)) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+    return suffix.len <= len && memcmp(buf + len - suffix.len, suffix.buf, suffix.len) == 0;
+}
+
+bool String::endsWith(const char* suffix) const {
+    return endsWith(String(suffix));
+}
+
+int String::indexOf(char c, unsigned int from) const {
+    if (from >= len) return -1;
+    const char* p = (const char*)memchr(buf + from, c, len - from);
+    return p ? p - buf : -1;
+}
+
+int String::indexOf(const char* s, unsigned int from) const {
+    if (from > len) return -1;
+    const char* p = strstr(buf + from, s);
+    return p ? p - buf : -1;
+}
+
+int String::lastIndexOf(char c) const {
+    const char* p = strrchr(buf, c);
+    return p ? p - buf : -1;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) { unsigned int t = from; from = to; to = t; }
+    if (from > len) return String();
+    if (to > len) to = len;
+    String out;
+    out.concat(buf + from, to - from);
+    return out;
+}
+
+void String::trim() {
+    unsigned int start = 0, end = len;
+    while (start < end && isspace((unsigned char)buf[start])) start++;
+    while (end > start && isspace((unsigned char)buf[end - 1])) end--;
+    memmove(buf, buf + start, end - start);
+    len = end - start;
+    buf[len] = 0;
+}
+
+void String::toLowerCase() {
+    for (unsigned int i = 0; i < len; i++) buf[i] = tolower((unsigned char)buf[i]);
+}
+
+void String::toUpperCase() {
+    for (unsigned int i = 0; i < len; i++) buf[i] = toupper((unsigned char)buf[i]);
+}
+
+// ---- Print ----
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(long n, int base) {
+    return print(String(n, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long n, int base) {
+    return print(String(n, (unsigned char)base));
+}
+
+size_t Print::print(long long n, int base) {
+    return print((long)n, base);
+}
+
+size_t Print::print(unsigned long long n, int base) {
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(double n, int digits) {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%.*f", digits, n);
+    return write(tmp);
+}
+
+int Print::printf(const char* format, ...) {
+    char tmp[512];
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(tmp, sizeof(tmp), format, ap);
+    va_end(ap);
+    if (n > (int)sizeof(tmp) - 1) n = sizeof(tmp) - 1;
+    return n < 0 ? n : (int)write((const uint8_t*)tmp, n);
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    unsigned long start = millis();
+    while (n < length && millis() - start < timeout) {
+        int c = read();
+        if (c < 0) continue;
+        buffer[n++] = c;
+    }
+    return n;
+}
+
+size_t usb_serial_class::write(const uint8_t* buffer, size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void usb_serial_class::flush() {
+    fflush(stdout);
+}
+
+// ---- IPAddress ----
+
+bool IPAddress::fromString(const char* s) {
+    unsigned int a, b, c, d;
+    char extra;
+    if (sscanf(s, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+        return false;
+    }
+    *this = IPAddress(a, b, c, d);
+    return true;
+}
+
+size_t IPAddress::printTo(Print& p) const {
+    char tmp[16];
+    snprintf(tmp, sizeof(tmp), "%u.%u.%u.%u", addr.bytes[0], addr.bytes[1], addr.bytes[2], addr.bytes[3]);
+    return p.write(tmp);
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build: main.cpp includes the CMSIS DSP header but uses nothing from it
@@ -0,0 +1,211 @@
+// Host build: EthernetClass, EthernetClient, EthernetServer and EthernetUDP over the socket table
+// in net.cpp. DHCP, through Ethernet.begin(mac) or dhcp_cache, gets the --bridge or --ip address.
+
+#include <Ethernet.h>
+#include "host.h"
+
+EthernetClass Ethernet;
+
+static uint32_t dns_server;
+static const uint8_t host_mac[6] = { 0x04, 0xE9, 0xE5, 0x00, 0x00, 0x01 };
+
+int EthernetClass::begin(uint8_t*, unsigned long, unsigned long) {
+    // DISCOVER, OFFER, REQUEST, ACK on a quiet LAN
+    host_spend_ns(2 * host_dhcp_exchange_ns());
+    host_dhcp_lease(host_ip, host_subnet, host_gateway);
+    dns_server = host_gateway;
+    return 1;
+}
+
+void EthernetClass::begin(uint8_t* mac, IPAddress ip) {
+    IPAddress gateway = ip;
+    gateway[3] = 1;
+    begin(mac, ip, gateway, gateway, IPAddress(255, 255, 255, 0));
+}
+
+void EthernetClass::begin(uint8_t*, IPAddress ip, IPAddress dns, IPAddress gateway, IPAddress subnet) {
+    host_ip = ip;
+    dns_server = dns;
+    host_gateway = gateway;
+    host_subnet = subnet;
+}
+
+IPAddress EthernetClass::localIP() { return IPAddress(host_ip); }
+IPAddress EthernetClass::subnetMask() { return IPAddress(host_subnet); }
+IPAddress EthernetClass::gatewayIP() { return IPAddress(host_gateway); }
+IPAddress EthernetClass::dnsServerIP() { return IPAddress(dns_server); }
+void EthernetClass::setLocalIP(const IPAddress ip) { host_ip = ip; }
+void EthernetClass::setSubnetMask(const IPAddress mask) { host_subnet = mask; }
+void EthernetClass::setGatewayIP(const IPAddress ip) { host_gateway = ip; }
+void EthernetClass::setDnsServerIP(const IPAddress ip) { dns_server = ip; }
+
+void EthernetClass::MACAddress(uint8_t* mac) {
+    memcpy(mac, host_mac, sizeof(host_mac));
+}
+
+// ---- EthernetClient ----
+
+int EthernetClient::connect(IPAddress ip, uint16_t port) {
+    if (sockindex < MAX_SOCK_NUM) stop();
+    int s = host_sock_connect(ip, port, connect_timeout);
+    sockindex = s < 0 ? MAX_SOCK_NUM : s;
+    return s >= 0;
+}
+
+int EthernetClient::connect(const char* host, uint16_t port) {
+    IPAddress ip;
+    if (!ip.fromString(host)) return 0;   // No DNS on the host network
+    return connect(ip, port);
+}
+
+size_t EthernetClient::write(const uint8_t* buf, size_t size) {
+    if (sockindex >= MAX_SOCK_NUM) return 0;
+    return host_sock_write(sockindex, buf, size);
+}
+
+int EthernetClient::available() {
+    if (sockindex >= MAX_SOCK_NUM) return 0;
+    return host_sock_available(sockindex);
+}
+
+int EthernetClient::read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int EthernetClient::read(uint8_t* buf, size_t size) {
+    if (sockindex >= MAX_SOCK_NUM) return -1;
+    return host_sock_read(sockindex, buf, size);
+}
+
+int EthernetClient::peek() {
+    if (sockindex >= MAX_SOCK_NUM) return -1;
+    return host_sock_peek(sockindex);
+}
+
+void EthernetClient::stop() {
+    if (sockindex >= MAX_SOCK_NUM) return;
+    host_sock_close(sockindex);
+    sockindex = MAX_SOCK_NUM;
+}
+
+// As the library: still connected while there is data left to read after the peer's FIN
+uint8_t EthernetClient::connected() {
+    if (sockindex >= MAX_SOCK_NUM) return 0;
+    uint8_t s = host_sock_status(sockindex);
+    return s == SnSR_ESTABLISHED || (s == SnSR_CLOSE_WAIT && host_sock_available(sockindex) > 0);
+}
+
+uint8_t EthernetClient::status() {
+    if (sockindex >= MAX_SOCK_NUM) return SnSR_CLOSED;
+    return host_sock_status(sockindex);
+}
+
+IPAddress EthernetClient::remoteIP() {
+    return IPAddress(sockindex < MAX_SOCK_NUM ? host_sock_remote_ip(sockindex) : 0);
+}
+
+uint16_t EthernetClient::remotePort() {
+    return sockindex < MAX_SOCK_NUM ? host_sock_remote_port(sockindex) : 0;
+}
+
+uint16_t EthernetClient::localPort() {
+    return sockindex < MAX_SOCK_NUM ? host_sock_local_port(sockindex) : 0;
+}
+
+// ---- EthernetServer ----
+
+void EthernetServer::begin() {
+    if (!host_sock_listening(port)) host_sock_listen(port);
+}
+
+EthernetClient EthernetServer::accept() {
+    int s = host_sock_accept(port);
+    // The library relistens as soon as the listening socket turns into a connection
+    if (!host_sock_listening(port)) host_sock_listen(port);
+    return s < 0 ? EthernetClient() : EthernetClient(s);
+}
+
+EthernetClient EthernetServer::available() {
+    int s = host_sock_accept(port);
+    if (!host_sock_listening(port)) host_sock_listen(port);
+    if (s < 0) return EthernetClient();
+    EthernetClient client(s);
+    return client;
+}
+
+size_t EthernetServer::write(const uint8_t* buf, size_t size) {
+    size_t n = 0;
+    for (int s = 0; s < MAX_SOCK_NUM; s++) {
+        if (host_sock_local_port(s) == port && host_sock_status(s) == SnSR_ESTABLISHED) {
+            n += host_sock_write(s, buf, size);
+        }
+    }
+    return n;
+}
+
+EthernetServer::operator bool() {
+    return host_sock_listening(port);
+}
+
+// ---- EthernetUDP ----
+
+uint8_t EthernetUDP::begin(uint16_t local_port) {
+    if (sockindex < MAX_SOCK_NUM) stop();
+    int s = host_udp_open(local_port);
+    if (s < 0) return 0;
+    sockindex = s;
+    port = local_port;
+    return 1;
+}
+
+void EthernetUDP::stop() {
+    if (sockindex >= MAX_SOCK_NUM) return;
+    host_sock_close(sockindex);
+    sockindex = MAX_SOCK_NUM;
+}
+
+int EthernetUDP::beginPacket(IPAddress ip, uint16_t remote_port) {
+    tx_ip = ip;
+    tx_port = remote_port;
+    tx_len = 0;
+    return sockindex < MAX_SOCK_NUM;
+}
+
+int EthernetUDP::beginPacket(const char* host, uint16_t remote_port) {
+    IPAddress ip;
+    if (!ip.fromString(host)) return 0;
+    return beginPacket(ip, remote_port);
+}
+
+size_t EthernetUDP::write(const uint8_t* buf, size_t size) {
+    size_t n = min(size, sizeof(tx_buf) - tx_len);
+    memcpy(tx_buf + tx_len, buf, n);
+    tx_len += n;
+    return n;
+}
+
+int EthernetUDP::endPacket() {
+    if (sockindex >= MAX_SOCK_NUM) return 0;
+    return host_udp_send(sockindex, tx_ip, tx_port, tx_buf, tx_len);
+}
+
+// Drops what is left of the current packet, as the library does
+int EthernetUDP::parsePacket() {
+    rx_len = rx_pos = 0;
+    if (sockindex >= MAX_SOCK_NUM) return 0;
+    rx_len = host_udp_recv(sockindex, rx_buf, sizeof(rx_buf), rx_ip, rx_port);
+    return rx_len;
+}
+
+int EthernetUDP::read() {
+    return rx_pos < rx_len ? rx_buf[rx_pos++] : -1;
+}
+
+int EthernetUDP::read(unsigned char* buffer, size_t len) {
+    int n = min((int)len, rx_len - rx_pos);
+    if (n <= 0) return -1;
+    memcpy(buffer, rx_buf + rx_pos, n);
+    rx_pos += n;
+    return n;
+}
@@ -0,0 +1,119 @@
+// Host build: the flash_* backend over an mmap'd image file, and the fixed RAM regions.
+// The firmware reads flash through plain pointers at FLASH_BASE, so the image is mapped there
+// read-only, exactly where XIP puts it; erase and program go through a second, writable mapping
+// of the same pages. A stray store into flash faults, as it would on the board.
+
+#include "s3bl.h"
+#include "host.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+host_costs_t host_costs = {
+    45000,      // Sector erase, 45 ms typical
+    150000,     // 64KB block erase, 150 ms typical
+    12000,      // Write enable, program and busy polling per word
+    2000,       // Register read: 4 byte SPI frame plus the library's double read of Sn_RX_RSR
+    600,        // 14MHz SPI plus framing
+    0,
+    1000,
+};
+
+host_stats_t host_stats;
+
+static char* flash_file;
+static uint8_t* flash_rw;
+
+const char* host_flash_path() {
+    return flash_file;
+}
+
+uint8_t* host_flash_rw(uint32_t addr) {
+    return flash_rw + (addr - FLASH_BASE);
+}
+
+static void* map_file(const char* path, size_t size, uintptr_t address, int prot, uint8_t fill) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "host: %s: %s\n", path, strerror(errno));
+        host_exit(HOST_EXIT_ERROR);
+    }
+    if ((size_t)st.st_size < size) {
+        // New image: erased flash, or RAM that has never been written
+        uint8_t* blank = (uint8_t*)malloc(size - st.st_size);
+        memset(blank, fill, size - st.st_size);
+        if (pwrite(fd, blank, size - st.st_size, st.st_size) != (ssize_t)(size - st.st_size)) {
+            fprintf(stderr, "host: %s: %s\n", path, strerror(errno));
+            host_exit(HOST_EXIT_ERROR);
+        }
+        free(blank);
+    }
+    int flags = MAP_SHARED | (address ? MAP_FIXED_NOREPLACE : 0);
+    void* p = mmap((void*)address, size, prot, flags, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED || (address && p != (void*)address)) {
+        fprintf(stderr, "host: can't map %s at 0x%08lx\n", path, (unsigned long)address);
+        host_exit(HOST_EXIT_ERROR);
+    }
+    return p;
+}
+
+void host_map_memory(const char* flash_path) {
+    flash_file = strdup(flash_path);
+    map_file(flash_path, FLASH_SIZE, FLASH_BASE, PROT_READ, 0xFF);
+    flash_rw = (uint8_t*)map_file(flash_path, FLASH_SIZE, 0, PROT_READ | PROT_WRITE, 0xFF);
+    // OCRAM2 keeps its contents over a warm reset (the handoff block lives there), DTCM does not
+    char ocram[4096];
+    snprintf(ocram, sizeof(ocram), "%s.ocram", flash_path);
+    map_file(ocram, OCRAM2_SIZE, OCRAM2_BASE, PROT_READ | PROT_WRITE, 0);
+    if (mmap((void*)DTCM_BASE, DTCM_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != (void*)DTCM_BASE) {
+        fprintf(stderr, "host: can't map DTCM at 0x%08x\n", DTCM_BASE);
+        host_exit(HOST_EXIT_ERROR);
+    }
+}
+
+static uint32_t flash_offset(uint32_t addr, uint32_t len, const char* what) {
+    if (addr < FLASH_BASE || addr - FLASH_BASE > FLASH_SIZE || len > FLASH_SIZE - (addr - FLASH_BASE)) {
+        host_event("fault %s 0x%08x+%u outside flash", what, (unsigned)addr, (unsigned)len);
+        host_exit(HOST_EXIT_ERROR);
+    }
+    return addr - FLASH_BASE;
+}
+
+// The chip erases the sector or block the address falls in
+void flash_erase_sector(uint32_t addr) {
+    uint32_t offset = flash_offset(addr, 1, "erase") & ~(SECTOR_SIZE - 1);
+    memset(flash_rw + offset, 0xFF, SECTOR_SIZE);
+    host_stats.sector_erases++;
+    host_stats.erase_ns += (uint64_t)host_costs.sector_erase_us * 1000;
+    host_spend_ns((uint64_t)host_costs.sector_erase_us * 1000);
+}
+
+void flash_erase_block(uint32_t addr) {
+    uint32_t offset = flash_offset(addr, 1, "erase") & ~(FLASH_BLOCK_SIZE - 1);
+    memset(flash_rw + offset, 0xFF, FLASH_BLOCK_SIZE);
+    host_stats.block_erases++;
+    host_stats.erase_ns += (uint64_t)host_costs.block_erase_us * 1000;
+    host_spend_ns((uint64_t)host_costs.block_erase_us * 1000);
+}
+
+// Whole words as the FlexSPI backend programs them, so up to 3 bytes past len come from data.
+// Programming can only clear bits; what was not erased first keeps its zeros.
+void flash_program(uint32_t addr, const void* data, size_t len) {
+    size_t words = (len + 3) / 4;
+    uint32_t offset = flash_offset(addr, words * 4, "program");
+    const uint8_t* src = (const uint8_t*)data;
+    for (size_t i = 0; i < words * 4; i++) {
+        flash_rw[offset + i] &= src[i];
+    }
+    host_stats.program_ns += (uint64_t)host_costs.program_word_ns * words;
+    host_spend_ns((uint64_t)host_costs.program_word_ns * words);
+}
@@ -0,0 +1,253 @@
+// Host build: LittleFS_Program in its flash region (see LittleFS.h). The bootloader only keeps a
+// handful of files at the root, so the region holds a flat table rather than littlefs blocks:
+//   header: magic "S3HF", version, body length, crc32_update over the body
+//   body:   per entry a 32 byte NUL padded path, its length (0xFFFFFFFF for a directory) and the
+//           data padded to 4 bytes
+// tools/flashimg.py reads and writes the same layout.
+
+#include <LittleFS.h>
+#include "host.h"
+#include "s3bl.h"
+#include <map>
+#include <string>
+#include <vector>
+
+#define HOST_FS_MAGIC    0x46483353 // "S3HF"
+#define HOST_FS_VERSION  1
+#define HOST_FS_NAME     32
+#define HOST_FS_DIR      0xFFFFFFFF
+
+typedef std::shared_ptr<std::vector<uint8_t>> host_data_t;
+
+struct HostFile {
+    host_data_t data;
+    uint64_t pos = 0;
+    bool writable = false;
+    bool dirty = false;
+    ~HostFile();
+};
+
+static std::map<std::string, host_data_t> fs_files;   // A null entry is a directory
+static uint32_t fs_base, fs_size, fs_written;           // fs_written: bytes of the last table
+
+static uint32_t entry_bytes(const host_data_t& d) {
+    return HOST_FS_NAME + 4 + (d ? ((uint32_t)d->size() + 3) & ~3u : 0);
+}
+
+static uint32_t table_bytes() {
+    uint32_t n = 16;
+    for (auto& e : fs_files) n += entry_bytes(e.second);
+    return n;
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back(v >> (8 * i));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Erases what the last table used and writes the new one in its place
+static bool fs_sync() {
+    std::vector<uint8_t> table;
+    for (auto& e : fs_files) {
+        size_t at = table.size();
+        table.resize(at + HOST_FS_NAME, 0);
+        memcpy(table.data() + at, e.first.c_str(), e.first.size());
+        put32(table, e.second ? (uint32_t)e.second->size() : HOST_FS_DIR);
+        if (e.second) {
+            table.insert(table.end(), e.second->begin(), e.second->end());
+            table.resize((table.size() + 3) & ~3u, 0xFF);
+        }
+    }
+    std::vector<uint8_t> header;
+    put32(header, HOST_FS_MAGIC);
+    put32(header, HOST_FS_VERSION);
+    put32(header, table.size());
+    put32(header, crc32_update(0, table.data(), table.size()));
+    uint32_t len = header.size() + table.size();
+    if (len > fs_size) return false;
+    uint8_t* region = host_flash_rw(fs_base);
+    uint32_t erase = (max(len, fs_written) + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    memset(region, 0xFF, min(erase, fs_size));
+    // Header last, so a reader never sees a valid header over a half written table
+    memcpy(region + header.size(), table.data(), table.size());
+    memcpy(region, header.data(), header.size());
+    fs_written = len;
+    return true;
+}
+
+// Mounts the table in the region; anything else there is formatted, as LittleFS_Program::begin does
+static void fs_load() {
+    fs_files.clear();
+    const uint8_t* region = (const uint8_t*)(uintptr_t)fs_base;
+    uint32_t len = get32(region + 8);
+    if (get32(region) != HOST_FS_MAGIC || get32(region + 4) != HOST_FS_VERSION || len > fs_size - 16 ||
+        crc32_update(0, region + 16, len) != get32(region + 12)) {
+        fs_written = fs_size;   // Unknown contents, erase all of it
+        fs_sync();
+        return;
+    }
+    const uint8_t* p = region + 16;
+    const uint8_t* end = p + len;
+    while (p + HOST_FS_NAME + 4 <= end) {
+        std::string name((const char*)p, strnlen((const char*)p, HOST_FS_NAME));
+        uint32_t size = get32(p + HOST_FS_NAME);
+        p += HOST_FS_NAME + 4;
+        if (size == HOST_FS_DIR) {
+            fs_files[name] = nullptr;
+            continue;
+        }
+        if (size > (uint32_t)(end - p)) break;
+        fs_files[name] = std::make_shared<std::vector<uint8_t>>(p, p + size);
+        p += (size + 3) & ~3u;
+    }
+    fs_written = 16 + len;
+}
+
+static bool valid_path(const char* path) {
+    return fs_size && path[0] == '/' && strlen(path) < HOST_FS_NAME;
+}
+
+HostFile::~HostFile() {
+    if (dirty) fs_sync();
+}
+
+size_t File::write(const uint8_t* buf, size_t size) {
+    if (!f || !f->writable) return 0;
+    size_t end = max((size_t)f->pos + size, f->data->size());
+    // Full like LittleFS when the table would no longer fit the region
+    if (table_bytes() + ((end + 3) & ~3u) - ((f->data->size() + 3) & ~3u) > fs_size) return 0;
+    if (end > f->data->size()) f->data->resize(end);
+    memcpy(f->data->data() + f->pos, buf, size);
+    f->pos += size;
+    f->dirty = true;
+    return size;
+}
+
+int File::available() {
+    if (!f) return 0;
+    return (int)(size() - position());
+}
+
+int File::read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int File::read(void* buf, size_t size) {
+    if (!f) return -1;
+    size_t n = f->pos < f->data->size() ? min(size, (size_t)(f->data->size() - f->pos)) : 0;
+    memcpy(buf, f->data->data() + f->pos, n);
+    f->pos += n;
+    return (int)n;
+}
+
+int File::peek() {
+    if (!f || f->pos >= f->data->size()) return -1;
+    return (*f->data)[f->pos];
+}
+
+void File::flush() {
+    if (f && f->dirty) {
+        fs_sync();
+        f->dirty = false;
+    }
+}
+
+bool File::seek(uint64_t pos, int mode) {
+    if (!f || mode < SeekSet || mode > SeekEnd) return false;
+    int64_t origin = mode == SeekSet ? 0 : mode == SeekCur ? (int64_t)f->pos : (int64_t)f->data->size();
+    int64_t to = origin + (int64_t)pos;
+    if (to < 0) return false;
+    f->pos = to;
+    return true;
+}
+
+uint64_t File::position() {
+    return f ? f->pos : 0;
+}
+
+uint64_t File::size() {
+    return f ? f->data->size() : 0;
+}
+
+void File::close() {
+    f.reset();
+}
+
+File FS::open(const char* path, uint8_t mode) {
+    if (!valid_path(path)) return File();
+    auto it = fs_files.find(path);
+    if (it != fs_files.end() && !it->second) return File();   // Directories are not opened here
+    auto file = std::make_shared<HostFile>();
+    if (it == fs_files.end()) {
+        if (mode != FILE_WRITE && mode != FILE_WRITE_BEGIN) return File();
+        if (table_bytes() + HOST_FS_NAME + 4 > fs_size) return File();
+        file->data = fs_files[path] = std::make_shared<std::vector<uint8_t>>();
+        file->dirty = true;   // Synced on close even if nothing gets written
+    } else {
+        file->data = it->second;
+    }
+    file->writable = mode == FILE_WRITE || mode == FILE_WRITE_BEGIN;
+    if (mode == FILE_WRITE) file->pos = file->data->size();
+    return File(file);
+}
+
+bool FS::exists(const char* path) {
+    return valid_path(path) && fs_files.count(path);
+}
+
+bool FS::mkdir(const char* path) {
+    if (!valid_path(path) || fs_files.count(path)) return false;
+    fs_files[path] = nullptr;
+    return fs_sync();
+}
+
+bool FS::rename(const char* from, const char* to) {
+    if (!valid_path(from) || !valid_path(to)) return false;
+    auto it = fs_files.find(from);
+    if (it == fs_files.end()) return false;
+    host_data_t data = it->second;
+    fs_files.erase(it);
+    fs_files[to] = data;
+    return fs_sync();
+}
+
+bool FS::remove(const char* path) {
+    auto it = valid_path(path) ? fs_files.find(path) : fs_files.end();
+    if (it == fs_files.end() || !it->second) return false;
+    fs_files.erase(it);
+    return fs_sync();
+}
+
+bool FS::rmdir(const char* path) {
+    auto it = valid_path(path) ? fs_files.find(path) : fs_files.end();
+    if (it == fs_files.end() || it->second) return false;
+    fs_files.erase(it);
+    return fs_sync();
+}
+
+// Whole 4KB blocks per file, as LittleFS allocates them
+uint64_t FS::usedSize() {
+    if (!fs_size) return 0;
+    uint64_t used = 2 * 4096;   // The superblock pair
+    for (auto& e : fs_files) used += e.second ? (e.second->size() + 4095) / 4096 * 4096 : 4096;
+    return used;
+}
+
+bool LittleFS::quickFormat() {
+    if (!fs_size) return false;
+    fs_files.clear();
+    return fs_sync();
+}
+
+bool LittleFS_Program::begin(uint32_t bytes) {
+    bytes &= ~(SECTOR_SIZE - 1);
+    if (bytes == 0 || bytes > LFS_PROGRAM_FLASH_END - FLASH_BASE) return false;
+    size = fs_size = bytes;
+    fs_base = LFS_PROGRAM_FLASH_END - bytes;
+    fs_load();
+    return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Host build of the bootloader: src/ compiled for Linux against the stand-ins in this directory,
+// so the firmware's own recovery loop, parsers and flash paths run without a board. The Teensy
+// specifics sit behind the same seams on both sides: the flash_* backend and the jump in
+// main.cpp, hot_jump and the netboot barriers are only compiled for __IMXRT1062__, and the
+// W5x00 is replaced above the Ethernet library API. test/hostsim.py builds and drives it.
+//
+//   s3bl_host --flash dev.bin [--bridge 127.0.0.2 --port-offset 20000]
+//   s3bl_host --flash dev.bin --script net.txt --transcript out.txt [--link-rate 12500000 --rtt-us 1000]
+//
+// Flash: the image file is mapped MAP_SHARED at FLASH_BASE, so the firmware reads it in place
+// exactly like XIP, and it persists across runs; erase and program follow NOR rules. OCRAM2 is
+// mapped the same way from <image>.ocram, as it survives a warm reset on the board. LittleFS_Program
+// lives in its region of the same image (LittleFS.h).
+//
+// Clock: with --bridge, millis() is the wall clock and the socket table is backed by real
+// localhost sockets, device port p listening on <ip>:p+offset. With --script the clock is
+// virtual: it only moves on delay(), on waits for socket events and by the modelled cost of
+// W5x00 SPI transfers and flash operations, and the network is the scripted clients of the
+// script file. Runs are reproducible to the microsecond.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Exit codes, the harness restarts the process on HOST_EXIT_RESET
+#define HOST_EXIT_IDLE   0   // Virtual clock: nothing left to happen
+#define HOST_EXIT_ERROR  1
+#define HOST_EXIT_RESET  3   // SCB_AIRCR system reset
+#define HOST_EXIT_JUMP   4   // jump_to_app into an image, which the host can't run
+
+#define OCRAM2_BASE      0x20200000
+#define OCRAM2_SIZE      (512 * 1024)
+#define DTCM_BASE        0x20000000
+#define DTCM_SIZE        (512 * 1024)
+
+// Virtual clock cost model, defaults from the W25Q16JV data sheet and the W5500 at 14MHz SPI
+typedef struct {
+    uint32_t sector_erase_us;
+    uint32_t block_erase_us;
+    uint32_t program_word_ns;   // flash_program programs one word per write enable
+    uint32_t spi_poll_ns;       // One socket register read (Sn_SR, Sn_RX_RSR)
+    uint32_t spi_byte_ns;       // Per byte of a buffer transfer
+    uint32_t link_rate;         // Bytes/s of the scripted link, 0 = unlimited
+    uint32_t rtt_us;
+} host_costs_t;
+
+extern host_costs_t host_costs;
+
+// Where the modelled time went; the virtual clock run ends with them as a "stats" event
+typedef struct {
+    uint64_t erase_ns;
+    uint64_t program_ns;
+    uint64_t spi_ns;
+    uint32_t sector_erases;
+    uint32_t block_erases;
+} host_stats_t;
+
+extern host_stats_t host_stats;
+
+// Clock
+void host_use_virtual_clock();
+bool host_virtual();
+uint64_t host_now_ns();
+// Virtual clock: moves time forward. Wall clock: sleeps.
+void host_spend_ns(uint64_t ns);
+
+// Flash and RAM mappings
+void host_map_memory(const char* flash_path);
+const char* host_flash_path();
+// Writable view of the image at a flash address, for host state kept in flash (the LittleFS
+// region). Not charged to the cost model.
+uint8_t* host_flash_rw(uint32_t addr);
+
+// Network. Bridge: real sockets on ip, device ports shifted by port_offset. Script: the clients in
+// script_path, what the device sends goes to transcript_path.
+void host_net_bridge(uint32_t ip, uint16_t port_offset);
+void host_net_script(const char* script_path, const char* transcript_path, uint32_t ip);
+// Waits up to timeout_ms (0 = no limit) for a socket event, see eth_irq_wait
+void host_net_wait(uint32_t timeout_ms);
+void host_net_close_all();
+// The address, mask and gateway the network's DHCP server assigns, the --bridge or --ip address
+void host_dhcp_lease(uint32_t& ip, uint32_t& subnet, uint32_t& gateway);
+// One request and reply with that server: a round trip plus its turnaround. A full discovery is
+// two of them (DISCOVER/OFFER, REQUEST/ACK), an INIT-REBOOT request one.
+#define HOST_DHCP_TURNAROUND_US 2000
+static inline uint64_t host_dhcp_exchange_ns() {
+    return (host_costs.rtt_us + HOST_DHCP_TURNAROUND_US) * 1000ull;
+}
+// One line into the transcript (script mode) or onto stderr, prefixed with the time
+void host_event(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// Leaving the firmware
+void host_exit(int code) __attribute__((noreturn));
+// What the image at address does once started, see target.cpp
+void host_start_image(uint32_t address) __attribute__((noreturn));
+
+// TCP/UDP sockets of the simulated W5x00, socket numbers 0 to MAX_SOCK_NUM - 1
+int host_sock_listen(uint16_t port);
+int host_sock_accept(uint16_t port);
+bool host_sock_listening(uint16_t port);
+int host_sock_connect(uint32_t ip, uint16_t port, uint32_t timeout_ms);
+uint8_t host_sock_status(int s);
+int host_sock_available(int s);
+int host_sock_read(int s, uint8_t* buf, size_t len);
+int host_sock_peek(int s);
+size_t host_sock_write(int s, const uint8_t* buf, size_t len);
+void host_sock_close(int s);
+uint32_t host_sock_remote_ip(int s);
+uint16_t host_sock_remote_port(int s);
+uint16_t host_sock_local_port(int s);
+int host_udp_open(uint16_t port);
+bool host_udp_send(int s, uint32_t ip, uint16_t port, const uint8_t* data, size_t len);
+int host_udp_recv(int s, uint8_t* buf, size_t len, uint32_t& ip, uint16_t& port);
+
+// The interface address and mask Ethernet reports
+extern uint32_t host_ip, host_subnet, host_gateway;
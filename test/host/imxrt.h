@@ -0,0 +1,22 @@
+#pragma once
+
+// Host build: the i.MX RT1062 registers the portable code touches. The FlexSPI, DCP and barrier
+// code is only compiled for the Teensy (__IMXRT1062__); these are plain variables, apart from the
+// reset request and the cycle counter, which the host turns into a process exit and host time.
+
+#include <stdint.h>
+
+// FlexRAM bank configuration, the Teensy default of 4 ITCM, 12 DTCM banks unless --gpr17 says otherwise
+extern volatile uint32_t IOMUXC_GPR_GPR17;
+extern volatile uint32_t SCB_VTOR;
+extern volatile uint32_t SCB_CACHE_ICIALLU;
+
+// Writing SYSRESETREQ (0x05FA0004) ends the process with HOST_EXIT_RESET (host.h)
+struct host_aircr_t {
+    host_aircr_t& operator=(uint32_t value);
+};
+extern host_aircr_t SCB_AIRCR;
+
+// Cycles at F_CPU_ACTUAL derived from the host clock
+uint32_t host_cycle_count();
+#define ARM_DWT_CYCCNT (host_cycle_count())
@@ -0,0 +1,690 @@
+// Host build: the W5x00 socket table and the two networks behind it.
+//
+// Bridge: every socket is backed by a real socket on the loopback address given with --bridge.
+// Device ports below 32768 are shifted by the port offset both ways, so several host devices and
+// the host tools (s3bl_upload.py, s3bl_coap.py, openssl s_client) can talk to each other.
+//
+// Script: the clients of a script file connect and send on the virtual clock. Sends go out as
+// MSS-sized segments, the client only sends while the socket's receive buffer has room (a window
+// freed by a read reaches it half an RTT later), and segments share a link of --link-rate bytes/s.
+// Everything the device sends or does goes into the transcript.
+//
+// Script lines, times in microseconds, relative to the connection's start:
+//   <us> open <conn> <port> [after <conn>]   connect at <us>, or <us> after the device closed <conn>;
+//                                            the SYN is retried until a socket listens on the port
+//   <us> send <conn> <len>                   followed by <len> raw bytes and a newline
+//   <us> close <conn>                        the client's FIN
+// Transcript lines: @<us> accept|delivered|close <conn>, where delivered means the client's last
+// byte reached the socket; @<us> recv <conn> <len> plus the raw bytes and a newline; and the
+// host's own events (reset, jump, stats, idle).
+
+#include <Ethernet.h>
+#include "host.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#define RX_BUFFER        2048     // Per socket with all 8 W5500 sockets in use
+#define SCRIPT_MSS          1460
+#define UDP_QUEUE        8
+#define SERVICE_PORTS    32768    // Bridge: ports below are device ports and get the offset
+#define SCRIPT_CLIENT_IP 0x0A01A8C0   // 192.168.1.10, the scripted clients' address
+#define NEVER            UINT64_MAX
+
+uint32_t host_ip, host_subnet, host_gateway;
+static uint32_t lease_ip, lease_subnet, lease_gateway;   // What the network's DHCP server hands out
+
+typedef struct {
+    uint32_t ip;
+    uint16_t port;
+    std::string data;
+} udp_packet_t;
+
+typedef struct {
+    uint8_t status;           // SnSR_*
+    uint16_t port;            // Local port
+    bool handed;              // Returned by accept() already
+    bool peer_fin;
+    std::string rx;           // Receive buffer, read from rx_pos
+    size_t rx_pos;
+    uint32_t remote_ip;
+    uint16_t remote_port;
+    std::deque<udp_packet_t> udp;
+    int fd;                   // Bridge
+    int conn;                 // Script
+} sock_t;
+
+typedef struct {
+    uint64_t t;               // Script: relative to the connection's start. In flight: arrival.
+    std::string data;
+    bool fin;
+} segment_t;
+
+enum { CONN_WAITING, CONN_OPEN, CONN_DONE };
+
+typedef struct {
+    int id;
+    uint16_t port;
+    int after;                // Connection whose close starts this one, -1 for none
+    uint64_t base;            // Start of the connection's timeline, NEVER until known
+    uint64_t open_at;
+    int state;
+    int sock;
+    std::deque<segment_t> pending;
+    std::deque<segment_t> flight;
+    std::deque<std::pair<uint64_t, uint32_t> > credits;   // Window updates on their way back
+    uint32_t unacked;         // Sent bytes the client has not seen read yet
+    uint64_t window_at;       // Last window update it did see
+} conn_t;
+
+static sock_t socks[MAX_SOCK_NUM];
+static bool bridge = false;
+static bool script = false;
+static uint16_t port_offset;
+static std::map<uint16_t, int> listen_fds;
+static std::map<int, conn_t> conns;
+static FILE* transcript;
+static uint64_t link_free;
+static uint64_t events, events_seen;
+
+static void sock_reset(sock_t& s) {
+    s.status = SnSR_CLOSED;
+    s.port = 0;
+    s.handed = false;
+    s.peer_fin = false;
+    s.rx.clear();
+    s.rx_pos = 0;
+    s.remote_ip = 0;
+    s.remote_port = 0;
+    s.udp.clear();
+    s.fd = -1;
+    s.conn = -1;
+}
+
+// ---- Transcript ----
+
+static void transcript_line(const char* format, va_list ap) {
+    FILE* out = transcript ? transcript : stderr;
+    fprintf(out, "@%llu ", (unsigned long long)(host_now_ns() / 1000));
+    vfprintf(out, format, ap);
+    fputc('\n', out);
+    fflush(out);
+}
+
+void host_event(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    transcript_line(format, ap);
+    va_end(ap);
+}
+
+static void transcript_data(int conn, const uint8_t* data, size_t len) {
+    host_event("recv %d %zu", conn, len);
+    fwrite(data, 1, len, transcript);
+    fputc('\n', transcript);
+    fflush(transcript);
+}
+
+// ---- Bridge ----
+
+static uint16_t to_host_port(uint16_t port) {
+    return port < SERVICE_PORTS ? port + port_offset : port;
+}
+
+static uint16_t from_host_port(uint16_t port) {
+    return port >= port_offset && port - port_offset < SERVICE_PORTS ? port - port_offset : port;
+}
+
+static sockaddr_in host_addr(uint32_t ip, uint16_t port) {
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = ip;
+    a.sin_port = htons(to_host_port(port));
+    return a;
+}
+
+static int bridge_listen_fd(uint16_t port) {
+    std::map<uint16_t, int>::iterator it = listen_fds.find(port);
+    if (it != listen_fds.end()) return it->second;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in a = host_addr(lease_ip, port);
+    if (bind(fd, (sockaddr*)&a, sizeof(a)) < 0 || listen(fd, 16) < 0) {
+        fprintf(stderr, "host: can't listen on port %u: %s\n", to_host_port(port), strerror(errno));
+        host_exit(HOST_EXIT_ERROR);
+    }
+    listen_fds[port] = fd;
+    return fd;
+}
+
+static void bridge_pump() {
+    for (std::map<uint16_t, int>::iterator it = listen_fds.begin(); it != listen_fds.end(); ++it) {
+        sockaddr_in from;
+        socklen_t len = sizeof(from);
+        // Connections wait in the kernel's backlog until a socket listens on the port again, as a
+        // client's retransmitted SYN would on the real network
+        while (true) {
+            int s = -1;
+            for (int i = 0; i < MAX_SOCK_NUM && s < 0; i++) {
+                if (socks[i].status == SnSR_LISTEN && socks[i].port == it->first) s = i;
+            }
+            if (s < 0) break;
+            int fd = accept4(it->second, (sockaddr*)&from, &len, SOCK_NONBLOCK);
+            if (fd < 0) break;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            socks[s].status = SnSR_ESTABLISHED;
+            socks[s].fd = fd;
+            socks[s].remote_ip = from.sin_addr.s_addr;
+            socks[s].remote_port = from_host_port(ntohs(from.sin_port));
+            events++;
+            len = sizeof(from);
+        }
+    }
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        sock_t& s = socks[i];
+        if (s.fd < 0) continue;
+        if (s.status == SnSR_UDP) {
+            uint8_t buf[1500];
+            sockaddr_in from;
+            socklen_t len = sizeof(from);
+            ssize_t n;
+            while ((n = recvfrom(s.fd, buf, sizeof(buf), 0, (sockaddr*)&from, &len)) >= 0) {
+                if (s.udp.size() < UDP_QUEUE) {
+                    udp_packet_t p = { from.sin_addr.s_addr, from_host_port(ntohs(from.sin_port)), std::string((char*)buf, n) };
+                    s.udp.push_back(p);
+                    events++;
+                }
+                len = sizeof(from);
+            }
+            continue;
+        }
+        if (s.peer_fin || (s.status != SnSR_ESTABLISHED && s.status != SnSR_CLOSE_WAIT)) continue;
+        if (s.rx_pos > 0) {
+            s.rx.erase(0, s.rx_pos);
+            s.rx_pos = 0;
+        }
+        size_t room = RX_BUFFER - s.rx.size();
+        if (room == 0) continue;
+        char buf[RX_BUFFER];
+        ssize_t n = recv(s.fd, buf, room, 0);
+        if (n > 0) {
+            s.rx.append(buf, n);
+            events++;
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            s.peer_fin = true;
+            s.status = SnSR_CLOSE_WAIT;
+            events++;
+        }
+    }
+}
+
+static void lease_init(uint32_t ip) {
+    lease_ip = ip;
+    lease_subnet = IPAddress(255, 255, 255, 0);
+    lease_gateway = (ip & lease_subnet) | IPAddress(0, 0, 0, 1);
+    host_ip = lease_ip;
+    host_subnet = lease_subnet;
+    host_gateway = lease_gateway;
+}
+
+void host_dhcp_lease(uint32_t& ip, uint32_t& subnet, uint32_t& gateway) {
+    ip = lease_ip;
+    subnet = lease_subnet;
+    gateway = lease_gateway;
+}
+
+void host_net_bridge(uint32_t ip, uint16_t offset) {
+    bridge = true;
+    lease_init(ip);
+    port_offset = offset;
+    for (int i = 0; i < MAX_SOCK_NUM; i++) sock_reset(socks[i]);
+}
+
+// ---- Script ----
+
+static bool read_line(FILE* f, char* line, size_t len) {
+    while (fgets(line, len, f)) {
+        if (line[0] != '#' && line[0] != '\n') return true;
+    }
+    return false;
+}
+
+void host_net_script(const char* script_path, const char* transcript_path, uint32_t ip) {
+    script = true;
+    host_use_virtual_clock();
+    lease_init(ip);
+    for (int i = 0; i < MAX_SOCK_NUM; i++) sock_reset(socks[i]);
+    transcript = fopen(transcript_path, "wb");
+    FILE* f = fopen(script_path, "rb");
+    if (!f || !transcript) {
+        fprintf(stderr, "host: can't open %s or %s\n", script_path, transcript_path);
+        host_exit(HOST_EXIT_ERROR);
+    }
+    char line[256];
+    while (read_line(f, line, sizeof(line))) {
+        unsigned long long t;
+        char verb[16];
+        int id, arg = 0, after = -1;
+        int fields = sscanf(line, "%llu %15s %d %d after %d", &t, verb, &id, &arg, &after);
+        if (fields < 3) {
+            fprintf(stderr, "host: bad script line: %s", line);
+            host_exit(HOST_EXIT_ERROR);
+        }
+        conn_t& c = conns[id];
+        if (!strcmp(verb, "open")) {
+            c.id = id;
+            c.port = arg;
+            c.after = after;
+            c.base = after < 0 ? 0 : NEVER;
+            c.open_at = t * 1000;
+            c.state = CONN_WAITING;
+            c.sock = -1;
+            c.unacked = 0;
+            c.window_at = 0;
+        } else if (!strcmp(verb, "send")) {
+            std::string data(arg, '\0');
+            if (fread(&data[0], 1, arg, f) != (size_t)arg) {
+                fprintf(stderr, "host: script ends inside a send\n");
+                host_exit(HOST_EXIT_ERROR);
+            }
+            fgetc(f);
+            // The client's stack cuts the send into full-sized segments
+            for (size_t off = 0; off < data.size(); off += SCRIPT_MSS) {
+                segment_t seg = { t * 1000, data.substr(off, SCRIPT_MSS), false };
+                c.pending.push_back(seg);
+            }
+        } else if (!strcmp(verb, "close")) {
+            segment_t seg = { t * 1000, std::string(), true };
+            c.pending.push_back(seg);
+        }
+    }
+    fclose(f);
+}
+
+static void conn_done(conn_t& c) {
+    c.state = CONN_DONE;
+    for (std::map<int, conn_t>::iterator it = conns.begin(); it != conns.end(); ++it) {
+        if (it->second.after == c.id && it->second.base == NEVER) it->second.base = host_now_ns();
+    }
+}
+
+static void script_pump() {
+    uint64_t now = host_now_ns();
+    for (std::map<int, conn_t>::iterator it = conns.begin(); it != conns.end(); ++it) {
+        conn_t& c = it->second;
+        if (c.state == CONN_WAITING && c.base != NEVER && c.base + c.open_at <= now) {
+            int s = -1;
+            for (int i = 0; i < MAX_SOCK_NUM && s < 0; i++) {
+                if (socks[i].status == SnSR_LISTEN && socks[i].port == c.port) s = i;
+            }
+            // Until a socket listens on the port the client keeps retransmitting its SYN
+            if (s < 0) continue;
+            socks[s].status = SnSR_ESTABLISHED;
+            socks[s].conn = c.id;
+            socks[s].remote_ip = SCRIPT_CLIENT_IP;
+            socks[s].remote_port = 40000 + c.id;
+            c.sock = s;
+            c.state = CONN_OPEN;
+            c.base = now;   // Send times count from the accepted connection
+            events++;
+            host_event("accept %d", c.id);
+        }
+        if (c.state != CONN_OPEN) continue;
+        sock_t& s = socks[c.sock];
+        while (!c.credits.empty() && c.credits.front().first <= now) {
+            c.unacked -= c.credits.front().second;
+            c.window_at = c.credits.front().first;
+            c.credits.pop_front();
+        }
+        while (!c.pending.empty()) {
+            segment_t& seg = c.pending.front();
+            uint64_t t = max(c.base + seg.t, c.window_at);
+            if (t > now || c.unacked + seg.data.size() > RX_BUFFER) break;
+            uint64_t start = max(t, link_free);
+            uint64_t wire = host_costs.link_rate ? seg.data.size() * 1000000000ull / host_costs.link_rate : 0;
+            link_free = start + wire;
+            segment_t sent = { start + wire + host_costs.rtt_us * 500ull, seg.data, seg.fin };
+            c.unacked += seg.data.size();
+            c.flight.push_back(sent);
+            c.pending.pop_front();
+        }
+        while (!c.flight.empty() && c.flight.front().t <= now) {
+            segment_t& seg = c.flight.front();
+            if (seg.fin) {
+                s.peer_fin = true;
+                s.status = SnSR_CLOSE_WAIT;
+            } else {
+                if (s.rx_pos > 0) {
+                    s.rx.erase(0, s.rx_pos);
+                    s.rx_pos = 0;
+                }
+                s.rx += seg.data;
+            }
+            c.flight.pop_front();
+            events++;
+            if (c.flight.empty() && c.pending.empty()) host_event("delivered %d", c.id);
+        }
+    }
+}
+
+// Earliest time something scripted can happen, NEVER if nothing can without the device acting
+static uint64_t script_next() {
+    uint64_t next = NEVER;
+    for (std::map<int, conn_t>::iterator it = conns.begin(); it != conns.end(); ++it) {
+        conn_t& c = it->second;
+        // A connection that is due but has no listener only goes ahead once the device listens
+        if (c.state == CONN_WAITING && c.base != NEVER && c.base + c.open_at > host_now_ns()) {
+            next = min(next, c.base + c.open_at);
+        }
+        if (c.state != CONN_OPEN) continue;
+        if (!c.flight.empty()) next = min(next, c.flight.front().t);
+        if (c.pending.empty()) continue;
+        const segment_t& seg = c.pending.front();
+        if (c.unacked + seg.data.size() <= RX_BUFFER) {
+            next = min(next, max(c.base + seg.t, c.window_at));
+        } else if (!c.credits.empty()) {
+            next = min(next, c.credits.front().first);
+        }
+    }
+    return next;
+}
+
+// ---- Socket table ----
+
+static void pump() {
+    if (bridge) bridge_pump();
+    if (script) script_pump();
+}
+
+static void spend_poll() {
+    if (!host_virtual()) return;
+    host_stats.spi_ns += host_costs.spi_poll_ns;
+    host_spend_ns(host_costs.spi_poll_ns);
+}
+
+static void spend_transfer(size_t len) {
+    if (!host_virtual()) return;
+    uint64_t ns = host_costs.spi_poll_ns + (uint64_t)host_costs.spi_byte_ns * len;
+    host_stats.spi_ns += ns;
+    host_spend_ns(ns);
+}
+
+static int alloc_sock() {
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        if (socks[i].status == SnSR_CLOSED) return i;
+    }
+    return -1;
+}
+
+int host_sock_listen(uint16_t port) {
+    int s = alloc_sock();
+    if (s < 0) return -1;
+    sock_reset(socks[s]);
+    socks[s].status = SnSR_LISTEN;
+    socks[s].port = port;
+    if (bridge) bridge_listen_fd(port);
+    return s;
+}
+
+bool host_sock_listening(uint16_t port) {
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        if (socks[i].status == SnSR_LISTEN && socks[i].port == port) return true;
+    }
+    return false;
+}
+
+int host_sock_accept(uint16_t port) {
+    pump();
+    spend_poll();
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        sock_t& s = socks[i];
+        if (s.port == port && !s.handed && (s.status == SnSR_ESTABLISHED || s.status == SnSR_CLOSE_WAIT)) {
+            s.handed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int host_sock_connect(uint32_t ip, uint16_t port, uint32_t timeout_ms) {
+    int s = alloc_sock();
+    if (s < 0) return -1;
+    if (!bridge) {
+        // Nothing to connect to on a scripted network; the chip gives up after its timeout
+        host_spend_ns((uint64_t)timeout_ms * 1000000);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sockaddr_in a = host_addr(ip, port);
+    if (connect(fd, (sockaddr*)&a, sizeof(a)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    pollfd p = { fd, POLLOUT, 0 };
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (poll(&p, 1, timeout_ms) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sock_reset(socks[s]);
+    socks[s].status = SnSR_ESTABLISHED;
+    socks[s].handed = true;
+    socks[s].fd = fd;
+    socks[s].remote_ip = ip;
+    socks[s].remote_port = port;
+    return s;
+}
+
+uint8_t host_sock_status(int s) {
+    pump();
+    spend_poll();
+    return socks[s].status;
+}
+
+int host_sock_available(int s) {
+    pump();
+    spend_poll();
+    return socks[s].rx.size() - socks[s].rx_pos;
+}
+
+int host_sock_read(int s, uint8_t* buf, size_t len) {
+    pump();
+    sock_t& k = socks[s];
+    size_t n = min(len, k.rx.size() - k.rx_pos);
+    if (n == 0) {
+        spend_poll();
+        return -1;
+    }
+    memcpy(buf, k.rx.data() + k.rx_pos, n);
+    k.rx_pos += n;
+    spend_transfer(n);
+    if (k.conn >= 0) {
+        conn_t& c = conns[k.conn];
+        c.credits.push_back(std::make_pair(host_now_ns() + host_costs.rtt_us * 500ull, (uint32_t)n));
+    }
+    return n;
+}
+
+int host_sock_peek(int s) {
+    pump();
+    spend_poll();
+    sock_t& k = socks[s];
+    return k.rx_pos < k.rx.size() ? (uint8_t)k.rx[k.rx_pos] : -1;
+}
+
+size_t host_sock_write(int s, const uint8_t* buf, size_t len) {
+    sock_t& k = socks[s];
+    if (k.status != SnSR_ESTABLISHED && k.status != SnSR_CLOSE_WAIT) return 0;
+    spend_transfer(len);
+    if (k.conn >= 0) {
+        transcript_data(k.conn, buf, len);
+        return len;
+    }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = send(k.fd, buf + done, len - done, MSG_NOSIGNAL);
+        if (n > 0) {
+            done += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd p = { k.fd, POLLOUT, 0 };
+            if (poll(&p, 1, 2000) != 1) break;
+        } else {
+            break;
+        }
+    }
+    return done;
+}
+
+void host_sock_close(int s) {
+    sock_t& k = socks[s];
+    if (k.conn >= 0) {
+        conn_t& c = conns[k.conn];
+        host_event("close %d", c.id);
+        conn_done(c);
+    }
+    if (k.fd >= 0) close(k.fd);
+    sock_reset(k);
+}
+
+uint32_t host_sock_remote_ip(int s) { return socks[s].remote_ip; }
+uint16_t host_sock_remote_port(int s) { return socks[s].remote_port; }
+uint16_t host_sock_local_port(int s) { return socks[s].port; }
+
+int host_udp_open(uint16_t port) {
+    int s = alloc_sock();
+    if (s < 0) return -1;
+    sock_reset(socks[s]);
+    socks[s].status = SnSR_UDP;
+    socks[s].port = port;
+    if (bridge) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+        // DHCP runs before the address is configured and is answered in-process, see dhcp_answer
+        sockaddr_in a = host_addr(lease_ip, port);
+        if (port != 68 && bind(fd, (sockaddr*)&a, sizeof(a)) < 0) {
+            fprintf(stderr, "host: can't bind UDP port %u: %s\n", to_host_port(port), strerror(errno));
+        }
+        socks[s].fd = fd;
+    }
+    return s;
+}
+
+// The network's DHCP server: acknowledges a request for the host's address, refuses anything else
+static void dhcp_answer(sock_t& s, const uint8_t* req, size_t len) {
+    if (len < 240 || req[0] != 1) return;
+    uint32_t requested = 0;
+    for (size_t i = 240; i + 2 <= len && req[i] != 255; i += 2 + req[i + 1]) {
+        if (req[i] == 50 && req[i + 1] == 4 && i + 6 <= len) memcpy(&requested, req + i + 2, 4);
+    }
+    uint8_t reply[300];
+    memset(reply, 0, sizeof(reply));
+    reply[0] = 2;
+    memcpy(reply + 1, req + 1, 3);
+    memcpy(reply + 4, req + 4, 4);              // xid
+    memcpy(reply + 28, req + 28, 16);           // chaddr
+    memcpy(reply + 236, req + 236, 4);          // Magic cookie
+    uint8_t* opt = reply + 240;
+    bool ack = requested == lease_ip;
+    if (ack) memcpy(reply + 16, &lease_ip, 4);  // yiaddr
+    *opt++ = 53; *opt++ = 1; *opt++ = ack ? 5 : 6;
+    *opt++ = 54; *opt++ = 4; memcpy(opt, &lease_gateway, 4); opt += 4;
+    if (ack) {
+        *opt++ = 1; *opt++ = 4; memcpy(opt, &lease_subnet, 4); opt += 4;
+        *opt++ = 3; *opt++ = 4; memcpy(opt, &lease_gateway, 4); opt += 4;
+        *opt++ = 51; *opt++ = 4; *opt++ = 0; *opt++ = 0; *opt++ = 0x0E; *opt++ = 0x10;
+    }
+    *opt++ = 255;
+    host_spend_ns(host_dhcp_exchange_ns());
+    udp_packet_t p = { lease_gateway, 67, std::string((char*)reply, opt - reply) };
+    s.udp.push_back(p);
+    events++;
+}
+
+bool host_udp_send(int s, uint32_t ip, uint16_t port, const uint8_t* data, size_t len) {
+    sock_t& k = socks[s];
+    spend_transfer(len);
+    if (port == 67) {
+        dhcp_answer(k, data, len);
+        return true;
+    }
+    if (!bridge) return true;   // Scripted networks have no UDP peers, the packet is lost
+    sockaddr_in a = host_addr(ip, port);
+    return sendto(k.fd, data, len, 0, (sockaddr*)&a, sizeof(a)) == (ssize_t)len;
+}
+
+int host_udp_recv(int s, uint8_t* buf, size_t len, uint32_t& ip, uint16_t& port) {
+    pump();
+    spend_poll();
+    sock_t& k = socks[s];
+    if (k.udp.empty()) return 0;
+    udp_packet_t p = k.udp.front();
+    k.udp.pop_front();
+    size_t n = min(len, p.data.size());
+    memcpy(buf, p.data.data(), n);
+    spend_transfer(n);
+    ip = p.ip;
+    port = p.port;
+    return n;
+}
+
+void host_net_close_all() {
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        if (socks[i].status != SnSR_CLOSED) host_sock_close(i);
+    }
+}
+
+void host_net_wait(uint32_t timeout_ms) {
+    uint64_t deadline = timeout_ms ? host_now_ns() + (uint64_t)timeout_ms * 1000000 : NEVER;
+    while (true) {
+        pump();
+        if (events != events_seen) break;
+        if (script) {
+            uint64_t next = min(script_next(), deadline);
+            if (next == NEVER) {
+                host_event("idle");
+                host_exit(HOST_EXIT_IDLE);
+            }
+            uint64_t now = host_now_ns();
+            if (next > now) host_spend_ns(next - now);
+            if (next == deadline) {
+                pump();
+                break;
+            }
+            continue;
+        }
+        // Bridge: sleep in poll() on every socket that can produce an event
+        std::vector<pollfd> fds;
+        for (std::map<uint16_t, int>::iterator it = listen_fds.begin(); it != listen_fds.end(); ++it) {
+            if (host_sock_listening(it->first)) fds.push_back((pollfd){ it->second, POLLIN, 0 });
+        }
+        for (int i = 0; i < MAX_SOCK_NUM; i++) {
+            sock_t& s = socks[i];
+            if (s.fd >= 0 && !s.peer_fin && (s.status == SnSR_UDP || s.rx.size() - s.rx_pos < RX_BUFFER)) {
+                fds.push_back((pollfd){ s.fd, POLLIN, 0 });
+            }
+        }
+        uint64_t now = host_now_ns();
+        if (now >= deadline) break;
+        int wait = deadline == NEVER ? -1 : (int)((deadline - now + 999999) / 1000000);
+        poll(fds.data(), fds.size(), wait);
+    }
+    events_seen = events;
+}
@@ -0,0 +1,179 @@
+// Host build: main(), leaving the firmware (reset and jumps) and the eth_irq_* interface, which
+// on the host is the socket layer's own wait.
+
+#include <Arduino.h>
+#include "s3bl.h"
+#include "boot_clock.h"
+#include "component.h"
+#include "eth_irq.h"
+#include "hot_preload.h"
+#include "host.h"
+#include <getopt.h>
+
+void setup();
+void loop();
+
+static uint64_t until_ns;
+
+void host_exit(int code) {
+    if (host_virtual()) {
+        host_event("stats erase_us=%llu program_us=%llu spi_us=%llu sector_erases=%u block_erases=%u",
+                   (unsigned long long)(host_stats.erase_ns / 1000), (unsigned long long)(host_stats.program_ns / 1000),
+                   (unsigned long long)(host_stats.spi_ns / 1000), (unsigned)host_stats.sector_erases,
+                   (unsigned)host_stats.block_erases);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    exit(code);
+}
+
+// The host can't run an image, the harness sees the entry address in the exit event. A stand-in
+// application (hostsim.make_image) names what it does in its first KB: "S3BL-HOST-APP:confirm"
+// behaves like a healthy one under rollout, it confirms a trial boot and resets;
+// "S3BL-HOST-APP:recovery" asks for recovery mode and resets (boot_clock.h); and
+// "S3BL-HOST-APP:serve" does the first on a trial boot and the second otherwise, so the device
+// keeps taking updates. The modules in the directory (component.h) are reported as events, and
+// one marked "S3BL-HOST-MOD:crash" resets the base before it can confirm.
+static bool host_marked(uint32_t address, const char* kind, const char* name) {
+    char marker[64];
+    snprintf(marker, sizeof(marker), "S3BL-HOST-%s:%s", kind, name);
+    return memmem((const void*)(uintptr_t)address, 1024, marker, strlen(marker) + 1) != NULL;
+}
+
+static bool host_app_is(uint32_t address, const char* name) {
+    return host_marked(address, "APP", name);
+}
+
+void host_start_image(uint32_t address) {
+    host_event("jump 0x%08x", (unsigned)address);
+    const boot_modules_t* dir = (const boot_modules_t*)BOOT_MODULES_ADDRESS;
+    for (uint32_t k = 0; dir->magic == BOOT_MODULES_MAGIC && k < dir->count && k < PLACED_IMAGES; k++) {
+        host_event("module %u version %u", (unsigned)dir->modules[k].id, (unsigned)dir->modules[k].version);
+        if (host_marked(dir->modules[k].base, "MOD", "crash")) {
+            host_event("crash");
+            host_exit(HOST_EXIT_RESET);
+        }
+    }
+    bool serve = host_app_is(address, "serve");
+    if ((serve || host_app_is(address, "confirm")) && boot_handoff_confirm()) {
+        host_event("confirm");
+        host_exit(HOST_EXIT_RESET);
+    }
+    if ((serve || host_app_is(address, "recovery")) && boot_handoff_request_recovery()) {
+        host_event("recovery");
+        host_exit(HOST_EXIT_RESET);
+    }
+    host_exit(HOST_EXIT_JUMP);
+}
+
+void jump_to_app(uint32_t address) {
+    boot_handoff_write(address);
+    host_start_image(address);
+}
+
+void hot_jump(uint32_t address, const hot_table_t* table) {
+    boot_handoff_write(address);
+    host_event("hot %u sections", (unsigned)table->count);
+    host_start_image(address);
+}
+
+void eth_irq_begin() {}
+
+void eth_irq_wait(uint32_t timeout_ms) {
+    if (until_ns && host_now_ns() >= until_ns) {
+        host_event("until");
+        host_exit(HOST_EXIT_IDLE);
+    }
+    if (until_ns && (timeout_ms == 0 || host_now_ns() + (uint64_t)timeout_ms * 1000000 > until_ns)) {
+        timeout_ms = (uint32_t)((until_ns - host_now_ns() + 999999) / 1000000);
+    }
+    host_net_wait(timeout_ms);
+}
+
+void eth_irq_ack() {}
+
+void eth_irq_end() {
+    host_net_close_all();
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: s3bl_host --flash IMAGE [--bridge IP [--port-offset N]]\n"
+            "                 [--script FILE --transcript FILE [--ip IP] [--link-rate BYTES_S] [--rtt-us US]]\n"
+            "                 [--until-ms MS] [--gpr17 HEX]\n"
+            "                 [--sector-erase-us US] [--block-erase-us US] [--program-word-ns NS]\n"
+            "                 [--spi-poll-ns NS] [--spi-byte-ns NS]\n");
+    host_exit(HOST_EXIT_ERROR);
+}
+
+static uint32_t parse_ip(const char* s) {
+    IPAddress ip;
+    if (!ip.fromString(s)) usage();
+    return ip;
+}
+
+int main(int argc, char** argv) {
+    static const struct option options[] = {
+        { "flash", required_argument, NULL, 'f' },
+        { "bridge", required_argument, NULL, 'b' },
+        { "port-offset", required_argument, NULL, 'o' },
+        { "script", required_argument, NULL, 's' },
+        { "transcript", required_argument, NULL, 't' },
+        { "ip", required_argument, NULL, 'i' },
+        { "link-rate", required_argument, NULL, 'l' },
+        { "rtt-us", required_argument, NULL, 'r' },
+        { "until-ms", required_argument, NULL, 'u' },
+        { "gpr17", required_argument, NULL, 'g' },
+        { "sector-erase-us", required_argument, NULL, 'S' },
+        { "block-erase-us", required_argument, NULL, 'B' },
+        { "program-word-ns", required_argument, NULL, 'P' },
+        { "spi-poll-ns", required_argument, NULL, 'R' },
+        { "spi-byte-ns", required_argument, NULL, 'Y' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char* flash = NULL;
+    const char* bridge = NULL;
+    const char* script = NULL;
+    const char* transcript = NULL;
+    uint32_t ip = IPAddress(192, 168, 1, 50);
+    unsigned long offset = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (c) {
+            case 'f': flash = optarg; break;
+            case 'b': bridge = optarg; break;
+            case 'o': offset = strtoul(optarg, NULL, 0); break;
+            case 's': script = optarg; break;
+            case 't': transcript = optarg; break;
+            case 'i': ip = parse_ip(optarg); break;
+            case 'l': host_costs.link_rate = strtoul(optarg, NULL, 0); break;
+            case 'r': host_costs.rtt_us = strtoul(optarg, NULL, 0); break;
+            case 'u': until_ns = strtoull(optarg, NULL, 0) * 1000000ull; break;
+            case 'g': IOMUXC_GPR_GPR17 = strtoul(optarg, NULL, 16); break;
+            case 'S': host_costs.sector_erase_us = strtoul(optarg, NULL, 0); break;
+            case 'B': host_costs.block_erase_us = strtoul(optarg, NULL, 0); break;
+            case 'P': host_costs.program_word_ns = strtoul(optarg, NULL, 0); break;
+            case 'R': host_costs.spi_poll_ns = strtoul(optarg, NULL, 0); break;
+            case 'Y': host_costs.spi_byte_ns = strtoul(optarg, NULL, 0); break;
+            default: usage();
+        }
+    }
+    if (!flash || (bridge && script) || (script && !transcript) || offset > 32768) usage();
+
+    // The supervisor stops bridged devices with a signal, the log has to be on disk by then
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    host_map_memory(flash);
+    if (script) {
+        host_net_script(script, transcript, ip);
+    } else {
+        host_net_bridge(bridge ? parse_ip(bridge) : (uint32_t)IPAddress(127, 0, 0, 1), offset);
+    }
+    setup();
+    while (true) {
+        if (until_ns && host_now_ns() >= until_ns) {
+            host_event("until");
+            host_exit(HOST_EXIT_IDLE);
+        }
+        loop();
+    }
+}
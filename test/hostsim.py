@@ -0,0 +1,308 @@
+"""Builds the bootloader for the host (test/host) and runs it as simulated devices.
+
+Each device is the firmware from src/ in its own process, on its own flash image. A bridged
+device serves its recovery ports on a loopback address with an offset (port 80 is 20080 with the
+default offset), so the tools in tools/ talk to it unchanged; a supervisor restarts it after a
+reset, as the board would. A scripted device runs on the virtual clock against the clients of a
+script file and leaves a transcript (test/host/host.h has both formats).
+
+    python3 -m unittest discover -s test -v
+    python3 test/hostsim.py build            # prints the binary's path
+    python3 test/hostsim.py tls-bench        # plain HTTP against both TLS suites
+"""
+
+import hashlib
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(ROOT, "tools"))
+
+EXIT_IDLE, EXIT_ERROR, EXIT_RESET, EXIT_JUMP = 0, 1, 3, 4
+PORT_OFFSET = 20000
+SLOT_A_ADDRESS = 0x60032000
+SLOT_B_ADDRESS = 0x60112000
+CXXFLAGS = ["-std=gnu++14", "-O1", "-g", "-Wno-int-to-pointer-cast"]
+_build_lock = threading.Lock()
+
+
+def sources():
+    src = [os.path.join(ROOT, "src", f) for f in sorted(os.listdir(os.path.join(ROOT, "src")))
+           if f.endswith(".cpp") and f != "eth_irq.cpp"]
+    host = [os.path.join(ROOT, "test", "host", f) for f in sorted(os.listdir(os.path.join(ROOT, "test", "host")))
+            if f.endswith(".cpp")]
+    return src + host
+
+
+def build(defines=()):
+    """Compiles the host binary once per source state and set of defines, returns its path."""
+    inputs = sources()
+    headers = [os.path.join(d, f) for d in (os.path.join(ROOT, "include"), os.path.join(ROOT, "test", "host"))
+               for f in sorted(os.listdir(d)) if f.endswith(".h")]
+    digest = hashlib.sha256(" ".join(CXXFLAGS + list(defines)).encode())
+    for path in inputs + headers:
+        with open(path, "rb") as f:
+            digest.update(f.read())
+    out = os.path.join(tempfile.gettempdir(), "s3bl_host_" + digest.hexdigest()[:16])
+    binary = os.path.join(out, "s3bl_host")
+    with _build_lock:
+        if os.path.exists(binary):
+            return binary
+        os.makedirs(out, exist_ok=True)
+        flags = CXXFLAGS + ["-D" + d for d in defines] + ["-I" + os.path.join(ROOT, "test", "host"),
+                                                          "-I" + os.path.join(ROOT, "include")]
+
+        def compile_one(path):
+            obj = os.path.join(out, "%s_%s.o" % (os.path.basename(os.path.dirname(path)), os.path.basename(path)))
+            subprocess.run(["g++"] + flags + ["-c", path, "-o", obj], check=True)
+            return obj
+
+        with ThreadPoolExecutor(os.cpu_count() or 4) as pool:
+            objects = list(pool.map(compile_one, inputs))
+        subprocess.run(["g++", "-o", binary + ".tmp"] + objects, check=True)
+        os.rename(binary + ".tmp", binary)
+    return binary
+
+
+def make_image(slot, size=4096, seed=0, app=None):
+    """A stand-in application: a vector table that passes VectorTableVerifier, then filler.
+    app="confirm" makes the host run it as an application that confirms its boot, app="recovery"
+    as one that asks for recovery mode, app="serve" as one that does either (target.cpp)."""
+    marker = b"S3BL-HOST-APP:%s\0" % app.encode() if app else b""
+    body = marker + bytes((i * 7 + seed) & 0xFF for i in range(size - 8 - len(marker)))
+    return struct.pack("<II", slot + 0x1000, slot + 0x401) + body
+
+
+def read_file(flash, path, timeout=5.0):
+    """A file from the device's LittleFS_Program region (flashimg.read_files), None if it does not
+    exist. A running device may be rewriting the table, so an invalid one is read again."""
+    import flashimg
+    deadline = time.monotonic() + timeout
+    while True:
+        image = flashimg.NorFlash(flash)
+        try:
+            files = flashimg.read_files(image)
+        finally:
+            image.close()
+        if files is not None or time.monotonic() > deadline:
+            return (files or {}).get(path)
+        time.sleep(0.02)
+
+
+def wait_port(host, port, timeout=10.0):
+    import socket
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            socket.create_connection((host, port), timeout=0.5).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+class Device:
+    """One bridged device under a supervisor that restarts it after every reset."""
+
+    def __init__(self, workdir, ip="127.0.0.2", offset=PORT_OFFSET, defines=(), args=()):
+        """args: further s3bl_host options, e.g. the cost model's."""
+        self.binary = build(defines)
+        self.args = list(args)
+        self.flash = os.path.join(workdir, "%s.bin" % ip)
+        self.ip = ip
+        self.offset = offset
+        self.log_path = os.path.join(workdir, "%s.log" % ip)
+        self.exits = []          # (exit code, last event line) per run
+        self.proc = None
+        self.stopping = False
+        self.thread = None
+
+    def port(self, port):
+        return port + self.offset
+
+    def start(self, restart=True):
+        self.stopping = False
+        self.thread = threading.Thread(target=self._supervise, args=(restart,), daemon=True)
+        self.thread.start()
+        return wait_port(self.ip, self.port(80))
+
+    def _supervise(self, restart):
+        with open(self.log_path, "ab") as log:
+            while not self.stopping:
+                self.proc = subprocess.Popen([self.binary, "--flash", self.flash, "--bridge", self.ip,
+                                              "--port-offset", str(self.offset)] + self.args,
+                                             stdout=log, stderr=subprocess.PIPE)
+                events = self.proc.stderr.read().decode(errors="replace").splitlines()
+                self.proc.stderr.close()
+                code = self.proc.wait()
+                self.exits.append((code, events[-1] if events else ""))
+                log.write(("\n".join(events) + "\n").encode())
+                log.flush()
+                if not restart or code != EXIT_RESET:
+                    break
+
+    def wait_exit(self, count, timeout=30.0):
+        deadline = time.monotonic() + timeout
+        while len(self.exits) < count and time.monotonic() < deadline:
+            time.sleep(0.05)
+        return self.exits[count - 1] if len(self.exits) >= count else None
+
+    def stop(self):
+        self.stopping = True
+        if self.proc and self.proc.poll() is None:
+            self.proc.terminate()
+        if self.thread:
+            self.thread.join(10)
+
+
+def run(flash, *args, timeout=60, defines=()):
+    """Runs one boot to its end, returns (exit code, stdout, event lines)."""
+    p = subprocess.run([build(defines), "--flash", flash] + list(args),
+                       capture_output=True, timeout=timeout)
+    return p.returncode, p.stdout.decode(errors="replace"), p.stderr.decode(errors="replace").splitlines()
+
+
+def run_script(flash, entries, *args, timeout=120, defines=()):
+    """Runs a scripted device against entries (see write_script), returns (exit code, stdout,
+    transcript entries). Transcript entries are (time_us, verb, conn or None, payload or None)."""
+    script, transcript = flash + ".script", flash + ".transcript"
+    write_script(script, entries)
+    code, out, _ = run(flash, "--script", script, "--transcript", transcript, *args, timeout=timeout, defines=defines)
+    return code, out, parse_transcript(transcript)
+
+
+def write_script(path, entries):
+    """entries: ("open", us, conn, port[, after]), ("send", us, conn, bytes), ("close", us, conn)."""
+    with open(path, "wb") as f:
+        for e in entries:
+            if e[0] == "open":
+                f.write(b"%d open %d %d%s\n" % (e[1], e[2], e[3], b" after %d" % e[4] if len(e) > 4 else b""))
+            elif e[0] == "send":
+                f.write(b"%d send %d %d\n" % (e[1], e[2], len(e[3])) + bytes(e[3]) + b"\n")
+            else:
+                f.write(b"%d close %d\n" % (e[1], e[2]))
+
+
+def parse_transcript(path):
+    """Entries are (time_us, verb, conn or None, payload). The payload is the data for "recv",
+    the rest of the line otherwise, e.g. the fields of "stats"."""
+    entries = []
+    with open(path, "rb") as f:
+        data = f.read()
+    pos = 0
+    line_re = re.compile(rb"@(\d+) (\S+)(?: ([^\n]*))?\n")
+    while pos < len(data):
+        m = line_re.match(data, pos)
+        if not m:
+            raise ValueError("bad transcript line at byte %d" % pos)
+        pos = m.end()
+        t, verb, rest = int(m.group(1)), m.group(2).decode(), m.group(3) or b""
+        args = rest.split()
+        conn = int(args[0]) if args and args[0].isdigit() else None
+        payload = rest
+        if verb == "recv":
+            n = int(args[1])
+            payload = data[pos:pos + n]
+            pos += n + 1
+        entries.append((t, verb, conn, payload))
+    return entries
+
+
+def stats(entries):
+    """The "stats" event's fields as ints."""
+    for _, verb, _, rest in entries:
+        if verb == "stats":
+            return {k: int(v) for k, v in (f.split("=") for f in rest.decode().split())}
+    return {}
+
+
+def responses(entries):
+    """Everything the device sent, per connection."""
+    out = {}
+    for _, verb, conn, payload in entries:
+        if verb == "recv":
+            out[conn] = out.get(conn, b"") + payload
+    return out
+
+
+def s_client(ip, port, request, psk, identity="s3bl", suite="TLS_AES_128_CCM_SHA256", options=(), timeout=60):
+    """Sends request over TLS 1.3 with openssl s_client -psk, the client the device's PSK listener
+    is checked against. Returns (exit code, everything the device sent back)."""
+    p = subprocess.run(["openssl", "s_client", "-connect", "%s:%d" % (ip, port), "-tls1_3", "-quiet",
+                        "-psk", psk.hex(), "-psk_identity", identity, "-ciphersuites", suite] + list(options),
+                       input=request, capture_output=True, timeout=timeout)
+    return p.returncode, p.stdout
+
+
+def http_request(method, path, body=b"", headers=()):
+    head = "%s %s HTTP/1.1\r\nHost: s3bl\r\nContent-Length: %d\r\n" % (method, path, len(body))
+    head += "".join("%s: %s\r\n" % h for h in headers)
+    return head.encode() + b"\r\n" + body
+
+
+def tls_bench(size=512 * 1024, runs=5):
+    """Stages size bytes of a slot image with PUT /manifest/app over plain HTTP and over TLS with
+    each suite, on a device with flash and SPI costs modelled as free, so only the transport is
+    measured. KB/s is the median of runs wall clock transfers with the handshake (a GET /status
+    over the same path) taken out; cycles/KB is the device's own count for record protection. On
+    the host both measure software AES on the build machine, not the DCP."""
+    import socket
+    import statistics
+    import s3bl_provision
+    import s3bl_upload
+    psk = bytes(range(32))
+    image = make_image(SLOT_B_ADDRESS, size)
+    # One sector more than is sent, so the release stays staged and the device in recovery
+    manifest = ("app slot %d %s\n" % (size + 4096, hashlib.sha256(image + bytes(4096)).hexdigest())).encode()
+    put = http_request("PUT", "/manifest/app", image, [("Content-Range", "bytes 0-%d/%d" % (size - 1, size + 4096))])
+    print("%-24s %10s %14s" % ("transport", "KB/s", "cycles/KB in"))
+    with tempfile.TemporaryDirectory() as workdir:
+        dev = Device(workdir, args=["--sector-erase-us", "0", "--block-erase-us", "0", "--program-word-ns", "0",
+                                    "--spi-poll-ns", "0", "--spi-byte-ns", "0"])
+        dev.start()
+        try:
+            cfg = s3bl_provision.net_config("0.0.0.0", 1883, 300, "0.0.0.0", 514, 2048, 0, psk, "s3bl", tls_only=False)
+            s3bl_provision.send_bundle(dev.ip, s3bl_provision.build_bundle([(s3bl_provision.NETCFG, cfg)]), dev.port(80))
+            for suite in (None, "TLS_AES_128_CCM_SHA256", "TLS_AES_128_GCM_SHA256"):
+                # A restart loads the config and clears the /status counters
+                dev.stop()
+                dev.start()
+                def send(request):
+                    if suite:
+                        return s_client(dev.ip, dev.port(443), request, psk, suite=suite)[1]
+                    with socket.create_connection((dev.ip, dev.port(80))) as conn:
+                        conn.sendall(request)
+                        return b"".join(iter(lambda: conn.recv(65536), b""))
+                rates = []
+                for _ in range(runs):
+                    send(http_request("POST", "/manifest", manifest))
+                    start = time.monotonic()
+                    send(http_request("GET", "/status"))
+                    handshake = time.monotonic() - start
+                    start = time.monotonic()
+                    reply = send(put)
+                    rates.append(size / 1024 / (time.monotonic() - start - handshake))
+                    if b" 202 " not in reply.split(b"\r\n", 1)[0]:
+                        raise SystemExit("%s: %s" % (suite or "plain", reply[:200]))
+                    send(http_request("DELETE", "/manifest"))
+                status = s3bl_upload.get_status(dev.ip, dev.port(80), path="/status")
+                print("%-24s %10.0f %14s" % (suite or "plain HTTP", statistics.median(rates),
+                                             status["tls_open_cycles_per_kb"] if suite else "-"))
+        finally:
+            dev.stop()
+
+
+if __name__ == "__main__":
+    if sys.argv[1:] == ["build"]:
+        print(build())
+    elif sys.argv[1:] == ["tls-bench"]:
+        tls_bench()
+    else:
+        print(__doc__)
@@ -0,0 +1,37 @@
+"""Boot clock policy on the host build: which phases run at the raised clock (include/boot_clock.h)."""
+
+import re
+import tempfile
+import unittest
+
+import hostsim
+import s3bl_upload
+
+
+class BootClockTest(unittest.TestCase):
+    def measure(self, defines=()):
+        with tempfile.TemporaryDirectory() as workdir:
+            dev = hostsim.Device(workdir, defines=defines)
+            self.assertTrue(dev.start())
+            try:
+                hz, times = s3bl_upload.verify_benchmark(dev.ip, dev.port(80), 64 * 1024, samples=1)
+            finally:
+                dev.stop()
+            with open(dev.log_path) as f:
+                phases = dict(re.findall(r"Boot phase (\w+): \d+ us at (\d+) MHz", f.read()))
+        self.assertEqual(len(times), 1)
+        return hz, phases
+
+    def test_fast_clock_is_off_by_default(self):
+        hz, phases = self.measure()
+        self.assertEqual(hz, 600000000)
+        self.assertEqual(phases, {"storage": "600", "validate": "600", "verify": "600"})
+
+    def test_opt_in_raises_verify_only(self):
+        hz, phases = self.measure(["BOOT_CLOCK_FAST_HZ=816000000"])
+        self.assertEqual(hz, 816000000)
+        self.assertEqual(phases, {"storage": "600", "validate": "600", "verify": "816"})
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,138 @@
+"""tools/s3bl_coap.py against the recovery CoAP server of the host build."""
+
+import os
+import socket
+import tempfile
+import threading
+import unittest
+import zlib
+
+import hostsim
+import flashimg
+import s3bl_coap as coap
+
+
+class CoapTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.dev = hostsim.Device(self.dir.name, ip="127.0.0.3")
+        self.assertTrue(self.dev.start(restart=False))
+        self.port = self.dev.port(coap.COAP_PORT)
+
+    def tearDown(self):
+        self.dev.stop()
+        self.dir.cleanup()
+
+    def slot_b(self, length):
+        flash = flashimg.NorFlash(self.dev.flash)
+        try:
+            return flash.read(hostsim.SLOT_B_ADDRESS, length)
+        finally:
+            flash.close()
+
+    def test_block1_upload_commits_and_starts_the_image(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 40 * 1024 + 100)
+        self.assertTrue(coap.upload(self.dev.ip, image, szx=6, port=self.port))
+        code, event = self.dev.wait_exit(1)
+        self.assertEqual(code, hostsim.EXIT_JUMP)
+        self.assertIn("jump 0x%08x" % hostsim.SLOT_B_ADDRESS, event)
+        self.assertEqual(self.slot_b(len(image)), image)
+
+    def test_small_blocks(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 5000, seed=9)
+        self.assertTrue(coap.upload(self.dev.ip, image, szx=2, port=self.port))
+        self.assertEqual(self.dev.wait_exit(1)[0], hostsim.EXIT_JUMP)
+        self.assertEqual(self.slot_b(len(image)), image)
+
+    def test_bad_crc_is_refused(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 2048)
+        client = coap.Client(self.dev.ip, self.port)
+        self.addCleanup(client.close)
+        query = [(coap.OPT_URI_QUERY, b"crc=%08X" % (zlib.crc32(image) ^ 1))]
+        first = client.request(coap.PUT, "fw", query + [(coap.OPT_BLOCK1, coap.encode_uint(8 | 6)),
+                                                        (coap.OPT_SIZE1, coap.encode_uint(len(image)))], image[:1024])
+        self.assertEqual(first["code"], 2 << 5 | 31)
+        last = client.request(coap.PUT, "fw", query + [(coap.OPT_BLOCK1, coap.encode_uint(1 << 4 | 6))], image[1024:])
+        self.assertEqual(last["code"] >> 5, 4)
+        self.assertEqual(self.dev.exits, [])
+
+    def test_upload_without_crc_is_refused(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 1000)
+        client = coap.Client(self.dev.ip, self.port)
+        self.addCleanup(client.close)
+        for query in ([], [(coap.OPT_URI_QUERY, b"crc=")], [(coap.OPT_URI_QUERY, b"crc=xyz")]):
+            resp = client.request(coap.PUT, "fw", query + [(coap.OPT_BLOCK1, coap.encode_uint(6))], image)
+            self.assertEqual(resp["code"], 4 << 5 | 0, query)
+        status = client.request(coap.GET, "status")
+        self.assertIn(b"state=idle received=0 ", status["payload"])
+        self.assertEqual(self.dev.exits, [])
+
+    def test_retransmitted_request_gets_the_cached_response(self):
+        client = coap.Client(self.dev.ip, self.port)
+        self.addCleanup(client.close)
+        packet = coap.build(coap.CON, coap.PUT, 0x1234, b"\x07",
+                            [(coap.OPT_URI_PATH, b"fw"), (coap.OPT_URI_QUERY, b"crc=00000000"), (coap.OPT_BLOCK1, coap.encode_uint(8 | 6)),
+                             (coap.OPT_SIZE1, coap.encode_uint(4096))], b"\xAA" * 1024)
+        replies = []
+        client.sock.settimeout(5)
+        for _ in range(2):
+            client.sock.sendto(packet, (self.dev.ip, self.port))
+            replies.append(client.sock.recvfrom(2048)[0])
+        self.assertEqual(replies[0], replies[1])
+        # Block 1 follows block 0 once, so the duplicate did not advance the upload
+        status = client.request(coap.GET, "status")
+        self.assertIn(b"received=1024 ", status["payload"])
+
+    def test_observe_reports_progress(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 96 * 1024, seed=4)
+        watcher = coap.Client(self.dev.ip, self.port)
+        self.addCleanup(watcher.close)
+        first = watcher.request(coap.GET, "status", [(coap.OPT_OBSERVE, b"")], token=b"\x42")
+        self.assertIn(coap.OPT_OBSERVE, first["options"])
+        notes = []
+
+        def watch():
+            watcher.sock.settimeout(10)
+            try:
+                while True:
+                    msg = coap.parse(watcher.sock.recvfrom(2048)[0])
+                    notes.append(msg["payload"].decode())
+                    if "state=complete" in notes[-1]:
+                        return
+            except socket.timeout:
+                pass
+
+        t = threading.Thread(target=watch)
+        t.start()
+        self.assertTrue(coap.upload(self.dev.ip, image, port=self.port))
+        t.join()
+        self.assertTrue(any("received=32768 " in n for n in notes), notes)
+        self.assertIn("state=complete", notes[-1])
+
+
+class CoapSmallBufferTest(unittest.TestCase):
+    """A board built for 256 byte blocks negotiates a client down from 1024."""
+
+    def test_bigger_blocks_are_negotiated_down(self):
+        with tempfile.TemporaryDirectory() as workdir:
+            dev = hostsim.Device(workdir, ip="127.0.0.3", defines=["COAP_MAX_SZX=4"])
+            self.assertTrue(dev.start(restart=False))
+            port = dev.port(coap.COAP_PORT)
+            try:
+                image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 3000, seed=5)
+                client = coap.Client(dev.ip, port)
+                self.addCleanup(client.close)
+                query = [(coap.OPT_URI_QUERY, b"crc=%08X" % zlib.crc32(image))]
+                resp = client.request(coap.PUT, "fw", query + [(coap.OPT_BLOCK1, coap.encode_uint(8 | 6))], image[:1024])
+                self.assertEqual(resp["code"], 4 << 5 | 13)
+                self.assertEqual(coap.option_uint(resp, coap.OPT_BLOCK1) & 7, 4)
+                self.assertTrue(coap.upload(dev.ip, image, szx=6, port=port))
+                self.assertEqual(dev.wait_exit(1)[0], hostsim.EXIT_JUMP)
+            finally:
+                dev.stop()
+            with open(dev.log_path, errors="replace") as f:
+                self.assertIn("CoAP upload started, block size: 256", f.read())
+
+
+if __name__ == "__main__":
+    unittest.main()
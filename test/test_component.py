@@ -0,0 +1,87 @@
+"""Modules of a component build on a host device (include/component.h): a placed module is handed
+to the base, a new version is on trial until the base confirms a boot with it, and one whose
+trial boot resets unconfirmed is dropped for the version before it."""
+
+import re
+import struct
+import tempfile
+import unittest
+
+import hostsim
+import s3bl_upload
+
+ABI = 3
+MODULE_ID = 7
+V1_ADDRESS = 0x60040000
+V2_ADDRESS = 0x60050000
+
+
+def base_image():
+    # component_exports_t at 0x400, no functions
+    image = bytearray(hostsim.make_image(hostsim.SLOT_B_ADDRESS, 64 * 1024, app="serve"))
+    image[0x400:0x40C] = struct.pack("<III", 0x58453353, ABI, 0)
+    return bytes(image)
+
+
+def module_image(address, version, crash=False):
+    # module_header_t, init inside the module with the thumb bit set
+    header = struct.pack("<8I", 0x444D3353, MODULE_ID, version, ABI, address + 0x21, 0, 0, 0)
+    marker = b"S3BL-HOST-MOD:crash\0" if crash else b""
+    body = header + marker
+    return body + bytes((i * 13 + version) & 0xFF for i in range(8192 - len(body)))
+
+
+class ComponentTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.dev = hostsim.Device(self.dir.name)
+        self.assertTrue(self.dev.start())
+
+    def tearDown(self):
+        self.dev.stop()
+        self.dir.cleanup()
+
+    def events(self, count):
+        """The last event of each run up to count, without timestamps."""
+        self.assertIsNotNone(self.dev.wait_exit(count))
+        return [(code, event.split()[-1]) for code, event in self.dev.exits]
+
+    def module_events(self):
+        with open(self.dev.log_path, errors="replace") as f:
+            return [m.group(1) for m in re.finditer(r"^@\d+ (module \d+ version \d+)$", f.read(), re.M)]
+
+    def alloc_modules(self):
+        code, text = s3bl_upload.manifest_request(self.dev.ip, self.dev.port(80), "GET", "/alloc")
+        self.assertEqual(code, 200, text)
+        return [dict(f.split("=", 1) for f in line.split()) for line in text.splitlines() if " module=" in line]
+
+    def place(self, image, address):
+        code, body = s3bl_upload.place(self.dev.ip, image, address, self.dev.port(80), module=True)
+        self.assertEqual(code, 200, body)
+
+    def test_failed_trial_falls_back_to_the_previous_version(self):
+        self.assertTrue(s3bl_upload.upload(self.dev.ip, base_image(), self.dev.port(80), log=lambda *a: None))
+        # Trial boot of the base confirms and resets, the confirmed boot goes back to recovery
+        self.assertEqual(self.events(2), [(hostsim.EXIT_RESET, "confirm"), (hostsim.EXIT_RESET, "recovery")])
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+
+        # A new module makes the boot a trial again, even under the confirmed base
+        self.place(module_image(V1_ADDRESS, 1), V1_ADDRESS)
+        self.assertEqual(self.events(4)[2:], [(hostsim.EXIT_RESET, "confirm"), (hostsim.EXIT_RESET, "recovery")])
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+        self.assertEqual([(m["module"], m["version"], m["trial"]) for m in self.alloc_modules()],
+                         [(str(MODULE_ID), "1", "0")])
+
+        # Version 2 resets the base before it confirms; version 1 is listed again
+        self.place(module_image(V2_ADDRESS, 2, crash=True), V2_ADDRESS)
+        self.assertEqual(self.events(6)[4:], [(hostsim.EXIT_RESET, "crash"), (hostsim.EXIT_RESET, "recovery")])
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+        self.assertEqual([(m["module"], m["version"], m["trial"]) for m in self.alloc_modules()],
+                         [(str(MODULE_ID), "1", "0")])
+        self.assertEqual(self.module_events(), ["module %d version %d" % (MODULE_ID, v) for v in (1, 1, 2, 1)])
+        with open(self.dev.log_path, errors="replace") as f:
+            self.assertIn("Module %d version 2 failed its trial boot" % MODULE_ID, f.read())
+
+
+if __name__ == "__main__":
+    unittest.main()
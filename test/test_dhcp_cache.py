@@ -0,0 +1,59 @@
+"""Cached DHCP leases on the host build (include/dhcp_cache.h): the second recovery entry gets its
+address back with one INIT-REBOOT exchange instead of a full discovery, unless the lease can't be
+trusted any more."""
+
+import os
+import re
+import struct
+import tempfile
+import unittest
+
+import hostsim
+import flashimg
+
+RTT_US = 20000
+
+
+class DhcpCacheTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.flash = os.path.join(self.dir.name, "dev.bin")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def dhcp(self):
+        """How the boot got its address and in how many ms of the virtual clock."""
+        code, out, _ = hostsim.run(self.flash, "--until-ms", "3000", "--rtt-us", str(RTT_US))
+        self.assertEqual(code, hostsim.EXIT_IDLE)
+        m = re.search(r"DHCP: (full discovery|reacquired cached lease \(INIT-REBOOT\)) (?:took|in) (\d+) ms", out)
+        self.assertIsNotNone(m, out)
+        return m.group(1).split()[0], int(m.group(2))
+
+    def test_init_reboot_beats_full_discovery(self):
+        kind, discovery_ms = self.dhcp()
+        self.assertEqual(kind, "full")
+        kind, reboot_ms = self.dhcp()
+        self.assertEqual(kind, "reacquired")
+        # One exchange instead of two
+        self.assertGreaterEqual(discovery_ms, 2 * RTT_US // 1000)
+        self.assertLess(reboot_ms, 0.6 * discovery_ms)
+
+    def test_lease_from_the_future_counts_as_expired(self):
+        self.assertEqual(self.dhcp()[0], "full")
+        # The clock went back a day since the lease was obtained, so its age is unknown
+        image = flashimg.NorFlash(self.flash)
+        try:
+            files = flashimg.read_files(image)
+            lease = bytearray(files["/lease.bin"])
+            obtained, = struct.unpack_from("<I", lease, 24)   # dhcp_lease_t.obtained
+            struct.pack_into("<I", lease, 24, obtained + 86400)
+            files["/lease.bin"] = bytes(lease)
+            flashimg.write_files(image, files)
+        finally:
+            image.close()
+        self.assertEqual(self.dhcp()[0], "full")
+
+
+if __name__ == "__main__":
+    unittest.main()
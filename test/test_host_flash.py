@@ -0,0 +1,126 @@
+"""The firmware's own flash paths on the host backend, checked with tools/flashimg.py."""
+
+import os
+import struct
+import tempfile
+import unittest
+import zlib
+
+import hostsim
+import flashimg
+import s3bl_upload
+
+
+class HostFlashTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.flash = os.path.join(self.dir.name, "dev.bin")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def test_blank_flash_enters_recovery(self):
+        code, out, events = hostsim.run(self.flash, "--until-ms", "3000")
+        self.assertEqual(code, hostsim.EXIT_IDLE)
+        self.assertIn("No valid application found. Entering recovery mode.", out)
+        # The metadata went into the LittleFS_Program region of the image, nothing beside it
+        self.assertIsNotNone(hostsim.read_file(self.flash, "/meta.bin"))
+        self.assertEqual(sorted(os.listdir(self.dir.name)), ["dev.bin", "dev.bin.ocram"])
+
+    def test_upload_lands_in_slot_b_and_boots(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 150 * 1024)
+        dev = hostsim.Device(self.dir.name)
+        self.assertTrue(dev.start(restart=False))
+        try:
+            self.assertTrue(s3bl_upload.upload(dev.ip, image, dev.port(80), log=lambda *a: None))
+            # Installed images are started straight from recovery, without a reset
+            code, event = dev.wait_exit(1)
+            self.assertEqual(code, hostsim.EXIT_JUMP)
+            self.assertIn("jump 0x%08x" % hostsim.SLOT_B_ADDRESS, event)
+        finally:
+            dev.stop()
+
+        # What flash_program left behind, read through the independent NOR model
+        flash = flashimg.NorFlash(dev.flash)
+        try:
+            slot = flash.read(hostsim.SLOT_B_ADDRESS, len(image))
+            self.assertEqual(slot, image)
+            rest = flash.read(hostsim.SLOT_B_ADDRESS + len(image), flashimg.SLOT_SIZE - len(image))
+            self.assertEqual(flashimg.used_length(rest), 0)
+            self.assertTrue(flashimg.slot_vectors_ok(slot))
+        finally:
+            flash.close()
+
+        code, out, events = hostsim.run(dev.flash, "--until-ms", "5000")
+        self.assertEqual(code, hostsim.EXIT_JUMP, out)
+        self.assertIn("jump 0x%08x" % hostsim.SLOT_B_ADDRESS, events[-1])
+
+    def test_legacy_multipart_upload_logs_a_summary_only(self):
+        # The legacy handler buffers the body in a String, so keep NUL bytes out of it
+        image = bytes(range(1, 256)) * 12
+        boundary = "----s3bl%08x" % zlib.crc32(image)
+        body = (("--%s\r\nContent-Disposition: form-data; name=\"file\"; filename=\"fw.bin\"\r\n"
+                 "Content-Type: application/octet-stream\r\n\r\n" % boundary).encode() + image +
+                ("\r\n--%s--\r\n" % boundary).encode())
+        dev = hostsim.Device(self.dir.name)
+        self.assertTrue(dev.start(restart=False))
+        try:
+            code, text = s3bl_upload.manifest_request(dev.ip, dev.port(80), "POST", "/upload", body,
+                                                      {"Content-Type": "multipart/form-data; boundary=" + boundary})
+            self.assertEqual(code, 200, text)
+        finally:
+            dev.stop()
+        with open(dev.log_path, "rb") as f:
+            log = f.read()
+        self.assertIn(b"Received upload: %d bytes, crc32=%X" % (len(body), zlib.crc32(body)), log)
+        self.assertNotIn(boundary.encode(), log)
+
+    def test_installed_image_survives_an_offline_edit(self):
+        # flashimg edits the image file, slots and LittleFS files alike, the firmware boots what it finds there
+        image = hostsim.make_image(hostsim.SLOT_A_ADDRESS, 8192, seed=3)
+        hostsim.run(self.flash, "--until-ms", "2000")
+        flash = flashimg.NorFlash(self.flash)
+        try:
+            flash.erase_range(hostsim.SLOT_A_ADDRESS, len(image))
+            flash.program(hostsim.SLOT_A_ADDRESS, image)
+        finally:
+            flash.close()
+        code, out, events = hostsim.run(self.flash, "--until-ms", "5000")
+        # No metadata marks slot A valid, so the bootloader must not jump into it
+        self.assertEqual(code, hostsim.EXIT_IDLE, out)
+        self.assertIn("No valid application found", out)
+
+        # The metadata is in the same image: marking slot A valid offline makes it boot
+        flash = flashimg.NorFlash(self.flash)
+        try:
+            files = flashimg.read_files(flash)
+            meta = bytearray(files["/meta.bin"])
+            struct.pack_into("<5I", meta, 0, 0, 1, 0, 0, 1)
+            files["/meta.bin"] = bytes(meta)
+            flashimg.write_files(flash, files)
+        finally:
+            flash.close()
+        code, out, events = hostsim.run(self.flash, "--until-ms", "5000")
+        self.assertEqual(code, hostsim.EXIT_JUMP, out)
+        self.assertIn("jump 0x%08x" % hostsim.SLOT_A_ADDRESS, events[-1])
+
+    def test_netboot_image_runs_from_ocram(self):
+        # Stack in DTCM, reset handler inside the image; nothing goes to flash
+        image = struct.pack("<II", 0x20010000, 0x20200401) + os.urandom(200 * 1024)
+        dev = hostsim.Device(self.dir.name)
+        self.assertTrue(dev.start(restart=False))
+        try:
+            code, text = s3bl_upload.manifest_request(dev.ip, dev.port(80), "POST", "/netboot", image,
+                                                      {"X-Image-CRC32": "%08x" % zlib.crc32(image)})
+            self.assertEqual(code, 200, text)
+            code, event = dev.wait_exit(1)
+            self.assertEqual(code, hostsim.EXIT_JUMP)
+            self.assertIn("jump 0x20200000", event)
+        finally:
+            dev.stop()
+        with open(dev.flash + ".ocram", "rb") as f:
+            self.assertEqual(f.read(len(image)), image)
+
+
+if __name__ == "__main__":
+    unittest.main()
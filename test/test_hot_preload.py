@@ -0,0 +1,75 @@
+"""Hot sections of placed images on a host device (include/hot_preload.h): the table is programmed
+after the image and the jump goes through hot_jump; a section outside the image or ITCM is
+refused before anything is erased."""
+
+import socket
+import struct
+import tempfile
+import unittest
+import zlib
+
+import hostsim
+import s3bl_upload
+
+FLASH_BASE = 0x60000000
+PLACED_ADDRESS = 0x60120000
+SIZE = 64 * 1024
+
+
+class HotPreloadTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.dev = hostsim.Device(self.dir.name)
+        self.assertTrue(self.dev.start())
+
+    def tearDown(self):
+        self.dev.stop()
+        self.dir.cleanup()
+
+    def alloc_images(self):
+        code, text = s3bl_upload.manifest_request(self.dev.ip, self.dev.port(80), "GET", "/alloc")
+        self.assertEqual(code, 200, text)
+        return [dict(f.split("=", 1) for f in line.split()) for line in text.splitlines() if line.startswith("image=")]
+
+    def test_hot_sections_go_through_hot_jump(self):
+        image = hostsim.make_image(PLACED_ADDRESS, SIZE, seed=5, app="recovery")
+        hot = [(PLACED_ADDRESS + 0x1000, 0x8000, 2048), (PLACED_ADDRESS + 0x4000, 0x9000, 512)]
+        code, body = s3bl_upload.place(self.dev.ip, image, PLACED_ADDRESS, self.dev.port(80), hot=hot)
+        self.assertEqual(code, 200, body)
+        self.assertIsNotNone(self.dev.wait_exit(1))
+        with open(self.dev.log_path, errors="replace") as f:
+            events = [line.split(None, 1)[1].strip() for line in f if line.startswith("@")]
+        self.assertEqual(events[-3:], ["hot 2 sections", "jump 0x%08x" % PLACED_ADDRESS, "recovery"])
+
+        # The table follows the image, 4 byte aligned
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+        with open(self.dev.flash, "rb") as f:
+            f.seek(PLACED_ADDRESS + SIZE - FLASH_BASE)
+            magic, count = struct.unpack("<II", f.read(8))
+            sections = [struct.unpack("<3I", f.read(12)) for _ in range(count)]
+        self.assertEqual((magic, sections), (0x54483353, hot))
+        self.assertEqual([(i["base"], i["hot"]) for i in self.alloc_images()], [("0x%X" % PLACED_ADDRESS, "1")])
+
+    def test_section_outside_the_image_is_refused(self):
+        image = hostsim.make_image(PLACED_ADDRESS, 4096, seed=6)
+        for section in [(PLACED_ADDRESS + 0xF00, 0x8000, 512),     # Runs past the image
+                        (PLACED_ADDRESS + 0x100, 0x1FF00, 1024)]:  # Runs past the 128KB of ITCM
+            # The device answers after the header and closes on the unread image, which resets the
+            # connection, so only the status line is read
+            header = struct.pack("<5IHH", s3bl_upload.IMAGE_HEADER_MAGIC, 36, PLACED_ADDRESS, len(image),
+                                 zlib.crc32(image), 1, 0) + struct.pack("<3I", *section)
+            with socket.create_connection((self.dev.ip, self.dev.port(80)), timeout=5) as s:
+                s.sendall(hostsim.http_request("POST", "/alloc", header + image))
+                reply = b""
+                while b"\r\n" not in reply:
+                    data = s.recv(64)
+                    if not data:
+                        break
+                    reply += data
+                self.assertTrue(reply.startswith(b"HTTP/1.1 400"), reply)
+        self.assertEqual(self.alloc_images(), [])
+        self.assertEqual(self.dev.exits, [])
+
+
+if __name__ == "__main__":
+    unittest.main()
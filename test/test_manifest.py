@@ -0,0 +1,69 @@
+"""Release manifests on a host device while a placed image (image_alloc.h) is the one booted: the
+release is staged into the fixed slot that leaves the placed image alone, and that is the slot
+the commit marks."""
+
+import os
+import struct
+import tempfile
+import unittest
+
+import hostsim
+import s3bl_upload
+
+FLASH_BASE = 0x60000000
+PLACED_ADDRESS = 0x60120000   # Inside slot B
+
+
+class ManifestPlacedTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.dev = hostsim.Device(self.dir.name)
+        self.assertTrue(self.dev.start())
+
+    def tearDown(self):
+        self.dev.stop()
+        self.dir.cleanup()
+
+    def read_flash(self, address, length):
+        with open(self.dev.flash, "rb") as f:
+            f.seek(address - FLASH_BASE)
+            return f.read(length)
+
+    def metadata(self):
+        # boot_metadata_t: active_slot, valid_a, valid_b, boot_count, boot_success, active_image,
+        # then the image table (base, length, crc, valid)
+        data = hostsim.read_file(self.dev.flash, "/meta.bin")
+        head = struct.unpack_from("<6I", data)
+        images = [struct.unpack_from("<4I", data, 24 + 16 * i) for i in range(4)]
+        return head, images
+
+    def test_release_stages_beside_a_booted_placed_image(self):
+        placed = hostsim.make_image(PLACED_ADDRESS, 64 * 1024, seed=3, app="recovery")
+        code, body = s3bl_upload.place(self.dev.ip, placed, PLACED_ADDRESS, self.dev.port(80))
+        self.assertEqual(code, 200, body)
+        # The placed image asks for recovery and resets, the bootloader comes back up with it booted
+        code, event = self.dev.wait_exit(1)
+        self.assertEqual((code, event.split()[-1]), (hostsim.EXIT_RESET, "recovery"))
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+        (active_slot, _, _, _, _, active_image), images = self.metadata()
+        self.assertEqual((active_slot, images[active_image][0]), (2, PLACED_ADDRESS))
+
+        app = hostsim.make_image(hostsim.SLOT_A_ADDRESS, 128 * 1024, seed=4)
+        config = os.urandom(3000)
+        self.assertTrue(s3bl_upload.release(self.dev.ip, [("app", "slot", app), ("config", "data", config)],
+                                            self.dev.port(80), log=lambda *a: None))
+        code, event = self.dev.wait_exit(2)
+        self.assertEqual((code, event.split()[-1]), (hostsim.EXIT_JUMP, "0x%08x" % hostsim.SLOT_A_ADDRESS))
+
+        (active_slot, valid_a, valid_b, _, _, _), images = self.metadata()
+        self.assertEqual((active_slot, valid_a, valid_b), (0, 1, 0))
+        self.assertEqual(self.read_flash(hostsim.SLOT_A_ADDRESS, len(app)), app)
+        # Still there and still a fallback
+        self.assertEqual(self.read_flash(PLACED_ADDRESS, len(placed)), placed)
+        self.assertTrue(any(base == PLACED_ADDRESS and valid for base, _, _, valid in images))
+        self.assertEqual(hostsim.read_file(self.dev.flash, "/config_a.bin"), config)
+        self.assertIsNone(hostsim.read_file(self.dev.flash, "/config_b.bin"))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,33 @@
+"""tools/otasim.py against the firmware: the update completes, lands in slot B, and is reproducible."""
+
+import unittest
+
+import hostsim  # noqa: F401, puts tools/ on the path
+import otasim
+
+
+class OtasimTest(unittest.TestCase):
+    def test_range_upload_is_reproducible(self):
+        params = dict(otasim.DEFAULTS)
+        first = otasim.simulate("range", 64 * 1024, params, connections=4)
+        second = otasim.simulate("range", 64 * 1024, params, connections=4)
+        self.assertEqual(first, second)
+        total, stats = first
+        self.assertEqual(stats["sector_erases"], 16)
+        # Sixteen sector erases alone take 16 * 45 ms of the virtual time
+        self.assertGreater(total, 16 * params["sector_erase_ms"] / 1000)
+
+    def test_provision_erases_in_blocks(self):
+        total, stats = otasim.simulate("provision", 256 * 1024, dict(otasim.DEFAULTS))
+        self.assertGreater(stats["block_erases"], 0)
+
+    def test_rtt_slows_the_transfer(self):
+        params = dict(otasim.DEFAULTS)
+        fast, _ = otasim.simulate("range", 128 * 1024, params, connections=1)
+        params["rtt_ms"] = 20.0
+        slow, _ = otasim.simulate("range", 128 * 1024, params, connections=1)
+        self.assertGreater(slow, fast)
+
+
+if __name__ == "__main__":
+    unittest.main()
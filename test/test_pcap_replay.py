@@ -0,0 +1,68 @@
+"""tools/pcap_replay.py --host-build: captured flows into the firmware's simulated socket layer."""
+
+import os
+import socket
+import struct
+import tempfile
+import unittest
+import zlib
+
+import hostsim
+import pcap_replay
+
+
+def write_pcap(path, flows):
+    """flows: [(client port, [request segments], response)], one IPv4/TCP flow each to port 80."""
+    out = [struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0, 65535, 1)]
+    t = 1000.0
+
+    def frame(src, dst, sport, dport, seq, payload):
+        tcp = struct.pack(">HHIIBBHHH", sport, dport, seq, 0, 5 << 4, 0x18, 65535, 0, 0) + payload
+        ip = struct.pack(">BBHHHBBH4s4s", 0x45, 0, 20 + len(tcp), 0, 0, 64, 6, 0,
+                         socket.inet_aton(src), socket.inet_aton(dst)) + tcp
+        return b"\x00" * 12 + b"\x08\x00" + ip
+
+    for sport, segments, response in flows:
+        seq = 1000
+        for data in segments:
+            f = frame("192.168.1.10", "192.168.1.222", sport, 80, seq, data)
+            out.append(struct.pack("<IIII", int(t), int(t % 1 * 1e6), len(f), len(f)) + f)
+            seq += len(data)
+            t += 0.001
+        f = frame("192.168.1.222", "192.168.1.10", 80, sport, 5000, response)
+        out.append(struct.pack("<IIII", int(t), int(t % 1 * 1e6), len(f), len(f)) + f)
+        t += 0.5
+    with open(path, "wb") as f:
+        f.write(b"".join(out))
+
+
+class PcapReplayTest(unittest.TestCase):
+    def test_statuses_match_the_capture(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 8192)
+        put = (b"PUT /image HTTP/1.1\r\nContent-Range: bytes 0-8191/8192\r\nContent-Length: 8192\r\n"
+               b"X-Image-CRC32: %08X\r\n\r\n" % zlib.crc32(image))
+        body = [image[i:i + 1460] for i in range(0, len(image), 1460)]
+        with tempfile.TemporaryDirectory() as tmp:
+            pcap = os.path.join(tmp, "field.pcap")
+            write_pcap(pcap, [
+                (40001, [b"GET /status HTTP/1.1\r\n", b"Host: s3bl\r\n\r\n"], b"HTTP/1.1 200 OK\r\n\r\n"),
+                # Headers split mid-line, as a slow client sends them
+                (40002, [b"PUT /image HTTP/1.1\r\nContent-Ra", b"nge: bytes 0-99/100\r\n\r\n"],
+                 b"HTTP/1.1 400 Bad Request\r\n\r\n"),
+                (40003, [put] + body, b"HTTP/1.1 200 OK\r\n\r\n"),
+                (40004, [b"GET /status HTTP/1.1\r\n\r\n"], b"HTTP/1.1 200 OK\r\n\r\n"),
+            ])
+            flows = pcap_replay.load_flows(pcap, 80)
+            self.assertEqual(len(flows), 4)
+            results, end, _ = pcap_replay.host_replay(flows, fast=False, pause=0.1)
+            again, _, _ = pcap_replay.host_replay(flows, fast=False, pause=0.1)
+
+        # The upload makes the firmware start the image, so the last flow never runs
+        self.assertEqual(end, "jump")
+        self.assertEqual([r[1] for r in results], [200, 400, 200])
+        self.assertEqual(results[2][2], len(put) + len(image))
+        self.assertEqual([r[1:] for r in results], [r[1:] for r in again])
+
+
+if __name__ == "__main__":
+    unittest.main()
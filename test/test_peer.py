@@ -0,0 +1,54 @@
+"""Peer serving on a host device (include/peer.h): a device in recovery serves the image its
+metadata boots, as the chunk hash list and the chunks themselves, and nothing else."""
+
+import hashlib
+import http.client
+import tempfile
+import unittest
+
+import hostsim
+import s3bl_upload
+
+PLACED_ADDRESS = 0x60120000
+CHUNK = 32 * 1024
+
+
+class PeerServeTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.dev = hostsim.Device(self.dir.name)
+        self.assertTrue(self.dev.start())
+
+    def tearDown(self):
+        self.dev.stop()
+        self.dir.cleanup()
+
+    def get(self, path):
+        conn = http.client.HTTPConnection(self.dev.ip, self.dev.port(80), timeout=10)
+        conn.request("GET", path)
+        resp = conn.getresponse()
+        body = resp.read()
+        conn.close()
+        return resp.status, body
+
+    def test_booted_image_is_served_in_chunks(self):
+        # Not a whole number of chunks, so the last one is short
+        image = hostsim.make_image(PLACED_ADDRESS, 2 * CHUNK + 5000, seed=7, app="recovery")
+        code, body = s3bl_upload.place(self.dev.ip, image, PLACED_ADDRESS, self.dev.port(80))
+        self.assertEqual(code, 200, body)
+        code, event = self.dev.wait_exit(1)
+        self.assertEqual((code, event.split()[-1]), (hostsim.EXIT_RESET, "recovery"))
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+
+        sha = hashlib.sha256(image).hexdigest()
+        chunks = [image[i:i + CHUNK] for i in range(0, len(image), CHUNK)]
+        self.assertEqual(self.get("/peer/hashes?sha256=" + sha),
+                         (200, b"".join(hashlib.sha256(c).digest() for c in chunks)))
+        for n, chunk in enumerate(chunks):
+            self.assertEqual(self.get("/peer/chunk?sha256=%s&n=%d" % (sha, n)), (200, chunk))
+        self.assertEqual(self.get("/peer/chunk?sha256=%s&n=%d" % (sha, len(chunks)))[0], 416)
+        self.assertEqual(self.get("/peer/hashes?sha256=" + hashlib.sha256(b"other").hexdigest())[0], 404)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,45 @@
+"""Update traffic limit on a host device (include/rate_limit.h): the rate holds, and /status counts
+the times a transfer had to wait, not the calls made while it waited."""
+
+import tempfile
+import time
+import unittest
+
+import hostsim
+import s3bl_provision
+import s3bl_upload
+
+RATE = 128 * 1024
+SIZE = 256 * 1024
+
+
+class RateLimitTest(unittest.TestCase):
+    def test_netboot_body_is_paced_and_waits_are_episodes(self):
+        with tempfile.TemporaryDirectory() as workdir:
+            dev = hostsim.Device(workdir)
+            self.assertTrue(dev.start())
+            try:
+                cfg = s3bl_provision.net_config("0.0.0.0", 1883, 300, "0.0.0.0", 514, 2048, RATE)
+                bundle = s3bl_provision.build_bundle([(s3bl_provision.NETCFG, cfg)])
+                s3bl_provision.send_bundle(dev.ip, bundle, dev.port(80))
+                dev.stop()
+                dev.start()
+                start = time.monotonic()
+                s3bl_upload.verify_benchmark(dev.ip, dev.port(80), SIZE, samples=1)
+                elapsed = time.monotonic() - start
+                status = s3bl_upload.get_status(dev.ip, dev.port(80), path="/status")
+            finally:
+                dev.stop()
+        self.assertEqual(int(status["upload_rate"]), RATE)
+        self.assertEqual(int(status["rate_limit_bytes"]), SIZE)
+        # The first burst goes at once, the rest at the configured rate
+        self.assertGreater(elapsed, 0.8 * SIZE / RATE)
+        # At most one wait per read's worth of bytes, however often the loop came around
+        waits = int(status["rate_limit_waits"])
+        self.assertGreater(waits, 0)
+        self.assertLessEqual(waits, SIZE // 1024)
+        self.assertGreater(int(status["rate_limit_wait_ms"]), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,82 @@
+"""Canary rollouts with s3bl_upload against a fleet of host devices. A good boot is only reported
+by the bootloader once the application confirmed it through the handoff block (boot_clock.h)."""
+
+import contextlib
+import io
+import struct
+import tempfile
+import unittest
+
+import hostsim
+import s3bl_upload
+
+FLEET = ["127.0.0.%d" % i for i in range(11, 14)]
+
+
+class RolloutTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.devices = [hostsim.Device(self.dir.name, ip=ip) for ip in FLEET]
+        for dev in self.devices:
+            self.assertTrue(dev.start())
+
+    def tearDown(self):
+        for dev in self.devices:
+            dev.stop()
+        self.dir.cleanup()
+
+    def rollout(self, image, **kwargs):
+        fleet = [(dev.ip, dev.port(80), "127.0.0.0/24") for dev in self.devices]
+        out, err = io.StringIO(), io.StringIO()
+        with contextlib.redirect_stdout(out), contextlib.redirect_stderr(err):
+            ok = s3bl_upload.rollout(fleet, image, stages="1,100%", boot_timeout=15, **kwargs)
+        return ok, out.getvalue(), err.getvalue()
+
+    def boot_success(self, dev):
+        # boot_metadata_t: active_slot, valid_a, valid_b, boot_count, boot_success
+        return struct.unpack_from("<5I", hostsim.read_file(dev.flash, "/meta.bin"))[4]
+
+    def test_confirmed_boots_complete_the_rollout(self):
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 64 * 1024, app="confirm")
+        ok, out, err = self.rollout(image)
+        self.assertTrue(ok, out + err)
+        self.assertEqual(out.count("Boot good"), len(FLEET))
+        for dev in self.devices:
+            # Trial boot, confirm and reset, then the confirmed boot that stays in the application
+            self.assertIsNotNone(dev.wait_exit(2))
+            self.assertEqual([code for code, _ in dev.exits], [hostsim.EXIT_RESET, hostsim.EXIT_JUMP])
+            self.assertEqual(self.boot_success(dev), 1)
+
+    def test_unconfirmed_canary_halts_the_rollout(self):
+        # Starts but never confirms, as an image that hangs or crashes early would
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 64 * 1024)
+        ok, out, err = self.rollout(image)
+        self.assertFalse(ok)
+        self.assertIn("Rollout halted with %d device(s) untouched" % (len(FLEET) - 1), err)
+        canary, rest = self.devices[0], self.devices[1:]
+        self.assertEqual(canary.exits[0][0], hostsim.EXIT_JUMP)
+        self.assertEqual(self.boot_success(canary), 0)
+        for dev in rest:
+            self.assertEqual(dev.exits, [])
+            self.assertEqual(s3bl_upload.get_status(dev.ip, dev.port(80), path="/status")["mode"], "recovery")
+
+
+class ReportWindowTest(unittest.TestCase):
+    def test_only_rollout_uploads_hold_the_confirmed_boot(self):
+        with tempfile.TemporaryDirectory() as workdir:
+            dev = hostsim.Device(workdir)
+            self.assertTrue(dev.start())
+            try:
+                image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, 64 * 1024, app="confirm")
+                self.assertTrue(s3bl_upload.upload(dev.ip, image, dev.port(80), log=lambda *a: None))
+                # Nobody reads /status, and the confirmed boot goes on without waiting out the window
+                self.assertIsNotNone(dev.wait_exit(2, timeout=10))
+                self.assertEqual([code for code, _ in dev.exits], [hostsim.EXIT_RESET, hostsim.EXIT_JUMP])
+            finally:
+                dev.stop()
+            with open(dev.log_path, errors="replace") as f:
+                self.assertNotIn("Reporting the confirmed boot", f.read())
+
+
+if __name__ == "__main__":
+    unittest.main()
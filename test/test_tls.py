@@ -0,0 +1,151 @@
+"""TLS on a host device: what a configured PSK closes on the plain HTTP side, and the PSK
+listener against openssl s_client."""
+
+import hashlib
+import http.client
+import os
+import socket
+import tempfile
+import unittest
+
+import hostsim
+import flashimg
+import s3bl_coap as coap
+import s3bl_provision
+import s3bl_upload
+
+PSK = bytes(range(32))
+
+
+def get(dev, path):
+    conn = http.client.HTTPConnection(dev.ip, dev.port(80), timeout=10)
+    try:
+        conn.request("GET", path)
+        resp = conn.getresponse()
+        return resp.status, resp.read()
+    finally:
+        conn.close()
+
+
+class TlsProvisionTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.dev = hostsim.Device(self.dir.name)
+        self.assertTrue(self.dev.start())
+
+    def tearDown(self):
+        self.dev.stop()
+        self.dir.cleanup()
+
+    def provision(self, mqtt_broker="0.0.0.0", **kwargs):
+        cfg = s3bl_provision.net_config(mqtt_broker, 1883, 300, "0.0.0.0", 514, 2048, 0, PSK, "s3bl", **kwargs)
+        bundle = s3bl_provision.build_bundle([(s3bl_provision.NETCFG, cfg)])
+        status, _, report, body = s3bl_provision.send_bundle(self.dev.ip, bundle, self.dev.port(80))
+        self.assertEqual((status, report.get("result")), (200, "ok"), body)
+        # The config is read when recovery starts, so power cycle into it
+        self.dev.stop()
+        self.dev.start()
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(443)))
+
+    def status(self):
+        return s3bl_upload.get_status(self.dev.ip, self.dev.port(80), path="/status")
+
+    def test_psk_closes_plain_http_by_default(self):
+        self.provision()
+        with self.assertRaises(ConnectionRefusedError):
+            socket.create_connection((self.dev.ip, self.dev.port(80)), timeout=2).close()
+
+    def test_tls_only_refuses_coap_uploads(self):
+        # No authentication on CoAP or MQTT announcements, so neither may install anything
+        self.provision(mqtt_broker="127.0.0.1")
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.addCleanup(sock.close)
+        sock.connect((self.dev.ip, self.dev.port(coap.COAP_PORT)))
+        sock.settimeout(5)
+        sock.send(coap.build(coap.CON, coap.PUT, 0x1234, b"\x01",
+                             [(coap.OPT_URI_PATH, b"fw"), (coap.OPT_BLOCK1, coap.encode_uint(8 | 6)),
+                              (coap.OPT_SIZE1, coap.encode_uint(4096))], b"\xAA" * 1024))
+        with self.assertRaises(ConnectionRefusedError):
+            sock.recv(2048)
+        with open(self.dev.log_path) as f:
+            log = f.read()
+        self.assertIn("TLS only: CoAP and MQTT update paths are off.", log)
+        self.assertNotIn("MQTT: broker", log)
+
+    def test_flash_dump_refused_once_a_psk_is_configured(self):
+        status, data = get(self.dev, "/flash?length=4096")
+        self.assertEqual((status, len(data)), (200, 4096))
+        self.provision(tls_only=False)
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+        status, data = get(self.dev, "/flash?length=4096")
+        self.assertEqual(status, 403)
+        self.assertNotIn(PSK, data)
+        with self.assertRaises(flashimg.NorError):
+            flashimg.dump(self.dev.ip, os.path.join(self.dir.name, "dump.bin"), self.dev.port(80))
+
+    def test_tls_listener_takes_a_peer_connection(self):
+        self.assertEqual(self.status()["peer_connections"], "3")
+        self.provision(tls_only=False)
+        self.assertTrue(hostsim.wait_port(self.dev.ip, self.dev.port(80)))
+        self.assertEqual(self.status()["peer_connections"], "2")
+
+
+class OpensslInteropTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.dir = tempfile.TemporaryDirectory()
+        cls.dev = hostsim.Device(cls.dir.name, ip="127.0.0.3")
+        cls.dev.start()
+        cfg = s3bl_provision.net_config("0.0.0.0", 1883, 300, "0.0.0.0", 514, 2048, 0, PSK, "s3bl", tls_only=False)
+        s3bl_provision.send_bundle(cls.dev.ip, s3bl_provision.build_bundle([(s3bl_provision.NETCFG, cfg)]),
+                                   cls.dev.port(80))
+        cls.dev.stop()
+        cls.dev.start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.dev.stop()
+        cls.dir.cleanup()
+
+    def request(self, request, **kwargs):
+        return hostsim.s_client(self.dev.ip, self.dev.port(443), request, kwargs.pop("psk", PSK), **kwargs)
+
+    def status(self):
+        return s3bl_upload.get_status(self.dev.ip, self.dev.port(80), path="/status")
+
+    def test_both_suites_and_key_exchange_modes(self):
+        before = int(self.status()["tls_handshakes"])
+        for suite in ("TLS_AES_128_CCM_SHA256", "TLS_AES_128_GCM_SHA256"):
+            # psk_dhe_ke, then psk_ke offered as well
+            for options in ((), ("-allow_no_dhe_kex",)):
+                code, reply = self.request(hostsim.http_request("GET", "/status"), suite=suite, options=options)
+                self.assertEqual(code, 0, (suite, options))
+                self.assertTrue(reply.startswith(b"HTTP/1.1 200 OK"), reply[:100])
+                self.assertIn(b"mode=recovery", reply)
+        self.assertEqual(int(self.status()["tls_handshakes"]), before + 4)
+
+    def test_wrong_key_fails_the_handshake(self):
+        before = int(self.status()["tls_failures"])
+        _, reply = self.request(hostsim.http_request("GET", "/status"), psk=bytes(32))
+        self.assertNotIn(b"HTTP/1.1", reply)
+        self.assertEqual(int(self.status()["tls_failures"]), before + 1)
+
+    def test_image_staged_over_tls_matches(self):
+        # Many records each way through the AEAD: stage a slot image, read the resume point back
+        size = 128 * 1024
+        image = hostsim.make_image(hostsim.SLOT_B_ADDRESS, size, seed=5)
+        manifest = b"app slot %d %s\n" % (size + 4096, hashlib.sha256(image + bytes(4096)).hexdigest().encode())
+        for suite in ("TLS_AES_128_CCM_SHA256", "TLS_AES_128_GCM_SHA256"):
+            code, reply = self.request(hostsim.http_request("POST", "/manifest", manifest), suite=suite)
+            self.assertTrue(reply.startswith(b"HTTP/1.1 200"), reply[:200])
+            put = hostsim.http_request("PUT", "/manifest/app", image,
+                                       [("Content-Range", "bytes 0-%d/%d" % (size - 1, size + 4096))])
+            code, reply = self.request(put, suite=suite)
+            self.assertTrue(reply.startswith(b"HTTP/1.1 202"), reply[:200])
+            _, reply = self.request(hostsim.http_request("GET", "/manifest/status"), suite=suite)
+            self.assertIn(b"received=%d" % size, reply)
+            self.request(hostsim.http_request("DELETE", "/manifest"), suite=suite)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+"""Offline work on 2MB S3BL flash images.
+
+A flash image is a plain file holding the whole external flash (0x60000000-0x60200000). NorFlash
+maps it with mmap, so changes land in the file directly, persist across runs and can be diffed
+with ordinary tools. Erase and program follow NOR rules: erasing sets whole sectors to 0xFF,
+programming can only clear bits. The host build of the bootloader (test/host) maps the same file
+at 0x60000000 as its flash_* backend, so an image can go from a /flash dump to a simulated device
+and back to this tool unchanged; pages are only paged in where they are touched.
+
+    python3 tools/flashimg.py dump 192.168.1.222 field.bin        # GET /flash from a device
+    python3 tools/flashimg.py info field.bin
+    python3 tools/flashimg.py install field.bin b firmware.bin
+    python3 tools/flashimg.py diff before.bin after.bin
+    python3 tools/flashimg.py export field.bin field_fs/       # LittleFS_Program files to a directory
+    python3 tools/flashimg.py import field.bin field_fs/
+
+The files live in the LittleFS_Program region (FS_BASE-FS_END), where the Teensy 4.0 library puts a
+PROG_FLASH_SIZE filesystem: right below the EEPROM emulation area, across the tails of both slots.
+The host build keeps them there as a flat table (test/host/fs.cpp); export and import work on that
+table. An image dumped from a board holds littlefs blocks there instead, which this tool does not
+parse.
+"""
+
+import argparse
+import hashlib
+import http.client
+import mmap
+import os
+import struct
+import sys
+import zlib
+
+FLASH_BASE = 0x60000000
+FLASH_SIZE = 2 * 1024 * 1024
+SECTOR_SIZE = 4096
+BLOCK_SIZE = 64 * 1024
+SLOT_A_ADDRESS = 0x60032000
+SLOT_B_ADDRESS = 0x60112000
+SLOT_SIZE = SLOT_B_ADDRESS - SLOT_A_ADDRESS
+FS_END = 0x601F0000
+FS_SIZE = 1024 * 1024         # PROG_FLASH_SIZE
+FS_BASE = FS_END - FS_SIZE
+FS_MAGIC, FS_VERSION, FS_NAME, FS_DIR = 0x46483353, 1, 32, 0xFFFFFFFF
+REGIONS = [
+    ("bootloader", FLASH_BASE, 0x60031000),
+    ("metadata", 0x60031000, SLOT_A_ADDRESS),
+    ("slot_a", SLOT_A_ADDRESS, SLOT_B_ADDRESS),
+    ("slot_b", SLOT_B_ADDRESS, SLOT_B_ADDRESS + SLOT_SIZE),
+    ("tail", SLOT_B_ADDRESS + SLOT_SIZE, FLASH_BASE + FLASH_SIZE),
+]
+
+
+class NorError(Exception):
+    pass
+
+
+def to_offset(addr):
+    """Accepts both XIP addresses (0x6xxxxxxx) and plain offsets into the image."""
+    return addr - FLASH_BASE if addr >= FLASH_BASE else addr
+
+
+def region_of(offset):
+    for name, start, end in REGIONS:
+        if start - FLASH_BASE <= offset < end - FLASH_BASE:
+            return name
+    return "?"
+
+
+class NorFlash:
+    """NOR flash model over an mmap'd image file."""
+
+    def __init__(self, path, create=False):
+        if create and not os.path.exists(path):
+            with open(path, "wb") as f:
+                f.write(b"\xff" * FLASH_SIZE)
+        self.file = open(path, "r+b")
+        size = os.fstat(self.file.fileno()).st_size
+        if size < FLASH_SIZE:
+            if not create:
+                raise NorError("%s is %d bytes, expected a %d byte flash image" % (path, size, FLASH_SIZE))
+            self.file.seek(size)
+            self.file.write(b"\xff" * (FLASH_SIZE - size))
+            self.file.flush()
+        self.map = mmap.mmap(self.file.fileno(), FLASH_SIZE)
+        self.erases = 0
+        self.programmed = 0
+
+    def close(self):
+        self.map.flush()
+        self.map.close()
+        self.file.close()
+
+    def read(self, addr, length):
+        offset = to_offset(addr)
+        return self.map[offset:offset + length]
+
+    def erase(self, addr, size):
+        offset = to_offset(addr)
+        if offset % size or offset + size > FLASH_SIZE:
+            raise NorError("unaligned or out of range erase at 0x%08X" % (offset + FLASH_BASE))
+        self.map[offset:offset + size] = b"\xff" * size
+        self.erases += 1
+
+    def erase_range(self, addr, length):
+        """Same split as flash_erase_range on the device: 64KB blocks where they fit, sectors elsewhere."""
+        offset = to_offset(addr) & ~(SECTOR_SIZE - 1)
+        end = (to_offset(addr) + length + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)
+        while offset < end:
+            size = BLOCK_SIZE if offset % BLOCK_SIZE == 0 and end - offset >= BLOCK_SIZE else SECTOR_SIZE
+            self.erase(offset, size)
+            offset += size
+
+    def program(self, addr, data, strict=True):
+        """Programming ANDs into the array. In strict mode a bit that would need 0->1 is an error."""
+        offset = to_offset(addr)
+        if offset + len(data) > FLASH_SIZE:
+            raise NorError("program past the end of flash")
+        old = self.map[offset:offset + len(data)]
+        new = bytes(a & b for a, b in zip(old, data))
+        if strict and new != bytes(data):
+            bad = next(i for i in range(len(data)) if new[i] != data[i])
+            raise NorError("0x%08X needs erasing first (0x%02X -> 0x%02X)" % (offset + bad + FLASH_BASE, old[bad], data[bad]))
+        self.map[offset:offset + len(data)] = new
+        self.programmed += len(data)
+
+
+def used_length(data):
+    """Length without the trailing erased bytes."""
+    return len(data.rstrip(b"\xff"))
+
+
+def slot_vectors_ok(data):
+    # Same check as the bootloader before it jumps: stack pointer and reset handler in flash space
+    if len(data) < 8:
+        return False
+    sp, rv = struct.unpack("<II", data[:8])
+    return (sp & 0x60000000) == 0x60000000 and (rv & 0x60000000) == 0x60000000
+
+
+def read_files(flash):
+    """The host LittleFS table as {path: bytes, directories: None}, None if there is no valid table."""
+    magic, version, length, crc = struct.unpack("<4I", flash.read(FS_BASE, 16))
+    if magic != FS_MAGIC or version != FS_VERSION or length > FS_SIZE - 16:
+        return None
+    table = flash.read(FS_BASE + 16, length)
+    if zlib.crc32(table) & 0xFFFFFFFF != crc:
+        return None
+    files, p = {}, 0
+    while p + FS_NAME + 4 <= len(table):
+        name = table[p:p + FS_NAME].split(b"\0")[0].decode()
+        size, = struct.unpack_from("<I", table, p + FS_NAME)
+        p += FS_NAME + 4
+        if size == FS_DIR:
+            files[name] = None
+            continue
+        files[name] = table[p:p + size]
+        p += (size + 3) & ~3
+    return files
+
+
+def write_files(flash, files):
+    """Replaces the host LittleFS table with files ({path: bytes}), erasing only what it needs."""
+    table = b""
+    for name in sorted(files):
+        if not name.startswith("/") or len(name.encode()) >= FS_NAME:
+            raise NorError("%s: paths start with / and are shorter than %d bytes" % (name, FS_NAME))
+        data = files[name]
+        table += name.encode().ljust(FS_NAME, b"\0") + struct.pack("<I", FS_DIR if data is None else len(data))
+        if data is not None:
+            table += data + b"\xff" * (-len(data) % 4)
+    if 16 + len(table) > FS_SIZE:
+        raise NorError("files need %d bytes, the region holds %d" % (16 + len(table), FS_SIZE))
+    old = flash.read(FS_BASE, FS_SIZE)
+    flash.erase_range(FS_BASE, max(16 + len(table), used_length(old)))
+    flash.program(FS_BASE + 16, table)
+    flash.program(FS_BASE, struct.pack("<4I", FS_MAGIC, FS_VERSION, len(table), zlib.crc32(table) & 0xFFFFFFFF))
+
+
+def info(flash):
+    print("%-10s %-23s %9s %9s  %-8s  %s" % ("region", "range", "used", "erased", "crc32", "sha256"))
+    for name, start, end in REGIONS:
+        data = flash.read(start, end - start)
+        used = data[:used_length(data)]
+        erased = sum(1 for s in range(0, len(data), SECTOR_SIZE) if data[s:s + SECTOR_SIZE].count(0xFF) == SECTOR_SIZE)
+        print("%-10s 0x%08X-0x%08X %9d %6d/%-3d %08X  %s" %
+              (name, start, end, len(used), erased, len(data) // SECTOR_SIZE,
+               zlib.crc32(used) & 0xFFFFFFFF, hashlib.sha256(used).hexdigest()[:16]))
+        if name.startswith("slot") and used:
+            sp, rv = struct.unpack("<II", data[:8])
+            print("%10s SP 0x%08X reset 0x%08X: %s" % ("", sp, rv,
+                  "looks bootable" if slot_vectors_ok(data) else "NOT a valid vector table"))
+    files = read_files(flash)
+    print("%-10s 0x%08X-0x%08X  %s" % ("littlefs", FS_BASE, FS_END, "no host table" if files is None else
+                                        "%d file(s), %d bytes" % (len(files), sum(len(d or b"") for d in files.values()))))
+
+
+def diff(a, b):
+    """Prints the differing sector ranges between two images. Returns the number of sectors."""
+    count = 0
+    run = None
+    for offset in range(0, FLASH_SIZE, SECTOR_SIZE):
+        differs = a.map[offset:offset + SECTOR_SIZE] != b.map[offset:offset + SECTOR_SIZE]
+        if differs:
+            count += 1
+            run = run or [offset, offset]
+            run[1] = offset + SECTOR_SIZE
+        if run and (not differs or offset + SECTOR_SIZE == FLASH_SIZE):
+            print("0x%08X-0x%08X  %4d sector(s)  %s" % (run[0] + FLASH_BASE, run[1] + FLASH_BASE,
+                                                     (run[1] - run[0]) // SECTOR_SIZE, region_of(run[0])))
+            run = None
+    print("%d sector(s) differ" % count)
+    return count
+
+
+def dump(host, path, port=80, chunk=64 * 1024):
+    with open(path, "wb") as out:
+        for offset in range(0, FLASH_SIZE, chunk):
+            conn = http.client.HTTPConnection(host, port, timeout=30)
+            conn.request("GET", "/flash?offset=%d&length=%d" % (offset, chunk))
+            resp = conn.getresponse()
+            data = resp.read()
+            conn.close()
+            if resp.status != 200 or len(data) != chunk:
+                raise NorError("GET /flash at 0x%X: HTTP %d, %d bytes" % (offset, resp.status, len(data)))
+            out.write(data)
+            print("\r%d / %d KB" % ((offset + chunk) // 1024, FLASH_SIZE // 1024), end="", flush=True)
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="S3BL flash image tool (NOR semantics over mmap)")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("create", help="create an erased 2MB image")
+    p.add_argument("image")
+    p = sub.add_parser("dump", help="read a device's flash through GET /flash")
+    p.add_argument("host")
+    p.add_argument("image")
+    p.add_argument("--port", type=int, default=80)
+    p = sub.add_parser("info", help="region summary with hashes and vector table check")
+    p.add_argument("image")
+    p = sub.add_parser("erase", help="erase a range (rounded out to sectors)")
+    p.add_argument("image")
+    p.add_argument("addr", type=lambda v: int(v, 0))
+    p.add_argument("length", type=lambda v: int(v, 0))
+    p = sub.add_parser("program", help="program a file at an address without erasing")
+    p.add_argument("image")
+    p.add_argument("addr", type=lambda v: int(v, 0))
+    p.add_argument("file")
+    p.add_argument("--force", action="store_true", help="AND the data in even where bits would need erasing")
+    p = sub.add_parser("install", help="erase a slot and program an application image into it")
+    p.add_argument("image")
+    p.add_argument("slot", choices=("a", "b"))
+    p.add_argument("file")
+    p = sub.add_parser("extract", help="write a slot's contents (trailing 0xFF trimmed) to a file")
+    p.add_argument("image")
+    p.add_argument("slot", choices=("a", "b"))
+    p.add_argument("out")
+    p = sub.add_parser("export", help="copy the LittleFS_Program files into a directory")
+    p.add_argument("image")
+    p.add_argument("dir")
+    p = sub.add_parser("import", help="replace the LittleFS_Program files with a directory's files")
+    p.add_argument("image")
+    p.add_argument("dir")
+    p = sub.add_parser("diff", help="list differing sector ranges between two images")
+    p.add_argument("image")
+    p.add_argument("other")
+    args = parser.parse_args()
+
+    try:
+        if args.command == "dump":
+            dump(args.host, args.image, args.port)
+            return 0
+        flash = NorFlash(args.image, create=args.command == "create")
+        if args.command == "info":
+            info(flash)
+        elif args.command == "erase":
+            flash.erase_range(args.addr, args.length)
+            print("%d erase operation(s)" % flash.erases)
+        elif args.command == "program":
+            with open(args.file, "rb") as f:
+                flash.program(args.addr, f.read(), strict=not args.force)
+        elif args.command == "install":
+            with open(args.file, "rb") as f:
+                data = f.read()
+            if len(data) > SLOT_SIZE:
+                raise NorError("image is %d bytes, a slot holds %d" % (len(data), SLOT_SIZE))
+            base = SLOT_A_ADDRESS if args.slot == "a" else SLOT_B_ADDRESS
+            flash.erase_range(base, len(data))
+            flash.program(base, data)
+            print("Installed %d bytes at 0x%08X (%d erase operation(s))" % (len(data), base, flash.erases))
+        elif args.command == "extract":
+            base = SLOT_A_ADDRESS if args.slot == "a" else SLOT_B_ADDRESS
+            data = flash.read(base, SLOT_SIZE)
+            with open(args.out, "wb") as f:
+                f.write(data[:used_length(data)])
+        elif args.command == "export":
+            files = read_files(flash)
+            if files is None:
+                raise NorError("no host LittleFS table at 0x%08X" % FS_BASE)
+            os.makedirs(args.dir, exist_ok=True)
+            for name, data in files.items():
+                if data is None:
+                    os.makedirs(os.path.join(args.dir, name.lstrip("/")), exist_ok=True)
+                    continue
+                with open(os.path.join(args.dir, name.lstrip("/")), "wb") as f:
+                    f.write(data)
+            print("Exported %d file(s)" % len(files))
+        elif args.command == "import":
+            files = {}
+            for name in sorted(os.listdir(args.dir)):
+                path = os.path.join(args.dir, name)
+                if os.path.isdir(path):
+                    files["/" + name] = None
+                else:
+                    with open(path, "rb") as f:
+                        files["/" + name] = f.read()
+            write_files(flash, files)
+            print("Imported %d file(s) (%d erase operation(s))" % (len(files), flash.erases))
+        elif args.command == "diff":
+            other = NorFlash(args.other)
+            changed = diff(flash, other)
+            other.close()
+            flash.close()
+            return 1 if changed else 0
+        flash.close()
+    except NorError as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
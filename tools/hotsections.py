@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Picks hot functions for ITCM preloading and lists them for the image header.
+
+pick reads a profile (CSV of function,samples, e.g. from perf or the application's own PC
+sampler) and the application's symbol sizes, and fills an ITCM budget with the functions that
+have the most samples per byte. It writes a linker fragment that gives them a .hot output section
+running from ITCM and loaded from flash; include it in the application's linker script right
+after .text.itcm and build with -ffunction-sections. The Teensy startup code only copies
+.text.itcm, so the bootloader does the .hot copy (hot_preload.h).
+
+table reads the linked ELF and prints the FLASH:ITCM:LEN specs that s3bl_upload.py place --hot
+puts in the image header.
+
+    arm-none-eabi-nm -S app.elf > app.sym
+    python3 tools/hotsections.py pick profile.csv app.sym --budget 16384 > hot.ld
+    python3 tools/hotsections.py table app.elf
+    python3 tools/s3bl_upload.py place 192.168.1.222 app.bin 0x60120000 $(python3 tools/hotsections.py table app.elf --args)
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+HOT_SECTIONS_MAX = 8
+ITCM_BANK = 32 * 1024
+
+
+def read_profile(path):
+    samples = {}
+    with open(path, newline="") as f:
+        for row in csv.reader(f):
+            if len(row) < 2 or row[0].startswith("#"):
+                continue
+            try:
+                samples[row[0].strip()] = samples.get(row[0].strip(), 0) + int(row[1])
+            except ValueError:
+                continue  # Header line
+    return samples
+
+
+def read_symbols(path):
+    """nm -S output: address size type name. Only text symbols are kept."""
+    sizes = {}
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) == 4 and parts[2] in "tT":
+                sizes[parts[3]] = int(parts[1], 16)
+    return sizes
+
+
+def pick(samples, sizes, budget):
+    """Greedy by samples per byte, each function padded to 4 bytes."""
+    candidates = [(n / ((sizes[name] + 3) & ~3), name) for name, n in samples.items() if n > 0 and sizes.get(name)]
+    chosen, used = [], 0
+    for _, name in sorted(candidates, reverse=True):
+        size = (sizes[name] + 3) & ~3
+        if used + size <= budget:
+            chosen.append(name)
+            used += size
+    return chosen, used
+
+
+def linker_fragment(chosen, used, total):
+    lines = [
+        "/* tools/hotsections.py: %d functions, %d bytes, %.1f%% of profile samples." % (len(chosen), used, total),
+        " * Goes right after .text.itcm; add SIZEOF(.hot) to _itcm_block_count so the banks stay ITCM. */",
+        ".hot : {",
+        "    . = ALIGN(4);",
+        "    _shot = .;",
+    ]
+    lines += ["    KEEP(*(.text.%s))" % name for name in chosen]
+    lines += [
+        "    . = ALIGN(4);",
+        "    _ehot = .;",
+        "} > ITCM AT> FLASH",
+    ]
+    return "\n".join(lines) + "\n"
+
+
+def elf_hot_sections(path, prefix):
+    """(flash address, ITCM address, length) for every allocated section named prefix*."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        raise ValueError("%s is not a 32-bit little endian ELF file" % path)
+    e_phoff, e_shoff = struct.unpack_from("<II", data, 28)
+    e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx = struct.unpack_from("<5H", data, 42)
+    segments = [struct.unpack_from("<8I", data, e_phoff + i * e_phentsize) for i in range(e_phnum)]
+    sections = [struct.unpack_from("<10I", data, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+    strtab = sections[e_shstrndx][4]
+    out = []
+    for sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size in (s[:6] for s in sections):
+        name = data[strtab + sh_name:data.index(b"\0", strtab + sh_name)].decode()
+        if not name.startswith(prefix) or not sh_size or not sh_flags & 2 or sh_type == 8:
+            continue
+        for _, p_offset, p_vaddr, p_paddr, p_filesz, _, _, _ in segments:
+            if p_offset <= sh_offset and sh_offset + sh_size <= p_offset + p_filesz:
+                out.append((p_paddr + sh_offset - p_offset, sh_addr, (sh_size + 3) & ~3))
+                break
+        else:
+            raise ValueError("%s is in no loadable segment" % name)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description="S3BL hot section helper")
+    sub = parser.add_subparsers(dest="command", required=True)
+    pk = sub.add_parser("pick", help="choose functions for an ITCM budget and print a linker fragment")
+    pk.add_argument("profile", help="CSV of function,samples")
+    pk.add_argument("symbols", help="nm -S output of the application")
+    pk.add_argument("--budget", type=int, default=ITCM_BANK, help="ITCM bytes for hot code")
+    tb = sub.add_parser("table", help="print FLASH:ITCM:LEN specs for the image header")
+    tb.add_argument("elf")
+    tb.add_argument("--prefix", default=".hot", help="section names to list")
+    tb.add_argument("--args", action="store_true", help="print as --hot options for s3bl_upload.py")
+    args = parser.parse_args()
+
+    if args.command == "pick":
+        samples = read_profile(args.profile)
+        chosen, used = pick(samples, read_symbols(args.symbols), args.budget)
+        total = sum(samples.values())
+        share = 100.0 * sum(samples[name] for name in chosen) / total if total else 0.0
+        sys.stdout.write(linker_fragment(chosen, used, share))
+        print("%d functions, %d of %d bytes, %.1f%% of samples" % (len(chosen), used, args.budget, share),
+              file=sys.stderr)
+        return 0
+    if args.command == "table":
+        try:
+            specs = elf_hot_sections(args.elf, args.prefix)
+        except (OSError, ValueError, struct.error) as e:
+            print("error: %s" % e, file=sys.stderr)
+            return 1
+        if len(specs) > HOT_SECTIONS_MAX:
+            print("error: %d hot sections, the header takes %d" % (len(specs), HOT_SECTIONS_MAX), file=sys.stderr)
+            return 1
+        for flash, itcm, length in specs:
+            spec = "0x%08x:0x%08x:%d" % (flash, itcm, length)
+            print("--hot " + spec if args.args else spec)
+        return 0
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
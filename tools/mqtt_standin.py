@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+"""Local MQTT broker stand-in for testing S3BL update notifications.
+
+Implements just enough of MQTT 3.1.1 for the bootloader client: CONNECT, SUBSCRIBE
+(QoS 0/1, '+' and '#' wildcards), PUBLISH with retained messages, PUBACK and PINGREQ.
+With --serve it also serves the image over HTTP and publishes a retained announcement
+(sha256=... url=... chunks=...) for the device, so a pull update can be tested end to end.
+chunks= is the SHA-256 over the per-32KB chunk hashes, which devices check peer hash lists against.
+
+    python3 tools/mqtt_standin.py --serve firmware.bin --device 04e9e5000001 --host-ip 192.168.1.10
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import socket
+import struct
+import sys
+import threading
+
+PEER_CHUNK_SIZE = 32 * 1024
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 8, 9, 12, 13, 14
+
+
+def encode_length(n):
+    out = bytearray()
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        out.append(b | 0x80 if n else b)
+        if not n:
+            return bytes(out)
+
+
+def packet(ptype, flags, body):
+    return bytes([(ptype << 4) | flags]) + encode_length(len(body)) + body
+
+
+def mqtt_string(s):
+    data = s.encode()
+    return struct.pack(">H", len(data)) + data
+
+
+def topic_matches(pattern, topic):
+    p, t = pattern.split("/"), topic.split("/")
+    for i, part in enumerate(p):
+        if part == "#":
+            return True
+        if i >= len(t) or (part != "+" and part != t[i]):
+            return False
+    return len(p) == len(t)
+
+
+class Broker:
+    def __init__(self, verbose=True):
+        self.lock = threading.Lock()
+        self.subscriptions = []     # (connection, pattern, qos)
+        self.retained = {}
+        self.verbose = verbose
+        self.stats = {"packets_in": 0, "pingreq": 0}
+
+    def log(self, *args):
+        if self.verbose:
+            print("[broker]", *args, flush=True)
+
+    def publish(self, topic, payload, retain=False):
+        with self.lock:
+            if retain:
+                self.retained[topic] = payload
+            targets = [(c, q) for c, pat, q in self.subscriptions if topic_matches(pat, topic)]
+        for conn, qos in targets:
+            conn.deliver(topic, payload, qos, False)
+
+    def serve(self, port):
+        srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        srv.bind(("", port))
+        srv.listen(16)
+        self.log("listening on port", port)
+        while True:
+            sock, addr = srv.accept()
+            threading.Thread(target=Connection(self, sock, addr).run, daemon=True).start()
+
+
+class Connection:
+    def __init__(self, broker, sock, addr):
+        self.broker, self.sock, self.addr = broker, sock, addr
+        self.send_lock = threading.Lock()
+        self.next_id = 1
+
+    def recv_exact(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionError
+            data += chunk
+        return data
+
+    def read_packet(self):
+        first = self.recv_exact(1)[0]
+        length, shift = 0, 0
+        while True:
+            b = self.recv_exact(1)[0]
+            length |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        return first >> 4, first & 0x0F, self.recv_exact(length)
+
+    def send(self, data):
+        with self.send_lock:
+            self.sock.sendall(data)
+
+    def deliver(self, topic, payload, qos, retain):
+        body = mqtt_string(topic)
+        if qos:
+            body += struct.pack(">H", self.next_id)
+            self.next_id = self.next_id % 0xFFFF + 1
+        self.send(packet(PUBLISH, (qos << 1) | (1 if retain else 0), body + payload))
+
+    def run(self):
+        b = self.broker
+        try:
+            while True:
+                ptype, flags, body = self.read_packet()
+                b.stats["packets_in"] += 1
+                if ptype == CONNECT:
+                    name_len = struct.unpack(">H", body[:2])[0]
+                    keepalive = struct.unpack(">H", body[4 + name_len:6 + name_len])[0]
+                    client_id = body[8 + name_len:].decode(errors="replace")
+                    b.log("CONNECT from %s id=%s keepalive=%ds" % (self.addr[0], client_id, keepalive))
+                    self.send(packet(CONNACK, 0, b"\x00\x00"))
+                elif ptype == SUBSCRIBE:
+                    pid, p, granted = body[:2], 2, b""
+                    while p < len(body):
+                        tlen = struct.unpack(">H", body[p:p + 2])[0]
+                        pattern = body[p + 2:p + 2 + tlen].decode()
+                        qos = min(body[p + 2 + tlen], 1)
+                        p += 3 + tlen
+                        with b.lock:
+                            b.subscriptions.append((self, pattern, qos))
+                            retained = [(t, m) for t, m in b.retained.items() if topic_matches(pattern, t)]
+                        granted += bytes([qos])
+                        b.log("SUBSCRIBE %s qos=%d" % (pattern, qos))
+                    self.send(packet(SUBACK, 0, pid + granted))
+                    for topic, payload in retained:
+                        self.deliver(topic, payload, qos, True)
+                elif ptype == PUBLISH:
+                    tlen = struct.unpack(">H", body[:2])[0]
+                    topic = body[2:2 + tlen].decode()
+                    qos = (flags >> 1) & 3
+                    p = 2 + tlen
+                    if qos:
+                        self.send(packet(PUBACK, 0, body[p:p + 2]))
+                        p += 2
+                    b.publish(topic, body[p:], bool(flags & 1))
+                elif ptype == PINGREQ:
+                    b.stats["pingreq"] += 1
+                    b.log("PINGREQ from %s (%d so far)" % (self.addr[0], b.stats["pingreq"]))
+                    self.send(packet(PINGRESP, 0, b""))
+                elif ptype == DISCONNECT:
+                    break
+        except (ConnectionError, OSError):
+            pass
+        finally:
+            with b.lock:
+                b.subscriptions = [s for s in b.subscriptions if s[0] is not self]
+            self.sock.close()
+            b.log("connection from %s closed" % self.addr[0])
+
+
+def serve_image(path, port):
+    directory, name = os.path.split(os.path.abspath(path))
+
+    class Handler(http.server.SimpleHTTPRequestHandler):
+        def __init__(self, *args, **kwargs):
+            super().__init__(*args, directory=directory, **kwargs)
+
+        def log_message(self, fmt, *args):
+            print("[http]", fmt % args, flush=True)
+
+    httpd = http.server.ThreadingHTTPServer(("", port), Handler)
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+    return name
+
+
+def chunks_root(image):
+    """SHA-256 over the SHA-256 of every PEER_CHUNK_SIZE chunk, the list GET /peer/hashes serves."""
+    hashes = b"".join(hashlib.sha256(image[i:i + PEER_CHUNK_SIZE]).digest()
+                      for i in range(0, len(image), PEER_CHUNK_SIZE))
+    return hashlib.sha256(hashes).hexdigest()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="MQTT broker stand-in for S3BL")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--serve", metavar="IMAGE", help="serve IMAGE over HTTP and announce it")
+    parser.add_argument("--http-port", type=int, default=8080)
+    parser.add_argument("--device", help="device MAC as 12 hex digits, announcement goes to s3bl/<mac>/update")
+    parser.add_argument("--host-ip", help="address the device uses to reach this host")
+    args = parser.parse_args()
+
+    broker = Broker()
+    if args.serve:
+        if not (args.device and args.host_ip):
+            parser.error("--serve needs --device and --host-ip")
+        name = serve_image(args.serve, args.http_port)
+        with open(args.serve, "rb") as f:
+            image = f.read()
+        topic = "s3bl/%s/update" % args.device.lower().replace(":", "")
+        payload = "sha256=%s url=http://%s:%d/%s chunks=%s" % (hashlib.sha256(image).hexdigest(), args.host_ip,
+                                                              args.http_port, name, chunks_root(image))
+        broker.publish(topic, payload.encode(), retain=True)
+        print("[broker] retained announcement on %s: %s" % (topic, payload), flush=True)
+    try:
+        broker.serve(args.port)
+    except KeyboardInterrupt:
+        return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,453 @@
+#!/usr/bin/env python3
+"""Update transfer timings for S3BL on a virtual clock.
+
+run and compare boot the bootloader itself: the host build of src/ (test/host, built by
+test/hostsim.py) on a virtual clock, where millis(), delay() and socket waits only move that
+clock and every flash erase, program and W5x00 SPI transfer advances it by the costs below. A
+scripted client sends the update to the real recovery loop, so the numbers are those of the code
+in src/; a run ends when the firmware starts the installed image, and the slot it wrote is
+compared with the image. Nothing sleeps and the same parameters give the same numbers every run.
+
+  post       POST /upload: byte-at-a-time reads into RAM, then erase + program
+  range      PUT /image range sessions: per-socket sector buffers, erase + program per sector
+  provision  POST /provision: whole region block erased up front, then program only
+
+TCP: the W5x00 receive buffer is the window; the client only has that many bytes outstanding per
+socket, space freed by a read reaches it half an RTT later, and all sockets share one link.
+
+model is the earlier analytical model, a separate Python reimplementation of the recovery loop
+and not the firmware. It also covers CoAP Block1, which the scripted network can't drive, since
+stop-and-wait needs the device's replies; use it for quick what-ifs and check them with run.
+
+    python3 tools/otasim.py compare --size 896K
+    python3 tools/otasim.py run range --size 512K --connections 4 --rtt 20 --image sim.bin
+    python3 tools/otasim.py model compare --size 896K
+"""
+
+import argparse
+import heapq
+import os
+import random
+import sys
+import tempfile
+import time
+import zlib
+
+SECTOR_SIZE = 4096
+BLOCK_SIZE = 64 * 1024
+SLOT_A_ADDRESS = 0x60032000
+SLOT_B_ADDRESS = 0x60112000
+SLOT_SIZE = SLOT_B_ADDRESS - SLOT_A_ADDRESS
+
+# Costs for both the host build and the model. Erase times are W25Q16JV typicals; the rest are
+# estimates to adjust with measurements from real boards (see the provisioning timing report).
+DEFAULTS = {
+    "sector_erase_ms": 45.0,
+    "block_erase_ms": 150.0,
+    "program_word_us": 12.0,     # flash_program writes one 32-bit word per write-enable cycle
+    "spi_rate": 1_500_000,       # Bytes/s for bulk W5x00 buffer reads
+    "spi_byte_us": 6.0,          # One SPI transaction per client.read() of a single byte
+    "link_rate": 12_500_000,     # Bytes/s, 100 Mbit Ethernet
+    "rtt_ms": 1.0,
+    "window": 2048,              # W5x00 RX buffer per socket with all sockets enabled
+    "coap_block": 1024,
+}
+
+
+class Sim:
+    """Event queue on a virtual clock. Processes are generators that yield delays or Signals."""
+
+    def __init__(self, seed=0):
+        self.now = 0.0
+        self.rng = random.Random(seed)
+        self._queue = []
+        self._count = 0
+
+    def schedule(self, delay, fn, *args):
+        heapq.heappush(self._queue, (self.now + delay, self._count, fn, args))
+        self._count += 1
+
+    def spawn(self, gen):
+        self._step(gen, None)
+
+    def _step(self, gen, value):
+        try:
+            item = gen.send(value)
+        except StopIteration:
+            return
+        if isinstance(item, Signal):
+            item.wait(lambda: self._step(gen, None))
+        else:
+            self.schedule(item, self._step, gen, None)
+
+    def run(self):
+        while self._queue:
+            self.now, _, fn, args = heapq.heappop(self._queue)
+            fn(*args)
+        return self.now
+
+
+class Signal:
+    """Wakes every waiting process once fired, like the W5x00 INTn line."""
+
+    def __init__(self, sim):
+        self.sim = sim
+        self.waiters = []
+
+    def wait(self, resume):
+        self.waiters.append(resume)
+
+    def fire(self):
+        waiters, self.waiters = self.waiters, []
+        for resume in waiters:
+            self.sim.schedule(0, resume)
+
+
+class Link:
+    """Shared Ethernet link, frames are serialised one after the other."""
+
+    def __init__(self, sim, rate):
+        self.sim = sim
+        self.rate = rate
+        self.busy_until = 0.0
+
+    def transmit(self, n):
+        start = max(self.sim.now, self.busy_until)
+        self.busy_until = start + n / self.rate
+        return self.busy_until - self.sim.now
+
+
+class TcpStream:
+    """Host to device byte stream into one W5x00 socket."""
+
+    def __init__(self, sim, link, length, p, arrived):
+        self.sim, self.link, self.p = sim, link, p
+        self.unsent = length
+        self.window = p["window"]    # Free buffer space as the host last heard it
+        self.buffered = 0            # Bytes sitting in the socket RX buffer
+        self.arrived = arrived
+
+    def one_way(self):
+        rtt = self.p["rtt_ms"] / 1000
+        jitter = self.p.get("jitter", 0.0)
+        return rtt / 2 * (1 + self.sim.rng.uniform(-jitter, jitter))
+
+    def start(self):
+        self._send()
+
+    def _send(self):
+        n = min(self.window, self.unsent)
+        if n <= 0:
+            return
+        self.window -= n
+        self.unsent -= n
+        self.sim.schedule(self.link.transmit(n) + self.one_way(), self._arrive, n)
+
+    def _arrive(self, n):
+        self.buffered += n
+        self.arrived.fire()
+
+    def read(self, n):
+        self.buffered -= n
+        self.sim.schedule(self.one_way(), self._window_update, n)
+
+    def _window_update(self, n):
+        self.window += n
+        self._send()
+
+
+class Device:
+    """MCU side costs and bookkeeping, optionally mirrored into a NOR flash image."""
+
+    def __init__(self, sim, p, flash=None, base=SLOT_B_ADDRESS):
+        self.sim, self.p, self.flash, self.base = sim, p, flash, base
+        self.stats = {"erase": 0.0, "program": 0.0, "spi": 0.0, "sector_erases": 0, "block_erases": 0}
+        self.arrived = Signal(sim)
+
+    def spi(self, n, single_bytes=False):
+        t = n * self.p["spi_byte_us"] / 1e6 if single_bytes else n / self.p["spi_rate"]
+        self.stats["spi"] += t
+        return t
+
+    def erase_sector(self, offset):
+        self.stats["sector_erases"] += 1
+        self.stats["erase"] += self.p["sector_erase_ms"] / 1000
+        if self.flash:
+            self.flash.erase(self.base + offset, SECTOR_SIZE)
+        return self.p["sector_erase_ms"] / 1000
+
+    def erase_range(self, length):
+        """Mirrors flash_erase_range; returns the total time."""
+        t = 0.0
+        offset = 0
+        end = (length + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)
+        while offset < end:
+            if (self.base + offset) % BLOCK_SIZE == 0 and end - offset >= BLOCK_SIZE:
+                self.stats["block_erases"] += 1
+                self.stats["erase"] += self.p["block_erase_ms"] / 1000
+                t += self.p["block_erase_ms"] / 1000
+                if self.flash:
+                    self.flash.erase(self.base + offset, BLOCK_SIZE)
+                offset += BLOCK_SIZE
+            else:
+                t += self.erase_sector(offset)
+                offset += SECTOR_SIZE
+        return t
+
+    def program(self, offset, data):
+        t = (len(data) + 3) // 4 * self.p["program_word_us"] / 1e6
+        self.stats["program"] += t
+        if self.flash:
+            self.flash.program(self.base + offset, data)
+        return t
+
+
+def tcp_paths(sim, dev, image, connections, path):
+    """post, range and provision: TCP streams drained by the single threaded recovery loop."""
+    link = Link(sim, dev.p["link_rate"])
+    sectors = (len(image) + SECTOR_SIZE - 1) // SECTOR_SIZE
+    per = -(-sectors // connections) * SECTOR_SIZE
+    sessions = []
+    for first in range(0, len(image), per):
+        last = min(len(image), first + per)
+        s = {"stream": TcpStream(sim, link, last - first, dev.p, dev.arrived), "offset": first, "end": last,
+             "buf": bytearray()}
+        sessions.append(s)
+
+    def loop():
+        if path == "provision":
+            yield dev.erase_range(len(image))
+        for s in sessions:
+            s["stream"].start()
+        if path == "post":
+            # The whole body is collected with single byte reads, then written in one go
+            s = sessions[0]
+            while s["offset"] < s["end"]:
+                n = s["stream"].buffered
+                if n == 0:
+                    yield dev.arrived
+                    continue
+                yield dev.spi(n, single_bytes=True)
+                s["stream"].read(n)
+                s["offset"] += n
+            for offset in range(0, len(image), SECTOR_SIZE):
+                yield dev.erase_sector(offset)
+                yield dev.program(offset, image[offset:offset + SECTOR_SIZE])
+            return
+        turn = 0
+        while any(s["offset"] < s["end"] for s in sessions):
+            ready = [s for s in sessions if s["stream"].buffered > 0]
+            if not ready:
+                yield dev.arrived
+                continue
+            s = ready[turn % len(ready)]
+            turn += 1
+            want = min(s["stream"].buffered, SECTOR_SIZE - len(s["buf"]), s["end"] - s["offset"])
+            yield dev.spi(want)
+            s["stream"].read(want)
+            s["buf"] += image[s["offset"]:s["offset"] + want]
+            s["offset"] += want
+            if len(s["buf"]) == SECTOR_SIZE or s["offset"] == s["end"]:
+                start = s["offset"] - len(s["buf"])
+                if path != "provision":
+                    yield dev.erase_sector(start)
+                yield dev.program(start, bytes(s["buf"]))
+                s["buf"] = bytearray()
+
+    sim.spawn(loop())
+
+
+def coap_path(sim, dev, image):
+    link = Link(sim, dev.p["link_rate"])
+    block = dev.p["coap_block"]
+
+    def one_way():
+        jitter = dev.p.get("jitter", 0.0)
+        return dev.p["rtt_ms"] / 2000 * (1 + sim.rng.uniform(-jitter, jitter))
+
+    def loop():
+        buf = bytearray()
+        for offset in range(0, len(image), block):
+            chunk = image[offset:offset + block]
+            yield link.transmit(len(chunk) + 32) + one_way()     # Request with CoAP/UDP headers
+            yield dev.spi(len(chunk))
+            buf += chunk
+            if len(buf) == SECTOR_SIZE or offset + len(chunk) == len(image):
+                start = offset + len(chunk) - len(buf)
+                yield dev.erase_sector(start)
+                yield dev.program(start, bytes(buf))
+                buf = bytearray()
+            yield one_way()                                        # ACK back to the client
+
+    sim.spawn(loop())
+
+
+def parse_size(text):
+    text = text.upper()
+    if text.endswith("K"):
+        return int(text[:-1]) * 1024
+    if text.endswith("M"):
+        return int(float(text[:-1]) * 1024 * 1024)
+    return int(text)
+
+
+def report(path, size, total, stats, connections):
+    busy = stats["erase"] + stats["program"] + stats["spi"]
+    print("%-10s %5s %7d  %9.3f s  %7.1f KB/s  erase %7.3f s  program %6.3f s  spi %6.3f s  waiting %6.3f s  %4d/%-3d erases" %
+          (path, "x%d" % connections if path == "range" else "", size, total, size / total / 1024, stats["erase"],
+           stats["program"], stats["spi"], max(0.0, total - busy), stats["sector_erases"], stats["block_erases"]))
+
+
+# ---- The firmware on the host build ----
+
+def hostsim():
+    sys.path.insert(0, os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "test"))
+    import hostsim
+    return hostsim
+
+
+def host_args(params):
+    spi_byte_ns = round(1e9 / params["spi_rate"])
+    return ["--sector-erase-us", str(round(params["sector_erase_ms"] * 1000)),
+            "--block-erase-us", str(round(params["block_erase_ms"] * 1000)),
+            "--program-word-ns", str(round(params["program_word_us"] * 1000)),
+            # A single byte read is a register poll plus one byte
+            "--spi-poll-ns", str(max(0, round(params["spi_byte_us"] * 1000) - spi_byte_ns)),
+            "--spi-byte-ns", str(spi_byte_ns),
+            "--link-rate", str(params["link_rate"]),
+            "--rtt-us", str(round(params["rtt_ms"] * 1000))]
+
+
+def update_script(path, image, connections):
+    """The client side of one update, as script entries for hostsim.write_script."""
+    if path == "post":
+        boundary = b"----otasim"
+        body = (b"--" + boundary + b"\r\nContent-Disposition: form-data; name=\"firmware\"; filename=\"app.bin\"\r\n"
+                b"Content-Type: application/octet-stream\r\n\r\n" + image + b"\r\n--" + boundary + b"--\r\n")
+        head = (b"POST /upload HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=" + boundary +
+                b"\r\nContent-Length: %d\r\n\r\n" % len(body))
+        return [("open", 0, 1, 80), ("send", 0, 1, head + body)]
+    if path == "provision":
+        from s3bl_provision import build_bundle, SLOT_B
+        bundle = build_bundle([(SLOT_B, image)])
+        head = b"POST /provision HTTP/1.1\r\nContent-Type: application/octet-stream\r\nContent-Length: %d\r\n\r\n" % len(bundle)
+        return [("open", 0, 1, 80), ("send", 0, 1, head + bundle)]
+    from s3bl_upload import split_ranges
+    crc = zlib.crc32(image)
+    entries = []
+    for conn, (first, last) in enumerate(split_ranges(len(image), connections), 1):
+        head = (b"PUT /image HTTP/1.1\r\nContent-Range: bytes %d-%d/%d\r\nContent-Length: %d\r\n"
+                b"X-Image-CRC32: %08X\r\n\r\n" % (first, last, len(image), last - first + 1, crc))
+        entries += [("open", 0, conn, 80), ("send", 0, conn, head + image[first:last + 1])]
+    return entries
+
+
+def simulate(path, size, params, connections=1, seed=0, flash=None):
+    """Runs the update against the firmware. Returns the seconds from the first connection to the
+    jump into the new image, and where they went."""
+    sim = hostsim()
+    # A vector table that passes the bootloader's checks, so the firmware starts the image at the end
+    image = sim.make_image(SLOT_B_ADDRESS, 8) + random.Random(seed).randbytes(size - 8)
+    with tempfile.TemporaryDirectory() as tmp:
+        dev = flash or os.path.join(tmp, "dev.bin")
+        code, out, transcript = sim.run_script(dev, update_script(path, image, connections), *host_args(params))
+        jump = [t for t, verb, _, _ in transcript if verb == "jump"]
+        accepted = [t for t, verb, _, _ in transcript if verb == "accept"]
+        if code != sim.EXIT_JUMP or not jump:
+            replies = b" | ".join(r.split(b"\r\n")[0] for r in sim.responses(transcript).values())
+            raise RuntimeError("%s: the firmware did not start the image (exit %d): %s" % (path, code, replies.decode()))
+        from flashimg import NorFlash, SLOT_B_ADDRESS as SLOT_B
+        written = NorFlash(dev)
+        try:
+            if written.read(SLOT_B, size) != image:
+                raise RuntimeError("%s: slot B does not hold the transferred image" % path)
+        finally:
+            written.close()
+        st = sim.stats(transcript)
+    stats = {"erase": st["erase_us"] / 1e6, "program": st["program_us"] / 1e6, "spi": st["spi_us"] / 1e6,
+             "sector_erases": st["sector_erases"], "block_erases": st["block_erases"]}
+    return (jump[0] - accepted[0]) / 1e6, stats
+
+
+# ---- The analytical model ----
+
+def model_simulate(path, size, params, connections=1, seed=0, flash=None):
+    sim = Sim(seed)
+    rng = random.Random(seed)
+    image = rng.randbytes(size)
+    dev = Device(sim, params, flash)
+    if path == "coap":
+        coap_path(sim, dev, image)
+    else:
+        tcp_paths(sim, dev, image, connections if path == "range" else 1, path)
+    total = sim.run()
+    if flash and flash.read(SLOT_B_ADDRESS, size) != image:
+        raise RuntimeError("flash image does not hold the transferred data")
+    return total, dev.stats
+
+
+def add_parameters(p):
+    p.add_argument("--size", type=parse_size, default=SLOT_SIZE, help="image size, e.g. 300K")
+    p.add_argument("--connections", type=int, default=4, help="range sessions")
+    p.add_argument("--seed", type=int, default=0)
+    for key, value in DEFAULTS.items():
+        p.add_argument("--" + key.replace("_", "-").replace("-ms", "").replace("-us", ""), dest=key,
+                       type=type(value), default=value, help="default %s" % value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Virtual time simulation of S3BL update paths")
+    sub = parser.add_subparsers(dest="command", required=True)
+    run = sub.add_parser("run", help="run one update path against the host build of the firmware")
+    run.add_argument("path", choices=("post", "range", "provision"))
+    run.add_argument("--image", help="flash image file for the device, kept afterwards (flashimg.py format)")
+    cmp = sub.add_parser("compare", help="run every path against the firmware with the same parameters")
+    model = sub.add_parser("model", help="the analytical model, not the firmware")
+    msub = model.add_subparsers(dest="model_command", required=True)
+    mrun = msub.add_parser("run", help="model one update path")
+    mrun.add_argument("path", choices=("post", "range", "provision", "coap"))
+    mrun.add_argument("--image", help="apply the writes to this flashimg.py image (slot B)")
+    mcmp = msub.add_parser("compare", help="model every path with the same parameters")
+    for p in (run, cmp, mrun, mcmp):
+        add_parameters(p)
+    for p in (mrun, mcmp):
+        p.add_argument("--jitter", type=float, default=0.0, help="+/- fraction of RTT, drawn from --seed")
+    args = parser.parse_args()
+    params = {key: getattr(args, key) for key in DEFAULTS}
+    params["jitter"] = getattr(args, "jitter", 0.0)
+    if not 0 < args.size <= SLOT_SIZE:
+        parser.error("size must fit in a slot")
+
+    wall = time.perf_counter()
+    if args.command == "run":
+        if args.image and os.path.exists(args.image):
+            parser.error("%s exists; the run needs a fresh device" % args.image)
+        total, stats = simulate(args.path, args.size, params, args.connections, args.seed, args.image)
+        report(args.path, args.size, total, stats, args.connections)
+    elif args.command == "compare":
+        for path in ("post", "range", "provision"):
+            try:
+                total, stats = simulate(path, args.size, params, args.connections, args.seed)
+            except RuntimeError as e:
+                print("%-10s failed, %s" % (path, e))
+                continue
+            report(path, args.size, total, stats, args.connections)
+    elif args.model_command == "run":
+        flash = None
+        if args.image:
+            from flashimg import NorFlash
+            flash = NorFlash(args.image, create=True)
+        total, stats = model_simulate(args.path, args.size, params, args.connections, args.seed, flash)
+        report(args.path, args.size, total, stats, args.connections)
+        if flash:
+            flash.close()
+    else:
+        for path in ("post", "range", "provision", "coap"):
+            total, stats = model_simulate(path, args.size, params, args.connections, args.seed)
+            report(path, args.size, total, stats, args.connections)
+    print("(%.3f s wall time)" % (time.perf_counter() - wall))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
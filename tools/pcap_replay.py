@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+"""Replays captured HTTP uploads against an S3BL recovery server.
+
+Reads a pcap (tcpdump -w, Ethernet or Linux cooked capture, IPv4), reassembles every client to
+server TCP flow on --capture-port and sends the client side again. The status of each replayed
+response is compared with the one in the capture, so parser regressions stand out.
+
+Against a device, each captured segment is one send() with TCP_NODELAY, so the original
+segmentation survives as far as the host stack allows. Segments are paced by their captured
+timestamps unless --fast is given.
+
+With --host-build the flows go to the bootloader's host build (test/host) instead, through its
+simulated W5x00 socket layer on a virtual clock. Each captured segment arrives in the socket
+buffer as exactly that segment. The flows run one after the other. Times are virtual, and the
+same capture always gives the same numbers. The wall time of the whole replay is printed at the
+end. A flow that makes the firmware start an image ends the replay, as it would on the board.
+
+    tcpdump -i eth0 -w field.pcap 'tcp port 80 and host 192.168.1.222'
+    python3 tools/pcap_replay.py field.pcap 192.168.1.222
+    python3 tools/pcap_replay.py field.pcap 192.168.1.222 --fast --flow 3
+    python3 tools/pcap_replay.py field.pcap --host-build --rtt-us 500
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import tempfile
+import time
+
+LINKTYPE_ETHERNET = 1
+LINKTYPE_LINUX_SLL = 113
+LINKTYPE_RAW = 101
+
+
+class Flow:
+    def __init__(self, client):
+        self.client = client
+        self.segments = []      # (timestamp, seq, payload) from the client
+        self.response = b""
+        self.response_seq = {}
+
+    def ordered(self):
+        """Client segments in sequence order, retransmissions dropped."""
+        seen = set()
+        out = []
+        for ts, seq, data in sorted(self.segments, key=lambda s: (s[1], s[0])):
+            if seq in seen:
+                continue
+            seen.add(seq)
+            out.append((ts, data))
+        return out
+
+    def request_line(self):
+        data = b"".join(d for _, d in self.ordered()[:4])
+        return data.split(b"\r\n", 1)[0].decode(errors="replace")
+
+    def captured_status(self):
+        body = b"".join(self.response_seq[s] for s in sorted(self.response_seq))
+        return parse_status(body)
+
+
+def parse_status(data):
+    if not data.startswith(b"HTTP/"):
+        return None
+    try:
+        return int(data.split(b" ", 2)[1])
+    except (IndexError, ValueError):
+        return None
+
+
+def read_pcap(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic = data[:4]
+    if magic in (b"\xd4\xc3\xb2\xa1", b"\x4d\x3c\xb2\xa1"):
+        endian = "<"
+    elif magic in (b"\xa1\xb2\xc3\xd4", b"\xa1\xb2\x3c\x4d"):
+        endian = ">"
+    else:
+        raise SystemExit("%s: not a classic pcap file (pcapng: convert with editcap -F pcap)" % path)
+    nano = magic in (b"\x4d\x3c\xb2\xa1", b"\xa1\xb2\x3c\x4d")
+    linktype = struct.unpack(endian + "I", data[20:24])[0]
+    pos = 24
+    while pos + 16 <= len(data):
+        sec, frac, caplen, _ = struct.unpack(endian + "IIII", data[pos:pos + 16])
+        pos += 16
+        yield sec + frac / (1e9 if nano else 1e6), linktype, data[pos:pos + caplen]
+        pos += caplen
+
+
+def ip_payload(linktype, frame):
+    if linktype == LINKTYPE_ETHERNET:
+        ethertype, offset = struct.unpack(">H", frame[12:14])[0], 14
+        if ethertype == 0x8100:
+            ethertype, offset = struct.unpack(">H", frame[16:18])[0], 18
+    elif linktype == LINKTYPE_LINUX_SLL:
+        ethertype, offset = struct.unpack(">H", frame[14:16])[0], 16
+    elif linktype == LINKTYPE_RAW:
+        ethertype, offset = 0x0800, 0
+    else:
+        raise SystemExit("unsupported link type %d" % linktype)
+    return frame[offset:] if ethertype == 0x0800 else None
+
+
+def load_flows(path, port):
+    flows = {}
+    for ts, linktype, frame in read_pcap(path):
+        ip = ip_payload(linktype, frame)
+        if not ip or ip[9] != 6:
+            continue
+        ihl = (ip[0] & 0x0F) * 4
+        total = struct.unpack(">H", ip[2:4])[0]
+        tcp = ip[ihl:total]
+        src, dst = socket.inet_ntoa(ip[12:16]), socket.inet_ntoa(ip[16:20])
+        sport, dport, seq = struct.unpack(">HHI", tcp[:8])
+        payload = tcp[(tcp[12] >> 4) * 4:]
+        if dport == port:
+            key = (src, sport, dst)
+            flow = flows.setdefault(key, Flow("%s:%d" % (src, sport)))
+            flow.syn_time = getattr(flow, "syn_time", ts)
+            if payload:
+                flow.segments.append((ts, seq, payload))
+        elif sport == port and payload:
+            flow = flows.get((dst, dport, src))
+            if flow:
+                flow.response_seq.setdefault(seq, payload)
+    return [f for f in flows.values() if f.segments]
+
+
+def replay(flow, host, port, fast, timeout):
+    """Returns (status, bytes sent, send seconds, latency seconds, response head)."""
+    sock = socket.create_connection((host, port), timeout=timeout)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    segments = flow.ordered()
+    start = time.monotonic()
+    first_ts = segments[0][0]
+    sent = 0
+    response = b""
+    for ts, data in segments:
+        if not fast:
+            delay = (ts - first_ts) - (time.monotonic() - start)
+            if delay > 0:
+                time.sleep(delay)
+        try:
+            sock.sendall(data)
+        except OSError:
+            break                # The server may answer and close before the body is done
+        sent += len(data)
+    sent_at = time.monotonic()
+    sock.settimeout(timeout)
+    latency = None
+    try:
+        while True:
+            chunk = sock.recv(4096)
+            if not chunk:
+                break
+            if latency is None:
+                latency = time.monotonic() - sent_at
+            response += chunk
+    except socket.timeout:
+        pass
+    sock.close()
+    return parse_status(response), sent, sent_at - start, latency, response.split(b"\r\n", 1)[0]
+
+
+def host_replay(flows, fast, pause, flash=None, host_args=()):
+    """Replays flows into the host build. Returns [(flow, status, bytes, send s, latency s, head)]
+    for the flows that ran, the exit event and the wall time."""
+    sys.path.insert(0, os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "test"))
+    import hostsim
+    entries = []
+    for n, flow in enumerate(flows, 1):
+        segments = flow.ordered()
+        # The first flow waits for the recovery server to listen, the others for the previous close
+        entries.append(("open", 0, n, 80) if n == 1 else ("open", int(pause * 1e6), n, 80, n - 1))
+        for ts, data in segments:
+            entries.append(("send", 0 if fast else int((ts - segments[0][0]) * 1e6), n, data))
+    wall = time.monotonic()
+    with tempfile.TemporaryDirectory() as tmp:
+        code, _, transcript = hostsim.run_script(flash or os.path.join(tmp, "dev.bin"), entries, *host_args)
+    wall = time.monotonic() - wall
+    events = {}
+    for t, verb, conn, payload in transcript:
+        if conn is not None:
+            e = events.setdefault(conn, {"response": b""})
+            if verb == "recv":
+                e.setdefault("first_recv", t)
+                e["response"] += payload
+            else:
+                e.setdefault(verb, t)
+    results = []
+    for n, flow in enumerate(flows, 1):
+        e = events.get(n)
+        if not e or "accept" not in e:
+            break
+        sent = sum(len(d) for _, d in flow.ordered()) if "delivered" in e else None
+        done = e.get("delivered", e.get("close", e["accept"]))
+        latency = (e["first_recv"] - done) / 1e6 if "first_recv" in e and e["first_recv"] >= done else None
+        results.append((flow, parse_status(e["response"]), sent, (done - e["accept"]) / 1e6, latency,
+                        e["response"].split(b"\r\n", 1)[0]))
+    last = transcript[-1][1] if transcript else "no transcript"
+    return results, {hostsim.EXIT_JUMP: "jump", hostsim.EXIT_RESET: "reset"}.get(code, last), wall
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay captured HTTP uploads against an S3BL recovery server")
+    parser.add_argument("pcap")
+    parser.add_argument("host", nargs="?", help="device to replay to, not needed with --host-build")
+    parser.add_argument("--port", type=int, default=80, help="port to replay to")
+    parser.add_argument("--capture-port", type=int, default=80, help="server port in the capture")
+    parser.add_argument("--fast", action="store_true", help="send segments back to back instead of on the captured timing")
+    parser.add_argument("--flow", type=int, action="append", help="replay only these flow numbers (see --list)")
+    parser.add_argument("--list", action="store_true", help="list the flows in the capture and exit")
+    parser.add_argument("--timeout", type=float, default=30)
+    parser.add_argument("--pause", type=float, default=0.5, help="seconds between flows")
+    host = parser.add_argument_group("host build")
+    host.add_argument("--host-build", action="store_true", help="replay into the simulated socket layer of the host build")
+    host.add_argument("--flash", help="flash image for the simulated device (default: a fresh one)")
+    host.add_argument("--rtt-us", type=int, default=1000)
+    host.add_argument("--link-rate", type=int, default=12500000, help="bytes/s")
+    args = parser.parse_args()
+    if not args.list and not args.host_build and not args.host:
+        parser.error("give a device to replay to, or --host-build")
+
+    flows = load_flows(args.pcap, args.capture_port)
+    if not flows:
+        print("no client payload to port %d in %s" % (args.capture_port, args.pcap))
+        return 1
+    if args.list:
+        for i, flow in enumerate(flows):
+            segs = flow.ordered()
+            print("%3d  %-21s %5d segments %9d bytes  captured %s  %s" %
+                  (i, flow.client, len(segs), sum(len(d) for _, d in segs), flow.captured_status() or "-",
+                   flow.request_line()))
+        return 0
+
+    mismatches = 0
+    print("%3s  %-34s %5s %9s %8s %10s %9s  %s" % ("#", "request", "segs", "bytes", "sent_s", "KB/s", "latency", "status"))
+    selected = [(i, flow) for i, flow in enumerate(flows) if not args.flow or i in args.flow]
+
+    def row(i, flow, status, sent, send_s, latency, head):
+        expected = flow.captured_status()
+        ok = expected is None or status == expected
+        print("%3d  %-34s %5d %9s %8.3f %10s %9s  %s%s" %
+              (i, flow.request_line()[:34], len(flow.ordered()), sent if sent is not None else "-", send_s,
+               "%.1f" % (sent / max(send_s, 1e-6) / 1024) if sent is not None else "-",
+               "%.3f s" % latency if latency is not None else "-", status or head.decode(errors="replace") or "no reply",
+               "" if ok else "  (captured %d)" % expected))
+        return not ok
+
+    if args.host_build:
+        results, end, wall = host_replay([f for _, f in selected], args.fast, args.pause, args.flash,
+                                         ("--rtt-us", str(args.rtt_us), "--link-rate", str(args.link_rate)))
+        for (i, _), result in zip(selected, results):
+            mismatches += row(i, *result)
+        if len(results) < len(selected):
+            print("device ended with %s after %d of %d flow(s)" % (end, len(results), len(selected)))
+        print("(virtual times; %.3f s wall time)" % wall)
+    else:
+        for i, flow in selected:
+            try:
+                status, sent, send_s, latency, head = replay(flow, args.host, args.port, args.fast, args.timeout)
+            except OSError as e:
+                print("%3d  %-34s connect failed: %s" % (i, flow.request_line()[:34], e))
+                mismatches += 1
+                continue
+            mismatches += row(i, flow, status, sent, send_s, latency, head)
+            time.sleep(args.pause)
+    print("%d flow(s) with a different status than captured" % mismatches)
+    return 1 if mismatches else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
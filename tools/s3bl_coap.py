@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""Minimal CoAP client for the S3BL recovery server (UDP-only sites).
+
+Uploads a firmware image with Block1 (RFC 7959) to coap://<host>/fw and can observe
+coap://<host>/status (RFC 7641) for progress. Standard library only.
+
+    python3 tools/s3bl_coap.py upload 192.168.1.222 firmware.bin
+    python3 tools/s3bl_coap.py observe 192.168.1.222
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+import zlib
+
+COAP_PORT = 5683
+CON, NON, ACK, RST = 0, 1, 2, 3
+GET, POST, PUT = 1, 2, 3
+OPT_OBSERVE, OPT_URI_PATH, OPT_FORMAT, OPT_URI_QUERY, OPT_BLOCK1, OPT_SIZE1 = 6, 11, 12, 15, 27, 60
+ACK_TIMEOUT = 2.0
+MAX_RETRANSMIT = 4
+
+
+def code_str(code):
+    return "%d.%02d" % (code >> 5, code & 0x1F)
+
+
+def encode_uint(value):
+    out = b""
+    while value:
+        out = bytes([value & 0xFF]) + out
+        value >>= 8
+    return out
+
+
+def encode_option_header(delta, length):
+    def part(v):
+        if v < 13:
+            return v, b""
+        if v < 269:
+            return 13, bytes([v - 13])
+        return 14, struct.pack(">H", v - 269)
+    d, dext = part(delta)
+    l, lext = part(length)
+    return bytes([(d << 4) | l]) + dext + lext
+
+
+def build(mtype, code, mid, token, options, payload=b""):
+    out = bytes([(1 << 6) | (mtype << 4) | len(token), code]) + struct.pack(">H", mid) + token
+    last = 0
+    for num, value in sorted(options, key=lambda o: o[0]):
+        out += encode_option_header(num - last, len(value)) + value
+        last = num
+    if payload:
+        out += b"\xff" + payload
+    return out
+
+
+def parse(data):
+    tkl = data[0] & 0x0F
+    msg = {"type": (data[0] >> 4) & 3, "code": data[1], "mid": struct.unpack(">H", data[2:4])[0],
+           "token": data[4:4 + tkl], "options": {}, "payload": b""}
+    p, num = 4 + tkl, 0
+    while p < len(data):
+        if data[p] == 0xFF:
+            msg["payload"] = data[p + 1:]
+            break
+        delta, length = data[p] >> 4, data[p] & 0x0F
+        p += 1
+        if delta == 13:
+            delta, p = 13 + data[p], p + 1
+        elif delta == 14:
+            delta, p = 269 + struct.unpack(">H", data[p:p + 2])[0], p + 2
+        if length == 13:
+            length, p = 13 + data[p], p + 1
+        elif length == 14:
+            length, p = 269 + struct.unpack(">H", data[p:p + 2])[0], p + 2
+        num += delta
+        msg["options"][num] = data[p:p + length]
+        p += length
+    return msg
+
+
+def option_uint(msg, num):
+    return int.from_bytes(msg["options"].get(num, b""), "big")
+
+
+class Client:
+    def __init__(self, host, port=COAP_PORT):
+        self.addr = (host, port)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.mid = int.from_bytes(os.urandom(2), "big")
+
+    def close(self):
+        self.sock.close()
+
+    def request(self, code, path, options=(), payload=b"", token=b"\x01"):
+        """Confirmable request with RFC 7252 retransmission, returns the parsed response."""
+        self.mid = (self.mid + 1) & 0xFFFF
+        opts = [(OPT_URI_PATH, p.encode()) for p in path.split("/") if p] + list(options)
+        packet = build(CON, code, self.mid, token, opts, payload)
+        timeout = ACK_TIMEOUT
+        for _ in range(MAX_RETRANSMIT + 1):
+            self.sock.sendto(packet, self.addr)
+            self.sock.settimeout(timeout)
+            try:
+                while True:
+                    data, _ = self.sock.recvfrom(2048)
+                    msg = parse(data)
+                    if msg["type"] == ACK and msg["mid"] == self.mid:
+                        return msg
+                    if msg["type"] == RST and msg["mid"] == self.mid:
+                        raise IOError("request reset by server")
+            except socket.timeout:
+                timeout *= 2
+        raise IOError("no response from %s:%d" % self.addr)
+
+
+def upload(host, image, szx=6, port=COAP_PORT):
+    client = Client(host, port)
+    try:
+        return _upload(client, image, szx)
+    finally:
+        client.close()
+
+
+def _upload(client, image, szx):
+    crc = zlib.crc32(image) & 0xFFFFFFFF
+    query = [(OPT_URI_QUERY, ("crc=%08X" % crc).encode())]
+    offset = 0
+    start = time.monotonic()
+    while True:
+        size = 16 << szx
+        num = offset // size
+        chunk = image[offset:offset + size]
+        more = offset + len(chunk) < len(image)
+        options = query + [(OPT_BLOCK1, encode_uint((num << 4) | (8 if more else 0) | szx))]
+        if num == 0:
+            options.append((OPT_SIZE1, encode_uint(len(image))))
+        resp = client.request(PUT, "fw", options, chunk)
+        if resp["code"] == (4 << 5 | 13) and OPT_BLOCK1 in resp["options"]:
+            # Server prefers a smaller block size, continue at the same offset with it
+            szx = option_uint(resp, OPT_BLOCK1) & 7
+            continue
+        if resp["code"] == (2 << 5 | 31):
+            # The server may answer with a smaller SZX than we used
+            szx = min(szx, option_uint(resp, OPT_BLOCK1) & 7)
+            offset += len(chunk)
+            continue
+        elapsed = time.monotonic() - start
+        print("Upload finished with %s after %.2f s (%.1f KB/s): %s" %
+              (code_str(resp["code"]), elapsed, len(image) / elapsed / 1024, resp["payload"].decode(errors="replace")))
+        return resp["code"] == (2 << 5 | 4)
+
+
+def observe(host, port=COAP_PORT, seconds=600):
+    client = Client(host, port)
+    try:
+        return _observe(client, seconds)
+    finally:
+        client.close()
+
+
+def _observe(client, seconds):
+    resp = client.request(GET, "status", [(OPT_OBSERVE, b"")], token=b"\x42")
+    print(resp["payload"].decode(errors="replace"))
+    deadline = time.monotonic() + seconds
+    client.sock.settimeout(1.0)
+    while time.monotonic() < deadline:
+        try:
+            data, _ = client.sock.recvfrom(2048)
+        except socket.timeout:
+            continue
+        msg = parse(data)
+        if msg["token"] == b"\x42" and OPT_OBSERVE in msg["options"]:
+            status = msg["payload"].decode(errors="replace")
+            print(status)
+            if "state=complete" in status or "state=failed" in status:
+                return True
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description="S3BL CoAP client")
+    sub = parser.add_subparsers(dest="command", required=True)
+    up = sub.add_parser("upload", help="Block1 upload to coap://<host>/fw")
+    up.add_argument("host")
+    up.add_argument("image")
+    up.add_argument("--port", type=int, default=COAP_PORT)
+    up.add_argument("--szx", type=int, default=6, choices=range(0, 7), help="initial block size exponent")
+    ob = sub.add_parser("observe", help="observe coap://<host>/status")
+    ob.add_argument("host")
+    ob.add_argument("--port", type=int, default=COAP_PORT)
+    args = parser.parse_args()
+
+    if args.command == "upload":
+        with open(args.image, "rb") as f:
+            image = f.read()
+        return 0 if upload(args.host, image, args.szx, args.port) else 1
+    return 0 if observe(args.host, args.port) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Factory provisioning for S3BL boards.
+
+Builds one bundle with the slot images, golden image, network config and initial metadata,
+and POSTs it to /provision on a board in recovery mode. The board answers with a timing
+report per section; --log appends it to a CSV so line throughput can be tuned. A config with a
+TLS key closes the unauthenticated update paths, the plain HTTP listener, CoAP uploads and
+MQTT announcements, unless --tls-allow-plain is given.
+
+    python3 tools/s3bl_provision.py build line.s3pb --slot-a app.bin --golden app.bin --mqtt-broker 10.0.0.5
+    python3 tools/s3bl_provision.py build net.s3pb --tls-psk $(openssl rand -hex 32)
+    python3 tools/s3bl_provision.py send 192.168.1.222 line.s3pb --log provisioning.csv
+"""
+
+import argparse
+import csv
+import hashlib
+import http.client
+import os
+import socket
+import struct
+import sys
+import time
+
+MAGIC = b"S3PB"
+VERSION = 1
+SLOT_SIZE = 0x60112000 - 0x60032000
+SLOT_A, SLOT_B, GOLDEN, NETCFG, METADATA = 1, 2, 3, 4, 5
+SECTION_NAMES = {SLOT_A: "slot_a", SLOT_B: "slot_b", GOLDEN: "golden", NETCFG: "netcfg", METADATA: "metadata"}
+NET_CONFIG_MAGIC = 0x53334E43
+
+
+def net_config(broker, port, keepalive, syslog_server, syslog_port, syslog_rate, upload_rate,
+               tls_psk=b"", tls_identity="", tls_only=True):
+    # net_config_t: magic, MQTT broker (network byte order), port, keepalive, the syslog fields, upload rate,
+    # then the TLS PSK, its length, the TLS-only flag and the PSK identity
+    return (struct.pack("<I", NET_CONFIG_MAGIC) + socket.inet_aton(broker) + struct.pack("<HH", port, keepalive) +
+            socket.inet_aton(syslog_server) + struct.pack("<HHII", syslog_port, 0, syslog_rate, upload_rate) +
+            struct.pack("<32sHH32s", tls_psk, len(tls_psk), 1 if tls_only else 0, tls_identity.encode()))
+
+
+def metadata(active_slot, valid_a, valid_b):
+    # boot_metadata_t: active_slot, valid_a, valid_b, boot_count, boot_success
+    return struct.pack("<5I", active_slot, valid_a, valid_b, 0, 0)
+
+
+def build_bundle(sections):
+    """sections: list of (type, payload). Returns the bundle bytes."""
+    out = MAGIC + struct.pack("<II", VERSION, len(sections))
+    for kind, payload in sections:
+        out += struct.pack("<II", kind, len(payload)) + hashlib.sha256(payload).digest()
+    for _, payload in sections:
+        out += payload
+    return out
+
+
+def send_bundle(host, bundle, port=80, timeout=120):
+    start = time.monotonic()
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    conn.request("POST", "/provision", body=bundle,
+                 headers={"Content-Type": "application/octet-stream", "Content-Length": str(len(bundle))})
+    resp = conn.getresponse()
+    body = resp.read().decode(errors="replace")
+    conn.close()
+    elapsed = time.monotonic() - start
+    report = {"sections": []}
+    for line in body.splitlines():
+        fields = dict(f.split("=", 1) for f in line.split() if "=" in f)
+        if "section" in fields:
+            report["sections"].append(fields)
+        else:
+            report.update(fields)
+    return resp.status, elapsed, report, body
+
+
+def read_file(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) > SLOT_SIZE:
+        raise SystemExit("%s is %d bytes, a slot holds %d" % (path, len(data), SLOT_SIZE))
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description="S3BL factory provisioning")
+    sub = parser.add_subparsers(dest="command", required=True)
+    bu = sub.add_parser("build", help="build a provisioning bundle")
+    bu.add_argument("output")
+    bu.add_argument("--slot-a", help="image for slot A")
+    bu.add_argument("--slot-b", help="image for slot B")
+    bu.add_argument("--golden", help="golden image, stored as /golden.bin")
+    bu.add_argument("--mqtt-broker", help="write a network config with this broker (0.0.0.0 disables MQTT)")
+    bu.add_argument("--mqtt-port", type=int, default=1883)
+    bu.add_argument("--mqtt-keepalive", type=int, default=300)
+    bu.add_argument("--syslog-server", help="write a network config shipping logs to this collector")
+    bu.add_argument("--syslog-port", type=int, default=514)
+    bu.add_argument("--syslog-rate", type=int, default=2048, help="bytes/s of log traffic at most")
+    bu.add_argument("--upload-rate", type=int, help="write a network config holding update traffic to this many bytes/s")
+    bu.add_argument("--tls-psk", help="write a network config with a TLS listener on port 443 using this key (hex, 16-32 bytes)")
+    bu.add_argument("--tls-identity", default="s3bl", help="PSK identity clients name")
+    bu.add_argument("--tls-allow-plain", action="store_true",
+                    help="keep plain HTTP, CoAP and MQTT announcements next to TLS (off by default with --tls-psk)")
+    bu.add_argument("--active-slot", choices=("a", "b"), help="write explicit metadata instead of deriving it")
+    se = sub.add_parser("send", help="POST a bundle to /provision and print the timing report")
+    se.add_argument("host")
+    se.add_argument("bundle")
+    se.add_argument("--port", type=int, default=80)
+    se.add_argument("--log", help="append the timing report to this CSV file")
+    args = parser.parse_args()
+
+    if args.command == "build":
+        sections = []
+        if args.slot_a:
+            sections.append((SLOT_A, read_file(args.slot_a)))
+        if args.slot_b:
+            sections.append((SLOT_B, read_file(args.slot_b)))
+        if args.golden:
+            sections.append((GOLDEN, read_file(args.golden)))
+        tls_psk = b""
+        if args.tls_psk:
+            try:
+                tls_psk = bytes.fromhex(args.tls_psk)
+            except ValueError:
+                parser.error("--tls-psk has to be hex")
+            if not 16 <= len(tls_psk) <= 32:
+                parser.error("--tls-psk has to be 16 to 32 bytes")
+            if not 0 < len(args.tls_identity.encode()) < 32:
+                parser.error("--tls-identity has to be 1 to 31 bytes")
+        elif args.tls_allow_plain:
+            parser.error("--tls-allow-plain needs --tls-psk")
+        if args.mqtt_broker or args.syslog_server or args.upload_rate is not None or tls_psk:
+            sections.append((NETCFG, net_config(args.mqtt_broker or "0.0.0.0", args.mqtt_port, args.mqtt_keepalive,
+                                                args.syslog_server or "0.0.0.0", args.syslog_port, args.syslog_rate,
+                                                args.upload_rate or 0, tls_psk, args.tls_identity,
+                                                not args.tls_allow_plain)))
+        if args.active_slot:
+            active = 0 if args.active_slot == "a" else 1
+            if (active == 0 and not args.slot_a) or (active == 1 and not args.slot_b):
+                parser.error("--active-slot %s needs an image for that slot" % args.active_slot)
+            sections.append((METADATA, metadata(active, 1 if args.slot_a else 0, 1 if args.slot_b else 0)))
+        if not sections:
+            parser.error("nothing to put in the bundle")
+        bundle = build_bundle(sections)
+        with open(args.output, "wb") as f:
+            f.write(bundle)
+        for kind, payload in sections:
+            print("%-8s %7d bytes  sha256 %s" % (SECTION_NAMES[kind], len(payload), hashlib.sha256(payload).hexdigest()))
+        print("Bundle %s: %d bytes" % (args.output, len(bundle)))
+        return 0
+
+    with open(args.bundle, "rb") as f:
+        bundle = f.read()
+    status, elapsed, report, body = send_bundle(args.host, bundle, args.port)
+    print(body.strip())
+    print("HTTP %d, %.2f s on the host side (%.1f KB/s)" % (status, elapsed, len(bundle) / elapsed / 1024))
+    if args.log:
+        new_file = not os.path.exists(args.log)
+        with open(args.log, "a", newline="") as f:
+            writer = csv.writer(f)
+            if new_file:
+                writer.writerow(["time", "host", "result", "host_s", "board_ms", "section", "bytes",
+                                 "erase_ms", "write_ms", "verify_ms", "ok"])
+            stamp = time.strftime("%Y-%m-%dT%H:%M:%S")
+            for sec in report["sections"] or [{}]:
+                writer.writerow([stamp, args.host, report.get("result", status), "%.3f" % elapsed,
+                                 report.get("total_ms", ""), sec.get("section", ""), sec.get("bytes", ""),
+                                 sec.get("erase_ms", ""), sec.get("write_ms", ""), sec.get("verify_ms", ""),
+                                 sec.get("ok", "")])
+    return 0 if status == 200 and report.get("result") == "ok" else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
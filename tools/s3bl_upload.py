@@ -0,0 +1,702 @@
+#!/usr/bin/env python3
+"""Host side upload client for the S3BL recovery server.
+
+Splits a firmware image into sector aligned byte ranges and PUTs them to /image over
+several concurrent connections. The W5x00 gives every socket a small window, so one
+stream is capped at window / RTT; the connection count is picked from the measured RTT
+unless --connections is given.
+
+The rollout command pushes one image to a fleet of devices in canary stages. Each stage
+only starts once every device of the previous one reports a good boot on GET /status,
+and uploads are spread across subnets so no single link is oversubscribed.
+
+    python3 tools/s3bl_upload.py upload 192.168.1.222 firmware.bin
+The release command sends an application image together with data partitions as one
+manifest. Nothing changes on the device until every image has arrived and verified, and an
+interrupted transfer resumes from the device's last persisted offset.
+
+    python3 tools/s3bl_upload.py rollout devices.txt firmware.bin --stages 1,10%,50%,100%
+    python3 tools/s3bl_upload.py release 192.168.1.222 firmware.bin --data config=config.bin
+
+Images bigger than a fixed slot, or kept next to others as fallbacks, are placed by the block
+allocator: ask for a free address, link the build for it, then send it with its image header.
+
+    python3 tools/s3bl_upload.py alloc 192.168.1.222 --size 1200000
+    python3 tools/s3bl_upload.py place 192.168.1.222 big.bin 0x60040000
+
+Placed images can list hot sections for the bootloader to copy into ITCM before the jump
+(tools/hotsections.py table prints them from the linked ELF).
+
+    python3 tools/s3bl_upload.py place 192.168.1.222 app.bin 0x60120000 --hot 0x60126000:0x00008000:2048
+
+Modules of a component build (include/component.h) are placed the same way and only carry their
+own blocks; the device keeps booting the base image and hands it the newest module versions,
+falling back to the one before when a new version's trial boot is not confirmed.
+
+    python3 tools/s3bl_upload.py place 192.168.1.222 control.bin 0x601E0000 --module
+
+Every command that sends an image can hold it to a rate (MB/s) with a token bucket, so updates
+use a known share of a plant network that also carries control traffic. A rollout takes one
+limit per device and one for all of its uploads together; devices enforce their own limit as
+well (net_config_t.upload_rate). shaping measures the limiter's own cost and accuracy.
+
+    python3 tools/s3bl_upload.py rollout devices.txt firmware.bin --device-rate 0.5 --rollout-rate 2
+    python3 tools/s3bl_upload.py shaping --rate 1 --threads 4
+
+clock times the image verification phase on a device in recovery, once on the default build and
+once on env:teensy40_fastclock, to see what the raised core clock buys (include/boot_clock.h).
+
+    python3 tools/s3bl_upload.py clock 192.168.1.222 --samples 10
+
+release, place and alloc can go over TLS 1.3 to a device provisioned with a pre-shared key
+(s3bl_provision.py build --tls-psk, include/tls_psk.h), port 443 by default. Python only offers
+AES-GCM there; openssl s_client -ciphersuites TLS_AES_128_CCM_SHA256 gets the suite the device
+runs entirely on its crypto engine. Needs Python 3.13 or later for PSK support.
+
+    python3 tools/s3bl_upload.py place 192.168.1.222 app.bin 0x60120000 --tls-psk $(cat device.psk)
+"""
+
+import argparse
+import collections
+import hashlib
+import http.client
+import itertools
+import math
+import ssl
+import struct
+import sys
+import threading
+import time
+import zlib
+
+SECTOR_SIZE = 4096
+W5X00_SOCKET_WINDOW = 2048       # Default per-socket RX buffer with all 8 sockets enabled
+TARGET_RATE = 1_500_000          # Bytes/s, roughly what the W5x00 SPI link sustains
+DEFAULT_MAX_SESSIONS = 4
+SUBNET_RATE = 4_000_000          # Bytes/s a shared subnet uplink is allowed to carry by default
+IMAGE_HEADER_MAGIC = 0x48493353   # "S3IH", image_header_t in include/image_alloc.h
+IMAGE_FLAG_RESET = 1             # image_header_t.flags: start through a system reset
+IMAGE_FLAG_MODULE = 2            # image_header_t.flags: a module for the base image
+RATE_SMOOTHING = 0.3             # Weight of the newest sample in the per-subnet throughput estimate
+SHAPE_BLOCK = W5X00_SOCKET_WINDOW  # Bytes handed to a socket per token bucket take
+SHAPE_BURST = 0.05               # Seconds of a bucket's rate that may go at once
+
+
+class TokenBucket:
+    """Bytes per second with a SHAPE_BURST allowance, shared by every thread sending through it.
+    take() blocks until the bytes may go; a take larger than the burst runs the bucket into debt,
+    which the next take waits off."""
+
+    def __init__(self, rate):
+        self.rate = rate
+        self.burst = max(SHAPE_BLOCK, rate * SHAPE_BURST)
+        self.tokens = self.burst
+        self.last = time.monotonic()
+        self.lock = threading.Lock()
+        self.bytes = 0
+        self.waited = 0.0            # Seconds spent blocked, summed over threads
+
+    def take(self, n):
+        while True:
+            with self.lock:
+                now = time.monotonic()
+                self.tokens = min(self.burst, self.tokens + (now - self.last) * self.rate)
+                self.last = now
+                if self.tokens >= min(n, self.burst):
+                    self.tokens -= n
+                    self.bytes += n
+                    return
+                wait = (min(n, self.burst) - self.tokens) / self.rate
+                self.waited += wait
+            time.sleep(wait)
+
+
+def make_buckets(*rates):
+    """Buckets for the non-zero rates, in bytes/s."""
+    return [TokenBucket(rate) for rate in rates if rate]
+
+
+def shaped(data, buckets):
+    """data as SHAPE_BLOCK pieces, each let through by every bucket. Needs an explicit
+    Content-Length, http.client would use chunked encoding for an iterable body otherwise."""
+    view = memoryview(data)
+    for offset in range(0, len(view), SHAPE_BLOCK):
+        block = view[offset:offset + SHAPE_BLOCK]
+        for bucket in buckets:
+            bucket.take(len(block))
+        yield block
+
+
+def shaping_summary(buckets, elapsed):
+    if not buckets or elapsed <= 0:
+        return ""
+    bucket = buckets[0]
+    return ", shaped to %.1f KB/s (%.1f KB/s achieved, %.2f s waiting)" % (
+        bucket.rate / 1024, bucket.bytes / elapsed / 1024, bucket.waited)
+
+
+def get_status(host, port=80, timeout=5.0, path="/upload/status"):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    conn.request("GET", path)
+    body = conn.getresponse().read().decode(errors="replace")
+    conn.close()
+    status = {}
+    for line in body.splitlines():
+        key, sep, value = line.partition("=")
+        if sep:
+            status[key.strip()] = value.strip()
+    return status
+
+
+def measure_rtt(host, port=80, samples=3):
+    best = None
+    for _ in range(samples):
+        start = time.monotonic()
+        get_status(host, port)
+        elapsed = time.monotonic() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def pick_connections(rtt, max_sessions):
+    """Enough sockets that their combined window covers the bandwidth-delay product."""
+    wanted = math.ceil(rtt * TARGET_RATE / W5X00_SOCKET_WINDOW)
+    return max(1, min(max_sessions, wanted))
+
+
+def split_ranges(total, parts):
+    sectors = (total + SECTOR_SIZE - 1) // SECTOR_SIZE
+    per_part = max(1, math.ceil(sectors / parts))
+    ranges = []
+    for first_sector in range(0, sectors, per_part):
+        first = first_sector * SECTOR_SIZE
+        last = min(total, (first_sector + per_part) * SECTOR_SIZE) - 1
+        ranges.append((first, last))
+    return ranges
+
+
+def put_range(host, port, image, first, last, crc, results, index, buckets=(), report=False):
+    headers = {
+        "Content-Range": "bytes %d-%d/%d" % (first, last, len(image)),
+        "Content-Length": str(last - first + 1),
+        "Content-Type": "application/octet-stream",
+        "X-Image-CRC32": "%08X" % crc,
+    }
+    if report:
+        headers["X-Boot-Report"] = "1"
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=30)
+        body = image[first:last + 1]
+        conn.request("PUT", "/image", body=shaped(body, buckets) if buckets else body, headers=headers)
+        resp = conn.getresponse()
+        results[index] = (resp.status, resp.read().decode(errors="replace").strip())
+        conn.close()
+    except OSError as e:
+        results[index] = (None, str(e))
+
+
+def coalesce_sectors(sectors, total):
+    """Turns a sorted list of sector numbers into contiguous byte ranges."""
+    ranges = []
+    for sector in sectors:
+        first = sector * SECTOR_SIZE
+        last = min(total, first + SECTOR_SIZE) - 1
+        if ranges and ranges[-1][1] + 1 == first:
+            ranges[-1] = (ranges[-1][0], last)
+        else:
+            ranges.append((first, last))
+    return ranges
+
+
+def run_batch(host, port, image, ranges, crc, buckets=(), report=False):
+    results = [None] * len(ranges)
+    threads = [threading.Thread(target=put_range, args=(host, port, image, first, last, crc, results, i, buckets, report))
+               for i, (first, last) in enumerate(ranges)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return results
+
+
+def upload(host, image, port=80, connections=None, retries=3, log=print, buckets=(), report=False):
+    """buckets: TokenBuckets every byte sent goes through, the device's own, a rollout's shared one.
+    report asks the bootloader to hold the confirmed boot for GET /status (include/recovery.h)."""
+    status = get_status(host, port)
+    max_sessions = int(status.get("max_sessions", DEFAULT_MAX_SESSIONS))
+    if connections is None:
+        rtt = measure_rtt(host, port)
+        connections = pick_connections(rtt, max_sessions)
+        log("RTT %.1f ms -> %d connection(s)" % (rtt * 1000, connections))
+    crc = zlib.crc32(image) & 0xFFFFFFFF
+    ranges = split_ranges(len(image), connections)
+    start = time.monotonic()
+    for attempt in range(retries + 1):
+        results = []
+        for batch in range(0, len(ranges), connections):
+            results += run_batch(host, port, image, ranges[batch:batch + connections], crc, buckets, report)
+        if any(r[0] == 200 for r in results):
+            elapsed = time.monotonic() - start
+            log("Upload complete: %d bytes in %.2f s (%.1f KB/s)%s" %
+                (len(image), elapsed, len(image) / elapsed / 1024, shaping_summary(buckets, elapsed)))
+            return True
+        failed = [r for r in results if r[0] not in (200, 202)]
+        for code, message in failed:
+            log("Range failed: %s %s" % (code, message))
+        if any(code in (400, 409, 413, 416, 422) for code, _ in failed):
+            return False
+        # Re-send only the sectors the bootloader is still missing
+        missing = get_status(host, port).get("missing", "")
+        sectors = [int(x) for x in missing.split(",") if x]
+        if not sectors:
+            break
+        ranges = coalesce_sectors(sectors, len(image))
+        log("Retrying %d missing sector(s)" % len(sectors))
+    return False
+
+
+def boot_good(status):
+    """mode=confirmed comes from the bootloader's report window after the application confirmed its
+    boot (include/boot_clock.h); an application may answer /status itself. mode=recovery never counts."""
+    return status.get("mode") != "recovery" and status.get("boot_success") == "1"
+
+
+def wait_boot_good(host, port, timeout, interval=2.0):
+    """Polls GET /status until the device reports a good boot. Returns (good, last status)."""
+    deadline = time.monotonic() + timeout
+    status = {}
+    while time.monotonic() < deadline:
+        try:
+            status = get_status(host, port, timeout=interval, path="/status")
+            if boot_good(status):
+                return True, status
+        except OSError:
+            pass                     # Rebooting, nothing listening yet
+        time.sleep(interval)
+    return False, status
+
+
+def load_devices(path, default_port=80):
+    """One device per line: host[:port] [subnet]. Without a subnet the /24 of an IPv4 address is used."""
+    devices = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split("#", 1)[0].split()
+            if not fields:
+                continue
+            host, _, port = fields[0].partition(":")
+            port = int(port) if port else default_port
+            if len(fields) > 1:
+                subnet = fields[1]
+            else:
+                octets = host.split(".")
+                subnet = ".".join(octets[:3]) + ".0/24" if len(octets) == 4 else "default"
+            devices.append((host, port, subnet))
+    return devices
+
+
+def parse_stages(spec, total):
+    """'1,10%,50%' -> cumulative device counts, always ending with the whole fleet."""
+    counts = []
+    for part in spec.split(","):
+        part = part.strip()
+        if not part:
+            continue
+        count = math.ceil(total * float(part[:-1]) / 100) if part.endswith("%") else int(part)
+        count = max(1, min(total, count))
+        if not counts or count > counts[-1]:
+            counts.append(count)
+    if not counts or counts[-1] < total:
+        counts.append(total)
+    return counts
+
+
+class SubnetScheduler:
+    """Admits uploads so that the estimated throughput per subnet stays under its budget.
+
+    Every subnet may always run one upload. Further uploads are admitted while the running
+    ones plus the newcomer, at the subnet's measured per-device rate, fit in subnet_rate.
+    Free global slots go to the subnet with the fewest uploads in flight.
+    """
+
+    def __init__(self, concurrency, subnet_rate):
+        self.concurrency = concurrency
+        self.subnet_rate = subnet_rate
+        self.cond = threading.Condition()
+        self.active = collections.Counter()
+        self.rate = {}               # subnet -> smoothed per-device bytes/s
+        self.bytes = collections.Counter()
+        self.seconds = collections.Counter()
+
+    def _admissible(self, subnet):
+        if self.active[subnet] == 0:
+            return True
+        per_device = self.rate.get(subnet, TARGET_RATE)
+        return (self.active[subnet] + 1) * per_device <= self.subnet_rate
+
+    def acquire(self, queues):
+        """Blocks until some subnet in queues (subnet -> list of devices) may start one. Returns the device."""
+        with self.cond:
+            while True:
+                if sum(self.active.values()) < self.concurrency:
+                    candidates = [s for s in queues if queues[s] and self._admissible(s)]
+                    if candidates:
+                        subnet = min(candidates, key=lambda s: self.active[s])
+                        self.active[subnet] += 1
+                        return queues[subnet].pop(0)
+                if not any(queues.values()):
+                    return None
+                self.cond.wait()
+
+    def release(self, subnet, size, elapsed):
+        with self.cond:
+            self.active[subnet] -= 1
+            if elapsed > 0 and size:
+                sample = size / elapsed
+                old = self.rate.get(subnet)
+                self.rate[subnet] = sample if old is None else old + RATE_SMOOTHING * (sample - old)
+                self.bytes[subnet] += size
+                self.seconds[subnet] += elapsed
+            self.cond.notify_all()
+
+
+def run_stage(devices, image, scheduler, boot_timeout, log_lock, device_rate=0, shared=()):
+    """Uploads to every device of one stage and waits for their boot reports. Returns the failed hosts."""
+    queues = collections.OrderedDict()
+    for device in devices:
+        queues.setdefault(device[2], []).append(device)
+    failed = []
+    threads = []
+
+    def log_for(host):
+        def log(message):
+            with log_lock:
+                print("[%s] %s" % (host, message), flush=True)
+        return log
+
+    def worker(host, port, subnet):
+        log = log_for("%s:%d" % (host, port))
+        start = time.monotonic()
+        try:
+            ok = upload(host, image, port, log=log, buckets=make_buckets(device_rate) + list(shared), report=True)
+        except OSError as e:
+            log("Upload failed: %s" % e)
+            ok = False
+        scheduler.release(subnet, len(image) if ok else 0, time.monotonic() - start)
+        if ok:
+            ok, status = wait_boot_good(host, port, boot_timeout)
+            log("Boot good" if ok else "No good boot report within %d s (last status: %s)" %
+                (boot_timeout, " ".join("%s=%s" % kv for kv in status.items()) or "none"))
+        if not ok:
+            with log_lock:
+                failed.append("%s:%d" % (host, port))
+
+    while True:
+        device = scheduler.acquire(queues)
+        if device is None:
+            break
+        t = threading.Thread(target=worker, args=device)
+        t.start()
+        threads.append(t)
+    for t in threads:
+        t.join()
+    return failed
+
+
+def rollout(devices, image, stages="1,10%,50%,100%", concurrency=8,
+            subnet_rate=SUBNET_RATE, boot_timeout=120, max_failures=0, device_rate=0, rollout_rate=0):
+    """device_rate limits each upload, rollout_rate all of them together (bytes/s, 0 = unlimited)."""
+    counts = parse_stages(stages, len(devices))
+    # Interleave subnets so every stage, canaries included, samples as many of them as it can
+    by_subnet = collections.OrderedDict()
+    for device in devices:
+        by_subnet.setdefault(device[2], []).append(device)
+    devices = [d for group in itertools.zip_longest(*by_subnet.values()) for d in group if d]
+    scheduler = SubnetScheduler(concurrency, subnet_rate)
+    shared = make_buckets(rollout_rate)
+    log_lock = threading.Lock()
+    done = 0
+    start = time.monotonic()
+    for number, count in enumerate(counts, 1):
+        stage = devices[done:count]
+        print("Stage %d/%d: %d device(s), %d of %d total" % (number, len(counts), len(stage), count, len(devices)))
+        failed = run_stage(stage, image, scheduler, boot_timeout, log_lock, device_rate, shared)
+        done = count
+        if len(failed) > max_failures:
+            print("Stage %d failed on %d device(s): %s. Rollout halted with %d device(s) untouched." %
+                  (number, len(failed), ", ".join(failed), len(devices) - done), file=sys.stderr)
+            return False
+        if failed:
+            print("Stage %d: %d failure(s) within the allowed %d: %s" %
+                  (number, len(failed), max_failures, ", ".join(failed)), file=sys.stderr)
+    elapsed = time.monotonic() - start
+    print("Rollout complete: %d device(s) in %.1f s%s" % (len(devices), elapsed, shaping_summary(shared, elapsed)))
+    for subnet in sorted(scheduler.seconds):
+        print("  %s: %.1f KB/s per device" % (subnet, scheduler.bytes[subnet] / scheduler.seconds[subnet] / 1024))
+    return True
+
+
+def parse_manifest_status(body):
+    status = {"images": {}}
+    for line in body.splitlines():
+        fields = dict(f.split("=", 1) for f in line.split() if "=" in f)
+        if "image" in fields:
+            status["images"][fields["image"]] = {k: int(v) if v.isdigit() else v for k, v in fields.items()}
+        else:
+            status.update(fields)
+    return status
+
+
+def tls_context(psk_hex, identity):
+    """TLS 1.3 client context for the device's PSK listener, no certificates involved."""
+    if not hasattr(ssl.SSLContext, "set_psk_client_callback"):
+        raise SystemExit("--tls-psk needs Python 3.13 or later")
+    psk = bytes.fromhex(psk_hex)
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+    ctx.minimum_version = ssl.TLSVersion.TLSv1_3
+    ctx.set_psk_client_callback(lambda hint: (identity, psk))
+    return ctx
+
+
+def manifest_request(host, port, method, path, body=None, headers=None, timeout=60, buckets=(), tls=None):
+    if tls:
+        conn = http.client.HTTPSConnection(host, port, timeout=timeout, context=tls)
+    else:
+        conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    headers = dict(headers or {})
+    if body and buckets:
+        headers["Content-Length"] = str(len(body))
+        body = shaped(body, buckets)
+    conn.request(method, path, body=body, headers=headers)
+    resp = conn.getresponse()
+    text = resp.read().decode(errors="replace")
+    conn.close()
+    return resp.status, text
+
+
+def release(host, images, port=80, chunk=64 * 1024, retries=5, log=print, buckets=(), tls=None):
+    """images: list of (name, target, data) with exactly one 'slot' target. Returns True once committed."""
+    manifest = "".join("%s %s %d %s\n" % (name, target, len(data), hashlib.sha256(data).hexdigest())
+                       for name, target, data in images)
+    chunk = max(SECTOR_SIZE, chunk - chunk % SECTOR_SIZE)   # Slot ranges must end on sector boundaries
+    code, text = manifest_request(host, port, "POST", "/manifest", manifest.encode(), tls=tls)
+    if code != 200:
+        log("Manifest rejected: %d %s" % (code, text.strip()))
+        return False
+    status = parse_manifest_status(text)
+    start = time.monotonic()
+    sent = 0
+    for attempt in range(retries + 1):
+        try:
+            for name, _, data in images:
+                offset = status["images"][name]["received"]
+                if offset:
+                    log("%s: resuming at %d of %d bytes" % (name, offset, len(data)))
+                while offset < len(data):
+                    last = min(len(data), offset + chunk) - 1
+                    headers = {"Content-Range": "bytes %d-%d/%d" % (offset, last, len(data)),
+                               "Content-Type": "application/octet-stream"}
+                    code, text = manifest_request(host, port, "PUT", "/manifest/" + name,
+                                                  data[offset:last + 1], headers, buckets=buckets, tls=tls)
+                    if code == 200:
+                        elapsed = time.monotonic() - start
+                        log("Release committed: %d bytes sent in %.2f s%s" %
+                            (sent + last + 1 - offset, elapsed, shaping_summary(buckets, elapsed)))
+                        return True
+                    if code != 202:
+                        raise IOError("%s: %d %s" % (name, code, text.strip()))
+                    sent += last + 1 - offset
+                    offset = last + 1
+            raise IOError("all images sent but the release was not committed")
+        except (OSError, IOError) as e:
+            log("Transfer interrupted (%s), resuming from the device's progress" % e)
+            if attempt == retries:
+                break
+            time.sleep(1)
+            try:
+                status = parse_manifest_status(manifest_request(host, port, "GET", "/manifest/status", tls=tls)[1])
+            except OSError:
+                continue
+            if status.get("state") != "staging":
+                # Dropped on the device side, stage it again; a same release keeps whatever is left
+                code, text = manifest_request(host, port, "POST", "/manifest", manifest.encode(), tls=tls)
+                status = parse_manifest_status(text)
+    return False
+
+
+def parse_hot(spec):
+    flash, itcm, length = (int(v, 0) for v in spec.split(":"))
+    return flash, itcm, length
+
+
+def place(host, image, load_address, port=80, timeout=120, hot=(), reset=False, module=False, buckets=(), tls=None):
+    """POSTs image_header_t, its hot_section_t entries and the image to /alloc. Returns (HTTP status, body).
+    The device jumps straight into the image once it is installed, unless reset asks for a system reset.
+    A module is not jumped to, the device starts its base image with it."""
+    flags = (IMAGE_FLAG_RESET if reset else 0) | (IMAGE_FLAG_MODULE if module else 0)
+    header = struct.pack("<5IHH", IMAGE_HEADER_MAGIC, 24 + 12 * len(hot), load_address, len(image),
+                         zlib.crc32(image) & 0xFFFFFFFF, len(hot), flags)
+    header += b"".join(struct.pack("<3I", *section) for section in hot)
+    return manifest_request(host, port, "POST", "/alloc", header + image,
+                            {"Content-Type": "application/octet-stream"}, timeout, buckets, tls)
+
+
+def shaping_benchmark(rate, threads, seconds):
+    """Cost of one take() with the bucket never blocking, then the rate threads pushing
+    SHAPE_BLOCK pieces through one shared bucket actually get. Returns (ns per take, bytes/s)."""
+    bucket = TokenBucket(float("inf"))
+    calls = 200000
+    start = time.perf_counter()
+    for _ in range(calls):
+        bucket.take(SHAPE_BLOCK)
+    per_take = (time.perf_counter() - start) / calls * 1e9
+
+    bucket = TokenBucket(rate)
+    bucket.tokens = 0                # Measure the steady rate, not the initial burst
+    deadline = time.monotonic() + seconds
+
+    def worker():
+        while time.monotonic() < deadline:
+            bucket.take(SHAPE_BLOCK)
+
+    workers = [threading.Thread(target=worker) for _ in range(threads)]
+    start = time.monotonic()
+    for t in workers:
+        t.start()
+    for t in workers:
+        t.join()
+    return per_take, bucket.bytes / (time.monotonic() - start)
+
+
+def verify_benchmark(host, port=80, size=256 * 1024, samples=5):
+    """VERIFY phase time of a device in recovery: POSTs a netboot body with a CRC32 that can't
+    match, so the device checksums size bytes from RAM, answers 422 and stays put, then reads
+    verify_us from /status. Returns (fast_clock_hz, [verify_us per sample])."""
+    body = bytes((i * 131) & 0xFF for i in range(size))
+    wrong_crc = (zlib.crc32(body) ^ 1) & 0xFFFFFFFF
+    times = []
+    status = {}
+    for _ in range(samples):
+        code, text = manifest_request(host, port, "POST", "/netboot", body,
+                                      {"X-Image-CRC32": "%08x" % wrong_crc, "Content-Type": "application/octet-stream"})
+        if code != 422:
+            raise IOError("POST /netboot: %d %s" % (code, text.strip()))
+        status = get_status(host, port, path="/status")
+        times.append(int(status["verify_us"]))
+    return int(status.get("fast_clock_hz", 0)), times
+
+
+def main():
+    parser = argparse.ArgumentParser(description="S3BL host upload client")
+    sub = parser.add_subparsers(dest="command", required=True)
+    up = sub.add_parser("upload", help="upload an image over parallel range connections")
+    up.add_argument("host")
+    up.add_argument("image")
+    up.add_argument("--port", type=int, default=80)
+    up.add_argument("--connections", type=int, help="override the automatic connection count")
+    up.add_argument("--rate", type=float, default=0, help="MB/s at most, 0 = unlimited")
+    ro = sub.add_parser("rollout", help="canary staged upload to a list of devices")
+    ro.add_argument("devices", help="file with one 'host[:port] [subnet]' per line")
+    ro.add_argument("image")
+    ro.add_argument("--port", type=int, default=80)
+    ro.add_argument("--stages", default="1,10%,50%,100%", help="cumulative device counts or percentages")
+    ro.add_argument("--concurrency", type=int, default=8, help="uploads in flight across all subnets")
+    ro.add_argument("--subnet-rate", type=float, default=SUBNET_RATE / 1e6, help="MB/s budget per subnet")
+    ro.add_argument("--boot-timeout", type=int, default=120, help="seconds to wait for a good boot report")
+    ro.add_argument("--max-failures", type=int, default=0, help="failures tolerated per stage")
+    ro.add_argument("--device-rate", type=float, default=0, help="MB/s at most per device, 0 = unlimited")
+    ro.add_argument("--rollout-rate", type=float, default=0, help="MB/s at most for all uploads together, 0 = unlimited")
+    rel = sub.add_parser("release", help="send an application and data partitions as one atomic release")
+    rel.add_argument("host")
+    rel.add_argument("image", help="application image for the inactive slot")
+    rel.add_argument("--data", action="append", default=[], metavar="NAME=FILE", help="data partition image")
+    rel.add_argument("--port", type=int, help="80, or 443 with --tls-psk")
+    rel.add_argument("--chunk", type=int, default=64, help="KB per PUT, the most that is re-sent after a drop")
+    rel.add_argument("--rate", type=float, default=0, help="MB/s at most, 0 = unlimited")
+    al = sub.add_parser("alloc", help="show the device's block map and a free address for a size")
+    al.add_argument("host")
+    al.add_argument("--size", type=int, help="bytes the next image needs")
+    al.add_argument("--port", type=int, help="80, or 443 with --tls-psk")
+    pl = sub.add_parser("place", help="install an image linked for a given address through the block allocator")
+    pl.add_argument("host")
+    pl.add_argument("image")
+    pl.add_argument("address", type=lambda v: int(v, 0), help="XIP address the image is linked for")
+    pl.add_argument("--port", type=int, help="80, or 443 with --tls-psk")
+    pl.add_argument("--hot", action="append", default=[], type=parse_hot, metavar="FLASH:ITCM:LEN",
+                    help="section to copy into ITCM before the jump (tools/hotsections.py table)")
+    pl.add_argument("--reset", action="store_true", help="start the image through a system reset, not a direct jump")
+    pl.add_argument("--module", action="store_true", help="the image is a module for the base image (include/component.h)")
+    pl.add_argument("--rate", type=float, default=0, help="MB/s at most, 0 = unlimited")
+    for p in (rel, al, pl):
+        p.add_argument("--tls-psk", metavar="HEX", help="connect over TLS 1.3 with this pre-shared key")
+        p.add_argument("--tls-identity", default="s3bl", help="PSK identity the device expects")
+    sh = sub.add_parser("shaping", help="measure the token bucket's cost per take and the rate it holds")
+    sh.add_argument("--rate", type=float, default=1.0, help="MB/s to hold")
+    sh.add_argument("--threads", type=int, default=4, help="senders sharing the bucket")
+    sh.add_argument("--seconds", type=float, default=3.0)
+    ck = sub.add_parser("clock", help="time the VERIFY phase (CRC32 from RAM) on a device in recovery")
+    ck.add_argument("host")
+    ck.add_argument("--port", type=int, default=80)
+    ck.add_argument("--size", type=int, default=256, help="KB checksummed per sample, at most 384")
+    ck.add_argument("--samples", type=int, default=5)
+    args = parser.parse_args()
+
+    if args.command == "clock":
+        hz, times = verify_benchmark(args.host, args.port, args.size * 1024, args.samples)
+        best = min(times)
+        print("verify_us: %s" % " ".join(str(t) for t in times))
+        print("%d KB at %d MHz: best %d us, %.1f MB/s, %.1f cycles/byte" %
+              (args.size, hz // 1000000, best, args.size * 1024 / best, best * (hz / 1e6) / (args.size * 1024)))
+        return 0
+    if args.command == "shaping":
+        per_take, achieved = shaping_benchmark(args.rate * 1e6, args.threads, args.seconds)
+        print("take(): %.0f ns per %d byte block, %.3f%% of the time at %.1f MB/s" %
+              (per_take, SHAPE_BLOCK, per_take * 1e-9 * args.rate * 1e6 / SHAPE_BLOCK * 100, args.rate))
+        print("held %.3f MB/s of %.3f MB/s with %d thread(s) (%+.1f%%)" %
+              (achieved / 1e6, args.rate, args.threads, (achieved / (args.rate * 1e6) - 1) * 100))
+        return 0
+    tls = None
+    if getattr(args, "tls_psk", None):
+        tls = tls_context(args.tls_psk, args.tls_identity)
+    if getattr(args, "port", 80) is None:
+        args.port = 443 if tls else 80
+    if args.command == "alloc":
+        code, text = manifest_request(args.host, args.port, "GET", "/alloc" + ("?size=%d" % args.size if args.size else ""),
+                                      tls=tls)
+        print(text.strip())
+        return 0 if code == 200 else 1
+    with open(args.image, "rb") as f:
+        image = f.read()
+    if args.command == "upload":
+        return 0 if upload(args.host, image, args.port, args.connections, buckets=make_buckets(args.rate * 1e6)) else 1
+    if args.command == "rollout":
+        ok = rollout(load_devices(args.devices, args.port), image, args.stages, args.concurrency,
+                     args.subnet_rate * 1e6, args.boot_timeout, args.max_failures,
+                     args.device_rate * 1e6, args.rollout_rate * 1e6)
+        return 0 if ok else 1
+    if args.command == "release":
+        images = [("app", "slot", image)]
+        for spec in args.data:
+            name, sep, path = spec.partition("=")
+            if not sep:
+                parser.error("--data takes NAME=FILE")
+            with open(path, "rb") as f:
+                images.append((name, "data", f.read()))
+        return 0 if release(args.host, images, args.port, args.chunk * 1024,
+                            buckets=make_buckets(args.rate * 1e6), tls=tls) else 1
+    if args.command == "place":
+        start = time.monotonic()
+        code, text = place(args.host, image, args.address, args.port, hot=args.hot, reset=args.reset,
+                           module=args.module, buckets=make_buckets(args.rate * 1e6), tls=tls)
+        elapsed = time.monotonic() - start
+        print("HTTP %d: %s" % (code, text.strip()))
+        # Same image with and without --tls-psk gives the cost of record protection on the device
+        print("%d bytes in %.2f s, %.0f KB/s%s" % (len(image), elapsed, len(image) / elapsed / 1024, " over TLS" if tls else ""))
+        return 0 if code == 200 else 1
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+"""Keeps functions at the same flash offsets from one release to the next.
+
+Sector-skip and range updates only save time when consecutive builds leave most sectors alone,
+but an ordinary link packs functions back to back, so one function that grows moves everything
+after it. plan pins every function (built with -ffunction-sections) to an offset: functions that
+still fit keep the offset of the previous release, a function that grew pushes only the rest of
+its own group into the slack, and whatever no longer fits moves, or is new, goes into the
+space freed by removed functions or is appended. Appended code leaves --slack of every sector
+free for growth in later releases.
+
+The layout is a JSON file kept with each release. The linker fragment is a complete output section,
+.text.stable, at a fixed flash address: --at bytes after ORIGIN(FLASH), a multiple of the sector
+size and kept from the previous release. It reserves --at bytes before itself for the image headers,
+startup code and .text.progmem, and a sector-rounded reservation for itself. That reservation only
+grows when the functions outgrow it, so code after it keeps its load address too. INCLUDE the fragment
+in the Teensy 4 linker script right after .text.progmem, so it is ahead of the *(.text*) catch-all in
+.text.itcm:
+
+    .text.progmem : { ... } > FLASH
+    INCLUDE stable.ld
+    .text.itcm : { ... *(.text*) ... } > ITCM AT> FLASH
+
+The pinned functions run from flash through the cache, not from ITCM. ITCM code can't be pinned:
+startup copies one range, .text.itcm, and its load address follows whatever precedes it in flash.
+In exchange the slack costs flash only and takes no RAM1 away from DTCM. FASTRUN functions sit in
+.fastrun, stay in ITCM and are not pinned. The linker fails if the code ahead of .text.stable
+outgrows --at; plan again with a larger one, which moves every sector once.
+
+measure installs consecutive release images into scratch flash images and counts the sectors
+flashimg.py diff reports, so the effect can be compared with ordinary builds (--baseline). The
+fragment has been checked with a host GNU ld and a two-region script: fixed address, reservation,
+the load address of the code after it, and the overlap failure. Real Teensy releases have not been
+linked with it, since no ARM toolchain was at hand, and measure has only seen synthetic images;
+there are no numbers from real releases yet.
+
+    arm-none-eabi-nm -S app.elf > app.sym      # not -C: section names use mangled names
+    python3 tools/stablelayout.py plan app.sym --previous v1.json --out v2.json --ld stable.ld
+    python3 tools/stablelayout.py measure v1.bin v2.bin v3.bin --baseline p1.bin p2.bin p3.bin
+"""
+
+import argparse
+import contextlib
+import io
+import json
+import os
+import sys
+import tempfile
+
+import flashimg
+
+SECTOR_SIZE = flashimg.SECTOR_SIZE
+BLOCK_SIZE = flashimg.BLOCK_SIZE
+ALIGN = 8
+DEFAULT_AT = 0x10000
+
+
+def rounded(size):
+    return (size + ALIGN - 1) & ~(ALIGN - 1)
+
+
+def read_symbols(path):
+    """Text symbols from nm -S, in address order. Names defined more than once (static functions
+    in several files) can't be told apart by section name and are left to the linker."""
+    seen, dupes = {}, set()
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) != 4 or parts[2] not in "tTwW":
+                continue
+            addr, size, name = int(parts[0], 16), int(parts[1], 16), parts[3]
+            if name in seen:
+                dupes.add(name)
+            seen[name] = (addr, size)
+    functions = [(name, size) for name, (addr, size) in sorted(seen.items(), key=lambda kv: kv[1][0])
+                 if name not in dupes and size]
+    return functions, sorted(dupes)
+
+
+def append(layout, names, need, cursor, slack):
+    """Places names from cursor on; a function that would cut into a sector's slack starts the
+    next sector, and one bigger than a sector always starts on a boundary."""
+    usable = SECTOR_SIZE - int(SECTOR_SIZE * slack)
+    for name in names:
+        n = need[name]
+        inside = cursor % SECTOR_SIZE
+        if (n <= SECTOR_SIZE and inside + n > usable) or (n > SECTOR_SIZE and inside):
+            cursor += SECTOR_SIZE - inside
+        layout[name] = cursor
+        cursor += n
+    return cursor
+
+
+def plan(functions, previous, slack):
+    """Returns (layout {name: offset}, end, kept count, moved, new, removed)."""
+    need = {name: rounded(size) for name, size in functions}
+    prev = previous["functions"] if previous else {}
+    layout = {}
+
+    # Surviving functions in previous order, grouped by the sector they started in. A group can
+    # grow up to where the next one starts; members shift within it, which only touches sectors
+    # that changed anyway.
+    kept_order = sorted((entry[0], name) for name, entry in prev.items() if name in need)
+    groups = []
+    for offset, name in kept_order:
+        if groups and offset // SECTOR_SIZE == groups[-1][0]:
+            groups[-1][1].append((offset, name))
+        else:
+            groups.append((offset // SECTOR_SIZE, [(offset, name)]))
+    evicted = []
+    for i, (_, members) in enumerate(groups):
+        end = groups[i + 1][1][0][0] if i + 1 < len(groups) else None
+        cursor = members[0][0]
+        for offset, name in members:
+            at = max(offset, cursor)
+            if end is not None and at + need[name] > end:
+                evicted.append(name)
+                continue
+            layout[name] = at
+            cursor = at + need[name]
+
+    # Space of removed and moved functions that nothing kept has grown into
+    taken = sorted((layout[name], layout[name] + need[name]) for name in layout)
+    freed = sorted((entry[0], entry[0] + rounded(entry[1])) for name, entry in prev.items()
+                   if name not in layout)
+    holes = []
+    for start, end in freed:
+        for t0, t1 in taken:
+            if t0 < end and start < t1:
+                if t0 > start:
+                    holes.append([start, t0])
+                start = max(start, t1)
+        if start < end:
+            holes.append([start, end])
+
+    order = [name for name, _ in functions if name not in layout]
+    rest = []
+    for name in order:
+        for hole in holes:
+            if hole[1] - hole[0] >= need[name]:
+                layout[name] = hole[0]
+                hole[0] += need[name]
+                break
+        else:
+            rest.append(name)
+    end = max([layout[name] + need[name] for name in layout] + [previous["end"] if previous else 0])
+    end = append(layout, rest, need, end, slack)
+
+    new = [name for name in order if name not in prev]
+    removed = [name for name in prev if name not in need]
+    kept = len(functions) - len(order)
+    return layout, end, kept, evicted, new, removed
+
+
+def sector_round(size):
+    return (size + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)
+
+
+def reservation(end, slack, previous):
+    """Bytes .text.stable takes in flash: the planned end plus slack, in whole sectors, and never
+    less than the previous release took, so what follows it keeps its load address."""
+    return max(sector_round(int(end * (1 + slack))), previous.get("reserve", 0) if previous else 0)
+
+
+def linker_fragment(layout, stats, at, reserve):
+    lines = ["/* tools/stablelayout.py: %d functions, %d kept, %d moved, %d new, %d removed */" % stats,
+             "/* Fixed at ORIGIN(FLASH) + 0x%x, 0x%x bytes; INCLUDE right after .text.progmem */" % (at, reserve),
+             ".text.stable ORIGIN(FLASH) + 0x%06x : {" % at]
+    for name, offset in sorted(layout.items(), key=lambda kv: kv[1]):
+        lines.append("\t. = 0x%06x; KEEP(*(.text.%s))" % (offset, name))
+    lines.append("\t. = 0x%06x;" % reserve)
+    lines.append("} > FLASH")
+    lines.append('ASSERT(LOADADDR(.text.progmem) + SIZEOF(.text.progmem) <= ADDR(.text.stable), '
+                 '"stablelayout: the code before .text.stable needs more than --at 0x%x")' % at)
+    return "\n".join(lines) + "\n"
+
+
+def changed_sectors(old, new):
+    """Installs both images into scratch flash images and counts what flashimg diff reports,
+    plus the 64KB blocks those sectors fall in. Returns (sectors, blocks, sectors used by new)."""
+    with tempfile.TemporaryDirectory() as tmp:
+        images = []
+        for i, data in enumerate((old, new)):
+            flash = flashimg.NorFlash(os.path.join(tmp, "%d.bin" % i), create=True)
+            flash.erase_range(flashimg.SLOT_A_ADDRESS, len(data))
+            flash.program(flashimg.SLOT_A_ADDRESS, data)
+            images.append(flash)
+        with contextlib.redirect_stdout(io.StringIO()):
+            sectors = flashimg.diff(images[0], images[1])
+        blocks = {o // BLOCK_SIZE for o in range(0, flashimg.FLASH_SIZE, SECTOR_SIZE)
+                  if images[0].map[o:o + SECTOR_SIZE] != images[1].map[o:o + SECTOR_SIZE]}
+        for flash in images:
+            flash.close()
+    return sectors, len(blocks), (len(new) + SECTOR_SIZE - 1) // SECTOR_SIZE
+
+
+def measure(paths):
+    rows = []
+    for old, new in zip(paths, paths[1:]):
+        with open(old, "rb") as f:
+            a = f.read()
+        with open(new, "rb") as f:
+            b = f.read()
+        if max(len(a), len(b)) > flashimg.SLOT_SIZE:
+            raise flashimg.NorError("%s or %s does not fit a slot" % (old, new))
+        rows.append((os.path.basename(old), os.path.basename(new)) + changed_sectors(a, b))
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description="S3BL release-stable code layout")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("plan", help="pin functions to offsets, keeping the previous release's where possible")
+    p.add_argument("symbols", help="nm -S output of a -ffunction-sections build")
+    p.add_argument("--previous", help="layout JSON of the previous release")
+    p.add_argument("--out", required=True, help="layout JSON to write for this release")
+    p.add_argument("--ld", required=True, help="linker fragment to write")
+    p.add_argument("--slack", type=float, default=0.125, help="share of each appended sector left free")
+    p.add_argument("--at", type=lambda v: int(v, 0),
+                   help="offset of .text.stable from ORIGIN(FLASH), a sector multiple (default: the previous "
+                        "release's, else 0x%x)" % DEFAULT_AT)
+    p = sub.add_parser("measure", help="changed sectors between consecutive release images")
+    p.add_argument("images", nargs="+", help="slot images of consecutive releases, oldest first")
+    p.add_argument("--baseline", nargs="+", default=[], help="the same releases linked the ordinary way")
+    args = parser.parse_args()
+
+    if args.command == "plan":
+        functions, dupes = read_symbols(args.symbols)
+        previous = None
+        if args.previous:
+            with open(args.previous) as f:
+                previous = json.load(f)
+        previous_at = previous.get("at") if previous else None
+        at = args.at if args.at is not None else previous_at if previous_at is not None else DEFAULT_AT
+        if at % SECTOR_SIZE:
+            parser.error("--at must be a multiple of %d" % SECTOR_SIZE)
+        if previous_at is not None and at != previous_at:
+            print("warning: .text.stable moves from 0x%x to 0x%x, every sector of it changes once" %
+                  (previous_at, at), file=sys.stderr)
+        layout, end, kept, moved, new, removed = plan(functions, previous, args.slack)
+        reserve = reservation(end, args.slack, previous)
+        sizes = dict(functions)
+        with open(args.out, "w") as f:
+            json.dump({"version": 1, "slack": args.slack, "end": end, "at": at, "reserve": reserve,
+                       "functions": {name: [layout[name], sizes[name]] for name in sorted(layout)}}, f, indent=1)
+        stats = (len(layout), kept, len(moved), len(new), len(removed))
+        with open(args.ld, "w") as f:
+            f.write(linker_fragment(layout, stats, at, reserve))
+        print("%d functions, %d kept, %d moved, %d new, %d removed, %d bytes" % (stats + (end,)))
+        code = sum(rounded(size) for name, size in functions if name in layout)
+        print(".text.stable at +0x%x, 0x%x bytes reserved: %d bytes of gaps and slack" % (at, reserve, reserve - code))
+        for name in moved:
+            print("  moved: %s" % name)
+        if dupes:
+            print("%d duplicate names left to the linker: %s" % (len(dupes), " ".join(dupes[:8])), file=sys.stderr)
+        return 0
+    if args.command == "measure":
+        if args.baseline and len(args.baseline) != len(args.images):
+            parser.error("--baseline needs one image per release")
+        if len(args.images) < 2:
+            parser.error("measure needs at least two releases")
+        try:
+            stable = measure(args.images)
+            baseline = measure(args.baseline) if args.baseline else None
+        except (OSError, flashimg.NorError) as e:
+            print("error: %s" % e, file=sys.stderr)
+            return 1
+        print("%-24s %8s %7s %6s %s" % ("release", "sectors", "blocks", "of", "baseline sectors"))
+        for i, (old, new, sectors, blocks, used) in enumerate(stable):
+            base = "%d" % baseline[i][2] if baseline else "-"
+            print("%-24s %8d %7d %6d %s" % ("%s -> %s" % (old, new), sectors, blocks, used, base))
+        total = sum(row[2] for row in stable)
+        if baseline:
+            base_total = sum(row[2] for row in baseline)
+            print("total %d changed sectors, baseline %d (%.0f%%)" %
+                  (total, base_total, 100.0 * total / base_total if base_total else 0))
+        else:
+            print("total %d changed sectors" % total)
+        return 0
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())